@@ -0,0 +1,1534 @@
+/*
+drekkar_wasm2c.c
+
+Drekkar WebAsm to C compiler
+https://www.drekkar.com/
+https://github.com/xehp/drekkar_webasm.git
+
+Translates the functions of a WebAssembly program into C, ahead of time.
+The program is parsed by the same code as the runtime uses (see
+dwac_parse_prog_sections in drekkar_wa_core.c) and the generated C is to be
+compiled and linked together with drekkar_wa_core.c, drekkar_wa_env.c and
+main.c into a runtime for that program. The runtime still loads the
+".wasm" file (for data, tables, exports etc) but when it is the same
+program the compiled functions are run instead of interpreting them,
+see DWAC_AOT.
+
+The generated code uses the same stack frames (d->fp), memory (dwac_memory)
+and imported functions (dwac_func_ptr) as the interpreter does. Values on
+the operand stack and local variables are C variables.
+
+Usage:
+	drekkar_wasm2c [--gas] <file.wasm> <file.c>
+
+With "--gas" gas metering is compiled in (or compile the generated code
+with -DDWAC_AOT_GAS). Gas is counted once per function call and loop
+iteration. Code compiled ahead of time can not stop and continue later so
+it gets all of the gas budget (see dwac_set_gas_budget) and when that runs
+out the call fails with DWAC_OUT_OF_GAS.
+
+Copyright (C) 2023 Henrik Bjorkman http://www.eit.se/hb/.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include "drekkar_wa_core.h"
+
+
+#define MAX_STACK_HEIGHT 0x400
+#define MAX_NOF_LABELS 0x400
+#define MAX_NOF_GLOBALS 0x1000
+
+// Number of values on the operand stack a function uses is not known until
+// the whole function is generated. So functions are generated into a buffer
+// and declarations written before it when done.
+typedef struct label_type
+{
+	uint8_t kind; // The opcode of block (0x02), loop (0x03), if (0x04) or zero for the function itself.
+	uint32_t id; // Used in names of C labels.
+	uint32_t height; // Height of operand stack at begin of block.
+	const dwac_func_type_type *type;
+	uint8_t has_else;
+} label_type;
+
+typedef struct gen_type
+{
+	const dwac_prog *p;
+	FILE *out;
+	dwac_leb128_reader_type r;
+	const dwac_func_type_type *func_type;
+
+	// Type of value at each height of the operand stack.
+	uint8_t stack[MAX_STACK_HEIGHT];
+	uint32_t height;
+	// Which C variable each (type, height) need.
+	uint8_t used[4][MAX_STACK_HEIGHT];
+
+	label_type labels[MAX_NOF_LABELS];
+	uint32_t nof_labels;
+	uint32_t next_label_id;
+
+	// After br, return etc code is not reachable until the end of the block.
+	uint8_t unreachable;
+	uint32_t skip_depth; // Blocks entered in code not reachable.
+
+	uint8_t *local_types;
+	uint32_t nof_locals;
+
+	uint8_t global_types[MAX_NOF_GLOBALS];
+	uint32_t nof_globals;
+
+	char error[256];
+} gen_type;
+
+
+
+// Helpers in the generated code. Some are the same as in drekkar_wa_core.c
+// (there they are static) so that results are the same as when interpreting.
+static const char prelude[] =
+	"#include <stdio.h>\n"
+	"#include <string.h>\n"
+	"#include <math.h>\n"
+	"#include \"drekkar_wa_core.h\"\n"
+	"\n"
+	"#pragma GCC diagnostic ignored \"-Wunused-label\"\n"
+	"#pragma GCC diagnostic ignored \"-Wunused-variable\"\n"
+	"#pragma GCC diagnostic ignored \"-Wunused-but-set-variable\"\n"
+	"#pragma GCC diagnostic ignored \"-Wunused-function\"\n"
+	"\n"
+	"#ifdef DWAC_AOT_GAS\n"
+	"#define AOT_GAS() {if (--d->gas_meter <= 0) {return aot_out_of_gas(d);}}\n"
+	"#else\n"
+	"#define AOT_GAS()\n"
+	"#endif\n"
+	"\n"
+	"static __attribute__((noinline, cold)) dwac_result aot_out_of_gas(dwac_data *d)\n"
+	"{\n"
+	"\tsnprintf(d->exception, sizeof(d->exception), \"Out of gas.\");\n"
+	"\treturn DWAC_OUT_OF_GAS;\n"
+	"}\n"
+	"\n"
+	"static __attribute__((noinline, cold)) dwac_result aot_stack_overflow(dwac_data *d)\n"
+	"{\n"
+	"\tsnprintf(d->exception, sizeof(d->exception), \"Stack overflow.\");\n"
+	"\treturn DWAC_STACK_OVERFLOW;\n"
+	"}\n"
+	"\n"
+	"static __attribute__((noinline, cold)) dwac_result aot_unreachable(dwac_data *d)\n"
+	"{\n"
+	"\tsprintf(d->exception, \"%s\", \"unreachable\");\n"
+	"\treturn DWAC_OP_CODE_ZERO;\n"
+	"}\n"
+	"\n"
+	"static __attribute__((noinline, cold)) dwac_result aot_not_supported(dwac_data *d, dwac_result r, const char *what)\n"
+	"{\n"
+	"\tsnprintf(d->exception, sizeof(d->exception), \"%s\", what);\n"
+	"\treturn r;\n"
+	"}\n"
+	"\n"
+	"static __attribute__((noinline, cold)) dwac_result aot_divide_by_zero(dwac_data *d, int64_t a)\n"
+	"{\n"
+	"\tsnprintf(d->exception, sizeof(d->exception), \"Divide %lld by zero\", (long long)a);\n"
+	"\treturn DWAC_DIVIDE_BY_ZERO;\n"
+	"}\n"
+	"\n"
+	"static __attribute__((noinline, cold)) dwac_result aot_integer_overflow(dwac_data *d)\n"
+	"{\n"
+	"\tsnprintf(d->exception, sizeof(d->exception), \"Integer overflow.\");\n"
+	"\treturn DWAC_INTEGER_OVERFLOW;\n"
+	"}\n"
+	"\n"
+	"static __attribute__((noinline, cold)) dwac_result aot_conversion_failed(dwac_data *d, double a)\n"
+	"{\n"
+	"\tif (isnan(a))\n"
+	"\t{\n"
+	"\t\tsprintf(d->exception, \"Not a number.\");\n"
+	"\t\treturn DWAC_INVALID_INTEGER_CONVERSION;\n"
+	"\t}\n"
+	"\tsnprintf(d->exception, sizeof(d->exception), \"Can't convert %g to integer.\", a);\n"
+	"\treturn DWAC_INTEGER_OVERFLOW;\n"
+	"}\n"
+	"\n"
+	"// trunc_sat, see trunc_sat_s32 etc.\n"
+	"static inline int32_t aot_trunc_sat_s32(double a) {return isnan(a) ? 0 : (a >= 2147483648.0) ? INT32_MAX : (a <= -2147483648.0) ? INT32_MIN : (int32_t)a;}\n"
+	"static inline uint32_t aot_trunc_sat_u32(double a) {return (isnan(a) || (a <= 0.0)) ? 0 : (a >= 4294967296.0) ? UINT32_MAX : (uint32_t)a;}\n"
+	"static inline int64_t aot_trunc_sat_s64(double a) {return isnan(a) ? 0 : (a >= 9223372036854775808.0) ? INT64_MAX : (a <= -9223372036854775808.0) ? INT64_MIN : (int64_t)a;}\n"
+	"static inline uint64_t aot_trunc_sat_u64(double a) {return (isnan(a) || (a <= 0.0)) ? 0 : (a >= 18446744073709551616.0) ? UINT64_MAX : (uint64_t)a;}\n"
+	"\n"
+	"// Memory, see translate_addr_grow_if_needed.\n"
+	"static inline uint8_t* aot_mem(dwac_data *d, uint32_t addr, size_t size)\n"
+	"{\n"
+	"#ifdef DWAC_GUARD_PAGES\n"
+	"\treturn d->memory.base + addr;\n"
+	"#else\n"
+	"\tconst uint32_t c = (addr >> 16) & (DWAC_MEMORY_CACHE_SIZE - 1);\n"
+	"\tif ((d->memory.cache_addr[c] == (addr & 0xffff0000)) && ((addr & 0xffff) + size <= DWAC_PAGE_SIZE)) {return d->memory.cache_array[c] + (addr & 0xffff);}\n"
+	"\treturn (uint8_t*) dwac_translate_to_host_addr_space(d, addr, size);\n"
+	"#endif\n"
+	"}\n"
+	"static inline uint8_t aot_load8(dwac_data *d, uint32_t addr) {return *aot_mem(d, addr, 1);}\n"
+	"static inline uint16_t aot_load16(dwac_data *d, uint32_t addr) {uint16_t v; memcpy(&v, aot_mem(d, addr, 2), 2); return v;}\n"
+	"static inline uint32_t aot_load32(dwac_data *d, uint32_t addr) {uint32_t v; memcpy(&v, aot_mem(d, addr, 4), 4); return v;}\n"
+	"static inline uint64_t aot_load64(dwac_data *d, uint32_t addr) {uint64_t v; memcpy(&v, aot_mem(d, addr, 8), 8); return v;}\n"
+	"static inline void aot_store8(dwac_data *d, uint32_t addr, uint8_t v) {*aot_mem(d, addr, 1) = v;}\n"
+	"static inline void aot_store16(dwac_data *d, uint32_t addr, uint16_t v) {memcpy(aot_mem(d, addr, 2), &v, 2);}\n"
+	"static inline void aot_store32(dwac_data *d, uint32_t addr, uint32_t v) {memcpy(aot_mem(d, addr, 4), &v, 4);}\n"
+	"static inline void aot_store64(dwac_data *d, uint32_t addr, uint64_t v) {memcpy(aot_mem(d, addr, 8), &v, 8);}\n"
+	"\n"
+	"static inline float aot_f32(uint32_t v) {float f; memcpy(&f, &v, 4); return f;}\n"
+	"static inline double aot_f64(uint64_t v) {double f; memcpy(&f, &v, 8); return f;}\n"
+	"static inline uint32_t aot_f32_bits(float f) {uint32_t v; memcpy(&v, &f, 4); return v;}\n"
+	"static inline uint64_t aot_f64_bits(double f) {uint64_t v; memcpy(&v, &f, 8); return v;}\n"
+	"\n"
+	"static inline uint32_t aot_clz32(uint32_t v) {return v ? __builtin_clz(v) : 32;}\n"
+	"static inline uint32_t aot_ctz32(uint32_t v) {return v ? __builtin_ctz(v) : 32;}\n"
+	"static inline uint64_t aot_clz64(uint64_t v) {return v ? __builtin_clzll(v) : 64;}\n"
+	"static inline uint64_t aot_ctz64(uint64_t v) {return v ? __builtin_ctzll(v) : 64;}\n"
+	"static inline uint32_t aot_rotl32(uint32_t v, uint32_t n) {n &= 31; return (v << n) | (v >> ((32 - n) & 31));}\n"
+	"static inline uint32_t aot_rotr32(uint32_t v, uint32_t n) {n &= 31; return (v >> n) | (v << ((32 - n) & 31));}\n"
+	"static inline uint64_t aot_rotl64(uint64_t v, uint64_t n) {n &= 63; return (v << n) | (v >> ((64 - n) & 63));}\n"
+	"static inline uint64_t aot_rotr64(uint64_t v, uint64_t n) {n &= 63; return (v >> n) | (v << ((64 - n) & 63));}\n"
+	"\n"
+	"// Same as nearly_equal_float & nearly_equal_double.\n"
+	"static int aot_nearly_equal_float(double a, double b)\n"
+	"{\n"
+	"\tif (memcmp((void*) (&a), (void*) (&b), 8) == 0) {return 1;}\n"
+	"\treturn fabs(a - b) <= (0x0.000002p0 * 2);\n"
+	"}\n"
+	"static int aot_nearly_equal_double(double a, double b)\n"
+	"{\n"
+	"\tif (memcmp((void*) (&a), (void*) (&b), 8) == 0) {return 1;}\n"
+	"\treturn fabs(a - b) <= (4.94065645841247E-324 * 2);\n"
+	"}\n"
+	"\n"
+	"// Calls. Arguments are put on stack above the current frame, that is\n"
+	"// where results are found after the call.\n"
+	"static inline dwac_value_type* aot_args(dwac_data *d, uint32_t n)\n"
+	"{\n"
+	"\tconst uint32_t stack_size = (dwac_stack_pointer_type)(d->sp + DWAC_SP_OFFSET);\n"
+	"\tif (stack_size + n >= DWAC_STACK_CAPACITY - 1) {return NULL;}\n"
+	"\treturn &d->stack[stack_size];\n"
+	"}\n"
+	"\n"
+	"// Frame size is number of parameters plus local variables.\n"
+	"static inline dwac_result aot_call(dwac_data *d, dwac_aot_func_ptr f, uint32_t frame_size)\n"
+	"{\n"
+	"\tconst dwac_stack_pointer_type sp = d->sp;\n"
+	"\tconst dwac_stack_pointer_type fp = d->fp;\n"
+	"\tconst uint32_t stack_size = (dwac_stack_pointer_type)(sp + DWAC_SP_OFFSET);\n"
+	"\tif (stack_size + frame_size >= DWAC_STACK_CAPACITY - 1) {return aot_stack_overflow(d);}\n"
+	"\td->fp = stack_size;\n"
+	"\td->sp += frame_size;\n"
+	"\tconst dwac_result r = f(d);\n"
+	"\td->sp = sp;\n"
+	"\td->fp = fp;\n"
+	"\treturn r;\n"
+	"}\n"
+	"\n"
+	"static inline dwac_result aot_call_imported(dwac_data *d, uint32_t function_idx, uint32_t nof_parameters, uint32_t nof_results)\n"
+	"{\n"
+	"\td->sp += nof_parameters;\n"
+	"\tconst dwac_result r = dwac_call_imported_function(d, function_idx);\n"
+	"\td->sp -= nof_results;\n"
+	"\treturn r;\n"
+	"}\n"
+	"\n"
+	"static dwac_result aot_call_indirect(dwac_data *d, uint32_t typeidx, uint32_t idx_into_table, uint32_t nof_parameters, uint32_t nof_results);\n"
+	"\n";
+
+// Set in the generated code when functions have been generated.
+static const char postlude[] =
+	"static dwac_result aot_call_indirect(dwac_data *d, uint32_t typeidx, uint32_t idx_into_table, uint32_t nof_parameters, uint32_t nof_results)\n"
+	"{\n"
+	"\tconst dwac_prog *p = d->p;\n"
+	"\tif (idx_into_table >= p->func_table.size)\n"
+	"\t{\n"
+	"\t\tsprintf(d->exception, \"%u\", idx_into_table);\n"
+	"\t\treturn DWAC_OUT_OF_RANGE_IN_TABLE;\n"
+	"\t}\n"
+	"\tconst uint64_t function_idx = p->func_table.array[idx_into_table];\n"
+	"\tif (function_idx >= p->funcs_vector.total_nof)\n"
+	"\t{\n"
+	"\t\tsprintf(d->exception, \"%llu %u\", (unsigned long long) function_idx, p->funcs_vector.total_nof);\n"
+	"\t\treturn DWAC_FUNCTION_INDEX_OUT_OF_RANGE;\n"
+	"\t}\n"
+	"\tconst dwac_function *func = &p->funcs_vector.functions_array[function_idx];\n"
+	"\tif (p->canonical_types.array[func->func_type_idx] != p->canonical_types.array[typeidx])\n"
+	"\t{\n"
+	"\t\tsprintf(d->exception, \"%lld != %lld\", (long long)func->func_type_idx, (long long)typeidx);\n"
+	"\t\treturn DWAC_WRONG_FUNCTION_TYPE;\n"
+	"\t}\n"
+	"\tif (function_idx < p->funcs_vector.nof_imported)\n"
+	"\t{\n"
+	"\t\treturn aot_call_imported(d, function_idx, nof_parameters, nof_results);\n"
+	"\t}\n"
+	"\treturn aot_call(d, functions[function_idx - p->funcs_vector.nof_imported], nof_parameters + func->internal_function.nof_local);\n"
+	"}\n";
+
+
+
+// Own LEB128 reading, the one in drekkar_wa_core.c is static.
+static uint64_t leb_read(dwac_leb128_reader_type *r, uint8_t is_signed)
+{
+	uint64_t result = 0;
+	uint32_t shift = 0;
+	for(;;)
+	{
+		if (r->pos >= r->nof)
+		{
+			r->errors++;
+			return 0;
+		}
+		const uint8_t byte = r->array[r->pos++];
+		if (shift < 64) {result |= (byte & 0x7fULL) << shift;}
+		shift += 7;
+		if ((byte & 0x80) == 0)
+		{
+			if (is_signed && (shift < 64) && (byte & 0x40))
+			{
+				result |= (~0ULL << shift);
+			}
+			return result;
+		}
+	}
+}
+
+static uint32_t leb_read_u32(dwac_leb128_reader_type *r)
+{
+	return leb_read(r, 0);
+}
+
+static uint8_t read_u8(dwac_leb128_reader_type *r)
+{
+	if (r->pos >= r->nof)
+	{
+		r->errors++;
+		return 0;
+	}
+	return r->array[r->pos++];
+}
+
+static uint64_t read_le(dwac_leb128_reader_type *r, uint32_t nof_bytes)
+{
+	uint64_t v = 0;
+	for (uint32_t i = 0; i < nof_bytes; i++)
+	{
+		v |= ((uint64_t)read_u8(r)) << (8 * i);
+	}
+	return v;
+}
+
+// Skip the immediate operands of an opcode with the 0xfc prefix.
+static void skip_fc_immediates(dwac_leb128_reader_type *r, uint32_t actual_opcode)
+{
+	switch (actual_opcode)
+	{
+		case 8: case 10: case 12: case 14: leb_read_u32(r); leb_read_u32(r); break;
+		case 9: case 11: case 13: case 15: case 16: case 17: leb_read_u32(r); break;
+		default: break;
+	}
+}
+
+// Skip the immediate operands of an opcode.
+// [1] 5.4. Instructions
+static void skip_immediates(dwac_leb128_reader_type *r, uint8_t opcode)
+{
+	switch (opcode)
+	{
+		case 0x02: case 0x03: case 0x04: leb_read(r, 1); break;
+		case 0x0c: case 0x0d: case 0x10: leb_read_u32(r); break;
+		case 0x0e:
+		{
+			const uint32_t n = leb_read_u32(r);
+			for (uint32_t i = 0; i <= n && !r->errors; i++) {leb_read_u32(r);}
+			break;
+		}
+		case 0x11: leb_read_u32(r); leb_read_u32(r); break;
+		case 0x1c:
+		{
+			const uint32_t n = leb_read_u32(r);
+			for (uint32_t i = 0; i < n && !r->errors; i++) {read_u8(r);}
+			break;
+		}
+		case 0x20: case 0x21: case 0x22: case 0x23: case 0x24: case 0x25: case 0x26: leb_read_u32(r); break;
+		case 0x3f: case 0x40: leb_read_u32(r); break;
+		case 0x41: case 0x42: leb_read(r, 1); break;
+		case 0x43: read_le(r, 4); break;
+		case 0x44: read_le(r, 8); break;
+		case 0xd0: read_u8(r); break;
+		case 0xd2: leb_read_u32(r); break;
+		case 0xfc: skip_fc_immediates(r, leb_read_u32(r)); break;
+		default:
+			if ((opcode >= 0x28) && (opcode <= 0x3e)) {leb_read_u32(r); leb_read_u32(r);}
+			break;
+	}
+}
+
+
+
+static uint32_t type_index(uint8_t t)
+{
+	switch (t)
+	{
+		case DWAC_I32: return 0;
+		case DWAC_I64: return 1;
+		case DWAC_F32: return 2;
+		default: return 3;
+	}
+}
+
+static const char* c_type(uint8_t t)
+{
+	static const char* names[4] = {"uint32_t", "uint64_t", "float", "double"};
+	return names[type_index(t)];
+}
+
+// Name of member in dwac_value_type to read a value of type t.
+static const char* member(uint8_t t)
+{
+	static const char* names[4] = {"u32", "u64", "f32", "f64"};
+	return names[type_index(t)];
+}
+
+static int is_value_type(uint8_t t)
+{
+	return (t == DWAC_I32) || (t == DWAC_I64) || (t == DWAC_F32) || (t == DWAC_F64);
+}
+
+static void emit(gen_type *g, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(g->out, fmt, args);
+	va_end(args);
+}
+
+static dwac_result fail(gen_type *g, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(g->error, sizeof(g->error), fmt, args);
+	va_end(args);
+	return DWAC_FEATURE_NOT_SUPPORTED_YET;
+}
+
+// C variable for value on operand stack at given height.
+static const char* var(gen_type *g, uint32_t height, uint8_t t)
+{
+	static char buf[8][32];
+	static uint32_t n = 0;
+	char *s = buf[n++ % 8];
+	static const char letters[4] = {'i', 'l', 'f', 'd'};
+	snprintf(s, sizeof(buf[0]), "s%u%c", height, letters[type_index(t)]);
+	g->used[type_index(t)][height] = 1;
+	return s;
+}
+
+static const char* push(gen_type *g, uint8_t t)
+{
+	if (g->height >= MAX_STACK_HEIGHT) {return NULL;}
+	g->stack[g->height] = t;
+	return var(g, g->height++, t);
+}
+
+static const char* pop(gen_type *g, uint8_t t)
+{
+	if ((g->height <= g->labels[g->nof_labels - 1].height) || (g->stack[g->height - 1] != t)) {return NULL;}
+	g->height--;
+	return var(g, g->height, t);
+}
+
+static const char* top(gen_type *g)
+{
+	if (g->height <= g->labels[g->nof_labels - 1].height) {return NULL;}
+	return var(g, g->height - 1, g->stack[g->height - 1]);
+}
+
+static const dwac_func_type_type* block_type(gen_type *g, int64_t blocktype)
+{
+	static dwac_func_type_type value_types[4];
+	switch (blocktype)
+	{
+		case -0x40: return &value_types[0]; // Empty, nof_results is zero.
+		case -0x01: value_types[1].nof_results = 1; value_types[1].results_list[0] = DWAC_I32; return &value_types[1];
+		case -0x02: value_types[2].nof_results = 1; value_types[2].results_list[0] = DWAC_I64; return &value_types[2];
+		case -0x03: value_types[3].nof_results = 1; value_types[3].results_list[0] = DWAC_F32; return &value_types[3];
+		case -0x04:
+		{
+			static dwac_func_type_type f64_type = {.nof_results = 1, .results_list = {DWAC_F64}};
+			return &f64_type;
+		}
+		default: break;
+	}
+	if (blocktype < 0) {return NULL;}
+	return dwac_get_func_type_ptr(g->p, blocktype);
+}
+
+
+
+// Value of type t in C variable v as a dwac_value_type member (assignment).
+static void emit_put_value(gen_type *g, const char *to, uint8_t t, const char *v)
+{
+	switch (t)
+	{
+		case DWAC_I32: emit(g, "%s.s64 = (int32_t)%s;", to, v); break;
+		case DWAC_I64: emit(g, "%s.u64 = %s;", to, v); break;
+		case DWAC_F32: emit(g, "%s.f32 = %s;", to, v); break;
+		default: emit(g, "%s.f64 = %s;", to, v); break;
+	}
+}
+
+static dwac_result gen_return(gen_type *g)
+{
+	const dwac_func_type_type *t = g->func_type;
+	if (g->height < t->nof_results) {return fail(g, "Missing return values");}
+	for (uint32_t i = 0; i < t->nof_results; i++)
+	{
+		const uint32_t h = g->height - t->nof_results + i;
+		if (g->stack[h] != t->results_list[i]) {return fail(g, "Wrong type of return value");}
+		char to[32];
+		snprintf(to, sizeof(to), "frame[%u]", i);
+		emit(g, "\t");
+		emit_put_value(g, to, t->results_list[i], var(g, h, t->results_list[i]));
+		emit(g, "\n");
+	}
+	emit(g, "\treturn DWAC_OK;\n");
+	return DWAC_OK;
+}
+
+// Move values the branch takes to where the target want them, then jump.
+static dwac_result gen_branch(gen_type *g, uint32_t labelidx)
+{
+	if (labelidx >= g->nof_labels) {return fail(g, "Branch to label %u out of range", labelidx);}
+	const label_type *l = &g->labels[g->nof_labels - 1 - labelidx];
+	if (l->kind == 0) {return gen_return(g);}
+	if (l->kind == 0x03)
+	{
+		emit(g, "\tgoto L%u_loop;\n", l->id);
+		return DWAC_OK;
+	}
+	const uint32_t n = l->type->nof_results;
+	if (g->height < l->height + n) {return fail(g, "Missing values for branch");}
+	for (uint32_t i = 0; i < n; i++)
+	{
+		const uint8_t t = l->type->results_list[i];
+		const uint32_t from = g->height - n + i;
+		if (g->stack[from] != t) {return fail(g, "Wrong type of value for branch");}
+		if (from != l->height + i)
+		{
+			emit(g, "\t%s = ", var(g, l->height + i, t));
+			emit(g, "%s;\n", var(g, from, t));
+		}
+	}
+	emit(g, "\tgoto L%u;\n", l->id);
+	return DWAC_OK;
+}
+
+static dwac_result gen_block(gen_type *g, uint8_t kind)
+{
+	const int64_t blocktype = leb_read(&g->r, 1);
+	const dwac_func_type_type *t = block_type(g, blocktype);
+	if (t == NULL) {return fail(g, "Unknown block type %lld", (long long) blocktype);}
+	if (t->nof_parameters != 0) {return fail(g, "Block parameters are not supported");}
+	for (uint32_t i = 0; i < t->nof_results; i++)
+	{
+		if (!is_value_type(t->results_list[i])) {return fail(g, "Block type 0x%x not supported", t->results_list[i]);}
+	}
+	if (g->nof_labels >= MAX_NOF_LABELS) {return fail(g, "Too many nested blocks");}
+
+	const char *cond = NULL;
+	if (kind == 0x04)
+	{
+		cond = pop(g, DWAC_I32);
+		if (cond == NULL) {return fail(g, "Missing condition for if");}
+	}
+
+	label_type *l = &g->labels[g->nof_labels++];
+	l->kind = kind;
+	l->id = g->next_label_id++;
+	l->height = g->height;
+	l->type = t;
+	l->has_else = 0;
+
+	switch (kind)
+	{
+		case 0x03:
+			emit(g, "L%u_loop:;\n", l->id);
+			emit(g, "\tAOT_GAS();\n");
+			break;
+		case 0x04:
+			emit(g, "\tif (!%s) {goto L%u_else;}\n", cond, l->id);
+			break;
+		default:
+			break;
+	}
+	return DWAC_OK;
+}
+
+static dwac_result gen_else(gen_type *g)
+{
+	label_type *l = &g->labels[g->nof_labels - 1];
+	if ((l->kind != 0x04) || (l->has_else)) {return fail(g, "Else without if");}
+	if (!g->unreachable)
+	{
+		const dwac_result r = gen_branch(g, 0);
+		if (r) {return r;}
+	}
+	emit(g, "L%u_else:;\n", l->id);
+	l->has_else = 1;
+	g->height = l->height;
+	g->unreachable = 0;
+	return DWAC_OK;
+}
+
+static dwac_result gen_end(gen_type *g)
+{
+	const label_type *l = &g->labels[g->nof_labels - 1];
+	const uint32_t n = l->type->nof_results;
+	if (!g->unreachable)
+	{
+		if (g->height != l->height + n) {return fail(g, "Stack height at end of block %u != %u", g->height, l->height + n);}
+		for (uint32_t i = 0; i < n; i++)
+		{
+			if (g->stack[l->height + i] != l->type->results_list[i]) {return fail(g, "Wrong type of value at end of block");}
+		}
+	}
+	if (l->kind == 0)
+	{
+		g->nof_labels--;
+		return g->unreachable ? DWAC_OK : gen_return(g);
+	}
+	if ((l->kind == 0x04) && (!l->has_else))
+	{
+		if (n != 0) {return fail(g, "If without else can not have results");}
+		emit(g, "L%u_else:;\n", l->id);
+	}
+	if (l->kind != 0x03)
+	{
+		emit(g, "L%u:;\n", l->id);
+	}
+	for (uint32_t i = 0; i < n; i++)
+	{
+		g->stack[l->height + i] = l->type->results_list[i];
+		var(g, l->height + i, l->type->results_list[i]);
+	}
+	g->height = l->height + n;
+	g->nof_labels--;
+	g->unreachable = 0;
+	return DWAC_OK;
+}
+
+// Call an internal, imported or (if typeidx is given) indirect function.
+static dwac_result gen_call(gen_type *g, uint32_t function_idx, int64_t typeidx)
+{
+	const dwac_prog *p = g->p;
+	const char *idx_into_table = NULL;
+	const dwac_func_type_type *t;
+	if (typeidx >= 0)
+	{
+		t = dwac_get_func_type_ptr(p, typeidx);
+		idx_into_table = pop(g, DWAC_I32);
+		if ((t == NULL) || (idx_into_table == NULL)) {return fail(g, "Bad call_indirect");}
+		emit(g, "\t{\n\t\tconst uint32_t idx_into_table = %s;\n", idx_into_table);
+	}
+	else
+	{
+		if (function_idx >= p->funcs_vector.total_nof) {return fail(g, "Function %u out of range", function_idx);}
+		t = dwac_get_func_type_ptr(p, p->funcs_vector.functions_array[function_idx].func_type_idx);
+		emit(g, "\t{\n");
+	}
+
+	const uint32_t np = t->nof_parameters;
+	const uint32_t nr = t->nof_results;
+	if (g->height < g->labels[g->nof_labels - 1].height + np) {return fail(g, "Missing parameters for call");}
+	emit(g, "\t\tdwac_value_type *a = aot_args(d, %u);\n", (np > nr) ? np : nr);
+	emit(g, "\t\tif (a == NULL) {return aot_stack_overflow(d);}\n");
+	for (uint32_t i = 0; i < np; i++)
+	{
+		const uint32_t h = g->height - np + i;
+		if (g->stack[h] != t->parameters_list[i]) {return fail(g, "Wrong type of parameter");}
+		char to[32];
+		snprintf(to, sizeof(to), "a[%u]", i);
+		emit(g, "\t\t");
+		emit_put_value(g, to, t->parameters_list[i], var(g, h, t->parameters_list[i]));
+		emit(g, "\n");
+	}
+	g->height -= np;
+
+	if (typeidx >= 0)
+	{
+		emit(g, "\t\tconst dwac_result e = aot_call_indirect(d, %u, idx_into_table, %u, %u);\n", (uint32_t) typeidx, np, nr);
+	}
+	else if (function_idx < p->funcs_vector.nof_imported)
+	{
+		emit(g, "\t\tconst dwac_result e = aot_call_imported(d, %u, %u, %u);\n", function_idx, np, nr);
+	}
+	else
+	{
+		const dwac_function *f = &p->funcs_vector.functions_array[function_idx];
+		emit(g, "\t\tconst dwac_result e = aot_call(d, f%u, %u);\n", function_idx, np + f->internal_function.nof_local);
+	}
+	emit(g, "\t\tif (e) {return e;}\n");
+	for (uint32_t i = 0; i < nr; i++)
+	{
+		if (!is_value_type(t->results_list[i])) {return fail(g, "Result type 0x%x not supported", t->results_list[i]);}
+		const char *v = push(g, t->results_list[i]);
+		if (v == NULL) {return fail(g, "Stack too high");}
+		emit(g, "\t\t%s = a[%u].%s;\n", v, i, member(t->results_list[i]));
+	}
+	emit(g, "\t}\n");
+	return DWAC_OK;
+}
+
+static dwac_result gen_load(gen_type *g, uint8_t t, uint32_t bits, const char *cast)
+{
+	leb_read_u32(&g->r); // align
+	const uint32_t offset = leb_read_u32(&g->r);
+	const char *a = pop(g, DWAC_I32);
+	if (a == NULL) {return fail(g, "Missing address");}
+	char addr[64];
+	snprintf(addr, sizeof(addr), "%s + 0x%xu", a, offset);
+	const char *v = push(g, t);
+	switch (t)
+	{
+		case DWAC_F32: emit(g, "\t%s = aot_f32(aot_load32(d, %s));\n", v, addr); break;
+		case DWAC_F64: emit(g, "\t%s = aot_f64(aot_load64(d, %s));\n", v, addr); break;
+		default: emit(g, "\t%s = (%s)%saot_load%u(d, %s);\n", v, c_type(t), cast, bits, addr); break;
+	}
+	return DWAC_OK;
+}
+
+static dwac_result gen_store(gen_type *g, uint8_t t, uint32_t bits)
+{
+	leb_read_u32(&g->r); // align
+	const uint32_t offset = leb_read_u32(&g->r);
+	const char *v = pop(g, t);
+	const char *a = pop(g, DWAC_I32);
+	if ((v == NULL) || (a == NULL)) {return fail(g, "Missing operands for store");}
+	switch (t)
+	{
+		case DWAC_F32: emit(g, "\taot_store32(d, %s + 0x%xu, aot_f32_bits(%s));\n", a, offset, v); break;
+		case DWAC_F64: emit(g, "\taot_store64(d, %s + 0x%xu, aot_f64_bits(%s));\n", a, offset, v); break;
+		default: emit(g, "\taot_store%u(d, %s + 0x%xu, %s);\n", bits, a, offset, v); break;
+	}
+	return DWAC_OK;
+}
+
+// Numeric instructions that are just an expression of one or two operands.
+typedef struct numeric_op_type
+{
+	uint8_t operand_type;
+	uint8_t result_type;
+	uint8_t nof_operands;
+	const char *expr;
+} numeric_op_type;
+
+#define I32 DWAC_I32
+#define I64 DWAC_I64
+#define F32 DWAC_F32
+#define F64 DWAC_F64
+
+static const numeric_op_type numeric_ops[0x100] =
+{
+	[0x45] = {I32, I32, 1, "%s == 0"},
+	[0x46] = {I32, I32, 2, "%s == %s"},
+	[0x47] = {I32, I32, 2, "%s != %s"},
+	[0x48] = {I32, I32, 2, "(int32_t)%s < (int32_t)%s"},
+	[0x49] = {I32, I32, 2, "%s < %s"},
+	[0x4a] = {I32, I32, 2, "(int32_t)%s > (int32_t)%s"},
+	[0x4b] = {I32, I32, 2, "%s > %s"},
+	[0x4c] = {I32, I32, 2, "(int32_t)%s <= (int32_t)%s"},
+	[0x4d] = {I32, I32, 2, "%s <= %s"},
+	[0x4e] = {I32, I32, 2, "(int32_t)%s >= (int32_t)%s"},
+	[0x4f] = {I32, I32, 2, "%s >= %s"},
+	[0x50] = {I64, I32, 1, "%s == 0"},
+	[0x51] = {I64, I32, 2, "%s == %s"},
+	[0x52] = {I64, I32, 2, "%s != %s"},
+	[0x53] = {I64, I32, 2, "(int64_t)%s < (int64_t)%s"},
+	[0x54] = {I64, I32, 2, "%s < %s"},
+	[0x55] = {I64, I32, 2, "(int64_t)%s > (int64_t)%s"},
+	[0x56] = {I64, I32, 2, "%s > %s"},
+	[0x57] = {I64, I32, 2, "(int64_t)%s <= (int64_t)%s"},
+	[0x58] = {I64, I32, 2, "%s <= %s"},
+	[0x59] = {I64, I32, 2, "(int64_t)%s >= (int64_t)%s"},
+	[0x5a] = {I64, I32, 2, "%s >= %s"},
+	[0x5b] = {F32, I32, 2, "aot_nearly_equal_float(%s, %s)"},
+	[0x5c] = {F32, I32, 2, "!aot_nearly_equal_float(%s, %s)"},
+	[0x5d] = {F32, I32, 2, "%s < %s"},
+	[0x5e] = {F32, I32, 2, "%s > %s"},
+	[0x5f] = {F32, I32, 2, "%s <= %s"},
+	[0x60] = {F32, I32, 2, "%s >= %s"},
+	[0x61] = {F64, I32, 2, "aot_nearly_equal_double(%s, %s)"},
+	[0x62] = {F64, I32, 2, "!aot_nearly_equal_double(%s, %s)"},
+	[0x63] = {F64, I32, 2, "%s < %s"},
+	[0x64] = {F64, I32, 2, "%s > %s"},
+	[0x65] = {F64, I32, 2, "%s <= %s"},
+	[0x66] = {F64, I32, 2, "%s >= %s"},
+	[0x67] = {I32, I32, 1, "aot_clz32(%s)"},
+	[0x68] = {I32, I32, 1, "aot_ctz32(%s)"},
+	[0x69] = {I32, I32, 1, "__builtin_popcount(%s)"},
+	[0x6a] = {I32, I32, 2, "%s + %s"},
+	[0x6b] = {I32, I32, 2, "%s - %s"},
+	[0x6c] = {I32, I32, 2, "%s * %s"},
+	[0x71] = {I32, I32, 2, "%s & %s"},
+	[0x72] = {I32, I32, 2, "%s | %s"},
+	[0x73] = {I32, I32, 2, "%s ^ %s"},
+	[0x74] = {I32, I32, 2, "%s << (%s & 31)"},
+	[0x75] = {I32, I32, 2, "(int32_t)%s >> (%s & 31)"},
+	[0x76] = {I32, I32, 2, "%s >> (%s & 31)"},
+	[0x77] = {I32, I32, 2, "aot_rotl32(%s, %s)"},
+	[0x78] = {I32, I32, 2, "aot_rotr32(%s, %s)"},
+	[0x79] = {I64, I64, 1, "aot_clz64(%s)"},
+	[0x7a] = {I64, I64, 1, "aot_ctz64(%s)"},
+	[0x7b] = {I64, I64, 1, "__builtin_popcountll(%s)"},
+	[0x7c] = {I64, I64, 2, "%s + %s"},
+	[0x7d] = {I64, I64, 2, "%s - %s"},
+	[0x7e] = {I64, I64, 2, "%s * %s"},
+	[0x83] = {I64, I64, 2, "%s & %s"},
+	[0x84] = {I64, I64, 2, "%s | %s"},
+	[0x85] = {I64, I64, 2, "%s ^ %s"},
+	[0x86] = {I64, I64, 2, "%s << (%s & 63)"},
+	[0x87] = {I64, I64, 2, "(int64_t)%s >> (%s & 63)"},
+	[0x88] = {I64, I64, 2, "%s >> (%s & 63)"},
+	[0x89] = {I64, I64, 2, "aot_rotl64(%s, %s)"},
+	[0x8a] = {I64, I64, 2, "aot_rotr64(%s, %s)"},
+	[0x8b] = {F32, F32, 1, "fabsf(%s)"},
+	[0x8c] = {F32, F32, 1, "-%s"},
+	[0x8d] = {F32, F32, 1, "ceilf(%s)"},
+	[0x8e] = {F32, F32, 1, "floorf(%s)"},
+	[0x8f] = {F32, F32, 1, "truncf(%s)"},
+	[0x90] = {F32, F32, 1, "rintf(%s)"},
+	[0x91] = {F32, F32, 1, "sqrtf(%s)"},
+	[0x92] = {F32, F32, 2, "%s + %s"},
+	[0x93] = {F32, F32, 2, "%s - %s"},
+	[0x94] = {F32, F32, 2, "%s * %s"},
+	[0x95] = {F32, F32, 2, "%s / %s"},
+	[0x96] = {F32, F32, 2, "fminf(%s, %s)"},
+	[0x97] = {F32, F32, 2, "fmaxf(%s, %s)"},
+	[0x98] = {F32, F32, 2, "copysignf(%s, %s)"},
+	[0x99] = {F64, F64, 1, "fabs(%s)"},
+	[0x9a] = {F64, F64, 1, "-%s"},
+	[0x9b] = {F64, F64, 1, "ceil(%s)"},
+	[0x9c] = {F64, F64, 1, "floor(%s)"},
+	[0x9d] = {F64, F64, 1, "trunc(%s)"},
+	[0x9e] = {F64, F64, 1, "rint(%s)"},
+	[0x9f] = {F64, F64, 1, "sqrt(%s)"},
+	[0xa0] = {F64, F64, 2, "%s + %s"},
+	[0xa1] = {F64, F64, 2, "%s - %s"},
+	[0xa2] = {F64, F64, 2, "%s * %s"},
+	[0xa3] = {F64, F64, 2, "%s / %s"},
+	[0xa4] = {F64, F64, 2, "fmin(%s, %s)"},
+	[0xa5] = {F64, F64, 2, "fmax(%s, %s)"},
+	[0xa6] = {F64, F64, 2, "copysign(%s, %s)"},
+	[0xa7] = {I64, I32, 1, "%s"},
+	[0xac] = {I32, I64, 1, "(int32_t)%s"},
+	[0xad] = {I32, I64, 1, "%s"},
+	[0xb2] = {I32, F32, 1, "(int32_t)%s"},
+	[0xb3] = {I32, F32, 1, "%s"},
+	[0xb4] = {I64, F32, 1, "(int64_t)%s"},
+	[0xb5] = {I64, F32, 1, "%s"},
+	[0xb6] = {F64, F32, 1, "%s"},
+	[0xb7] = {I32, F64, 1, "(int32_t)%s"},
+	[0xb8] = {I32, F64, 1, "%s"},
+	[0xb9] = {I64, F64, 1, "(int64_t)%s"},
+	[0xba] = {I64, F64, 1, "%s"},
+	[0xbb] = {F32, F64, 1, "%s"},
+	[0xbc] = {F32, I32, 1, "aot_f32_bits(%s)"},
+	[0xbd] = {F64, I64, 1, "aot_f64_bits(%s)"},
+	[0xbe] = {I32, F32, 1, "aot_f32(%s)"},
+	[0xbf] = {I64, F64, 1, "aot_f64(%s)"},
+	[0xc0] = {I32, I32, 1, "(int8_t)%s"},
+	[0xc1] = {I32, I32, 1, "(int16_t)%s"},
+	[0xc2] = {I64, I64, 1, "(int8_t)%s"},
+	[0xc3] = {I64, I64, 1, "(int16_t)%s"},
+	[0xc4] = {I64, I64, 1, "(int32_t)%s"},
+};
+
+static dwac_result gen_numeric(gen_type *g, const numeric_op_type *op)
+{
+	const char *b = (op->nof_operands == 2) ? pop(g, op->operand_type) : NULL;
+	const char *a = pop(g, op->operand_type);
+	if ((a == NULL) || ((op->nof_operands == 2) && (b == NULL))) {return fail(g, "Missing operands");}
+	const char *c = push(g, op->result_type);
+	emit(g, "\t%s = ", c);
+	emit(g, op->expr, a, b);
+	emit(g, ";\n");
+	return DWAC_OK;
+}
+
+// Division and remainder, these trap on zero (and overflow).
+static dwac_result gen_division(gen_type *g, uint8_t t, uint8_t is_signed, uint8_t is_rem)
+{
+	const char *b = pop(g, t);
+	const char *a = pop(g, t);
+	if ((a == NULL) || (b == NULL)) {return fail(g, "Missing operands");}
+	const char *c = push(g, t);
+	const char *st = (t == DWAC_I32) ? "int32_t" : "int64_t";
+	const char *min = (t == DWAC_I32) ? "0x80000000u" : "0x8000000000000000ull";
+	const char *minus_one = (t == DWAC_I32) ? "0xffffffffu" : "0xffffffffffffffffull";
+	const char *op = is_rem ? "%" : "/";
+	emit(g, "\tif (%s == 0) {return aot_divide_by_zero(d, (%s)%s);}\n", b, st, a);
+	if (!is_signed)
+	{
+		emit(g, "\t%s = %s %s %s;\n", c, a, op, b);
+	}
+	else if (is_rem)
+	{
+		emit(g, "\t%s = (%s == %s) ? 0 : (%s)%s %s (%s)%s;\n", c, b, minus_one, st, a, op, st, b);
+	}
+	else
+	{
+		emit(g, "\tif ((%s == %s) && (%s == %s)) {return aot_integer_overflow(d);}\n", a, min, b, minus_one);
+		emit(g, "\t%s = (%s)%s %s (%s)%s;\n", c, st, a, op, st, b);
+	}
+	return DWAC_OK;
+}
+
+// Float to integer, these trap if value does not fit (same limits as in dwac_tick).
+static dwac_result gen_truncate(gen_type *g, uint8_t from, uint8_t to, uint8_t is_signed)
+{
+	const char *a = pop(g, from);
+	if (a == NULL) {return fail(g, "Missing operand");}
+	const char *c = push(g, to);
+	const char *limits;
+	if (to == DWAC_I32)
+	{
+		limits = is_signed ? "(%s > INT32_MAX) || (%s < INT32_MIN)" : "(%s > UINT32_MAX) || (%s < 0.0)";
+	}
+	else
+	{
+		limits = is_signed ? "(%s > INT64_MAX) || (%s < INT64_MIN)" : "(%s > UINT64_MAX) || (%s <= -0.5)";
+	}
+	emit(g, "\tif (isnan(%s) || ", a);
+	emit(g, limits, a, a);
+	emit(g, ") {return aot_conversion_failed(d, %s);}\n", a);
+	emit(g, "\t%s = (%s)%s;\n", c, is_signed ? ((to == DWAC_I32) ? "int32_t" : "int64_t") : c_type(to), a);
+	return DWAC_OK;
+}
+
+// Float to integer that does not trap, see aot_trunc_sat_s32 etc.
+static dwac_result gen_truncate_saturated(gen_type *g, uint8_t from, uint8_t to, uint8_t is_signed)
+{
+	const char *a = pop(g, from);
+	if (a == NULL) {return fail(g, "Missing operand");}
+	const char *c = push(g, to);
+	emit(g, "\t%s = aot_trunc_sat_%c%u(%s);\n", c, is_signed ? 's' : 'u', (to == DWAC_I32) ? 32 : 64, a);
+	return DWAC_OK;
+}
+
+// Things the interpreter does not support either, the generated code fail same way.
+static dwac_result gen_not_supported(gen_type *g, const char *result, const char *what)
+{
+	emit(g, "\treturn aot_not_supported(d, %s, \"%s\");\n", result, what);
+	g->unreachable = 1;
+	return DWAC_OK;
+}
+
+// memory.init, memory.copy and memory.fill, call is the function to call
+// up to the operands (destination, source or value and size).
+static dwac_result gen_bulk_memory(gen_type *g, const char *call)
+{
+	const char *n = pop(g, I32);
+	const char *b = pop(g, I32);
+	const char *a = pop(g, I32);
+	if ((a == NULL) || (b == NULL) || (n == NULL)) {return fail(g, "Missing operands for %s", call);}
+	emit(g, "\t{const dwac_result e = %s%s, %s, %s); if (e) {return e;}}\n", call, a, b, n);
+	return DWAC_OK;
+}
+
+static dwac_result gen_instruction(gen_type *g, uint8_t opcode)
+{
+	dwac_leb128_reader_type *r = &g->r;
+	dwac_result res = DWAC_OK;
+	switch (opcode)
+	{
+		case 0x00: // unreachable
+			emit(g, "\treturn aot_unreachable(d);\n");
+			g->unreachable = 1;
+			break;
+		case 0x01: // nop
+			break;
+		case 0x02: // block
+		case 0x03: // loop
+		case 0x04: // if
+			return gen_block(g, opcode);
+		case 0x05: // else
+			return gen_else(g);
+		case 0x0b: // end
+			return gen_end(g);
+		case 0x0c: // br
+			res = gen_branch(g, leb_read_u32(r));
+			g->unreachable = 1;
+			break;
+		case 0x0d: // br_if
+		{
+			const uint32_t labelidx = leb_read_u32(r);
+			const char *cond = pop(g, DWAC_I32);
+			if (cond == NULL) {return fail(g, "Missing condition for br_if");}
+			emit(g, "\tif (%s) {\n", cond);
+			res = gen_branch(g, labelidx);
+			emit(g, "\t}\n");
+			break;
+		}
+		case 0x0e: // br_table
+		{
+			const uint32_t n = leb_read_u32(r);
+			const char *idx = pop(g, DWAC_I32);
+			if (idx == NULL) {return fail(g, "Missing index for br_table");}
+			emit(g, "\tswitch (%s) {\n", idx);
+			for (uint32_t i = 0; (i <= n) && (res == DWAC_OK) && (!r->errors); i++)
+			{
+				const uint32_t labelidx = leb_read_u32(r);
+				if (i < n) {emit(g, "\tcase %u:\n", i);} else {emit(g, "\tdefault:\n");}
+				res = gen_branch(g, labelidx);
+			}
+			emit(g, "\t}\n");
+			g->unreachable = 1;
+			break;
+		}
+		case 0x0f: // return
+			res = gen_return(g);
+			g->unreachable = 1;
+			break;
+		case 0x10: // call
+			return gen_call(g, leb_read_u32(r), -1);
+		case 0x11: // call_indirect
+		{
+			const uint32_t typeidx = leb_read_u32(r);
+			const uint32_t tableidx = leb_read_u32(r);
+			if (tableidx != 0) {return gen_not_supported(g, "DWAC_ONLY_ONE_TABLE_IS_SUPPORTED", "call_indirect");}
+			return gen_call(g, 0, typeidx);
+		}
+		case 0x1a: // drop
+			if (top(g) == NULL) {return fail(g, "Nothing to drop");}
+			g->height--;
+			break;
+		case 0x1b: // select
+		{
+			const char *cond = pop(g, DWAC_I32);
+			if ((cond == NULL) || (g->height < 2)) {return fail(g, "Missing operands for select");}
+			const uint8_t t = g->stack[g->height - 1];
+			char c[32];
+			snprintf(c, sizeof(c), "%s", cond);
+			const char *b = pop(g, t);
+			const char *a = pop(g, t);
+			if ((a == NULL) || (b == NULL)) {return fail(g, "Missing operands for select");}
+			push(g, t);
+			emit(g, "\tif (!%s) {%s = %s;}\n", c, a, b);
+			break;
+		}
+		case 0x1c: // select t
+			skip_immediates(r, opcode);
+			return gen_not_supported(g, "DWAC_PARAMETRIC_INSTRUCTIONS_NOT_SUPPORTED_YET", "select t");
+		case 0x20: // local.get
+		{
+			const uint32_t localidx = leb_read_u32(r);
+			if (localidx >= g->nof_locals) {return fail(g, "Local %u out of range", localidx);}
+			const char *v = push(g, g->local_types[localidx]);
+			if (v == NULL) {return fail(g, "Stack too high");}
+			emit(g, "\t%s = l%u;\n", v, localidx);
+			break;
+		}
+		case 0x21: // local.set
+		case 0x22: // local.tee
+		{
+			const uint32_t localidx = leb_read_u32(r);
+			if (localidx >= g->nof_locals) {return fail(g, "Local %u out of range", localidx);}
+			const char *v = pop(g, g->local_types[localidx]);
+			if (v == NULL) {return fail(g, "Missing value for local %u", localidx);}
+			emit(g, "\tl%u = %s;\n", localidx, v);
+			if (opcode == 0x22) {g->height++;}
+			break;
+		}
+		case 0x23: // global.get
+		{
+			const uint32_t globalidx = leb_read_u32(r);
+			if (globalidx >= g->nof_globals) {return fail(g, "Global %u out of range", globalidx);}
+			const uint8_t t = g->global_types[globalidx];
+			const char *v = push(g, t);
+			if (v == NULL) {return fail(g, "Stack too high");}
+			switch (t)
+			{
+				case DWAC_F32: emit(g, "\t%s = aot_f32(d->globals.array[%u]);\n", v, globalidx); break;
+				case DWAC_F64: emit(g, "\t%s = aot_f64(d->globals.array[%u]);\n", v, globalidx); break;
+				default: emit(g, "\t%s = d->globals.array[%u];\n", v, globalidx); break;
+			}
+			break;
+		}
+		case 0x24: // global.set
+		{
+			const uint32_t globalidx = leb_read_u32(r);
+			if (globalidx >= g->nof_globals) {return fail(g, "Global %u out of range", globalidx);}
+			const uint8_t t = g->global_types[globalidx];
+			const char *v = pop(g, t);
+			if (v == NULL) {return fail(g, "Missing value for global %u", globalidx);}
+			switch (t)
+			{
+				case DWAC_I32: emit(g, "\td->globals.array[%u] = (int32_t)%s;\n", globalidx, v); break;
+				case DWAC_F32: emit(g, "\td->globals.array[%u] = aot_f32_bits(%s);\n", globalidx, v); break;
+				case DWAC_F64: emit(g, "\td->globals.array[%u] = aot_f64_bits(%s);\n", globalidx, v); break;
+				default: emit(g, "\td->globals.array[%u] = %s;\n", globalidx, v); break;
+			}
+			break;
+		}
+		case 0x25: // table.get
+		case 0x26: // table.set
+			skip_immediates(r, opcode);
+			return gen_not_supported(g, "DWAC_TABLE_INSTRUCTIONS_NOT_SUPPORTED", "table.get/set");
+		case 0x28: return gen_load(g, I32, 32, "");
+		case 0x29: return gen_load(g, I64, 64, "");
+		case 0x2a: return gen_load(g, F32, 32, "");
+		case 0x2b: return gen_load(g, F64, 64, "");
+		case 0x2c: return gen_load(g, I32, 8, "(int8_t)");
+		case 0x2d: return gen_load(g, I32, 8, "");
+		case 0x2e: return gen_load(g, I32, 16, "(int16_t)");
+		case 0x2f: return gen_load(g, I32, 16, "");
+		case 0x30: return gen_load(g, I64, 8, "(int8_t)");
+		case 0x31: return gen_load(g, I64, 8, "");
+		case 0x32: return gen_load(g, I64, 16, "(int16_t)");
+		case 0x33: return gen_load(g, I64, 16, "");
+		case 0x34: return gen_load(g, I64, 32, "(int32_t)");
+		case 0x35: return gen_load(g, I64, 32, "");
+		case 0x36: return gen_store(g, I32, 32);
+		case 0x37: return gen_store(g, I64, 64);
+		case 0x38: return gen_store(g, F32, 32);
+		case 0x39: return gen_store(g, F64, 64);
+		case 0x3a: return gen_store(g, I32, 8);
+		case 0x3b: return gen_store(g, I32, 16);
+		case 0x3c: return gen_store(g, I64, 8);
+		case 0x3d: return gen_store(g, I64, 16);
+		case 0x3e: return gen_store(g, I64, 32);
+		case 0x3f: // memory.size
+		{
+			if (leb_read_u32(r) != 0) {return gen_not_supported(g, "DWAC_ONLY_ONE_MEMORY_IS_SUPPORTED", "memory.size");}
+			emit(g, "\t%s = d->memory.current_size_in_pages;\n", push(g, I32));
+			break;
+		}
+		case 0x40: // memory.grow
+		{
+			if (leb_read_u32(r) != 0) {return gen_not_supported(g, "DWAC_ONLY_ONE_MEMORY_IS_SUPPORTED", "memory.grow");}
+			const char *v = top(g);
+			if ((v == NULL) || (g->stack[g->height - 1] != I32)) {return fail(g, "Missing operand for memory.grow");}
+			emit(g, "\t%s = dwac_memory_grow(d, %s);\n", v, v);
+			break;
+		}
+		case 0x41: // i32.const
+			emit(g, "\t%s = 0x%xu;\n", push(g, I32), (uint32_t) leb_read(r, 1));
+			break;
+		case 0x42: // i64.const
+			emit(g, "\t%s = 0x%llxull;\n", push(g, I64), (unsigned long long) leb_read(r, 1));
+			break;
+		case 0x43: // f32.const
+			emit(g, "\t%s = aot_f32(0x%xu);\n", push(g, F32), (uint32_t) read_le(r, 4));
+			break;
+		case 0x44: // f64.const
+			emit(g, "\t%s = aot_f64(0x%llxull);\n", push(g, F64), (unsigned long long) read_le(r, 8));
+			break;
+		case 0x6d: return gen_division(g, I32, 1, 0);
+		case 0x6e: return gen_division(g, I32, 0, 0);
+		case 0x6f: return gen_division(g, I32, 1, 1);
+		case 0x70: return gen_division(g, I32, 0, 1);
+		case 0x7f: return gen_division(g, I64, 1, 0);
+		case 0x80: return gen_division(g, I64, 0, 0);
+		case 0x81: return gen_division(g, I64, 1, 1);
+		case 0x82: return gen_division(g, I64, 0, 1);
+		case 0xa8: return gen_truncate(g, F32, I32, 1);
+		case 0xa9: return gen_truncate(g, F32, I32, 0);
+		case 0xaa: return gen_truncate(g, F64, I32, 1);
+		case 0xab: return gen_truncate(g, F64, I32, 0);
+		case 0xae: return gen_truncate(g, F32, I64, 1);
+		case 0xaf: return gen_truncate(g, F32, I64, 0);
+		case 0xb0: return gen_truncate(g, F64, I64, 1);
+		case 0xb1: return gen_truncate(g, F64, I64, 0);
+		case 0xfc: // trunc_sat, memory.init. data.drop, memory.copy, memory.fill
+		{
+			const uint32_t actual_opcode = leb_read_u32(r);
+			switch (actual_opcode)
+			{
+				case 0: return gen_truncate_saturated(g, F32, I32, 1);
+				case 1: return gen_truncate_saturated(g, F32, I32, 0);
+				case 2: return gen_truncate_saturated(g, F64, I32, 1);
+				case 3: return gen_truncate_saturated(g, F64, I32, 0);
+				case 4: return gen_truncate_saturated(g, F32, I64, 1);
+				case 5: return gen_truncate_saturated(g, F32, I64, 0);
+				case 6: return gen_truncate_saturated(g, F64, I64, 1);
+				case 7: return gen_truncate_saturated(g, F64, I64, 0);
+				case 8: // memory.init
+				{
+					char call[64];
+					snprintf(call, sizeof(call), "dwac_memory_init(d, %uu, ", leb_read_u32(r));
+					if (leb_read_u32(r) != 0) {return gen_not_supported(g, "DWAC_ONLY_ONE_MEMORY_IS_SUPPORTED", "memory.init");}
+					return gen_bulk_memory(g, call);
+				}
+				case 9: // data.drop
+					emit(g, "\tdwac_data_drop(d, %uu);\n", leb_read_u32(r));
+					return DWAC_OK;
+				case 10: // memory.copy
+				{
+					const uint32_t dst_memory = leb_read_u32(r);
+					const uint32_t src_memory = leb_read_u32(r);
+					if ((dst_memory != 0) || (src_memory != 0)) {return gen_not_supported(g, "DWAC_ONLY_ONE_MEMORY_IS_SUPPORTED", "memory.copy");}
+					return gen_bulk_memory(g, "dwac_memory_copy(d, ");
+				}
+				case 11: // memory.fill
+					if (leb_read_u32(r) != 0) {return gen_not_supported(g, "DWAC_ONLY_ONE_MEMORY_IS_SUPPORTED", "memory.fill");}
+					return gen_bulk_memory(g, "dwac_memory_fill(d, ");
+				default:
+					skip_fc_immediates(r, actual_opcode);
+					return gen_not_supported(g, "DWAC_SATURATING_NOT_SUPPORTED_YET", "0xfc");
+			}
+		}
+		default:
+			if (numeric_ops[opcode].expr != NULL)
+			{
+				return gen_numeric(g, &numeric_ops[opcode]);
+			}
+			return fail(g, "Opcode 0x%x not supported", opcode);
+	}
+	return res;
+}
+
+// Generate a function from its body in code section. Local variables are
+// declared in the body before the instructions.
+static dwac_result gen_function(gen_type *g, uint32_t function_idx, size_t body_begin, size_t body_end, FILE *out)
+{
+	const dwac_prog *p = g->p;
+	const dwac_function *f = &p->funcs_vector.functions_array[function_idx];
+	g->func_type = dwac_get_func_type_ptr(p, f->func_type_idx);
+	const dwac_func_type_type *t = g->func_type;
+
+	// Parameters first then the declared local variables.
+	g->r.pos = body_begin;
+	g->r.nof = body_end;
+	uint32_t nof_locals = t->nof_parameters;
+	const uint32_t nof_decl = leb_read_u32(&g->r);
+	const size_t decl_begin = g->r.pos;
+	for (uint32_t i = 0; (i < nof_decl) && !g->r.errors; i++)
+	{
+		nof_locals += leb_read_u32(&g->r);
+		read_u8(&g->r);
+	}
+	if ((g->r.errors) || (nof_locals > 0x10000)) {return fail(g, "Bad local variables");}
+	free(g->local_types);
+	g->local_types = malloc(nof_locals + 1);
+	g->nof_locals = 0;
+	for (uint32_t i = 0; i < t->nof_parameters; i++)
+	{
+		g->local_types[g->nof_locals++] = t->parameters_list[i];
+	}
+	g->r.pos = decl_begin;
+	for (uint32_t i = 0; i < nof_decl; i++)
+	{
+		const uint32_t n = leb_read_u32(&g->r);
+		const uint8_t lt = read_u8(&g->r);
+		if (!is_value_type(lt)) {return fail(g, "Local type 0x%x not supported", lt);}
+		memset(g->local_types + g->nof_locals, lt, n);
+		g->nof_locals += n;
+	}
+	if (g->r.pos != f->internal_function.start_addr) {return fail(g, "Function %u not where expected", function_idx);}
+
+	char *body = NULL;
+	size_t body_size = 0;
+	g->out = open_memstream(&body, &body_size);
+	memset(g->used, 0, sizeof(g->used));
+	g->height = 0;
+	g->nof_labels = 1;
+	g->labels[0].kind = 0;
+	g->labels[0].id = 0;
+	g->labels[0].height = 0;
+	g->labels[0].type = t;
+	g->next_label_id = 1;
+	g->unreachable = 0;
+	g->skip_depth = 0;
+
+	dwac_result res = DWAC_OK;
+	while ((g->nof_labels != 0) && (res == DWAC_OK))
+	{
+		if (g->r.pos >= g->r.nof) {res = fail(g, "Missing end of function"); break;}
+		const uint8_t opcode = read_u8(&g->r);
+		if (g->unreachable)
+		{
+			// Only the nesting of blocks matter in code that is not reachable.
+			if ((opcode == 0x02) || (opcode == 0x03) || (opcode == 0x04))
+			{
+				skip_immediates(&g->r, opcode);
+				g->skip_depth++;
+				continue;
+			}
+			if ((opcode == 0x05) || (opcode == 0x0b))
+			{
+				if (g->skip_depth != 0)
+				{
+					if (opcode == 0x0b) {g->skip_depth--;}
+					continue;
+				}
+			}
+			else
+			{
+				skip_immediates(&g->r, opcode);
+				continue;
+			}
+		}
+		res = gen_instruction(g, opcode);
+		if (g->r.errors) {res = fail(g, "Unexpected end of code");}
+	}
+	fclose(g->out);
+	if ((res == DWAC_OK) && (g->r.pos != body_end))
+	{
+		res = fail(g, "Function %u ended at 0x%zx not 0x%zx", function_idx, g->r.pos, body_end);
+	}
+	if (res != DWAC_OK)
+	{
+		free(body);
+		return res;
+	}
+
+	fprintf(out, "// %s\n", dwac_get_func_name(p, function_idx));
+	fprintf(out, "static dwac_result f%u(dwac_data *d)\n{\n", function_idx);
+	fprintf(out, "\tdwac_value_type *frame = &d->stack[d->fp];\n");
+	for (uint32_t i = 0; i < g->nof_locals; i++)
+	{
+		if (i < t->nof_parameters)
+		{
+			fprintf(out, "\t%s l%u = frame[%u].%s;\n", c_type(g->local_types[i]), i, i, member(g->local_types[i]));
+		}
+		else
+		{
+			fprintf(out, "\t%s l%u = 0;\n", c_type(g->local_types[i]), i);
+		}
+	}
+	static const uint8_t types[4] = {DWAC_I32, DWAC_I64, DWAC_F32, DWAC_F64};
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		for (uint32_t h = 0; h < MAX_STACK_HEIGHT; h++)
+		{
+			if (g->used[i][h])
+			{
+				fprintf(out, "\t%s %s = 0;\n", c_type(types[i]), var(g, h, types[i]));
+			}
+		}
+	}
+	fprintf(out, "\tAOT_GAS();\n");
+	fwrite(body, 1, body_size, out);
+	fprintf(out, "}\n\n");
+	free(body);
+	return DWAC_OK;
+}
+
+
+
+// Used for imported functions at compile time, parsing requires them.
+static void not_available(dwac_data *d)
+{
+	snprintf(d->exception, sizeof(d->exception), "Not available at compile time");
+}
+
+// Imports must be registered before parsing. And types of globals are
+// needed but dwac_parse_prog_sections does not keep those. So take a
+// quick look at those sections first.
+static dwac_result scan_sections(gen_type *g, dwac_prog *p, const uint8_t *bytes, size_t size, size_t *code_begin)
+{
+	dwac_leb128_reader_type r = {.pos = 8, .nof = size, .array = bytes, .errors = 0};
+	*code_begin = 0;
+	while ((r.pos < r.nof) && !r.errors)
+	{
+		const uint8_t section_id = read_u8(&r);
+		const uint32_t section_len = leb_read_u32(&r);
+		const size_t section_end = r.pos + section_len;
+		switch (section_id)
+		{
+			case 2: // Import Section
+			{
+				const uint32_t n = leb_read_u32(&r);
+				for (uint32_t i = 0; (i < n) && !r.errors; i++)
+				{
+					const uint32_t module_len = leb_read_u32(&r);
+					const char *module_name = (const char*) bytes + r.pos;
+					r.pos += module_len;
+					const uint32_t field_len = leb_read_u32(&r);
+					const char *field_name = (const char*) bytes + r.pos;
+					r.pos += field_len;
+					const uint8_t kind = read_u8(&r);
+					if ((kind != DWAC_FUNCTYPE) || (r.pos > r.nof)) {break;} // dwac_parse_prog_sections will tell.
+					leb_read_u32(&r);
+					char name[DWAC_HASH_LIST_MAX_KEY_SIZE+1];
+					snprintf(name, sizeof(name), "%.*s/%.*s", (int) module_len, module_name, (int) field_len, field_name);
+					dwac_register_function(p, name, not_available);
+				}
+				break;
+			}
+			case 6: // Global Section
+			{
+				const uint32_t n = leb_read_u32(&r);
+				if (n > MAX_NOF_GLOBALS) {return fail(g, "Too many globals");}
+				for (uint32_t i = 0; (i < n) && !r.errors; i++)
+				{
+					g->global_types[g->nof_globals++] = read_u8(&r);
+					read_u8(&r); // mutable
+					for (uint8_t opcode = read_u8(&r); (opcode != 0x0b) && !r.errors; opcode = read_u8(&r))
+					{
+						skip_immediates(&r, opcode);
+					}
+				}
+				break;
+			}
+			case 10: // Code Section
+				*code_begin = r.pos;
+				break;
+			default:
+				break;
+		}
+		r.pos = section_end;
+	}
+	return r.errors ? fail(g, "Could not read sections") : DWAC_OK;
+}
+
+static dwac_result generate(gen_type *g, dwac_prog *p, dwac_data *d, const uint8_t *bytes, size_t size, uint8_t gas, FILE *out)
+{
+	size_t code_begin;
+	dwac_result res = scan_sections(g, p, bytes, size, &code_begin);
+	if (res) {return res;}
+
+	res = dwac_parse_prog_sections(p, d, bytes, size, NULL);
+	if (res)
+	{
+		snprintf(g->error, sizeof(g->error), "Parse failed %d '%s'", res, d->exception);
+		return res;
+	}
+	g->p = p;
+	g->r.array = bytes;
+	g->r.errors = 0;
+
+	fprintf(out, "// Generated by drekkar_wasm2c from a program of %zu bytes.\n", size);
+	if (gas) {fprintf(out, "#define DWAC_AOT_GAS\n");}
+	fprintf(out, "%s", prelude);
+
+	const uint32_t nof_imported = p->funcs_vector.nof_imported;
+	const uint32_t total_nof = p->funcs_vector.total_nof;
+	for (uint32_t i = nof_imported; i < total_nof; i++)
+	{
+		fprintf(out, "static dwac_result f%u(dwac_data *d);\n", i);
+	}
+	fprintf(out, "\n");
+
+	// Walk code section, each body is size then locals and code.
+	dwac_leb128_reader_type r = {.pos = code_begin, .nof = size, .array = bytes, .errors = 0};
+	const uint32_t n = (code_begin != 0) ? leb_read_u32(&r) : 0;
+	if (n != total_nof - nof_imported) {return fail(g, "Number of function bodies %u != %u", n, total_nof - nof_imported);}
+	for (uint32_t i = 0; i < n; i++)
+	{
+		const uint32_t body_size = leb_read_u32(&r);
+		const size_t body_begin = r.pos;
+		res = gen_function(g, nof_imported + i, body_begin, body_begin + body_size, out);
+		if (res)
+		{
+			const size_t len = strlen(g->error);
+			snprintf(g->error + len, sizeof(g->error) - len, " (function %u)", nof_imported + i);
+			return res;
+		}
+		r.pos = body_begin + body_size;
+	}
+
+	fprintf(out, "static const dwac_aot_func_ptr functions[] =\n{\n");
+	for (uint32_t i = nof_imported; i < total_nof; i++)
+	{
+		fprintf(out, "\tf%u,\n", i);
+	}
+	fprintf(out, "};\n\n");
+	fprintf(out, "%s\n", postlude);
+	fprintf(out, "const dwac_aot_module_type dwac_aot_module =\n{\n");
+	fprintf(out, "\t.hash = 0x%llxull,\n", (unsigned long long) dwac_module_hash(bytes, size));
+	fprintf(out, "\t.nof_functions = %u,\n", total_nof - nof_imported);
+	fprintf(out, "\t.functions = functions,\n");
+	fprintf(out, "};\n");
+	return DWAC_OK;
+}
+
+static uint8_t* load_file(const char *file_name, size_t *size)
+{
+	FILE *f = fopen(file_name, "rb");
+	if (f == NULL) {return NULL;}
+	fseek(f, 0, SEEK_END);
+	const long n = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t *bytes = (n > 0) ? malloc(n) : NULL;
+	if ((bytes == NULL) || (fread(bytes, 1, n, f) != (size_t) n))
+	{
+		free(bytes);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+	*size = n;
+	return bytes;
+}
+
+static void print_help(const char* name) {
+	printf("Usage: %s [options] <filename.wasm> <filename.c>\n", name);
+	printf("Options:\n");
+	printf("  --help               Display this information.\n");
+	printf("  --version            Display the version.\n");
+	printf("  --gas                Compile in gas metering.\n");
+}
+
+int main(int argc, const char **argv)
+{
+	uint8_t gas = 0;
+	const char *in_name = NULL;
+	const char *out_name = NULL;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--help") == 0) {print_help(argv[0]); return 0;}
+		else if (strcmp(argv[i], "--version") == 0) {printf("%s : %s\n", argv[0], DREKKAR_VERSION_STRING); return 0;}
+		else if (strcmp(argv[i], "--gas") == 0) {gas = 1;}
+		else if (in_name == NULL) {in_name = argv[i];}
+		else if (out_name == NULL) {out_name = argv[i];}
+		else {print_help(argv[0]); return 1;}
+	}
+	if ((in_name == NULL) || (out_name == NULL)) {print_help(argv[0]); return 1;}
+
+	size_t size = 0;
+	uint8_t *bytes = load_file(in_name, &size);
+	if ((bytes == NULL) || (size < 8))
+	{
+		printf("File not found (or too small): '%s'\n", in_name);
+		return 1;
+	}
+
+	dwac_st_init();
+	dwac_prog *p = malloc(sizeof(dwac_prog));
+	dwac_data *d = malloc(sizeof(dwac_data));
+	gen_type *g = calloc(1, sizeof(gen_type));
+	dwac_prog_init(p);
+	dwac_data_init(d, p);
+
+	FILE *out = fopen(out_name, "w");
+	dwac_result r = DWAC_FILE_NOT_FOUND;
+	if (out == NULL)
+	{
+		printf("Could not write '%s'\n", out_name);
+	}
+	else
+	{
+		r = generate(g, p, d, bytes, size, gas, out);
+		fclose(out);
+		if (r != DWAC_OK)
+		{
+			printf("Could not compile '%s': %s\n", in_name, g->error);
+			remove(out_name);
+		}
+	}
+
+	free(g->local_types);
+	free(g);
+	dwac_data_deinit(d, NULL);
+	dwac_prog_deinit(p);
+	free(d);
+	free(p);
+	free(bytes);
+	dwac_st_deinit();
+	return (r == DWAC_OK) ? 0 : 1;
+}
@@ -46,9 +46,21 @@
 #include <ctype.h>
 #include <math.h>
 #include <limits.h>
+#include <time.h>
 #include <stdio.h>
 #include <unistd.h>
 #include "drekkar_wa_core.h"
+#ifdef DWAC_TRANSLATE_THREADS
+#include <sched.h>
+#endif
+#if defined(DWAC_JIT) || defined(DWAC_GUARD_PAGES)
+#include <stddef.h>
+#include <sys/mman.h>
+#endif
+#ifdef DWAC_GUARD_PAGES
+#include <signal.h>
+#include <setjmp.h>
+#endif
 
 
 // Enable this macro if lots of debug logging is needed.
@@ -75,7 +87,32 @@
 
 static long alloc_counter = 0;
 static long alloc_size = 0;
+#ifndef DWAC_TRANSLATE_THREADS
 static int logged_alloc_counter = 0x10000;
+#endif
+
+// Translate threads also allocate memory, so counting must be atomic then.
+#ifdef DWAC_TRANSLATE_THREADS
+#define ST_COUNT(counter, n) __atomic_add_fetch(&(counter), (n), __ATOMIC_RELAXED)
+#else
+#define ST_COUNT(counter, n) ((counter) += (n))
+#endif
+
+// True if the gas of the slice is used or dwac_interrupt was called, at
+// these checkpoints the program stops as if out of gas and then dwac_tick
+// tells which it was.
+#ifdef DWAC_INTERRUPT
+#define INTERRUPT_REQUESTED(d) __atomic_load_n(&(d)->interrupt_requested, __ATOMIC_RELAXED)
+#else
+#define INTERRUPT_REQUESTED(d) 0
+#endif
+#define GAS_EXHAUSTED(meter) (((meter) <= 0) || INTERRUPT_REQUESTED(d))
+
+#ifdef DWAC_COUNT_OPCODES
+#define COUNT_OPCODE() (d->nof_opcodes++)
+#else
+#define COUNT_OPCODE()
+#endif
 
 
 
@@ -220,17 +257,23 @@ void* dwac_st_malloc(size_t size, const char *file, unsigned int line)
 	//*(size_t*)(ptr+size_inc_header_footer-ST_FOOTER_SIZE) = ST_MAGIC_NUMBER;
 	p[size_inc_header_footer-1] = ST_MAGIC_NUMBER;
 	assert(p[size_inc_header_footer-1] == ST_MAGIC_NUMBER);
-	++alloc_counter;
-	alloc_size += size;
+	#ifndef DWAC_TRANSLATE_THREADS
+	const long n = ST_COUNT(alloc_counter, 1);
+	#else
+	ST_COUNT(alloc_counter, 1);
+	#endif
+	ST_COUNT(alloc_size, (long)size);
 	#ifdef DWAC_ST_DEBUG
 	add_linked_list(h, file, line);
 	#endif
 	// Some logging (this can be removed later).
-	if (alloc_counter >= (2*logged_alloc_counter))
+	#ifndef DWAC_TRANSLATE_THREADS
+	if (n >= (2*logged_alloc_counter))
 	{
-		dbg("sys_alloc %lu %ld\n", alloc_size, alloc_counter);
-		logged_alloc_counter = alloc_counter;
+		dbg("sys_alloc %lu %ld\n", alloc_size, n);
+		logged_alloc_counter = n;
 	}
+	#endif
 
 	return p + ST_HEADER_SIZE;
 }
@@ -251,17 +294,23 @@ void* dwac_st_calloc(size_t num, size_t size, const char *file, unsigned int lin
 	//*(size_t*)(ptr+size_inc_header_footer-ST_FOOTER_SIZE) = ST_MAGIC_NUMBER;
 	p[size_inc_header_footer-1] = ST_MAGIC_NUMBER;
 	assert(p[size_inc_header_footer-1] == ST_MAGIC_NUMBER);
-	++alloc_counter;
-	alloc_size += (num * size);
+	#ifndef DWAC_TRANSLATE_THREADS
+	const long n = ST_COUNT(alloc_counter, 1);
+	#else
+	ST_COUNT(alloc_counter, 1);
+	#endif
+	ST_COUNT(alloc_size, (long)(num * size));
 	#ifdef DWAC_ST_DEBUG
 	add_linked_list(h, file, line);
 	#endif
 	// Some logging (this can be removed later).
-	if (alloc_counter >= (2*logged_alloc_counter))
+	#ifndef DWAC_TRANSLATE_THREADS
+	if (n >= (2*logged_alloc_counter))
 	{
-		dbg("sys_alloc %lu %ld\n", alloc_size, alloc_counter);
-		logged_alloc_counter = alloc_counter;
+		dbg("sys_alloc %lu %ld\n", alloc_size, n);
+		logged_alloc_counter = n;
 	}
+	#endif
 
 	return p + ST_HEADER_SIZE;
 }
@@ -293,9 +342,9 @@ void dwac_st_free(const void* ptr, const char *file, unsigned int line)
 		p[size_inc_header_footer-1] = 0;
 		#endif
 		free(p);
-		--alloc_counter;
-		alloc_size -= (size_inc_header_footer - (ST_HEADER_SIZE+ST_FOOTER_SIZE));
-		assert(alloc_counter>=0);
+		const long n = ST_COUNT(alloc_counter, -1);
+		ST_COUNT(alloc_size, -(long)(size_inc_header_footer - (ST_HEADER_SIZE+ST_FOOTER_SIZE)));
+		assert(n>=0);
 	}
 	else
 	{
@@ -355,7 +404,7 @@ void* dwac_st_resize(void* ptr, size_t old_size, size_t new_size, const char *fi
 	*(size_t*)new_ptr = new_size_inc_header_footer;
 	new_ptr[new_size_inc_header_footer-1] = ST_MAGIC_NUMBER;
 	assert(new_ptr[new_size_inc_header_footer-1] == ST_MAGIC_NUMBER);
-	alloc_size += (new_size - old_size);
+	ST_COUNT(alloc_size, (long)(new_size - old_size));
 	return new_ptr + ST_HEADER_SIZE;
 }
 
@@ -666,6 +715,102 @@ uint64_t dwac_linear_storage_64_pop(dwac_linear_storage_64_type *s)
 
 
 
+// Begin of file linear_storage_32.h
+
+void dwac_linear_storage_32_init(dwac_linear_storage_32_type* s)
+{
+	s->size = 0;
+	s->capacity = 0;
+	s->array = NULL;
+}
+
+void dwac_linear_storage_32_deinit(dwac_linear_storage_32_type* s)
+{
+	if (s->array != NULL)
+	{
+		DWAC_ST_FREE_SIZE(s->array, s->capacity * sizeof(uint32_t));
+		s->array = NULL;
+	}
+	memset(s, 0, sizeof(*s));
+}
+
+static void linear_storage_32_grow_buffer_if_needed(dwac_linear_storage_32_type *s, size_t needed_capacity)
+{
+	if (needed_capacity > s->capacity)
+	{
+		// There is not enough space.
+		if (s->capacity == 0)
+		{
+			// No list yet, create the first list.
+			s->capacity = needed_capacity;
+			s->array = DWAC_ST_MALLOC(s->capacity * sizeof(uint32_t));
+			memset(s->array, 0, s->capacity * sizeof(uint32_t));
+		}
+		else
+		{
+			// Need to make a bigger list. Make it at least twice bigger
+			// so that we don't need to resize too often.
+			long new_capacity = s->capacity * 2;
+			if (new_capacity < needed_capacity) {new_capacity = needed_capacity;}
+			s->array = DWAC_ST_RESIZE(s->array, s->capacity  * sizeof(uint32_t), new_capacity * sizeof(uint32_t));
+			for(size_t i = s->capacity; i <new_capacity; ++i) {s->array[i]=0;}
+			s->capacity = new_capacity;
+		}
+	}
+}
+
+void dwac_linear_storage_32_grow_if_needed(dwac_linear_storage_32_type *s, size_t needed_size)
+{
+	if (needed_size > s->size)
+	{
+		linear_storage_32_grow_buffer_if_needed(s, needed_size);
+	}
+}
+
+void dwac_linear_storage_32_set(dwac_linear_storage_32_type *s, size_t idx, const uint32_t i)
+{
+	if (idx >= s->size)
+	{
+		linear_storage_32_grow_buffer_if_needed(s, idx+1);
+		s->size = idx+1;
+	}
+	s->array[idx] = i;
+}
+
+uint32_t dwac_linear_storage_32_get(dwac_linear_storage_32_type *s, size_t idx)
+{
+	if (idx >= s->size)
+	{
+		linear_storage_32_grow_buffer_if_needed(s, idx+1);
+		s->size = idx+1;
+	}
+	return s->array[idx];
+}
+
+void dwac_linear_storage_32_push(dwac_linear_storage_32_type *s, uint32_t value)
+{
+	assert(s->size >= 0);
+	if (s->size >= s->capacity)
+	{
+		linear_storage_32_grow_buffer_if_needed(s, s->size + 1);
+	}
+	s->array[s->size++] = value;
+}
+
+// Not tested!
+uint32_t dwac_linear_storage_32_pop(dwac_linear_storage_32_type *s)
+{
+	if (s->size > 0)
+	{
+		return s->array[--s->size];
+	}
+	return 0;
+}
+
+// End of file linear_storage_32.h
+
+
+
 // Begin of file linear_storage_8.h
 
 
@@ -928,173 +1073,6 @@ void* dwac_linear_storage_size_get_const(const dwac_linear_storage_size_type *s,
 
 
 
-// Begin of file virtual_storage.h
-
-
-#define DIV_U_ROUND_UP(a,b) (((a)+((b)-1))/(b))
-
-
-void dwac_virtual_storage_init(dwac_virtual_storage_type* s)
-{
-	s->begin = 0;
-	s->end = 0;
-	s->inc = 0;
-	s->array = NULL;
-}
-
-void dwac_virtual_storage_deinit(dwac_virtual_storage_type* s)
-{
-	if (s->array != NULL)
-	{
-		DWAC_ST_FREE_SIZE(s->array, (s->end - s->begin));
-		s->array = NULL;
-	}
-	memset(s, 0, sizeof(*s));
-}
-
-void dwac_virtual_storage_grow_buffer_if_needed(dwac_virtual_storage_type *s, size_t begin, size_t nof_bytes, size_t min, size_t max)
-{
-	size_t end = begin + nof_bytes;
-
-	if (begin < min) {begin = min;}
-	if (end > max) {end = max;}
-	assert(begin < end);
-
-	if ((begin < s->begin) || (end >= s->end))
-	{
-		// There is not enough space.
-
-		// When we allocate we want it at some even boundary,
-		// just so we don't resize for every lousy little byte.
-		if (s->inc == 0) {s->inc = 0x1000;}
-
-		begin = (begin / s->inc) * s->inc;
-		end = DIV_U_ROUND_UP(end, s->inc) * s->inc;
-
-		if ((begin < min) || (end > max))
-		{
-			if (begin < min)
-			{
-				begin = min;
-			}
-			if (end > max)
-			{
-				end = max;
-			}
-		}
-		else
-		{
-			// Make a bigger increment next time.
-			if ((s->inc) < 0x20000000)
-			{
-				s->inc *= 2;
-			}
-		}
-
-		if (s->array == NULL)
-		{
-			// No list yet, create a first small list.
-			size_t new_capacity = end - begin;
-			s->array = DWAC_ST_MALLOC(new_capacity);
-			memset(s->array, 0, new_capacity);
-		}
-		else
-		{
-			// Never make it smaller.
-			if (begin > s->begin)
-			{
-				begin = s->begin;
-			}
-			if (end < s->end)
-			{
-				end = s->end;
-			}
-
-			assert(begin<=s->begin);
-			assert(end>=s->end);
-
-			// Make a bigger list.
-			size_t new_capacity = end - begin;
-			size_t move = s->begin - begin;
-			uint8_t* new_array = DWAC_ST_MALLOC(new_capacity);
-			memset(new_array, 0, new_capacity);
-			memcpy(new_array + move, s->array, (s->end - s->begin));
-			DWAC_ST_FREE_SIZE(s->array, (s->end - s->begin));
-			s->array = new_array;
-		}
-		s->begin = begin;
-		s->end = end;
-	}
-}
-
-// Set memory at offset.
-void virtual_storage_set_mem(dwac_virtual_storage_type *s, size_t offset, const uint8_t *src, size_t nof_bytes)
-{
-	dwac_virtual_storage_grow_buffer_if_needed(s, offset, nof_bytes, 0, -1);
-	memcpy(s->array + offset, src, nof_bytes);
-}
-
-void dwac_virtual_storage_set_uint64_t(dwac_virtual_storage_type *s, size_t offset, const uint64_t i)
-{
-	dwac_virtual_storage_grow_buffer_if_needed(s, offset, 8, 0, -1);
-	*((uint64_t*)(s->array+offset-s->begin)) = i;
-}
-
-void dwac_virtual_storage_set_uint32_t(dwac_virtual_storage_type *s, size_t offset, const uint32_t i)
-{
-	dwac_virtual_storage_grow_buffer_if_needed(s, offset, 4, 0, -1);
-	*((uint32_t*)(s->array+offset-s->begin)) = i;
-}
-
-void dwac_virtual_storage_set_uint16_t(dwac_virtual_storage_type *s, size_t offset, const uint16_t i)
-{
-	dwac_virtual_storage_grow_buffer_if_needed(s, offset, 2, 0, -1);
-	*((uint16_t*)(s->array+offset-s->begin)) = i;
-}
-
-void dwac_virtual_storage_set_uint8_t(dwac_virtual_storage_type *s, size_t offset, const uint8_t i)
-{
-	dwac_virtual_storage_grow_buffer_if_needed(s, offset, 1, 0, -1);
-	*((uint8_t*)(s->array+offset-s->begin)) = i;
-}
-
-void* dwac_virtual_storage_get_ptr(dwac_virtual_storage_type *s, size_t offset, size_t nof_bytes)
-{
-	dwac_virtual_storage_grow_buffer_if_needed(s, offset, nof_bytes, 0, -1);
-	return s->array + offset-s->begin;
-}
-
-uint64_t dwac_virtual_storage_get_uint64_t(dwac_virtual_storage_type *s, size_t offset)
-{
-	dwac_virtual_storage_grow_buffer_if_needed(s, offset, 8, 0, -1);
-	return *(uint64_t*)(s->array+offset-s->begin);
-}
-
-uint32_t dwac_virtual_storage_get_uint32_t(dwac_virtual_storage_type *s, size_t offset)
-{
-	dwac_virtual_storage_grow_buffer_if_needed(s, offset, 4, 0, -1);
-	return *(uint32_t*)(s->array+offset-s->begin);
-}
-
-uint16_t dwac_virtual_storage_get_uint16_t(dwac_virtual_storage_type *s, size_t offset)
-{
-	dwac_virtual_storage_grow_buffer_if_needed(s, offset, 2, 0, -1);
-	return *(uint16_t*)(s->array+offset-s->begin);
-}
-
-uint8_t dwac_virtual_storage_get_uint8_t(dwac_virtual_storage_type *s, size_t offset)
-{
-	dwac_virtual_storage_grow_buffer_if_needed(s, offset, 1, 0, -1);
-	return *(uint8_t*)(s->array+offset-s->begin);
-}
-
-// End of file virtual_storage.h
-
-
-
-
-
-
 // Begin of file wa_leb.c
 
 
@@ -1186,7 +1164,6 @@ static uint32_t leb_read_uint32(dwac_leb128_reader_type *r)
     return v;
 }
 
-#ifndef SKIP_FLOAT
 static uint64_t leb_read_uint64(dwac_leb128_reader_type *r)
 {
 	#ifdef __LITTLE_ENDIAN__
@@ -1197,7 +1174,6 @@ static uint64_t leb_read_uint64(dwac_leb128_reader_type *r)
     r->pos += 8;
     return v;
 }
-#endif
 
 static uint8_t leb_read_uint8(dwac_leb128_reader_type *r)
 {
@@ -1215,20 +1191,32 @@ static const char *leb_read_string(dwac_leb128_reader_type *r, size_t *len)
     return str;
 }
 
-static size_t leb_len(const uint8_t *ptr)
+// End of file wa_leb.c
+
+
+
+// Begin of file wa_code.c
+
+// Read one word of translated code.
+static uint32_t code_read_u32(dwac_code_reader_type *r)
 {
-	const uint8_t *tmp = ptr;
-	for(;;) {
-	  const uint8_t byte = *tmp++;
-	  if ((byte & 0x80U) == 0)
-	    break;
-	}
-	return tmp - ptr;
+	return r->array[r->pos++];
 }
 
+static int32_t code_read_s32(dwac_code_reader_type *r)
+{
+	return (int32_t) r->array[r->pos++];
+}
 
+// 64 bit immediates are stored as two words, least significant first.
+static uint64_t code_read_u64(dwac_code_reader_type *r)
+{
+	const uint64_t lo = r->array[r->pos++];
+	const uint64_t hi = r->array[r->pos++];
+	return (hi << 32) | lo;
+}
 
-// End of file wa_leb.c
+// End of file wa_code.c
 
 
 
@@ -1267,15 +1255,16 @@ static uint32_t sp_dec(dwac_data * d)
 #define TOP(d) (d->stack[d->sp])
 
 // When setting the data we want to set all 64 bits, so not using s32, u32 here.
-#define PUSH_I32(d, v) {PUSH(d).s64 = v;}
-#define PUSH_U32(d, v) {PUSH(d).u64 = v;}
-#define PUSH_I64(d, v) {PUSH(d).s64 = v;}
-#define PUSH_U64(d, v) {PUSH(d).u64 = v;}
+#define PUSH_VALUE(d, m, v) {PUSH(d).m = v;}
+#define PUSH_I32(d, v) PUSH_VALUE(d, s64, v)
+#define PUSH_U32(d, v) PUSH_VALUE(d, u64, v)
+#define PUSH_I64(d, v) PUSH_VALUE(d, s64, v)
+#define PUSH_U64(d, v) PUSH_VALUE(d, u64, v)
 #ifndef SKIP_FLOAT
-#define PUSH_F32(d, v) {PUSH(d).f32 = v;}
-#define PUSH_F64(d, v) {PUSH(d).f64 = v;}
-#define PUSH_F32I(d, v) {PUSH(d).u64 = v;}
-#define PUSH_F64I(d, v) {PUSH(d).u64 = v;}
+#define PUSH_F32(d, v) PUSH_VALUE(d, f32, v)
+#define PUSH_F64(d, v) PUSH_VALUE(d, f64, v)
+#define PUSH_F32I(d, v) PUSH_VALUE(d, u64, v)
+#define PUSH_F64I(d, v) PUSH_VALUE(d, u64, v)
 #endif
 
 #define POP_I32(d) (POP(d).s32)
@@ -1301,20 +1290,25 @@ static uint32_t sp_dec(dwac_data * d)
 #endif
 
 // When setting the data we want to set all 64 bits, so not using s32, u32 here.
-#define SET_I32(d, v) TOP(d).s64 = v;
-#define SET_U32(d, v) TOP(d).u64 = v;
-#define SET_I64(d, v) TOP(d).s64 = v;
-#define SET_U64(d, v) TOP(d).u64 = v;
+#define SET_VALUE(d, m, v) TOP(d).m = v;
+#define SET_I32(d, v) SET_VALUE(d, s64, v)
+#define SET_U32(d, v) SET_VALUE(d, u64, v)
+#define SET_I64(d, v) SET_VALUE(d, s64, v)
+#define SET_U64(d, v) SET_VALUE(d, u64, v)
 #ifndef SKIP_FLOAT
-#define SET_F32(d, v) TOP(d).f32 = v;
-#define SET_F64(d, v) TOP(d).f64 = v;
-#define SET_F32I(d, v) TOP(d).u64 = v;
-#define SET_F64I(d, v) TOP(d).u64 = v;
+#define SET_F32(d, v) SET_VALUE(d, f32, v)
+#define SET_F64(d, v) SET_VALUE(d, f64, v)
+#define SET_F32I(d, v) SET_VALUE(d, u64, v)
+#define SET_F64I(d, v) SET_VALUE(d, u64, v)
 #endif
 
 #define STACK_SIZE(d) (((d)->sp) + DWAC_SP_OFFSET)
 
 #define INVALID_FUNCTION_INDEX 0xFFFFFFFF
+#ifdef DWAC_CALL_INDIRECT_CACHE
+// Words after the operands of a call_indirect, see call_indirect_cache.
+#define CALL_INDIRECT_CACHE_WORDS (2 * DWAC_CALL_INDIRECT_CACHE + 1)
+#endif
 #define WA_MAGIC_STACK_VALUE 0x7876898575
 
 #ifndef SKIP_FLOAT
@@ -1365,6 +1359,40 @@ static int nearly_equal_double(double a, double b)
 	// There is much more to this but it will depend a lot on application so we can't solve all here.
 	return false;
 }
+
+// [1] 4.3.4. Conversions, trunc_sat. Same as the trunc opcodes but values
+// that do not fit give the nearest integer that does, and NaN gives zero.
+// The limits are exact as doubles (2^31, 2^32, 2^63 and 2^64), a float
+// operand is converted to double first without loss.
+static inline int32_t trunc_sat_s32(double a)
+{
+	if (isnan(a)) {return 0;}
+	if (a >= 2147483648.0) {return INT32_MAX;}
+	if (a <= -2147483648.0) {return INT32_MIN;}
+	return (int32_t) a;
+}
+
+static inline uint32_t trunc_sat_u32(double a)
+{
+	if (isnan(a) || (a <= 0.0)) {return 0;}
+	if (a >= 4294967296.0) {return UINT32_MAX;}
+	return (uint32_t) a;
+}
+
+static inline int64_t trunc_sat_s64(double a)
+{
+	if (isnan(a)) {return 0;}
+	if (a >= 9223372036854775808.0) {return INT64_MAX;}
+	if (a <= -9223372036854775808.0) {return INT64_MIN;}
+	return (int64_t) a;
+}
+
+static inline uint64_t trunc_sat_u64(double a)
+{
+	if (isnan(a) || (a <= 0.0)) {return 0;}
+	if (a >= 18446744073709551616.0) {return UINT64_MAX;}
+	return (uint64_t) a;
+}
 #endif
 
 
@@ -1544,120 +1572,504 @@ size_t dwac_func_type_to_string(char *buf, size_t size, const dwac_func_type_typ
 	return n;
 }
 
-
-// Merge the two by copying all data in upper into the lower.
-static void merge_memories(dwac_data *d)
+static int func_types_equal(const dwac_func_type_type *a, const dwac_func_type_type *b)
 {
-	dbg("merge upper memory with lower\n");
-	assert(d->memory.lower_mem.capacity <= d->memory.upper_mem.begin);
-	dwac_linear_storage_8_grow_if_needed(&(d->memory.lower_mem), d->memory.upper_mem.end);
-	memcpy(d->memory.lower_mem.array + d->memory.upper_mem.begin, d->memory.upper_mem.array, d->memory.upper_mem.end - d->memory.upper_mem.begin);
-	dwac_virtual_storage_deinit(&d->memory.upper_mem);
+	return (a->nof_parameters == b->nof_parameters) && (a->nof_results == b->nof_results) &&
+		(memcmp(a->parameters_list, b->parameters_list, a->nof_parameters) == 0) &&
+		(memcmp(a->results_list, b->results_list, a->nof_results) == 0);
 }
 
-// Translate address to host address space.
-// Compilers often using memory from lower addresses and high addresses.
-// So here is lower and upper memory hoping to catch those.
-static uint8_t* translate_addr_grow_if_needed(dwac_data *d, size_t addr, size_t size)
+// A program may have several function types that are the same (same
+// parameters and results), for call_indirect those are the same type.
+// Give each type the index of the first type equal to it so that types can
+// be compared by comparing those indexes.
+static void canonicalize_types(dwac_prog *p)
 {
-	const size_t end = addr + size;
-	assert(end >= addr);
-
-	// Is it in lower memory?
-	if (end <= d->memory.lower_mem.capacity)
+	const uint32_t nof = p->function_types_vector.size;
+	dwac_linear_storage_32_grow_if_needed(&p->canonical_types, nof);
+	for (uint32_t i = 0; i < nof; i++)
 	{
-		return d->memory.lower_mem.array + addr;
+		const dwac_func_type_type *type = dwac_get_func_type_ptr(p, i);
+		uint32_t c = i;
+		for (uint32_t j = 0; j < i; j++)
+		{
+			// Only the first of equal types needs to be compared with.
+			if ((p->canonical_types.array[j] == j) && (func_types_equal(dwac_get_func_type_ptr(p, j), type)))
+			{
+				c = j;
+				break;
+			}
+		}
+		dwac_linear_storage_32_set(&p->canonical_types, i, c);
 	}
+}
 
-	// Is it in upper memory?
-	if ((addr >= d->memory.upper_mem.begin) && (end <= d->memory.upper_mem.end))
-	{
-		return d->memory.upper_mem.array + addr - d->memory.upper_mem.begin;
-	}
 
-	// Perhaps its arguments memory?
-	if ((addr >= DWAC_ARGUMENTS_BASE) && ((end) <= (DWAC_ARGUMENTS_BASE + d->memory.arguments.size)))
-	{
-		return d->memory.arguments.array + (addr - DWAC_ARGUMENTS_BASE);
-	}
+#ifdef DWAC_GUARD_PAGES
+// The address space reserved for a memory. Addresses are 32 bits (offset is
+// added with wrap around) so an access can go at most a few bytes above 4 GiB,
+// the page after that is the guard.
+#define GUARD_RESERVED_SIZE (0x100000000ULL + DWAC_PAGE_SIZE)
+
+// The guarded code running in this thread, see GUARD_BEGIN.
+typedef struct guard_context_type
+{
+	dwac_data *d;
+	sigjmp_buf trap;
+	struct guard_context_type *prev;
+} guard_context_type;
+
+static __thread guard_context_type *guard_current = NULL;
+static __thread size_t guard_fault_addr = 0;
+static struct sigaction guard_old_action;
+static uint8_t guard_handler_installed = 0;
+
+// Make the range from addr up to end accessible, if not already.
+static int guard_memory_open(dwac_data *d, size_t addr, size_t size)
+{
+	const size_t end = (addr + size + DWAC_PAGE_SIZE - 1) & ~((size_t)DWAC_PAGE_SIZE - 1);
+	addr &= ~((size_t)DWAC_PAGE_SIZE - 1);
+	if ((d->memory.base == NULL) || (end > GUARD_RESERVED_SIZE - DWAC_PAGE_SIZE)) {return 0;}
+	return mprotect(d->memory.base + addr, end - addr, PROT_READ | PROT_WRITE) == 0;
+}
 
-	// Wanted range is not in existing memory.
-	// Need to expand memory, will hopefully not happen too often.
+// Make pages up to the current size of the memory accessible. Done when
+// the memory section is loaded and by the signal handler if the size has
+// been changed since (so it does not matter how the size was changed).
+static int guard_memory_update(dwac_data *d)
+{
+	const size_t size = wa_get_mem_size(d);
+	if (size <= d->memory.accessible) {return 1;}
+	if (!guard_memory_open(d, d->memory.accessible, size - d->memory.accessible)) {return 0;}
+	d->memory.accessible = size;
+	return 1;
+}
 
-	if (d->memory.upper_mem.end != 0)
+// An access outside of the accessible pages of the memory of the running
+// program stops it (the memory may have grown, then it is made accessible
+// and the access done again). Other faults are passed on to the handler that
+// was there before. SA_NODEFER is used so that signals are not blocked after
+// siglongjmp.
+static void guard_signal_handler(int sig, siginfo_t *info, void *context)
+{
+	guard_context_type *g = guard_current;
+	if (g != NULL)
 	{
-		if ((d->memory.lower_mem.capacity >= d->memory.upper_mem.begin) || (addr > 4 * d->memory.upper_mem.end))
+		dwac_data *d = g->d;
+		const uint8_t *a = (const uint8_t*) info->si_addr;
+		if ((a >= d->memory.base) && (a < d->memory.base + GUARD_RESERVED_SIZE))
 		{
-			merge_memories(d);
+			const size_t addr = a - d->memory.base;
+			if ((addr >= d->memory.accessible) && (addr < wa_get_mem_size(d)) && (guard_memory_update(d))) {return;}
+			guard_fault_addr = addr;
+			siglongjmp(g->trap, 1);
 		}
 	}
 
-	//const size_t upper_begin = (d->memory.upper_mem.begin != 0) ? d->memory.upper_mem.begin : wa_get_mem_size(d);
-	//const size_t cut = (d->memory.lower_mem.capacity + upper_begin) / 2;
-	const size_t cut = 0xF000;
-
-	if ((end <= cut) || (addr <= (2 * d->memory.lower_mem.capacity)))
+	if (guard_old_action.sa_flags & SA_SIGINFO)
 	{
-		// Grow lower memory.
-		//printf("grow lower memory %zx %zx %zx %x %x %zx %zx %zx\n", d->memory.lower_mem.capacity, d->memory.upper_mem.begin, d->memory.upper_mem.end, wa_get_mem_size(d), WA_ARGUMENTS_BASE, cut, addr, size);
-		if ((d->memory.upper_mem.end != 0) &&
-				((end >= d->memory.upper_mem.begin) || ((d->memory.lower_mem.capacity * 2) >= d->memory.upper_mem.begin)))
-		{
-			// Lower memory has grown up to upper memory.
-			assert(end <= d->memory.upper_mem.end);
-			merge_memories(d);
-		}
-		void *ptr = dwac_linear_storage_8_get_ptr(&(d->memory.lower_mem), addr, size);
-		//printf("lower memory now %zx\n", d->memory.lower_mem.capacity);
-		return ptr;
+		guard_old_action.sa_sigaction(sig, info, context);
 	}
-	else if (end <= wa_get_mem_size(d))
+	else if ((guard_old_action.sa_handler != SIG_DFL) && (guard_old_action.sa_handler != SIG_IGN))
 	{
-		// Grow upper memory.
-		//printf("grow upper memory %zx %zx %zx %x %x %zx %zx %zx\n", d->memory.lower_mem.capacity, d->memory.upper_mem.begin, d->memory.upper_mem.end, wa_get_mem_size(d), WA_ARGUMENTS_BASE, cut, addr, size);
-		dwac_virtual_storage_grow_buffer_if_needed(&d->memory.upper_mem, addr, size, d->memory.lower_mem.capacity, wa_get_mem_size(d));
-		//printf("upper memory now %zx %zx\n", d->memory.upper_mem.begin, d->memory.upper_mem.end);
-		return d->memory.upper_mem.array + addr - d->memory.upper_mem.begin;
+		guard_old_action.sa_handler(sig);
 	}
 	else
 	{
-		// This is outside and above upper memory, so it's an error.
-		printf("outside memory %zx %zx %zx %x %x %zx %zx %zx\n", d->memory.lower_mem.capacity, d->memory.upper_mem.begin, d->memory.upper_mem.end, wa_get_mem_size(d), DWAC_ARGUMENTS_BASE, cut, addr, size);
-		snprintf(d->exception, sizeof(d->exception), "Mem out of range 0x%zx 0x%zx 0x%x 0x%x", addr, size, wa_get_mem_size(d), DWAC_ARGUMENTS_BASE);
-
-		if (end <= DWAC_ARGUMENTS_BASE)
-		{
-			dwac_virtual_storage_grow_buffer_if_needed(&d->memory.upper_mem, addr, size, d->memory.lower_mem.capacity, DWAC_ARGUMENTS_BASE);
-			return d->memory.upper_mem.array + addr - d->memory.upper_mem.begin;
-		}
-		else if (addr >= DWAC_ARGUMENTS_BASE)
-		{
-			return dwac_linear_storage_8_get_ptr(&d->memory.arguments, addr - DWAC_ARGUMENTS_BASE, size);
-		}
-		else
-		{
-			// We might come here if someone reads/writes over the boundary of upper and arguments memory.
-			return NULL;
-		}
+		// Let the fault happen again without this handler.
+		signal(sig, SIG_DFL);
 	}
 }
 
-void* dwac_translate_to_host_addr_space(dwac_data *d, uint32_t offset, size_t size)
+static void guard_install_handler(void)
 {
-	return translate_addr_grow_if_needed(d, offset, size);
+	if (__atomic_exchange_n(&guard_handler_installed, 1, __ATOMIC_ACQ_REL)) {return;}
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = guard_signal_handler;
+	sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGSEGV, &sa, &guard_old_action);
 }
 
-// NOTE! This translate get/set code is only tested on a little endian host.
-
-static int32_t translate_get_int32(dwac_data *d, uint32_t addr)
+// Reserve address space for the memory, nothing is accessible until
+// guard_memory_update.
+static void guard_memory_reserve(dwac_data *d)
 {
-	const int32_t *host_addr = (const int32_t*) translate_addr_grow_if_needed(d, addr, 4);
-	return *host_addr;
+	guard_install_handler();
+	void *m = mmap(NULL, GUARD_RESERVED_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	d->memory.base = (m != MAP_FAILED) ? (uint8_t*) m : NULL;
+	d->memory.accessible = 0;
 }
 
-static int64_t translate_get_int64(dwac_data *d, uint32_t addr)
+// Called by GUARD_BEGIN when an access was outside of the memory. The gas
+// used is charged here since the code after GUARD_END is not run.
+static dwac_result guard_trapped(dwac_data *d, guard_context_type *g, long gas_used)
 {
-	const int64_t *host_addr = (const int64_t*) translate_addr_grow_if_needed(d, addr, 8);
+	guard_current = g->prev;
+	if (d->gas_metering) {d->gas_consumed += gas_used;}
+	d->gas_meter = 0;
+	snprintf(d->exception, sizeof(d->exception), "Mem out of range 0x%zx 0x%x", guard_fault_addr, wa_get_mem_size(d));
+	return DWAC_ADDR_OUT_OF_RANGE;
+}
+
+// Code between GUARD_BEGIN and GUARD_END returns DWAC_ADDR_OUT_OF_RANGE
+// if it (or a host function it calls) accesses memory that is not
+// accessible. Only d may be used after a trap, so the code between must
+// not change local variables that are used after. The gas_used expression
+// is evaluated after the trap, it is the gas to charge for the code run.
+#define GUARD_BEGIN(d, gas_used) \
+	guard_context_type guard = {.d = (d), .prev = guard_current}; \
+	if (sigsetjmp(guard.trap, 0) != 0) {return guard_trapped((d), &guard, (gas_used));} \
+	guard_current = &guard;
+#define GUARD_END() {guard_current = guard.prev;}
+
+// All addresses are in the reserved space, the guard pages do the checks.
+static inline uint8_t* translate_addr_grow_if_needed(dwac_data *d, size_t addr, size_t size)
+{
+	return d->memory.base + addr;
+}
+
+#else
+#define GUARD_BEGIN(d, gas_used)
+#define GUARD_END()
+
+// One allocation of memory pages, most are one page. If an access (or a
+// host function) needs pages that are not after each other in host memory
+// they are moved into one block, see memory_allocate_block. Nothing else is
+// ever moved, so memory can grow without copying.
+typedef struct memory_block_type
+{
+	uint32_t first_page;
+	uint32_t nof_pages;
+	uint8_t *array;
+} memory_block_type;
+
+#define MEMORY_PAGE(addr) ((uint32_t)((addr) >> 16))
+#define MEMORY_OFFSET(addr) ((uint32_t)((addr) & 0xffff))
+
+// Host address of a page, NULL if it is not allocated.
+static uint8_t* memory_page(const dwac_data *d, uint32_t page)
+{
+	uint8_t **const table = d->memory.directory[page >> 8];
+	return (table != NULL) ? table[page & 0xff] : NULL;
+}
+
+static void memory_set_page(dwac_data *d, uint32_t page, uint8_t *array)
+{
+	uint8_t ***table = &d->memory.directory[page >> 8];
+	if (*table == NULL)
+	{
+		*table = DWAC_ST_MALLOC(0x100 * sizeof(uint8_t*));
+		memset(*table, 0, 0x100 * sizeof(uint8_t*));
+	}
+	(*table)[page & 0xff] = array;
+}
+
+static void memory_clear_cache(dwac_data *d)
+{
+	memset(d->memory.cache_addr, 0xff, sizeof(d->memory.cache_addr));
+}
+
+// Allocate the pages first to last as one block. Blocks that overlap are
+// copied into it (so the block may get bigger than asked for). They are
+// freed later, see memory_free_merged_blocks.
+static void memory_allocate_block(dwac_data *d, uint32_t first, uint32_t last)
+{
+	dwac_linear_storage_size_type *blocks = &d->memory.blocks;
+	for (int changed = 1; changed;)
+	{
+		changed = 0;
+		for (size_t i = 0; i < blocks->size; i++)
+		{
+			const memory_block_type *b = dwac_linear_storage_size_get(blocks, i);
+			const uint32_t b_last = b->first_page + b->nof_pages - 1;
+			if ((b->first_page <= last) && (b_last >= first))
+			{
+				if (b->first_page < first) {first = b->first_page; changed = 1;}
+				if (b_last > last) {last = b_last; changed = 1;}
+			}
+		}
+	}
+
+	const size_t nof_pages = last - first + 1;
+	uint8_t *array = DWAC_ST_MALLOC(nof_pages * DWAC_PAGE_SIZE);
+	memset(array, 0, nof_pages * DWAC_PAGE_SIZE);
+
+	size_t i = 0;
+	while (i < blocks->size)
+	{
+		memory_block_type *b = dwac_linear_storage_size_get(blocks, i);
+		if ((b->first_page >= first) && (b->first_page <= last))
+		{
+			memcpy(array + (size_t)(b->first_page - first) * DWAC_PAGE_SIZE, b->array, (size_t)b->nof_pages * DWAC_PAGE_SIZE);
+			*(memory_block_type*) dwac_linear_storage_size_push(&d->memory.merged_blocks) = *b;
+			*b = *(const memory_block_type*) dwac_linear_storage_size_pop(blocks);
+		}
+		else
+		{
+			i++;
+		}
+	}
+
+	memory_block_type *n = dwac_linear_storage_size_push(blocks);
+	n->first_page = first;
+	n->nof_pages = nof_pages;
+	n->array = array;
+	d->memory.nof_bytes += nof_pages * DWAC_PAGE_SIZE;
+	for (uint32_t page = first; page <= last; page++)
+	{
+		memory_set_page(d, page, array + (size_t)(page - first) * DWAC_PAGE_SIZE);
+	}
+	memory_clear_cache(d);
+}
+
+// Not in the translation cache, look in the directory and allocate pages
+// not used before. The page is put in the cache (if the access is within
+// one page).
+static uint8_t* translate_addr_slow(dwac_data *d, size_t addr, size_t size)
+{
+	const size_t end = addr + size;
+	if ((end > wa_get_mem_size(d)) && ((addr < DWAC_ARGUMENTS_BASE) || (end > DWAC_ARGUMENTS_BASE + d->memory.arguments_size)))
+	{
+		// The memory is given anyway, the exception stops the program.
+		snprintf(d->exception, sizeof(d->exception), "Mem out of range 0x%zx 0x%zx 0x%x 0x%x", addr, size, wa_get_mem_size(d), DWAC_ARGUMENTS_BASE);
+	}
+
+	const uint32_t first = MEMORY_PAGE(addr);
+	const uint32_t last = MEMORY_PAGE((size != 0) ? end - 1 : addr);
+	if (last >= (DWAC_MEMORY_DIRECTORY_SIZE << 8)) {return NULL;}
+
+	// The pages must be after each other in host memory.
+	uint8_t *array = memory_page(d, first);
+	for (uint32_t page = first + 1; (array != NULL) && (page <= last); page++)
+	{
+		if (memory_page(d, page) != array + (size_t)(page - first) * DWAC_PAGE_SIZE) {array = NULL;}
+	}
+	if (array == NULL)
+	{
+		memory_allocate_block(d, first, last);
+		array = memory_page(d, first);
+	}
+
+	// Arguments are not cached so that access outside them is noted.
+	if ((first == last) && (end <= wa_get_mem_size(d)))
+	{
+		const uint32_t c = first & (DWAC_MEMORY_CACHE_SIZE - 1);
+		d->memory.cache_addr[c] = first << 16;
+		d->memory.cache_array[c] = array;
+	}
+	return array + MEMORY_OFFSET(addr);
+}
+
+// Translate address to host address space, pages are allocated when
+// first used.
+static inline uint8_t* translate_addr_grow_if_needed(dwac_data *d, size_t addr, size_t size)
+{
+	const uint32_t c = MEMORY_PAGE(addr) & (DWAC_MEMORY_CACHE_SIZE - 1);
+	if ((d->memory.cache_addr[c] == (addr & ~(size_t)0xffff)) && (MEMORY_OFFSET(addr) + size <= DWAC_PAGE_SIZE))
+	{
+		return d->memory.cache_array[c] + MEMORY_OFFSET(addr);
+	}
+	return translate_addr_slow(d, addr, size);
+}
+
+// A host function may translate an address and then another that moves the
+// pages of the first (see dwac_translate_to_host_addr_space). What it reads
+// at the first is then still there, so blocks moved are not freed until
+// the host function has returned.
+static void memory_free_merged_blocks(dwac_data *d)
+{
+	dwac_linear_storage_size_type *merged = &d->memory.merged_blocks;
+	while (merged->size != 0)
+	{
+		memory_block_type *b = dwac_linear_storage_size_pop(merged);
+		d->memory.nof_bytes -= (size_t)b->nof_pages * DWAC_PAGE_SIZE;
+		DWAC_ST_FREE_SIZE(b->array, (size_t)b->nof_pages * DWAC_PAGE_SIZE);
+	}
+}
+
+static void memory_pages_init(dwac_data *d)
+{
+	dwac_linear_storage_size_init(&d->memory.blocks, sizeof(memory_block_type));
+	dwac_linear_storage_size_init(&d->memory.merged_blocks, sizeof(memory_block_type));
+	memory_clear_cache(d);
+}
+
+static void memory_pages_deinit(dwac_data *d)
+{
+	memory_free_merged_blocks(d);
+	dwac_linear_storage_size_deinit(&d->memory.merged_blocks);
+	for (size_t i = 0; i < d->memory.blocks.size; i++)
+	{
+		memory_block_type *b = dwac_linear_storage_size_get(&d->memory.blocks, i);
+		DWAC_ST_FREE_SIZE(b->array, (size_t)b->nof_pages * DWAC_PAGE_SIZE);
+	}
+	dwac_linear_storage_size_deinit(&d->memory.blocks);
+	for (size_t i = 0; i < DWAC_MEMORY_DIRECTORY_SIZE; i++)
+	{
+		if (d->memory.directory[i] != NULL) {DWAC_ST_FREE_SIZE(d->memory.directory[i], 0x100 * sizeof(uint8_t*));}
+	}
+}
+#endif
+
+// Without DWAC_GUARD_PAGES a translation may move the pages of an address
+// translated before (if the range was not in one block). Host functions
+// shall write to memory using the address translated last (or use
+// dwac_memory_copy etc), what is written at one translated before may be
+// lost. Reading is safe, see memory_free_merged_blocks.
+void* dwac_translate_to_host_addr_space(dwac_data *d, uint32_t offset, size_t size)
+{
+	#ifdef DWAC_GUARD_PAGES
+	// As before an error is noted but the address given (the access will
+	// then fail if outside, so host functions need not check for NULL).
+	const size_t end = (size_t) offset + size;
+	if ((end > wa_get_mem_size(d)) && ((offset < DWAC_ARGUMENTS_BASE) || (end > DWAC_ARGUMENTS_BASE + d->memory.arguments_size)))
+	{
+		snprintf(d->exception, sizeof(d->exception), "Mem out of range 0x%x 0x%zx 0x%x", offset, size, wa_get_mem_size(d));
+	}
+	#endif
+	return translate_addr_grow_if_needed(d, offset, size);
+}
+
+// Used by memory.grow (also in code compiled ahead of time) and
+// emscripten_resize_heap.
+// [2] Return value: The previous size of the memory, in units of WebAssembly pages.
+// If the memory can not grow that much -1 is returned and the size is not changed.
+// Existing memory is never moved. With DWAC_GUARD_PAGES the new pages are
+// in the space already reserved, else pages are allocated when first used.
+uint32_t dwac_memory_grow(dwac_data *d, uint32_t delta_in_pages)
+{
+	const uint32_t current_size_in_pages = d->memory.current_size_in_pages;
+	if (((uint64_t)delta_in_pages + current_size_in_pages) > d->memory.maximum_size_in_pages)
+	{
+		dbg("memory.grow denied %u + %u > %u\n", current_size_in_pages, delta_in_pages, d->memory.maximum_size_in_pages);
+		return UINT32_MAX;
+	}
+	d->memory.current_size_in_pages += delta_in_pages;
+	#ifdef DWAC_GUARD_PAGES
+	if (!guard_memory_update(d))
+	{
+		d->memory.current_size_in_pages = current_size_in_pages;
+		return UINT32_MAX;
+	}
+	#endif
+	return current_size_in_pages;
+}
+
+// Bytes from addr, at most n, that are after each other in host memory.
+static inline size_t memory_chunk(size_t addr, size_t n)
+{
+	#ifdef DWAC_GUARD_PAGES
+	return n;
+	#else
+	const size_t left_in_page = DWAC_PAGE_SIZE - MEMORY_OFFSET(addr);
+	return (n < left_in_page) ? n : left_in_page;
+	#endif
+}
+
+// Same as memory_chunk but for the bytes just before end.
+static inline size_t memory_chunk_before(size_t end, size_t n)
+{
+	#ifdef DWAC_GUARD_PAGES
+	return n;
+	#else
+	const size_t in_page = MEMORY_OFFSET(end - 1) + 1;
+	return (n < in_page) ? n : in_page;
+	#endif
+}
+
+static dwac_result bulk_out_of_range(dwac_data *d, const char *what, uint32_t addr, uint32_t n, uint32_t size)
+{
+	snprintf(d->exception, sizeof(d->exception), "%s out of range 0x%x 0x%x 0x%x", what, addr, n, size);
+	return DWAC_ADDR_OUT_OF_RANGE;
+}
+
+// [1] 4.4.7. Memory Instructions, memory.init, data.drop, memory.copy and
+// memory.fill (also used by code compiled ahead of time). The ranges are
+// checked before anything is written and are done one chunk at a time (so
+// pages are not moved to get a range in one piece, see memory_chunk).
+dwac_result dwac_memory_init(dwac_data *d, uint32_t dataidx, uint32_t dst, uint32_t src, uint32_t n)
+{
+	if (dataidx >= d->data_segments.size) {return bulk_out_of_range(d, "Data segment", dataidx, 0, d->data_segments.size);}
+	const dwac_data_segment_type *segment = dwac_linear_storage_size_get(&d->data_segments, dataidx);
+	if ((uint64_t) src + n > segment->size) {return bulk_out_of_range(d, "memory.init", src, n, segment->size);}
+	if ((uint64_t) dst + n > wa_get_mem_size(d)) {return bulk_out_of_range(d, "memory.init", dst, n, wa_get_mem_size(d));}
+	const uint8_t *from = d->p->bytecodes.array + segment->pos + src;
+	while (n != 0)
+	{
+		const size_t c = memory_chunk(dst, n);
+		memcpy(translate_addr_grow_if_needed(d, dst, c), from, c);
+		from += c;
+		dst += c;
+		n -= c;
+	}
+	return DWAC_OK;
+}
+
+dwac_result dwac_data_drop(dwac_data *d, uint32_t dataidx)
+{
+	if (dataidx >= d->data_segments.size) {return bulk_out_of_range(d, "Data segment", dataidx, 0, d->data_segments.size);}
+	dwac_data_segment_type *segment = dwac_linear_storage_size_get(&d->data_segments, dataidx);
+	segment->size = 0;
+	return DWAC_OK;
+}
+
+dwac_result dwac_memory_copy(dwac_data *d, uint32_t dst, uint32_t src, uint32_t n)
+{
+	const uint32_t size = wa_get_mem_size(d);
+	if ((uint64_t) src + n > size) {return bulk_out_of_range(d, "memory.copy", src, n, size);}
+	if ((uint64_t) dst + n > size) {return bulk_out_of_range(d, "memory.copy", dst, n, size);}
+	if (dst <= src)
+	{
+		while (n != 0)
+		{
+			const size_t c = memory_chunk(src, memory_chunk(dst, n));
+			uint8_t *to = translate_addr_grow_if_needed(d, dst, c);
+			memmove(to, translate_addr_grow_if_needed(d, src, c), c);
+			dst += c;
+			src += c;
+			n -= c;
+		}
+	}
+	else
+	{
+		// Backwards, so that bytes that overlap are read before written.
+		while (n != 0)
+		{
+			const size_t c = memory_chunk_before(src + n, memory_chunk_before(dst + n, n));
+			n -= c;
+			uint8_t *to = translate_addr_grow_if_needed(d, dst + n, c);
+			memmove(to, translate_addr_grow_if_needed(d, src + n, c), c);
+		}
+	}
+	return DWAC_OK;
+}
+
+dwac_result dwac_memory_fill(dwac_data *d, uint32_t dst, uint8_t value, uint32_t n)
+{
+	if ((uint64_t) dst + n > wa_get_mem_size(d)) {return bulk_out_of_range(d, "memory.fill", dst, n, wa_get_mem_size(d));}
+	while (n != 0)
+	{
+		const size_t c = memory_chunk(dst, n);
+		memset(translate_addr_grow_if_needed(d, dst, c), value, c);
+		dst += c;
+		n -= c;
+	}
+	return DWAC_OK;
+}
+
+// NOTE! This translate get/set code is only tested on a little endian host.
+
+static int32_t translate_get_int32(dwac_data *d, uint32_t addr)
+{
+	const int32_t *host_addr = (const int32_t*) translate_addr_grow_if_needed(d, addr, 4);
+	return *host_addr;
+}
+
+static int64_t translate_get_int64(dwac_data *d, uint32_t addr)
+{
+	const int64_t *host_addr = (const int64_t*) translate_addr_grow_if_needed(d, addr, 8);
 	return *host_addr;
 }
 
@@ -1698,2229 +2110,3401 @@ static void translate_set_int16(dwac_data *d, uint32_t addr, int16_t value)
 }
 
 
-static long get_oplen(const uint8_t *ptr)
+// Number of immediate operands for the 0xfc prefixed opcodes.
+// [1] 5.4.7. Numeric Instructions & 5.4.6. Memory Instructions & 5.4.5. Table Instructions
+static uint32_t fc_nof_immediates(uint32_t actual_opcode)
 {
-	switch (*ptr)
+	switch (actual_opcode)
 	{
-		case 0x0c ... 0x0d:
-		case 0x10:
-		case 0x20 ... 0x24:
-		case 0x3f ... 0x40:
-		case 0x41:
-		case 0x42:
-		case 0x02 ... 0x04:
-			return 1 + leb_len(ptr + 1);
-		case 0x0e:
-		{
-			dwac_leb128_reader_type r;
-			leb128_reader_init(&r, ptr + 1, 4);
-			uint32_t target_count = leb_read(&r, 32);
-			for (uint32_t i = 0; i < target_count; i++)
-			{
-				leb_read(&r, 32);
-			}
-			leb_read(&r, 32);
-			//assert((1 + r.pos) < 0x10000);
-			return 1 + r.pos;
-		}
-		case 0x11:
-		case 0x28 ... 0x3e:
-		{
-			const uint8_t *tmp = ptr + 1;
-			tmp += leb_len(tmp);
-			tmp += leb_len(tmp);
-			return tmp - ptr;
-		}
-		case 0x43:
-			return 5;
-		case 0x44:
-			return 9;
-		default:
+		case 8: // memory.init x 0x00
+		case 10: // memory.copy 0x00 0x00
+		case 12: // table.init y x
+		case 14: // table.copy x y
+			return 2;
+		case 9: // data.drop x
+		case 11: // memory.fill 0x00
+		case 13: // elem.drop x
+		case 15: // table.grow x
+		case 16: // table.size x
+		case 17: // table.fill x
 			return 1;
+		default:
+			return 0;
 	}
 }
 
-
-static uint32_t find_br_addr(dwac_data *d, uint32_t start_pos)
+// Translate bytecodes, starting at r->pos, into 32 bit words.
+// Translation stops after the "end" opcode matching the beginning,
+// that is the end of a function body or an init expression.
+//
+// Opcodes are kept as they are but all LEB128 encoded operands are decoded
+// here once and stored as whole words (64 bit operands as two words, least
+// significant first) so that dwac_tick does not need to decode them every
+// time an instruction is executed. Alignment hints of load/store are dropped.
+static dwac_result translate_code(dwac_leb128_reader_type *r, dwac_linear_storage_32_type *code)
 {
-	uint32_t pos = start_pos;
+	const size_t max_nof = 16 + r->nof/16;
 	uint32_t level = 1;
-	for(;;)
+	while (level != 0)
 	{
-		dbg("find_br_addr %d\n", level);
-		switch (d->pc.array[pos])
+		if (r->pos >= r->nof)
+		{
+			// No end in sight!
+			return DWAC_NO_END;
+		}
+
+		const uint8_t opcode = leb_read_uint8(r);
+		dwac_linear_storage_32_push(code, opcode);
+
+		switch (opcode)
 		{
 			case 0x02: // block
 			case 0x03: // loop
 			case 0x04: // if
 			{
+				// [1] 5.4.1. Control Instructions
+				//     Block types are encoded in special compressed form, by either
+				//     the byte 0x40 indicating the empty type, as a single value type,
+				//     or as a type index encoded as a positive signed integer.
+				//     ...
+				//     To avoid any loss in the range of allowed indices, it is treated as a 33 bit signed integer.
+				//
+				// When reading the byte 0x40 as signed LEB the result is -64 (or -0x40).
+				// But the single value types 0x7F ... 0x7C are read as -1 ... -4, so
+				// adjust those to -DWAC_I32 ... -DWAC_F64 as dwac_get_func_type_ptr expects.
+				int64_t blocktype = leb_read_signed(r, 33);
+				if (blocktype < 0) {blocktype = -(blocktype + 0x80);}
+				dwac_linear_storage_32_push(code, (uint32_t) blocktype);
+
+				// Room for else and end addresses, see find_blocks_in_code,
+				// and the gas of an if, see count_gas_in_code.
+				if (opcode == 0x04) {dwac_linear_storage_32_push(code, 0);}
+				if (opcode != 0x03) {dwac_linear_storage_32_push(code, 0);}
+				if (opcode == 0x04) {dwac_linear_storage_32_push(code, 0);}
 				level++;
 				break;
 			}
 			case 0x05: // else
+				// Room for end address of the if and gas, see find_blocks_in_code.
+				dwac_linear_storage_32_push(code, 0);
+				dwac_linear_storage_32_push(code, 0);
 				break;
 			case 0x0b: // end
-			{
 				level--;
-				if (level==0)
+				break;
+			case 0x0c: // br
+			case 0x0d: // br_if
+				// The label and then room for its branch target, see find_blocks_in_code.
+				dwac_linear_storage_32_push(code, leb_read(r, 32));
+				dwac_linear_storage_32_push(code, 0);
+				dwac_linear_storage_32_push(code, 0);
+				dwac_linear_storage_32_push(code, 0);
+				dwac_linear_storage_32_push(code, 0);
+				break;
+			case 0x10: // call
+			case 0x20 ... 0x26: // local.get ... table.set
+			case 0x3f: // memory.size
+			case 0x40: // memory.grow
+				dwac_linear_storage_32_push(code, leb_read(r, 32));
+				break;
+			case 0x0e: // br_table
+			{
+				// Table size, the labels and then the default label. Each label
+				// is followed by room for its branch target, see find_blocks_in_code.
+				const uint32_t table_size = leb_read(r, 32);
+				if (table_size > max_nof) {return DWAC_TO_BIG_BRANCH_TABLE;}
+				dwac_linear_storage_32_push(code, table_size);
+				for (uint32_t i = 0; i <= table_size; i++)
 				{
-					return pos;
+					dwac_linear_storage_32_push(code, leb_read(r, 32));
+					dwac_linear_storage_32_push(code, 0);
+					dwac_linear_storage_32_push(code, 0);
+					dwac_linear_storage_32_push(code, 0);
+					dwac_linear_storage_32_push(code, 0);
 				}
 				break;
 			}
-			default:
-				// do nothing
+			case 0x11: // call_indirect
+				dwac_linear_storage_32_push(code, leb_read(r, 32)); // typeidx
+				dwac_linear_storage_32_push(code, leb_read(r, 32)); // tableidx
+				#ifdef DWAC_CALL_INDIRECT_CACHE
+				// Room for the inline cache, see call_indirect_cache_lookup.
+				for (uint32_t i = 0; i < CALL_INDIRECT_CACHE_WORDS; i++)
+				{
+					dwac_linear_storage_32_push(code, UINT32_MAX);
+				}
+				#endif
 				break;
-		}
-		pos += get_oplen(d->pc.array + pos);
-	}
-	return 0;
-}
-
-static uint32_t find_else_or_end(dwac_data *d, uint32_t start_pos)
-{
-	uint32_t pos = start_pos;
-	uint32_t level = 1;
-	for(;;)
-	{
-		dbg("find_else_or_end %d\n", level);
-		switch (d->pc.array[pos])
-		{
-			case 0x02: // block
-			case 0x03: // loop
-			case 0x04: // if
+			case 0x1c: // select t*
 			{
-				level++;
-				break;
-			}
-			case 0x05: // else
-				if (level==1)
+				// The value types are not needed when running, skip them.
+				const uint32_t n = leb_read(r, 32);
+				for (uint32_t i = 0; i < n; i++)
 				{
-					return pos;
+					leb_read(r, 32);
 				}
 				break;
-			case 0x0b: // end
+			}
+			case 0x28 ... 0x3e: // i32.load ... i64.store32
+				/*const uint32_t flags =*/ leb_read(r, 32);
+				dwac_linear_storage_32_push(code, leb_read(r, 32)); // offset
+				break;
+			case 0x41: // i32.const
+				dwac_linear_storage_32_push(code, (uint32_t) leb_read_signed(r, 32));
+				break;
+			case 0x42: // i64.const
 			{
-				level--;
-				if (level==0)
+				const uint64_t v = leb_read_signed(r, 64);
+				dwac_linear_storage_32_push(code, (uint32_t) v);
+				dwac_linear_storage_32_push(code, (uint32_t) (v >> 32));
+				break;
+			}
+			case 0x43: // f32.const
+				dwac_linear_storage_32_push(code, leb_read_uint32(r));
+				break;
+			case 0x44: // f64.const
+			{
+				const uint64_t v = leb_read_uint64(r);
+				dwac_linear_storage_32_push(code, (uint32_t) v);
+				dwac_linear_storage_32_push(code, (uint32_t) (v >> 32));
+				break;
+			}
+			case 0xfc:
+			{
+				const uint32_t actual_opcode = leb_read(r, 32);
+				dwac_linear_storage_32_push(code, actual_opcode);
+				const uint32_t n = fc_nof_immediates(actual_opcode);
+				for (uint32_t i = 0; i < n; i++)
 				{
-					return pos;
+					dwac_linear_storage_32_push(code, leb_read(r, 32));
 				}
 				break;
 			}
-			default:
-				// do nothing
+			case 0x00 ... 0x01: // unreachable, nop
+			case 0x0f: // return
+			case 0x1a ... 0x1b: // drop, select
+			case 0x45 ... 0xc4: // Numeric instructions, no immediate operands.
 				break;
+			case 0xfd:
+				// Keep the first operand, it is logged by dwac_tick.
+				dwac_linear_storage_32_push(code, leb_read(r, 32));
+				// fall through
+			default:
+			{
+				// The length of operands are not known for this opcode so
+				// translation can not continue. Close all open blocks so that
+				// code is still well formed, dwac_tick will report the opcode
+				// if it is reached.
+				for (uint32_t i = 0; i < level; i++)
+				{
+					dwac_linear_storage_32_push(code, 0x0b);
+				}
+				return DWAC_OK;
+			}
 		}
-		pos += get_oplen(d->pc.array + pos);
 	}
-	return 0;
+	return DWAC_OK;
 }
 
-
-// Parameters and local variables are pushed to stack.
-// Return address is pushed on block stack.
-// PC is set to the begin of the function.
-// Parameters: function_idx is index to the function to be called.
-//
-// If "gas metering" is not needed it would have been possible
-// to recursively call wa_tick instead of this block stack stuff.
-dwac_result dwac_setup_function_call(dwac_data *d, uint32_t function_idx)
+// Number of words an opcode and its immediate operands use in translated code.
+static long get_oplen(const uint32_t *ptr)
 {
-	dbg("dwac_setup_function_call %d %s\n", function_idx, dwac_get_func_name(d->p, function_idx));
-	const dwac_prog *p = d->p;
-	if (function_idx < p->funcs_vector.nof_imported) {return DWAC_CAN_NOT_CALL_IMPORTED_HERE;}
-	if (function_idx >= p->funcs_vector.total_nof) {return DWAC_FUNC_IDX_OUT_OF_RANGE;}
-	dwac_function *func = &p->funcs_vector.functions_array[function_idx];
-	assert(func && (func->func_type_idx >= 0));
-	const dwac_func_type_type *type = dwac_get_func_type_ptr(p, func->func_type_idx);
-	assert(type);
-	const dwac_stack_pointer_signed_type stack_size = STACK_SIZE(d);
-	if (stack_size < type->nof_parameters)
+	switch (*ptr)
 	{
-		snprintf(d->exception, sizeof(d->exception), "Insufficient number of parameters calling %u.", function_idx);
-		return DWAC_INSUFFICIENT_PARRAMETERS_FOR_CALL;
+		case 0x03:
+		case 0x10:
+		case 0x20 ... 0x26:
+		case 0x28 ... 0x41:
+		case 0x43:
+		case 0xfd:
+			return 2;
+		case 0x02:
+		case 0x05:
+		case 0x42:
+		case 0x44:
+		case 0x100 ... 0x101:
+		case 0x103:
+			return 3;
+		case 0x04:
+			return 5;
+		case 0x11:
+			#ifdef DWAC_CALL_INDIRECT_CACHE
+			return 3 + CALL_INDIRECT_CACHE_WORDS;
+			#else
+			return 3;
+			#endif
+		case 0x0c ... 0x0d:
+		case 0x102:
+			return 6;
+		case 0x0e:
+			return 7 + 5 * ptr[1];
+		case 0xfc:
+			return 2 + fc_nof_immediates(ptr[1]);
+		default:
+			return 1;
 	}
-	const dwac_stack_pointer_type expected_sp_after_call = d->sp - type->nof_parameters; // not counting results here
-
-	// Some data to save until returning.
-	dwac_block_stack_entry *block = (dwac_block_stack_entry*) dwac_linear_storage_size_push(&d->block_stack);
-	block->block_type_code = dwac_block_type_internal_func;
-	block->func_type_idx = func->func_type_idx;
-	block->func_info.func_idx = function_idx;
-	block->stack_pointer = expected_sp_after_call;
-	block->func_info.frame_pointer = d->fp;
-	block->func_info.return_addr = d->pc.pos;
-
-	// Remember current stack pointer, as it was before call.
-	// The called function need this to know where its parameters and local variables on stack begin.
-	// Add one since SP started at -1 as part of small CPU optimize (see WA_SP_INITIAL).
-	d->fp = expected_sp_after_call + DWAC_SP_OFFSET;
-
-	// Reserve space on operand stack for local variables of the function to be called.
-	d->sp += func->internal_function.nof_local;
-
-	// Set program counter to start of function.
-	d->pc.pos = func->internal_function.start_addr;
-
-	//printf("wa_setup_function_call 0x%x 0x%x 0x%x  0x%x 0x%x 0x%x\n", d->fp, d->sp, d->pc.pos, type->nof_results, type->nof_parameters, func->internal_function.nof_local);
-	return DWAC_OK;
 }
 
-static dwac_result call_imported_function(dwac_data *d, uint32_t function_idx)
-{
-	dbg("call_imported_function %d %s\n", function_idx, dwac_get_func_name(d->p, function_idx));
-	const dwac_prog *p = d->p;
-	if (function_idx >= p->funcs_vector.nof_imported) {return DWAC_NOT_AN_IDX_OF_IMPORTED_FUNCTION;}
-	dwac_function *func = &p->funcs_vector.functions_array[function_idx];
-	assert(func && (func->func_type_idx >= 0));
-	const dwac_func_type_type *type = dwac_get_func_type_ptr(p, func->func_type_idx);
-	assert(type);
-	const dwac_stack_pointer_signed_type stack_size = STACK_SIZE(d);
-	if (stack_size < type->nof_parameters)
+#ifdef DWAC_FUSE_OPCODES
+// Replace some common sequences of opcodes in translated code with
+// superinstructions, internal opcodes that do the same as the sequence
+// in one dispatch. These are (internal opcode, words in translated code):
+//   0x100: local.get x, i32.const c, i32.add -> [0x100][x][c]
+//   0x101: local.get x, i32.load offset      -> [0x101][x][offset]
+//   0x102: i32.eqz, br_if l                  -> [0x102][l][target][gas]
+//   0x103: local.get x, local.get y, i32.add -> [0x103][x][y]
+// None of the fused opcodes are branch targets (only block, loop, if, else
+// and end are) so the code is compacted, this must be done before
+// find_blocks_in_code. The gas of a fused opcode is that of the opcodes it
+// replace (see opcode_gas) so the gas used does not depend on fusing.
+// The target of 0x102 (three words, see find_blocks_in_code) is as for br_if.
+static void fuse_code(dwac_linear_storage_32_type *code)
+{
+	uint32_t *c = code->array;
+	const size_t nof = code->size;
+	size_t i = 0;
+	size_t w = 0;
+	while (i < nof)
 	{
-		snprintf(d->exception, sizeof(d->exception), "Insufficient nof parameters calling %u.", function_idx);
-		return DWAC_INSUFFICIENT_PARRAMETERS_FOR_CALL;
+		if ((c[i] == 0x20) && (i + 5 <= nof) && (c[i + 2] == 0x41) && (c[i + 4] == 0x6a))
+		{
+			c[w] = 0x100;
+			c[w + 1] = c[i + 1];
+			c[w + 2] = c[i + 3];
+			w += 3;
+			i += 5;
+		}
+		else if ((c[i] == 0x20) && (i + 5 <= nof) && (c[i + 2] == 0x20) && (c[i + 4] == 0x6a))
+		{
+			c[w] = 0x103;
+			c[w + 1] = c[i + 1];
+			c[w + 2] = c[i + 3];
+			w += 3;
+			i += 5;
+		}
+		else if ((c[i] == 0x20) && (i + 4 <= nof) && (c[i + 2] == 0x28))
+		{
+			c[w] = 0x101;
+			c[w + 1] = c[i + 1];
+			c[w + 2] = c[i + 3];
+			w += 3;
+			i += 4;
+		}
+		else if ((c[i] == 0x45) && (i + 7 <= nof) && (c[i + 1] == 0x0d))
+		{
+			c[w] = 0x102;
+			memmove(c + w + 1, c + i + 2, 5 * sizeof(uint32_t));
+			w += 6;
+			i += 7;
+		}
+		else
+		{
+			const size_t n = get_oplen(c + i);
+			if (w != i) {memmove(c + w, c + i, n * sizeof(uint32_t));}
+			w += n;
+			i += n;
+		}
 	}
-	const dwac_stack_pointer_type expected_sp_after_call = d->sp - type->nof_parameters; // not counting results here
-	dwac_stack_pointer_type saved_frame_pointer = d->fp;
-	d->fp = expected_sp_after_call + DWAC_SP_OFFSET;
+	code->size = w;
+}
+#endif
 
-	//printf("Calling '%s'\n", func->import_info.name);
+// Translate the body of an internal function, see translate_code.
+static dwac_result translate_function(const dwac_prog *p, dwac_function *f)
+{
+	dwac_leb128_reader_type r;
+	leb128_reader_init(&r, p->bytecodes.array, f->internal_function.end_addr + 1);
+	r.pos = f->internal_function.start_addr;
+	const dwac_result result = translate_code(&r, &f->internal_function.code);
+	#ifdef DWAC_FUSE_OPCODES
+	if (result == DWAC_OK) {fuse_code(&f->internal_function.code);}
+	#endif
+	return result;
+}
 
-	dwac_func_ptr f = func->external_function.func_ptr;
-	(f)(d);
 
-	if (d->exception[0] != 0)
-	{
-		return DWAC_EXCEPTION_FROM_IMPORTED_FUNCTION;
-	}
-	else if (d->sp != expected_sp_after_call + type->nof_results)
+// The number of values an instruction in translated code takes from the
+// operand stack and the number it puts there, see find_blocks_in_code.
+// Control instructions (0x00 ... 0x0f) are not handled here.
+static void get_stack_effect(const dwac_prog *p, const uint32_t *ptr, uint32_t *nof_pop, uint32_t *nof_push)
+{
+	*nof_pop = 0;
+	*nof_push = 0;
+	switch (ptr[0])
 	{
-		char tmp[256];
-		dwac_func_type_to_string(tmp, sizeof(tmp), type);
-		snprintf(d->exception, sizeof(d->exception), "Unexpected nof parameters and/or arguments, %d != %d + %d, %s.", (int) d->sp, (int) expected_sp_after_call, type->nof_results, tmp);
-		return DWAC_EXTERNAL_STACK_MISMATCH;
+		case 0x10: // call
+		case 0x11: // call_indirect
+		{
+			// If the function or type is not known the call fails when running.
+			const dwac_func_type_type *t = NULL;
+			if (ptr[0] == 0x11)
+			{
+				*nof_pop = 1;
+				if (ptr[1] < p->function_types_vector.size) {t = dwac_get_func_type_ptr(p, ptr[1]);}
+			}
+			else if (ptr[1] < p->funcs_vector.total_nof)
+			{
+				t = dwac_get_func_type_ptr(p, p->funcs_vector.functions_array[ptr[1]].func_type_idx);
+			}
+			if (t != NULL)
+			{
+				*nof_pop += t->nof_parameters;
+				*nof_push = t->nof_results;
+			}
+			break;
+		}
+		case 0x1a: // drop
+		case 0x21: // local.set
+		case 0x24: // global.set
+			*nof_pop = 1;
+			break;
+		case 0x1b ... 0x1c: // select
+			*nof_pop = 3;
+			*nof_push = 1;
+			break;
+		case 0x20: // local.get
+		case 0x23: // global.get
+		case 0x3f: // memory.size
+		case 0x41 ... 0x44: // const
+		case 0x100 ... 0x101:
+		case 0x103:
+			*nof_push = 1;
+			break;
+		case 0x22: // local.tee
+		case 0x25: // table.get
+		case 0x28 ... 0x35: // loads
+		case 0x40: // memory.grow
+		case 0x45: // i32.eqz
+		case 0x50: // i64.eqz
+		case 0x67 ... 0x69: // i32.clz ... i32.popcnt
+		case 0x79 ... 0x7b: // i64.clz ... i64.popcnt
+		case 0x8b ... 0x91: // f32.abs ... f32.sqrt
+		case 0x99 ... 0x9f: // f64.abs ... f64.sqrt
+		case 0xa7 ... 0xc4: // conversions
+			*nof_pop = 1;
+			*nof_push = 1;
+			break;
+		case 0x26: // table.set
+		case 0x36 ... 0x3e: // stores
+			*nof_pop = 2;
+			break;
+		case 0x46 ... 0x4f: // i32.eq ... i32.ge_u
+		case 0x51 ... 0x66: // i64.eq ... f64.ge
+		case 0x6a ... 0x78: // i32.add ... i32.rotr
+		case 0x7c ... 0x8a: // i64.add ... i64.rotr
+		case 0x92 ... 0x98: // f32.add ... f32.copysign
+		case 0xa0 ... 0xa6: // f64.add ... f64.copysign
+			*nof_pop = 2;
+			*nof_push = 1;
+			break;
+		case 0xfc:
+			switch (ptr[1])
+			{
+				case 0 ... 7: *nof_pop = 1; *nof_push = 1; break; // trunc_sat
+				case 15: *nof_pop = 2; *nof_push = 1; break; // table.grow
+				case 16: *nof_push = 1; break; // table.size
+				case 9: case 13: break; // data.drop, elem.drop
+				default: *nof_pop = 3; break; // memory.init, memory.copy etc
+			}
+			break;
+		default:
+			break;
 	}
-
-	d->fp = saved_frame_pointer;
-
-	dbg("done %d '%s'\n", function_idx, dwac_get_func_name(d->p, function_idx));
-
-	return DWAC_OK;
 }
 
-#ifdef LOG_FUNC_NAMES
-const char* dwac_get_func_name(const dwac_prog *p, long function_idx)
+// A block, loop, if or the function itself while in find_blocks_in_code.
+typedef struct find_blocks_label_type
 {
-	#ifdef LOG_FUNC_NAMES
-	const char* func_name = dwac_linear_storage_size_get_const(&p->func_names, function_idx);
-	return func_name ? func_name : "";
-	#else
-	return "";
-	#endif
-}
-#endif
+	uint8_t opcode; // block, loop, if or zero for the function itself.
+	uint8_t unreachable; // The rest of the block can not be reached (after br, return etc).
+	uint32_t begin_addr; // Position of block, loop or if.
+	uint32_t else_addr; // Position of else in an if, zero if none (yet).
+	uint32_t height; // Height of operand stack (above local variables) at begin, not counting parameters.
+	uint32_t nof_parameters;
+	uint32_t nof_results;
+	uint32_t nof_branch_values; // Values a branch to this label takes along.
+	uint32_t branch_links; // First in list of branch targets to set at end.
+} find_blocks_label_type;
 
-// This is then main state event machine that runs the program.
-// Returns DWAC_OK or DWAC_NEED_MORE_GAS if OK.
-// Something else if not OK.
-dwac_result dwac_tick(dwac_data *d)
+// Set the branch target at code[operand] for a branch to label l. Branches
+// to blocks and ifs that have not ended yet are linked into a list
+// (through the target address operands themselves) set when the end is found.
+static void find_blocks_set_target(uint32_t *code, uint32_t operand, find_blocks_label_type *l, uint32_t nof_locals)
 {
-	dbg("dwac_tick\n");
-
-	const dwac_prog *p = d->p;
-
-	assert(d->block_stack.size != 0);
-	if (d->stack[DWAC_STACK_CAPACITY - 1].s64 != WA_MAGIC_STACK_VALUE) {return DWAC_STACK_OVERFLOW;}
-	if (d->pc.pos >= d->pc.nof) {return DWAC_PC_ADDR_OUT_OF_RANGE;}
-	if (d->exception[0] !=  0) {return DWAC_EXCEPTION;}
-
-	// Regarding gas metering. As a CPU optimization: Instead of counting every
-	// opcode we only count the control opcodes (0x00 ... 0x11).
-	d->gas_meter = DWAC_GAS;
+	if (l->opcode == 0x03)
+	{
+		code[operand] = l->begin_addr + 2;
+	}
+	else
+	{
+		code[operand] = l->branch_links;
+		l->branch_links = operand;
+	}
+	code[operand + 1] = nof_locals + l->height - DWAC_SP_OFFSET;
+	code[operand + 2] = l->nof_branch_values;
+}
 
-	for(;;)
+// Find else and end of all blocks and ifs and the targets of all branches
+// in translated code and store them as operands, so that this does not
+// need to be searched for every time a block or branch is executed. The code
+// is traversed once with a stack of blocks not yet ended (and the height of
+// the operand stack). Blocks have no entries on the call stack when running.
+//
+// Translated code has these operands:
+//   block: blocktype, end_addr
+//   loop: blocktype (a loop branch to its start, that is known already)
+//   if: blocktype, else_addr (zero if no else), end_addr, gas
+//   else: end_addr, gas
+//   br, br_if: labelidx, target
+//   br_table: table_size, then labelidx and target for each label
+//
+// A target is four words: the branch address, the stack pointer (relative
+// to the frame pointer) that the label has, the number of values the
+// branch takes along to there and gas (set by count_gas_in_code). The branch address is the end of a block or
+// if, after the loop opcode of a loop or the end of the function. The end of
+// a function is its last word, it returns from the function. nof_locals is
+// the number of parameters and local variables of the function and type its
+// type (for an init expression that of its value).
+static dwac_result find_blocks_in_code(const dwac_prog *p, uint32_t *code, uint32_t nof, uint32_t nof_locals, const dwac_func_type_type *type)
+{
+	dwac_linear_storage_size_type labels;
+	dwac_linear_storage_size_init(&labels, sizeof(find_blocks_label_type));
+	find_blocks_label_type *l = dwac_linear_storage_size_push(&labels);
+	memset(l, 0, sizeof(find_blocks_label_type));
+	l->nof_results = type->nof_results;
+	l->nof_branch_values = type->nof_results;
+	uint32_t height = 0;
+	dwac_result r = DWAC_NO_END;
+	uint32_t pos = 0;
+	while ((pos < nof) && (r == DWAC_NO_END))
 	{
-		assert((d->pc.pos < d->pc.nof));
-		const uint8_t opcode = leb_read_uint8(&d->pc);
-		dbg("<%02x> ", opcode);
-		switch (opcode)
+		l = dwac_linear_storage_size_top(&labels);
+		uint32_t nof_pop = 0;
+		uint32_t nof_push = 0;
+		switch (code[pos])
 		{
 			case 0x00: // unreachable
-				dbg("unreachable\n");
-				// The unreachable instruction causes an unconditional trap.
-				sprintf(d->exception, "%s", "unreachable");
-				return DWAC_OP_CODE_ZERO;
-			case 0x01: // nop
-				// The nop instruction does nothing.
-				dbg("nop\n");
-				if (--d->gas_meter <= 0) {return DWAC_NEED_MORE_GAS;}
+			case 0x0f: // return
+				height = l->height;
+				l->unreachable = 1;
 				break;
 			case 0x02: // block
-			{
-				// [1] 5.4.1. Control Instructions
-				//     Block types are encoded in special compressed form, by either
-				//     the byte 0x40 indicating the empty type, as a single value type,
-				//     or as a type index encoded as a positive signed integer.
-				//     ...
-				//     To avoid any loss in the range of allowed indices, it is treated as a 33 bit signed integer.
-				//
-				// When reading the byte 0x40 as signed LEB the result is -64 (or -0x40).
-				// So func_type_idx need to be a signed variable, longer than 32 bits.
-				// Ref [3] assumed in its lookup parser that func_type_idx is always one byte
-				// but in the "main" loop it was 32 bit LEB.
-				const int64_t blocktype = leb_read_signed(&d->pc, 33);
-
-				dwac_block_stack_entry *block = (dwac_block_stack_entry*) dwac_linear_storage_size_push(&d->block_stack);
-				block->block_type_code = dwac_block_type_block;
-				block->func_type_idx = blocktype;
-				block->block_and_loop_info.br_addr = find_br_addr(d, d->pc.pos);
-				block->stack_pointer = d->sp; // Or just set it to zero?
-
-				dbg("block\n");
-
-				const dwac_func_type_type *ptr = dwac_get_func_type_ptr(p, block->func_type_idx);
-				if (ptr == NULL)
-				{
-					printf("value_type %02llx\n", (long long) block->func_type_idx);
-					return DWAC_VALUE_TYPE_NOT_SUPPORED_YET;
-				}
-
-				if (block->block_and_loop_info.br_addr > d->pc.nof) {return DWAC_BRANCH_ADDR_OUT_OF_RANGE;}
-				if (d->pc.pos >= d->pc.nof) {return DWAC_PC_ADDR_OUT_OF_RANGE;}
-				if (--d->gas_meter <= 0) {return DWAC_NEED_MORE_GAS;}
-				break;
-			}
 			case 0x03: // loop
-			{
-				// The loop statement creates a label that can later be branched back to with a
-				// br or br_if.
-				const int64_t blocktype = leb_read_signed(&d->pc, 33);
-
-				dwac_block_stack_entry *block = (dwac_block_stack_entry*) dwac_linear_storage_size_push(&d->block_stack);
-				block->block_type_code = dwac_block_type_loop;
-				block->func_type_idx = blocktype;
-				block->block_and_loop_info.br_addr = d->pc.pos;
-				block->stack_pointer = d->sp;
-
-				dbg("loop\n");
-
-				const dwac_func_type_type *ptr = dwac_get_func_type_ptr(p, block->func_type_idx);
-				if (ptr == NULL)
-				{
-					printf("value_type %02llx\n", (long long) block->func_type_idx);
-					return DWAC_VALUE_TYPE_NOT_SUPPORED_YET;
-				}
-
-				if (d->pc.pos >= d->pc.nof) {return DWAC_PC_ADDR_OUT_OF_RANGE;}
-				if (--d->gas_meter <= 0) {return DWAC_NEED_MORE_GAS;}
-				break;
-			}
 			case 0x04: // if
 			{
-				const int64_t blocktype = leb_read_signed(&d->pc, 33);
-
-				dwac_block_stack_entry *block = (dwac_block_stack_entry*) dwac_linear_storage_size_push(&d->block_stack);
-				block->block_type_code = dwac_block_type_if;
-				block->func_type_idx = blocktype;
-				block->stack_pointer = d->sp;
-
-				// Here we search the addresses of both else and end regardless of condition.
-				// We could check condition and search for only one of those. But emscripten
-				// seems to not use if/else so that optimization will be of little use for now.
-
-				uint32_t addr = find_else_or_end(d, d->pc.pos);
-				if (addr >= d->pc.nof) {return DWAC_ADDR_OUT_OF_RANGE;}
-
-				if (d->pc.array[addr] == 0x0b) // 0x0b = end
-				{
-					// An end was found.
-					block->if_else_info.else_addr = 0;
-					block->if_else_info.end_addr = addr;
-				}
-				else if (d->pc.array[addr] == 0x05) // 0x05 = else
-				{
-					// An else was found so continue to find end also.
-					block->if_else_info.else_addr = addr;
-					uint32_t end_addr = find_else_or_end(d, block->if_else_info.else_addr + 1);
-					if ((d->pc.array[end_addr] != 0x0b) || (end_addr >= d->pc.nof))
-					{
-						sprintf(d->exception, "%s", "No end in sight!");
-						return DWAC_NO_END;
-					}
-					block->if_else_info.end_addr = end_addr;
-				}
-				else
-				{
-					sprintf(d->exception, "%s", "No end or else found.");
-					return DWAC_NO_END_OR_ELSE;
-				}
-
-				const uint32_t cond = POP_I32(d);
-				if (cond == 0)
-				{
-					// Condition was not true, check if there is an else.
-					if (block->if_else_info.else_addr == 0)
-					{
-						// No else block.
-						d->block_stack.size--;
-						d->pc.pos = block->if_else_info.end_addr + 1;
-					}
-					else
-					{
-						// Condition was not true so continue with the else
-						// until end is found.
-						d->pc.pos = block->if_else_info.else_addr + 1;
-					}
-				}
-				else
-				{
-					// Condition was true, do nothing here, continue until else opcode is found.
-				}
-
-				dbg("if %u\n", cond);
-
-				const dwac_func_type_type *ptr = dwac_get_func_type_ptr(p, block->func_type_idx);
-				if (ptr == NULL)
+				const dwac_func_type_type *t = dwac_get_func_type_ptr(p, (int32_t) code[pos + 1]);
+				if (t == NULL)
 				{
-					printf("value_type %02llx\n", (long long) block->func_type_idx);
-					return DWAC_VALUE_TYPE_NOT_SUPPORED_YET;
+					r = DWAC_VALUE_TYPE_NOT_SUPPORED_YET;
+					break;
 				}
-
-				if (d->pc.pos >= d->pc.nof) {return DWAC_PC_ADDR_OUT_OF_RANGE;}
-				if (--d->gas_meter <= 0) {return DWAC_NEED_MORE_GAS;}
+				if (code[pos] == 0x04) {height = (height > l->height) ? height - 1 : l->height;}
+				const uint32_t block_height = (height >= l->height + t->nof_parameters) ? height - t->nof_parameters : l->height;
+				l = dwac_linear_storage_size_push(&labels);
+				memset(l, 0, sizeof(find_blocks_label_type));
+				l->opcode = code[pos];
+				l->begin_addr = pos;
+				l->height = block_height;
+				l->nof_parameters = t->nof_parameters;
+				l->nof_results = t->nof_results;
+				// Branching to a loop is to its begin, it takes the parameters along.
+				l->nof_branch_values = (code[pos] == 0x03) ? t->nof_parameters : t->nof_results;
+				height = block_height + t->nof_parameters;
 				break;
 			}
 			case 0x05: // else
 			{
-				// Program has reached an else. So now it shall skip to the end of it?
-				const dwac_block_stack_entry *f = (dwac_block_stack_entry*) dwac_linear_storage_size_top(&d->block_stack);
-				d->pc.pos = f->if_else_info.end_addr;
-
-				dbg("else\n");
-
-				if (d->pc.pos >= d->pc.nof) {return DWAC_PC_ADDR_OUT_OF_RANGE;}
-				if (--d->gas_meter <= 0) {return DWAC_NEED_MORE_GAS;}
+				if ((l->opcode != 0x04) || (l->else_addr != 0))
+				{
+					r = DWAC_ELSE_WITHOUT_IF;
+					break;
+				}
+				code[l->begin_addr + 2] = pos;
+				l->else_addr = pos;
+				l->unreachable = 0;
+				height = l->height + l->nof_parameters;
 				break;
 			}
 			case 0x0b: // end
 			{
-				// Reached the end of a block or function take new PC from the call/block stack.
-				dbg("end\n");
-
-				// Pop from block stack.
-				const dwac_block_stack_entry *block = (dwac_block_stack_entry*) dwac_linear_storage_size_pop(&d->block_stack);
-
-				if (block == NULL)
+				uint32_t link = l->branch_links;
+				while (link != 0)
 				{
-					snprintf(d->exception, sizeof(d->exception), "callstack underflow");
-					return DWAC_BLOCK_STACK_UNDER_FLOW;
+					const uint32_t next = code[link];
+					code[link] = pos;
+					link = next;
 				}
-
-				const dwac_func_type_type *t = dwac_get_func_type_ptr(p, block->func_type_idx);
-
-				if (t==NULL)
-				{
-					snprintf(d->exception, sizeof(d->exception), "No type info %ld", (long)block->func_type_idx);
-					return DWAC_NO_TYPE_INFO;
-				}
-
-				// Restore stack pointer to what is was before block.
-				// The result if any is to remain on stack while local variables shall be dropped.
-				// So keep a number of entries on top of stack, drop everything in between.
-				#if DWAC_STACK_CAPACITY == 0x10000
-				int16_t entries_available_on_stack = (int16_t)(d->sp) - (int16_t)block->stack_pointer;
-				if (entries_available_on_stack >= t->nof_results)
-				{
-					// Move t->nof_results entries from top of stack to block->stack_pointer.
-					for (uint32_t n = 0; n < t->nof_results; ++n)
-					{
-						const uint16_t to = block->stack_pointer + t->nof_results - n;
-						const uint16_t from = d->sp - n;
-						d->stack[to] = d->stack[from];
-					}
-					d->sp = block->stack_pointer + t->nof_results;
-				}
-				else
-				{
-					snprintf(d->exception, sizeof(d->exception), "missing return values");
-					return DWAC_MISSING_RETURN_VALUES;
-				}
-				#else
-				int32_t entries_available_on_stack = (int32_t)(d->sp) - (int32_t)block->stack_pointer;
-				if (entries_available_on_stack >= t->nof_results)
-				{
-					for (uint32_t n = 0; n < t->nof_results; ++n)
-					{
-						d->stack[SP_MASK(block->stack_pointer + t->nof_results - n)] = d->stack[SP_MASK(d->sp - n)];
-					}
-					d->sp = block->stack_pointer + t->nof_results;
-				}
-				else
+				if (labels.size == 1)
 				{
-					snprintf(d->exception, sizeof(d->exception), "missing return values");
-					return DWAC_MISSING_RETURN_VALUES;
+					// This is the end of the function (or expression) it must be last.
+					r = (pos == nof - 1) ? DWAC_OK : DWAC_MISSING_CODE_AT_END;
+					break;
 				}
-				#endif
-
-				switch(block->block_type_code)
+				switch (l->opcode)
 				{
-					case dwac_block_type_internal_func:
-					{
-						// Restore frame pointer to what previous block had.
-						d->fp = block->func_info.frame_pointer;
-
-						// If its a function that ends then it has a special return address.
-						// If so set program counter to the saved return address.
-						if (block->block_type_code == dwac_block_type_internal_func)
-						{
-							d->pc.pos = block->func_info.return_addr;
-						}
-
-						//printf("fp 0x%x 0x%x 0x%x\n", d->fp, d->sp, d->pc.pos);
-
-						if (d->block_stack.size == 0)
-						{
-							return DWAC_OK;
-						}
-						break;
-					}
-					case dwac_block_type_init_exp:
-					{
-						return DWAC_OK;
-					}
+					case 0x02: code[l->begin_addr + 2] = pos; break;
+					case 0x04: code[l->begin_addr + 3] = pos; break;
 					default: break;
 				}
-
-				if (d->stack[DWAC_STACK_CAPACITY - 1].s64 != WA_MAGIC_STACK_VALUE) {return DWAC_STACK_OVERFLOW;}
-				if (d->pc.pos >= d->pc.nof) {return DWAC_PC_ADDR_OUT_OF_RANGE;}
-				if (--d->gas_meter <= 0) {return DWAC_NEED_MORE_GAS;}
+				if (l->else_addr != 0) {code[l->else_addr + 1] = pos;}
+				height = l->height + l->nof_results;
+				dwac_linear_storage_size_pop(&labels);
 				break;
 			}
 			case 0x0c: // br
-			{
-				// The br statement branches out of a block or back in a loop.
-				const uint32_t labelidx = leb_read(&d->pc, 32);
-				if (labelidx >= d->block_stack.size)
-				{
-					sprintf(d->exception, "%s", "Branch stack under run");
-					return DWAC_BLOCK_STACK_UNDER_RUN;
-				}
-				d->block_stack.size -= labelidx;
-				const dwac_block_stack_entry *f = (dwac_block_stack_entry*) dwac_linear_storage_size_top(&d->block_stack);
-				d->pc.pos = f->block_and_loop_info.br_addr;
-
-				dbg("br\n");
-
-				if (d->stack[DWAC_STACK_CAPACITY - 1].s64 != WA_MAGIC_STACK_VALUE) {return DWAC_STACK_OVERFLOW;}
-				if (d->pc.pos >= d->pc.nof) {return DWAC_PC_ADDR_OUT_OF_RANGE;}
-				if (--d->gas_meter <= 0) {return DWAC_NEED_MORE_GAS;}
-				break;
-			}
 			case 0x0d: // br_if
+			case 0x102: // i32.eqz, br_if
 			{
-				dbg("br_if\n");
-				// This is the end of a loop, check condition to see if loop shall continue?
-				// First get how many levels of blocks program shall get out of.
-				const uint32_t labelidx = leb_read(&d->pc, 32);
-				// Take condition value from stack.
-				const uint32_t cond = POP_I32(d);
-				if (labelidx >= d->block_stack.size)
+				const uint32_t labelidx = code[pos + 1];
+				if (labelidx >= labels.size)
 				{
-					sprintf(d->exception, "%s", "Branch stack under run");
-					return DWAC_BLOCK_STACK_UNDER_RUN;
+					r = DWAC_LABEL_OUT_OF_RANGE;
+					break;
 				}
-				if (cond)
+				if (code[pos] != 0x0c) {height = (height > l->height) ? height - 1 : l->height;}
+				find_blocks_set_target(code, pos + 2, dwac_linear_storage_size_get(&labels, labels.size - 1 - labelidx), nof_locals);
+				if (code[pos] == 0x0c)
 				{
-					// Pop a number of blocks (may be zero) from block stack and set program counter.
-					d->block_stack.size -= labelidx;
-					const dwac_block_stack_entry *f = (dwac_block_stack_entry*) dwac_linear_storage_size_top(&d->block_stack);
-					d->pc.pos = f->block_and_loop_info.br_addr;
+					height = l->height;
+					l->unreachable = 1;
 				}
-				else
-				{
-					/* do nothing, will just continue with next opcode. */
-				}
-
-				if (d->stack[DWAC_STACK_CAPACITY - 1].s64 != WA_MAGIC_STACK_VALUE) {return DWAC_STACK_OVERFLOW;}
-				if (d->pc.pos >= d->pc.nof) {return DWAC_PC_ADDR_OUT_OF_RANGE;}
-				if (--d->gas_meter <= 0) {return DWAC_NEED_MORE_GAS;}
 				break;
 			}
 			case 0x0e: // br_table
 			{
-				// Branch using br_table to get labelidx.
-
-				// [1] 2.4.8. Control Instructions
-				// br_table performs an indirect branch through an operand indexing into the
-				// label vector that is an immediate to the instruction, or to a default target
-				// if the operand is out of bounds.
-
-				const size_t max_nof = 16 + d->pc.nof/16;
-				const uint32_t table_size = leb_read(&d->pc, 32);
-				if (table_size > max_nof) {return DWAC_TO_BIG_BRANCH_TABLE;}
-				uint64_t *a = DWAC_ST_MALLOC(table_size * sizeof(uint64_t));
-
-				// Read and setup the entire table.
-				for (uint32_t i = 0; i < table_size; i++)
+				const uint32_t table_size = code[pos + 1];
+				for (uint32_t i = 0; i <= table_size; i++)
 				{
-					a[i] = leb_read(&d->pc, 64);
-				}
-
-				const uint32_t default_labelidx = leb_read(&d->pc, 32);
-
-				int32_t idx = POP_I32(d);
-
-				const uint32_t labelidx = ((idx >= 0) && (idx < (int32_t) table_size)) ? a[idx] : default_labelidx;
-
-				if (labelidx >= d->block_stack.size)
-				{
-					sprintf(d->exception, "%s", "Block stack under run");
-					return DWAC_BLOCKSTACK_UNDERFLOW;
+					const uint32_t labelidx = code[pos + 2 + 5 * i];
+					if (labelidx >= labels.size)
+					{
+						r = DWAC_LABEL_OUT_OF_RANGE;
+						break;
+					}
+					find_blocks_set_target(code, pos + 3 + 5 * i, dwac_linear_storage_size_get(&labels, labels.size - 1 - labelidx), nof_locals);
 				}
-
-				if (labelidx > d->block_stack.size) {return DWAC_LABEL_OUT_OF_RANGE;}
-
-				d->block_stack.size -= labelidx;
-				const dwac_block_stack_entry *f = (dwac_block_stack_entry*) dwac_linear_storage_size_top(&d->block_stack);
-				d->pc.pos = f->block_and_loop_info.br_addr;
-
-				DWAC_ST_FREE(a);
-
-				dbg("br_table\n");
-
-				if (d->pc.pos >= d->pc.nof) {return DWAC_PC_ADDR_OUT_OF_RANGE;}
-				if (--d->gas_meter <= 0) {return DWAC_NEED_MORE_GAS;}
+				height = l->height;
+				l->unreachable = 1;
 				break;
 			}
-			case 0x0f: // return
-			{
-				// Drop any ongoing if, loops etc.
-				dwac_block_stack_entry *storage_array = (dwac_block_stack_entry*) d->block_stack.array;
-				while ((d->block_stack.size != 0) && (storage_array[d->block_stack.size - 1].block_type_code != dwac_block_type_internal_func))
-				{
-					d->block_stack.size--;
-				}
+			default:
+				get_stack_effect(p, code + pos, &nof_pop, &nof_push);
+				// Code that can not be reached may take values that are not there.
+				height = (height >= l->height + nof_pop) ? height - nof_pop : l->height;
+				height += nof_push;
+				break;
+		}
+		pos += get_oplen(code + pos);
+	}
+	dwac_linear_storage_size_deinit(&labels);
+	return r;
+}
 
-				if (d->block_stack.size != 0)
-				{
-					// Set the program count to the end of the function
-					const dwac_block_stack_entry *f = (dwac_block_stack_entry*) dwac_linear_storage_size_top(&d->block_stack);
+// Gas of each opcode in translated code, see count_gas_in_code. The fused
+// opcodes (see fuse_code) cost as much as the opcodes they replace.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+static const uint8_t opcode_gas[0x104] =
+{
+	[0 ... 0x103] = 1,
+	[0x10] = 5, // call
+	[0x11] = 8, // call_indirect
+	[0x28 ... 0x35] = 2, // loads
+	[0x36 ... 0x3e] = 2, // stores
+	[0x40] = 10, // memory.grow
+	[0x6d ... 0x70] = 4, // i32.div_s ... i32.rem_u
+	[0x7f ... 0x82] = 4, // i64.div_s ... i64.rem_u
+	[0x91] = 4, [0x95] = 4, // f32.sqrt, f32.div
+	[0x9f] = 4, [0xa3] = 4, // f64.sqrt, f64.div
+	[0x100] = 3, // local.get, i32.const, i32.add
+	[0x101] = 3, // local.get, i32.load
+	[0x102] = 2, // i32.eqz, br_if
+	[0x103] = 3, // local.get, local.get, i32.add
+};
+#pragma GCC diagnostic pop
+
+// Put the gas of branches into translated code, after find_blocks_in_code
+// has set their targets. The code from a position up to and including the
+// next br, br_table, else, return, unreachable or the end of the function
+// can only be run from start to end (or until a trap). The sum of the gas
+// of those opcodes is charged once, when a branch to the position is taken,
+// instead of counting each opcode when it is run. Code that follows block,
+// loop, if, end, br_if or a call is then paid for already. So a br_if that
+// is taken (or an if that is false) charges the gas of where it goes minus
+// that of the code after it, this can be negative. Branches to the end of
+// the function charge nothing, as return. Returns the gas of the code at
+// the beginning of the function, charged when the function is called.
+static uint32_t count_gas_in_code(uint32_t *code, uint32_t nof)
+{
+	// Gas from each position on, found going backwards through the opcodes.
+	dwac_linear_storage_32_type positions;
+	dwac_linear_storage_32_type gas;
+	dwac_linear_storage_32_init(&positions);
+	dwac_linear_storage_32_init(&gas);
+	dwac_linear_storage_32_grow_if_needed(&gas, nof + 1);
+	gas.size = nof + 1;
+	uint32_t pos = 0;
+	while (pos < nof)
+	{
+		dwac_linear_storage_32_push(&positions, pos);
+		pos += get_oplen(code + pos);
+	}
+	for (size_t i = positions.size; i > 0; i--)
+	{
+		pos = positions.array[i - 1];
+		const uint32_t op = code[pos];
+		uint32_t g = (op < sizeof(opcode_gas)) ? opcode_gas[op] : 1;
+		switch (op)
+		{
+			case 0x00: // unreachable
+			case 0x05: // else
+			case 0x0c: // br
+			case 0x0e: // br_table
+			case 0x0f: // return
+				break;
+			default:
+				if (pos != nof - 1) {g += gas.array[pos + get_oplen(code + pos)];}
+				break;
+		}
+		gas.array[pos] = g;
+	}
 
-					if (f->block_type_code != dwac_block_type_internal_func)
-					{
-						return DWAC_UNEXPECTED_RETURN;
-					}
-					dwac_function *func = &p->funcs_vector.functions_array[f->func_info.func_idx];
-					d->pc.pos = func->internal_function.end_addr;
-				}
-				else
+	// The gas of a branch is in the last word of its target.
+	for (size_t i = 0; i < positions.size; i++)
+	{
+		pos = positions.array[i];
+		const uint32_t next = pos + get_oplen(code + pos);
+		switch (code[pos])
+		{
+			case 0x04: // if, when false
+				code[pos + 4] = gas.array[(code[pos + 2] != 0) ? code[pos + 2] + 3 : code[pos + 3] + 1] - gas.array[next];
+				break;
+			case 0x05: // else
+				code[pos + 2] = gas.array[code[pos + 1]];
+				break;
+			case 0x0c: // br
+				code[pos + 5] = (code[pos + 2] >= nof - 1) ? 0 : gas.array[code[pos + 2]];
+				break;
+			case 0x0d: // br_if
+			case 0x102: // i32.eqz, br_if
+				code[pos + 5] = (code[pos + 2] >= nof - 1) ? 0 : gas.array[code[pos + 2]] - gas.array[next];
+				break;
+			case 0x0e: // br_table
+				for (uint32_t j = 0; j <= code[pos + 1]; j++)
 				{
-					return DWAC_BLOCKSTACK_UNDERFLOW;
+					const uint32_t target = code[pos + 3 + 5 * j];
+					code[pos + 6 + 5 * j] = (target >= nof - 1) ? 0 : gas.array[target];
 				}
+				break;
+			default:
+				break;
+		}
+	}
 
-				dbg("return\n");
+	const uint32_t entry_gas = (nof != 0) ? gas.array[0] : 0;
+	dwac_linear_storage_32_deinit(&positions);
+	dwac_linear_storage_32_deinit(&gas);
+	return entry_gas;
+}
 
-				if (d->stack[DWAC_STACK_CAPACITY - 1].s64 != WA_MAGIC_STACK_VALUE) {return DWAC_STACK_OVERFLOW;}
-				if (d->pc.pos >= d->pc.nof) {return DWAC_PC_ADDR_OUT_OF_RANGE;}
-				if (--d->gas_meter <= 0) {return DWAC_NEED_MORE_GAS;}
-				break;
-			}
-			case 0x10: // call
-			{
-				// 0x10 x:funcidx
-				const uint32_t function_idx = leb_read(&d->pc, 32);
+#ifdef DWAC_VALIDATE
+// Validation of function bodies, as in [1] Appendix 7.3 Validation Algorithm.
+// The types of values on the operand stack are followed through the code. If
+// all functions are valid it is known, without checking when running, that:
+//   * There are always the operands an instruction needs and of right type.
+//   * Branches, ends and returns have the values they take with them.
+//   * Blocks have known types and labels of branches are in range.
+//   * The operand stack of a function is never higher than max_stack_height.
+// Not everything the specification requires is checked, only what dwac_tick
+// relies on. Instructions that dwac_tick does not support make the function
+// not valid (so the checks are kept).
 
-				dbg("call %u %s\n", function_idx, dwac_get_func_name(p, function_idx));
+// Used in code not reachable where any type is allowed.
+#define VALIDATE_ANY_TYPE 0
 
-				if (function_idx < p->funcs_vector.nof_imported)
-				{
-					const long r = call_imported_function(d, function_idx);
-					if (r)
-					{
-						return r;
-					}
-				}
-				else
-				{
-					long r = dwac_setup_function_call(d, function_idx);
-					if (r)
-					{
-						return r;
-					}
-				}
+typedef struct validate_frame_type
+{
+	uint8_t opcode; // block, loop, if or zero for the function itself.
+	uint8_t unreachable;
+	uint32_t height; // Height of operand stack at begin of block.
+	const dwac_func_type_type *type;
+} validate_frame_type;
 
-				if (d->stack[DWAC_STACK_CAPACITY - 1].s64 != WA_MAGIC_STACK_VALUE) {return DWAC_STACK_OVERFLOW;}
-				if (d->pc.pos >= d->pc.nof) {return DWAC_PC_ADDR_OUT_OF_RANGE;}
-				if (--d->gas_meter <= 0) {return DWAC_NEED_MORE_GAS;}
-				break;
+typedef struct validate_type
+{
+	dwac_linear_storage_8_type stack; // Type of each value on operand stack.
+	dwac_linear_storage_size_type frames; // Blocks not yet ended, see validate_frame_type.
+	uint32_t max_height;
+} validate_type;
+
+static void validate_push(validate_type *v, uint8_t t)
+{
+	dwac_linear_storage_8_push_uint8_t(&v->stack, t);
+	if (v->stack.size > v->max_height) {v->max_height = v->stack.size;}
+}
+
+// Pop a value of type t, returns zero if there was none.
+static int validate_pop(validate_type *v, uint8_t t)
+{
+	const validate_frame_type *frame = dwac_linear_storage_size_top(&v->frames);
+	if (v->stack.size == frame->height) {return frame->unreachable;}
+	const uint8_t top = v->stack.array[--v->stack.size];
+	return (top == t) || (top == VALIDATE_ANY_TYPE) || (t == VALIDATE_ANY_TYPE);
+}
+
+// Pop values of given types (last one first).
+static int validate_pop_types(validate_type *v, const uint8_t *types, uint32_t n)
+{
+	for (uint32_t i = n; i > 0; i--)
+	{
+		if (!validate_pop(v, types[i - 1])) {return 0;}
+	}
+	return 1;
+}
+
+static void validate_push_types(validate_type *v, const uint8_t *types, uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++)
+	{
+		validate_push(v, types[i]);
+	}
+}
+
+// Code after br, return etc is not reachable. Values it uses may be of any type.
+static void validate_unreachable(validate_type *v)
+{
+	validate_frame_type *frame = dwac_linear_storage_size_top(&v->frames);
+	v->stack.size = frame->height;
+	frame->unreachable = 1;
+}
+
+// Get the frame a branch goes to, NULL if label is out of range.
+// The types a branch takes with it are returned in n and types.
+static const validate_frame_type* validate_label(validate_type *v, uint32_t labelidx, uint32_t *n, const uint8_t **types)
+{
+	if (labelidx >= (uint32_t) v->frames.size) {return NULL;}
+	const validate_frame_type *frame = dwac_linear_storage_size_get(&v->frames, v->frames.size - 1 - labelidx);
+	// Branching to a loop is to its begin, it has no parameters (see validate_block_type).
+	*n = (frame->opcode == 0x03) ? 0 : frame->type->nof_results;
+	*types = frame->type->results_list;
+	return frame;
+}
+
+// Block types with parameters are not supported by dwac_tick.
+static const dwac_func_type_type* validate_block_type(const dwac_prog *p, int64_t blocktype)
+{
+	if (blocktype < 0)
+	{
+		// Same adjustment as in translate_code.
+		blocktype = -(blocktype + 0x80);
+		switch (-blocktype)
+		{
+			case DWAC_EMPTY_TYPE: case DWAC_I32: case DWAC_I64: case DWAC_F32: case DWAC_F64: break;
+			default: return NULL;
+		}
+	}
+	else if (blocktype >= p->function_types_vector.size)
+	{
+		return NULL;
+	}
+	const dwac_func_type_type *t = dwac_get_func_type_ptr(p, blocktype);
+	return (t->nof_parameters == 0) ? t : NULL;
+}
+
+// Types of operands and result of numeric instructions (0x45 ... 0xc4), zero
+// if none. Conversions are in the order of [1] 5.4.7. Numeric Instructions.
+static void numeric_types(uint8_t opcode, uint8_t *a, uint8_t *b, uint8_t *r)
+{
+	static const uint8_t conversions[][2] =
+	{
+		{DWAC_I64, DWAC_I32}, {DWAC_F32, DWAC_I32}, {DWAC_F32, DWAC_I32}, {DWAC_F64, DWAC_I32}, {DWAC_F64, DWAC_I32}, // 0xa7
+		{DWAC_I32, DWAC_I64}, {DWAC_I32, DWAC_I64}, {DWAC_F32, DWAC_I64}, {DWAC_F32, DWAC_I64}, {DWAC_F64, DWAC_I64}, {DWAC_F64, DWAC_I64}, // 0xac
+		{DWAC_I32, DWAC_F32}, {DWAC_I32, DWAC_F32}, {DWAC_I64, DWAC_F32}, {DWAC_I64, DWAC_F32}, {DWAC_F64, DWAC_F32}, // 0xb2
+		{DWAC_I32, DWAC_F64}, {DWAC_I32, DWAC_F64}, {DWAC_I64, DWAC_F64}, {DWAC_I64, DWAC_F64}, {DWAC_F32, DWAC_F64}, // 0xb7
+		{DWAC_F32, DWAC_I32}, {DWAC_F64, DWAC_I64}, {DWAC_I32, DWAC_F32}, {DWAC_I64, DWAC_F64}, // 0xbc reinterpret
+		{DWAC_I32, DWAC_I32}, {DWAC_I32, DWAC_I32}, {DWAC_I64, DWAC_I64}, {DWAC_I64, DWAC_I64}, {DWAC_I64, DWAC_I64}, // 0xc0 extend
+	};
+	*b = 0;
+	switch (opcode)
+	{
+		case 0x45: *a = DWAC_I32; *r = DWAC_I32; break;
+		case 0x46 ... 0x4f: *a = *b = DWAC_I32; *r = DWAC_I32; break;
+		case 0x50: *a = DWAC_I64; *r = DWAC_I32; break;
+		case 0x51 ... 0x5a: *a = *b = DWAC_I64; *r = DWAC_I32; break;
+		case 0x5b ... 0x60: *a = *b = DWAC_F32; *r = DWAC_I32; break;
+		case 0x61 ... 0x66: *a = *b = DWAC_F64; *r = DWAC_I32; break;
+		case 0x67 ... 0x69: *a = *r = DWAC_I32; break;
+		case 0x6a ... 0x78: *a = *b = *r = DWAC_I32; break;
+		case 0x79 ... 0x7b: *a = *r = DWAC_I64; break;
+		case 0x7c ... 0x8a: *a = *b = *r = DWAC_I64; break;
+		case 0x8b ... 0x91: *a = *r = DWAC_F32; break;
+		case 0x92 ... 0x98: *a = *b = *r = DWAC_F32; break;
+		case 0x99 ... 0x9f: *a = *r = DWAC_F64; break;
+		case 0xa0 ... 0xa6: *a = *b = *r = DWAC_F64; break;
+		case 0xa7 ... 0xc4: *a = conversions[opcode - 0xa7][0]; *r = conversions[opcode - 0xa7][1]; break;
+		default: *a = *r = 0; break;
+	}
+}
+
+// Validate one instruction. Returns DWAC_OK or DWAC_NOT_VALID.
+static dwac_result validate_instruction(const dwac_prog *p, validate_type *v, dwac_leb128_reader_type *r, const uint8_t *local_types, uint32_t nof_locals, const dwac_func_type_type *func_type)
+{
+	const uint8_t opcode = leb_read_uint8(r);
+	switch (opcode)
+	{
+		case 0x00: // unreachable
+			validate_unreachable(v);
+			return DWAC_OK;
+		case 0x01: // nop
+			return DWAC_OK;
+		case 0x02: // block
+		case 0x03: // loop
+		case 0x04: // if
+		{
+			const dwac_func_type_type *t = validate_block_type(p, leb_read_signed(r, 33));
+			if (t == NULL) {return DWAC_NOT_VALID;}
+			if ((opcode == 0x04) && (!validate_pop(v, DWAC_I32))) {return DWAC_NOT_VALID;}
+			validate_frame_type *frame = dwac_linear_storage_size_push(&v->frames);
+			frame->opcode = opcode;
+			frame->unreachable = 0;
+			frame->height = v->stack.size;
+			frame->type = t;
+			return DWAC_OK;
+		}
+		case 0x05: // else
+		case 0x0b: // end
+		{
+			validate_frame_type *frame = dwac_linear_storage_size_top(&v->frames);
+			if ((opcode == 0x05) && (frame->opcode != 0x04)) {return DWAC_NOT_VALID;}
+			if (!validate_pop_types(v, frame->type->results_list, frame->type->nof_results)) {return DWAC_NOT_VALID;}
+			if (v->stack.size != frame->height) {return DWAC_NOT_VALID;}
+			if (opcode == 0x05)
+			{
+				// The else part begins as the if did. Marked so that end knows there was an else.
+				frame->opcode = 0x05;
+				frame->unreachable = 0;
+				return DWAC_OK;
+			}
+			// An if without else gives no values (it has no parameters to give).
+			if ((frame->opcode == 0x04) && (frame->type->nof_results != 0)) {return DWAC_NOT_VALID;}
+			const dwac_func_type_type *t = frame->type;
+			dwac_linear_storage_size_pop(&v->frames);
+			if (v->frames.size != 0) {validate_push_types(v, t->results_list, t->nof_results);}
+			return DWAC_OK;
+		}
+		case 0x0c: // br
+		case 0x0d: // br_if
+		{
+			uint32_t n;
+			const uint8_t *types;
+			if (validate_label(v, leb_read(r, 32), &n, &types) == NULL) {return DWAC_NOT_VALID;}
+			if ((opcode == 0x0d) && (!validate_pop(v, DWAC_I32))) {return DWAC_NOT_VALID;}
+			if (!validate_pop_types(v, types, n)) {return DWAC_NOT_VALID;}
+			if (opcode == 0x0d) {validate_push_types(v, types, n);} else {validate_unreachable(v);}
+			return DWAC_OK;
+		}
+		case 0x0e: // br_table
+		{
+			const uint32_t table_size = leb_read(r, 32);
+			if (table_size > r->nof) {return DWAC_NOT_VALID;}
+			if (!validate_pop(v, DWAC_I32)) {return DWAC_NOT_VALID;}
+			// All labels must take the same number of values as the default, check each.
+			const size_t height = v->stack.size;
+			const long nof_frames = v->frames.size;
+			uint32_t default_n = 0;
+			for (uint32_t i = 0; i <= table_size; i++)
+			{
+				uint32_t n;
+				const uint8_t *types;
+				if (validate_label(v, leb_read(r, 32), &n, &types) == NULL) {return DWAC_NOT_VALID;}
+				if ((i != 0) && (n != default_n)) {return DWAC_NOT_VALID;}
+				default_n = n;
+				v->stack.size = height;
+				if (!validate_pop_types(v, types, n)) {return DWAC_NOT_VALID;}
+				assert(v->frames.size == nof_frames);
+			}
+			validate_unreachable(v);
+			return DWAC_OK;
+		}
+		case 0x0f: // return
+			if (!validate_pop_types(v, func_type->results_list, func_type->nof_results)) {return DWAC_NOT_VALID;}
+			validate_unreachable(v);
+			return DWAC_OK;
+		case 0x10: // call
+		case 0x11: // call_indirect
+		{
+			const dwac_func_type_type *t;
+			if (opcode == 0x10)
+			{
+				const uint32_t function_idx = leb_read(r, 32);
+				if (function_idx >= p->funcs_vector.total_nof) {return DWAC_NOT_VALID;}
+				t = dwac_get_func_type_ptr(p, p->funcs_vector.functions_array[function_idx].func_type_idx);
 			}
-			case 0x11: // call_indirect
+			else
 			{
-				// [2] 4.4.8.11. call_indirect x y
-				// [2] call_indirect calls a function in a table.
-				// Indirect call, the function to call is taken via table.
-				// call_indirect tableidx typeidx
-				//
-				// [1] 5.4.1 Control Instructions
-				// 0x11 y:typeidx x:tableidx
+				const uint32_t typeidx = leb_read(r, 32);
+				const uint32_t tableidx = leb_read(r, 32);
+				if ((typeidx >= p->function_types_vector.size) || (tableidx != 0)) {return DWAC_NOT_VALID;}
+				t = dwac_get_func_type_ptr(p, typeidx);
+				if (!validate_pop(v, DWAC_I32)) {return DWAC_NOT_VALID;}
+			}
+			if (!validate_pop_types(v, t->parameters_list, t->nof_parameters)) {return DWAC_NOT_VALID;}
+			validate_push_types(v, t->results_list, t->nof_results);
+			return DWAC_OK;
+		}
+		case 0x1a: // drop
+			return validate_pop(v, VALIDATE_ANY_TYPE) ? DWAC_OK : DWAC_NOT_VALID;
+		case 0x1b: // select
+		{
+			if (!validate_pop(v, DWAC_I32)) {return DWAC_NOT_VALID;}
+			const validate_frame_type *frame = dwac_linear_storage_size_top(&v->frames);
+			const uint8_t t = (v->stack.size > frame->height) ? v->stack.array[v->stack.size - 1] : VALIDATE_ANY_TYPE;
+			if ((!validate_pop(v, t)) || (!validate_pop(v, t))) {return DWAC_NOT_VALID;}
+			validate_push(v, t);
+			return DWAC_OK;
+		}
+		case 0x20: // local.get
+		case 0x21: // local.set
+		case 0x22: // local.tee
+		{
+			const uint32_t localidx = leb_read(r, 32);
+			if (localidx >= nof_locals) {return DWAC_NOT_VALID;}
+			if ((opcode != 0x20) && (!validate_pop(v, local_types[localidx]))) {return DWAC_NOT_VALID;}
+			if (opcode != 0x21) {validate_push(v, local_types[localidx]);}
+			return DWAC_OK;
+		}
+		case 0x23: // global.get
+		case 0x24: // global.set
+		{
+			const uint32_t globalidx = leb_read(r, 32);
+			if (globalidx >= p->global_types.size) {return DWAC_NOT_VALID;}
+			const uint8_t t = p->global_types.array[globalidx];
+			if (opcode == 0x23) {validate_push(v, t); return DWAC_OK;}
+			return validate_pop(v, t) ? DWAC_OK : DWAC_NOT_VALID;
+		}
+		case 0x28 ... 0x3e: // i32.load ... i64.store32
+		{
+			static const uint8_t types[] =
+			{
+				DWAC_I32, DWAC_I64, DWAC_F32, DWAC_F64, DWAC_I32, DWAC_I32, DWAC_I32, DWAC_I32, // 0x28 loads
+				DWAC_I64, DWAC_I64, DWAC_I64, DWAC_I64, DWAC_I64, DWAC_I64,
+				DWAC_I32, DWAC_I64, DWAC_F32, DWAC_F64, DWAC_I32, DWAC_I32, DWAC_I64, DWAC_I64, DWAC_I64 // 0x36 stores
+			};
+			leb_read(r, 32); // align
+			leb_read(r, 32); // offset
+			const uint8_t t = types[opcode - 0x28];
+			if (opcode >= 0x36)
+			{
+				return (validate_pop(v, t) && validate_pop(v, DWAC_I32)) ? DWAC_OK : DWAC_NOT_VALID;
+			}
+			if (!validate_pop(v, DWAC_I32)) {return DWAC_NOT_VALID;}
+			validate_push(v, t);
+			return DWAC_OK;
+		}
+		case 0x3f: // memory.size
+		case 0x40: // memory.grow
+			if (leb_read(r, 32) != 0) {return DWAC_NOT_VALID;}
+			if ((opcode == 0x40) && (!validate_pop(v, DWAC_I32))) {return DWAC_NOT_VALID;}
+			validate_push(v, DWAC_I32);
+			return DWAC_OK;
+		case 0x41: leb_read_signed(r, 32); validate_push(v, DWAC_I32); return DWAC_OK;
+		case 0x42: leb_read_signed(r, 64); validate_push(v, DWAC_I64); return DWAC_OK;
+		case 0x43: leb_read_uint32(r); validate_push(v, DWAC_F32); return DWAC_OK;
+		case 0x44: leb_read_uint64(r); validate_push(v, DWAC_F64); return DWAC_OK;
+		case 0x45 ... 0xc4:
+		{
+			uint8_t a, b, t;
+			numeric_types(opcode, &a, &b, &t);
+			if ((b != 0) && (!validate_pop(v, b))) {return DWAC_NOT_VALID;}
+			if (!validate_pop(v, a)) {return DWAC_NOT_VALID;}
+			validate_push(v, t);
+			return DWAC_OK;
+		}
+		case 0xfc:
+		{
+			const uint32_t actual_opcode = leb_read(r, 32);
+			if (actual_opcode <= 7)
+			{
+				// trunc_sat, from f32 or f64 to i32 or i64.
+				if (!validate_pop(v, (actual_opcode & 2) ? DWAC_F64 : DWAC_F32)) {return DWAC_NOT_VALID;}
+				validate_push(v, (actual_opcode & 4) ? DWAC_I64 : DWAC_I32);
+				return DWAC_OK;
+			}
+			switch (actual_opcode)
+			{
+				case 8: // memory.init
+					if (leb_read(r, 32) >= p->nof_data_segments) {return DWAC_NOT_VALID;}
+					if (leb_read(r, 32) != 0) {return DWAC_NOT_VALID;}
+					break;
+				case 9: // data.drop
+					return (leb_read(r, 32) < p->nof_data_segments) ? DWAC_OK : DWAC_NOT_VALID;
+				case 10: // memory.copy
+					if ((leb_read(r, 32) != 0) || (leb_read(r, 32) != 0)) {return DWAC_NOT_VALID;}
+					break;
+				case 11: // memory.fill
+					if (leb_read(r, 32) != 0) {return DWAC_NOT_VALID;}
+					break;
+				default:
+					return DWAC_NOT_VALID;
+			}
+			// The operands are destination, source (or value) and size.
+			return (validate_pop(v, DWAC_I32) && validate_pop(v, DWAC_I32) && validate_pop(v, DWAC_I32)) ? DWAC_OK : DWAC_NOT_VALID;
+		}
+		default:
+			// Such as 0x1c, 0x25, 0x26 and 0xfd that dwac_tick does not support (yet).
+			return DWAC_NOT_VALID;
+	}
+}
 
-				const uint32_t typeidx = leb_read(&d->pc, 32);
+// Validate an internal function, code_start is where its local variable
+// declarations are (in the code section). Sets max_stack_height if valid.
+static dwac_result validate_function(const dwac_prog *p, dwac_function *f, uint32_t code_start)
+{
+	const dwac_func_type_type *func_type = dwac_get_func_type_ptr(p, f->func_type_idx);
+	if (func_type == NULL) {return DWAC_NOT_VALID;}
 
-				const uint32_t tableidx = leb_read(&d->pc, 32);
-				if (tableidx != 0) {return DWAC_ONLY_ONE_TABLE_IS_SUPPORTED;}
+	dwac_leb128_reader_type r;
+	leb128_reader_init(&r, p->bytecodes.array, f->internal_function.end_addr + 1);
+	r.pos = code_start;
 
-				// Get index into table from stack.
-				uint32_t idx_into_table = POP_I32(d);
+	// Types of parameters and then the local variables.
+	const uint32_t nof_locals = func_type->nof_parameters + f->internal_function.nof_local;
+	uint8_t *local_types = DWAC_ST_MALLOC(nof_locals + 1);
+	uint32_t n = 0;
+	memcpy(local_types, func_type->parameters_list, func_type->nof_parameters);
+	n += func_type->nof_parameters;
+	const uint32_t nof_local_variables = leb_read(&r, 32);
+	for (uint32_t j = 0; j < nof_local_variables; j++)
+	{
+		const uint32_t count = leb_read(&r, 32);
+		const uint8_t valtype = leb_read(&r, 7);
+		if (count > nof_locals - n) {break;}
+		memset(local_types + n, valtype, count);
+		n += count;
+	}
 
-				// Ref [3] had some code "if (m->options.mangle_table_index)..." here.
-				// No idea what that was about.
+	validate_type v;
+	dwac_linear_storage_8_init(&v.stack);
+	dwac_linear_storage_size_init(&v.frames, sizeof(validate_frame_type));
+	v.max_height = 0;
+	validate_frame_type *frame = dwac_linear_storage_size_push(&v.frames);
+	frame->opcode = 0;
+	frame->unreachable = 0;
+	frame->height = 0;
+	frame->type = func_type;
+
+	dwac_result result = (r.pos == f->internal_function.start_addr) ? DWAC_OK : DWAC_NOT_VALID;
+	while ((result == DWAC_OK) && (v.frames.size != 0))
+	{
+		if (r.pos >= r.nof) {result = DWAC_NOT_VALID; break;}
+		result = validate_instruction(p, &v, &r, local_types, n, func_type);
+	}
+	// The function shall end with its last end.
+	if ((result == DWAC_OK) && (r.pos != r.nof)) {result = DWAC_NOT_VALID;}
 
-				//  Check that its in range.
-				if (idx_into_table >= p->func_table.size)
-				{
-					// br_if had also a default. Not so here then.
-					sprintf(d->exception, "%d", idx_into_table);
-					return DWAC_OUT_OF_RANGE_IN_TABLE;
-				}
+	if (result == DWAC_OK) {f->internal_function.max_stack_height = v.max_height;}
+	dwac_linear_storage_8_deinit(&v.stack);
+	dwac_linear_storage_size_deinit(&v.frames);
+	DWAC_ST_FREE(local_types);
+	return result;
+}
+#endif
 
-				// Get function index via table.
-				const int64_t function_idx = p->func_table.array[idx_into_table];
+#ifdef DWAC_REGISTER_CODE
+// Register code, an alternative to the stack machine in dwac_tick.
+//
+// The operands of a register code instruction are slots in the frame of the
+// function (index relative to d->fp), first the local variables and then one
+// slot per level of the operand stack. Since the height of the operand stack
+// is known at every instruction, this is decided once here. Most local.get
+// and const instructions do not become instructions at all, they become
+// operands of the instruction that use the value. Branches are jumps (after
+// moving results if any).
+//
+// Only functions that do not call other functions and only use integer
+// instructions are translated (typically the inner loops of crc, sha1 etc).
+// Other functions are run by dwac_tick as before.
+//
+// Register code use the same opcode as the corresponding wasm instruction
+// where there is one, but operands are different:
+//   0x00                           unreachable
+//   0x0c target gas                br (jump)
+//   0x0d cond target gas           br_if (branch if not zero)
+//   0x0e idx n t0 g0 ... tdef gdef br_table
+//   0x0f n src0 ... srcn-1         return
+//   0x1b dst a b cond              select
+//   0x20 dst src                   move
+//   0x23 dst globalidx             global.get
+//   0x24 src globalidx             global.set
+//   0x28 ... 0x35 dst addr offset  loads
+//   0x36 ... 0x3e addr src offset  stores
+//   0x42 dst lo hi                 i32.const or i64.const
+//   0x45 ... 0xc4 dst a [b]        numeric instructions
+//   0x100 | op, dst a imm          i32 binary instructions with an immediate b
+//   0x200 cond target gas          branch if zero
+//
+// The gas of a branch is charged when it is taken, it is the gas the
+// branch has in translated code (see count_gas_in_code) so that register
+// code uses the same amount of gas as dwac_tick would.
 
-				dbg("call_indirect %lld '%s'\n", (long long int)function_idx, dwac_get_func_name(p, function_idx));
+enum reg_value_kind_enum
+{
+	reg_value_in_slot = 0, // The value is in the slot for its level of the operand stack.
+	reg_value_in_local = 1, // The value is (still) in a local variable.
+	reg_value_const = 2, // The value is a constant, not put in any slot yet.
+};
 
-				//  Check that its in range.
-				if (function_idx >= p->funcs_vector.total_nof)
-				{
-					sprintf(d->exception, "%lu %u", (long) function_idx, p->funcs_vector.total_nof);
-					return DWAC_FUNCTION_INDEX_OUT_OF_RANGE;
-				}
+// A value on the operand stack while translating.
+typedef struct reg_value_type
+{
+	uint8_t kind; // See reg_value_kind_enum.
+	uint32_t localidx;
+	uint64_t c;
+} reg_value_type;
 
-				dwac_function *func = &p->funcs_vector.functions_array[function_idx];
+// A block, loop, if or the function body while translating.
+typedef struct reg_label_type
+{
+	uint8_t kind; // See dwac_block_type_enum.
+	uint8_t unreachable; // The rest of the block can not be reached (after br, return etc).
+	uint8_t dead; // The entire block can not be reached.
+	uint32_t height; // Height of operand stack at begin of block.
+	uint32_t nof_results;
+	uint32_t loop_addr; // Where a loop begins.
+	uint32_t else_link; // Position of target operand to set at else (or end) of an if.
+	uint32_t end_links; // List of target operands to set at end of block, see reg_set_target.
+} reg_label_type;
 
-				// The type of the function must match the typeidx​.
-				int64_t func_typeidx = func->func_type_idx;
-				if (typeidx != func_typeidx)
-				{
-					sprintf(d->exception, "%lld != %lld", (long long)func_typeidx, (long long)typeidx);
-					return DWAC_WRONG_FUNCTION_TYPE;
-				}
+typedef struct reg_translator_type
+{
+	const dwac_prog *p;
+	dwac_linear_storage_32_type *code;
+	uint32_t nof_locals; // Including parameters.
+	uint32_t max_height;
+	uint32_t last_dst; // Position of the dst operand of the last instruction, zero if none.
+	dwac_linear_storage_size_type values; // Elements of type reg_value_type.
+	dwac_linear_storage_size_type labels; // Elements of type reg_label_type.
+} reg_translator_type;
 
-				// Do we at have enough parameters on stack?
-				const dwac_func_type_type *ft_ptr = dwac_get_func_type_ptr(p, func_typeidx);
-				const int64_t available = STACK_SIZE(d) - d->fp;
-				if (ft_ptr->nof_parameters > available)
-				{
-					sprintf(d->exception, "%d > %lld.", ft_ptr->nof_parameters, (long long)available);
-					return DWAC_INDIRECT_CALL_INSUFFICIENT_NOF_PARAM;
-				}
+static uint32_t reg_height(const reg_translator_type *t)
+{
+	return t->values.size;
+}
 
-				// Is it an imported or internal function to call?
-				if (function_idx < p->funcs_vector.nof_imported)
-				{
-					const long r = call_imported_function(d, function_idx);
-					if (r) {return r;}
-				}
-				else
-				{
-					const int r = dwac_setup_function_call(d, function_idx);
-					if (r) {return DWAC_INDIRECT_CALL_FAILED;}
-				}
+static uint32_t reg_slot(const reg_translator_type *t, uint32_t height)
+{
+	return t->nof_locals + height;
+}
 
-				dbg("call_indirect %u %u %u %u %s\n", typeidx, tableidx, idx_into_table, (unsigned int)function_idx, dwac_get_func_name(p, function_idx));
+static reg_value_type* reg_value(reg_translator_type *t, uint32_t height)
+{
+	return (reg_value_type*) dwac_linear_storage_size_get(&t->values, height);
+}
 
-				if (d->stack[DWAC_STACK_CAPACITY - 1].s64 != WA_MAGIC_STACK_VALUE) {return DWAC_STACK_OVERFLOW;}
-				if (d->pc.pos >= d->pc.nof) {return DWAC_PC_ADDR_OUT_OF_RANGE;}
-				if (--d->gas_meter <= 0) {return DWAC_NEED_MORE_GAS;}
-				break;
-			}
+static reg_label_type* reg_label(reg_translator_type *t, uint32_t labelidx)
+{
+	return (reg_label_type*) dwac_linear_storage_size_get(&t->labels, t->labels.size - 1 - labelidx);
+}
 
-			case 0x1a: // drop
-				d->sp--;
-				dbg("drop\n");
-				break;
-			case 0x1b: // select
-			{
-				// Select one of the two topmost values, put it back to stack.
-				// Small CPU optimize here (from ref [3]).
-				const uint32_t cond = POP_I32(d);
-				d->sp--;
-				if (!cond)
-				{
-					TOP(d) = d->stack[SP_MASK(d->sp + 1)];
-				}
-				dbg("select %u\n", cond);
-				break;
-			}
-			case 0x1c:
-				// 5.4.3. Parametric Instructions
-				return DWAC_PARAMETRIC_INSTRUCTIONS_NOT_SUPPORTED_YET;
-				break;
+static reg_value_type* reg_push(reg_translator_type *t, uint8_t kind, uint32_t localidx, uint64_t c)
+{
+	reg_value_type *v = (reg_value_type*) dwac_linear_storage_size_push(&t->values);
+	v->kind = kind;
+	v->localidx = localidx;
+	v->c = c;
+	if (t->values.size > t->max_height) {t->max_height = t->values.size;}
+	return v;
+}
 
-			case 0x20: // local.get
-			{
-				// Get a local variable value, push it to stack.
-				const uint32_t localidx = leb_read(&d->pc, 32);
-				PUSH(d) = d->stack[SP_MASK(d->fp + localidx)];
-				dbg("local.get %u 0x%llx\n", localidx, (unsigned long long)TOP_U64(d));
-				break;
-			}
-			case 0x21: // local.set
-			{
-				// Pop value from stack, set a local variable.
-				const uint32_t localidx = leb_read(&d->pc, 32);
-				const dwac_value_type a = POP(d);
-				d->stack[SP_MASK(d->fp + localidx)] = a;
-				dbg("local.set 0x%x 0x%llx\n", localidx, (unsigned long long)a.u64);
-				break;
-			}
-			case 0x22: // local.tee
-			{
-				// Same as local.set but value also stay on stack instead of popped.
-				const uint32_t localidx = leb_read(&d->pc, 32);
-				d->stack[SP_MASK(d->fp + localidx)] = TOP(d);
-				dbg("local.tee 0x%x 0x%llx  0x%x 0x%x\n", localidx, (unsigned long long)TOP_U64(d), d->fp, d->sp);
-				break;
-			}
-			case 0x23: // global.get
-			{
-				// Get a global variable, push it to stack.
-				const uint32_t globalidx = leb_read(&d->pc, 32);
-				if (globalidx >= d->globals.size) {return DWAC_GLOBAL_IDX_OUT_OF_RANGE;}
-				PUSH_U64(d, d->globals.array[globalidx]);
-				dbg("global.get 0x%x 0x%llx\n", globalidx, (long long unsigned)TOP_U64(d));
-				break;
-			}
-			case 0x24: // global.set
-			{
-				const uint32_t globalidx = leb_read(&d->pc, 32);
-				if (globalidx >= d->globals.size) {return DWAC_GLOBAL_IDX_OUT_OF_RANGE;}
-				d->globals.array[globalidx] = POP_U64(d);
-				dbg("global.set 0x%x 0x%llx\n", globalidx, (long long unsigned)d->globals.array[globalidx]);
-				break;
-			}
+static reg_label_type* reg_push_label(reg_translator_type *t, uint8_t kind, uint32_t nof_results)
+{
+	reg_label_type *l = (reg_label_type*) dwac_linear_storage_size_push(&t->labels);
+	memset(l, 0, sizeof(reg_label_type));
+	l->kind = kind;
+	l->height = reg_height(t);
+	l->nof_results = nof_results;
+	return l;
+}
 
-			case 0x25: // table.get
-			case 0x26: // table.set
-				// Remember that if func_table can be changed (table.set is implemented) then
-				// func_table shall be part of dwac_data and not part of dwac_prog structs.
-				// So will not implement this for now.
-				// See also 0xFC codes 12 .. 17.
-				//const uint32_t tableidx = leb_read(&d->pc, 32);
-				//sprintf(d->exception, "0x%x 0x%x", opcode, tableidx);
-				return DWAC_TABLE_INSTRUCTIONS_NOT_SUPPORTED;
-
-			case 0x28: // i32.load
-			{
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				const uint32_t addr = POP_U32(d);
-				PUSH_I32(d, translate_get_int32(d, offset + addr));
-				dbg("i32.load 0x%x 0x%x 0x%x\n", offset, addr, TOP_U32(d));
-				break;
-			}
-			case 0x29: // i64.load
-			{
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				const uint32_t addr = POP_U32(d);
-				PUSH_I64(d, translate_get_int64(d, offset + addr));
-				dbg("i64.load 0x%x 0x%x 0x%llx\n", offset, addr, (unsigned long long)TOP_U64(d));
-				break;
-			}
-			#ifndef SKIP_FLOAT
-			case 0x2a: // f32.load
-			{
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				const uint32_t addr = POP_U32(d);
-				const uint32_t v = translate_get_int32(d, offset + addr);
-				PUSH_F32I(d, v);
-				dbg("f32.load");
-				break;
-		    }
-		    case 0x2b: // f64.load
-		    {
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				const uint32_t addr = POP_U32(d);
-				const uint64_t v = translate_get_int64(d, offset + addr);
-				PUSH_F64I(d, v);
-				dbg("f64.load");
-				break;
-		    }
-			#endif
-		    case 0x2c: // i32.load8_s
-		    {
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				const uint32_t addr = POP_U32(d);
-				const int8_t value = translate_get_int8(d, offset + addr);
-				PUSH_I32(d, value);
-				dbg("i32.load8_s 0x%x\n", TOP_U32(d));
-				break;
-		    }
-		    case 0x2d: // i32.load8_u
-		    {
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				const uint32_t addr = POP_U32(d);
-				const uint8_t value = translate_get_int8(d, offset + addr);
-				PUSH_U32(d, value);
-				dbg("i32.load8_u 0x%x\n", TOP_U32(d));
-				break;
-		    }
-		    case 0x2e: // i32.load16_s
-		    {
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				const uint32_t addr = POP_U32(d);
-				const int16_t value = translate_get_int16(d, offset + addr);
-				PUSH_I32(d, value);
-				dbg("i32.load16_s 0x%x\n", TOP_U32(d));
-				break;
-		    }
-		    case 0x2f: // i32.load16_u
-		    {
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				const uint32_t addr = POP_U32(d);
-				const uint16_t value = translate_get_int16(d, offset + addr);
-				PUSH_U32(d, value);
-				dbg("i32.load16_u 0x%x\n", TOP_U32(d));
-				break;
-		    }
-		    case 0x30: // i64.load8_s
-		    {
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				const uint32_t addr = POP_U32(d);
-				const int8_t value = translate_get_int8(d, offset + addr);
-				PUSH_I64(d, value);
-				dbg("i64.load8_s 0x%llx\n", (long unsigned long)TOP_U64(d));
-				break;
-		    }
-		    case 0x31: // i64.load8_u
-		    {
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				const uint32_t addr = POP_U32(d);
-				const uint8_t value = translate_get_int8(d, offset + addr);
-				PUSH_U64(d, value);
-				dbg("i64.load8_u 0x%llx\n", (long unsigned long)TOP_U64(d));
-				break;
-		    }
-		    case 0x32: // i64.load16_s
-		    {
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				const uint32_t addr = POP_U32(d);
-				const int16_t value = translate_get_int16(d, offset + addr);
-				PUSH_I64(d, value);
-				dbg("i64.load16_s 0x%llx\n", (long unsigned long)TOP_U64(d));
-				break;
-		    }
-		    case 0x33: // i64.load16_u
-		    {
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				const uint32_t addr = POP_U32(d);
-				const uint16_t value = translate_get_int16(d, offset + addr);
-				PUSH_U64(d, value);
-				dbg("i64.load16_u 0x%llx\n", (long unsigned long)TOP_U64(d));
-				break;
-		    }
-		    case 0x34: // i64.load32_s
-		    {
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				const uint32_t addr = POP_U32(d);
-				const int32_t value = translate_get_int32(d, offset + addr);
-				PUSH_I64(d, value);
-				dbg("i64.load32_s 0x%llx\n", (long unsigned long)TOP_U64(d));
-				break;
-		    }
-		    case 0x35: // i64.load32_u
-		    {
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				const uint32_t addr = POP_U32(d);
-				const uint32_t value = translate_get_int32(d, offset + addr);
-				PUSH_U64(d, value);
-				dbg("i64.load32_u 0x%llx\n", (long unsigned long)TOP_U64(d));
-				break;
-		    }
-
-		    case 0x36: // i32.store
-		    {
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				const int32_t value = POP_I32(d);
-				const uint32_t addr = POP_U32(d);
-				translate_set_int32(d, offset + addr, value);
-				dbg("i32.store 0x%llx\n", (long unsigned long)value);
-				break;
-		    }
-		    case 0x37: // i64.store
-		    {
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				const int64_t value = POP_I64(d);
-				const uint32_t addr = POP_U32(d);
-				translate_set_int64(d, offset + addr, value);
-				dbg("i64.store 0x%llx\n", (long unsigned long)value);
-				break;
-		    }
-		    case 0x38: // f32.store
-		    {
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				const uint32_t value = POP_U32(d);
-				const uint32_t addr = POP_U32(d);
-				translate_set_int32(d, offset + addr, value);
-				dbg("f32.store");
-				break;
-		    }
-		    case 0x39: // f64.store
-		    {
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				// Take value and address from stack.
-				const uint64_t value = POP_U64(d);
-				const uint32_t addr = POP_U32(d);
-				translate_set_int64(d, offset + addr, value);
-				dbg("f64.store");
-				break;
-		    }
-		    case 0x3a: // i32.store8
-		    {
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				const int32_t value = POP_I32(d);
-				const uint32_t addr = POP_U32(d);
-				translate_set_int8(d, offset + addr, value);
-				dbg("i32.store8 0x%x 0x%x 0x%x\n", offset, value, addr);
-				break;
-		    }
-		    case 0x3b: // i32.store16
-		    {
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				const int32_t value = POP_I32(d);
-				const uint32_t addr = POP_U32(d);
-				translate_set_int16(d, offset + addr, value);
-				dbg("i32.store16 0x%x 0x%x 0x%x\n", offset, value, addr);
-				break;
-		    }
-		    case 0x3c: // i64.store8
-		    {
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				const int8_t value = POP_I32(d);
-				const uint32_t addr = POP_U32(d);
-				translate_set_int8(d, offset + addr, value);
-				dbg("i64.store8 0x%x 0x%llx 0x%x\n", offset, (long long unsigned)value, addr);
-				break;
-		    }
-		    case 0x3d: // i32.store16
-		    {
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				const int16_t value = POP_I32(d);
-				const uint32_t addr = POP_U32(d);
-				translate_set_int16(d, offset + addr, value);
-				dbg("i32.store16 0x%x 0x%llx 0x%x\n", offset, (long long unsigned)value, addr);
-				break;
-		    }
-		    case 0x3e: // i64.store32
-		    {
-				/*const uint32_t flags =*/ leb_read(&d->pc, 32);
-				const uint32_t offset = leb_read(&d->pc, 32);
-				const int32_t value = POP_I64(d);
-				const int32_t addr = POP_I32(d);
-				translate_set_int32(d, offset + addr, value);
-				dbg("i64.store32 0x%x 0x%llx 0x%x\n", offset, (long long unsigned)value, addr);
-				break;
-		    }
+// Check that there are at least n values in current block.
+static dwac_result reg_need(reg_translator_type *t, uint32_t n)
+{
+	const reg_label_type *l = reg_label(t, 0);
+	return (reg_height(t) >= l->height + n) ? DWAC_OK : DWAC_NO_RESULT_ON_STACK;
+}
 
-			case 0x3f: // current_memory
-			{
-				uint32_t memidx = leb_read(&d->pc, 32);
-				if (memidx != 0) {return DWAC_ONLY_ONE_MEMORY_IS_SUPPORTED;}
-				PUSH_I32(d, d->memory.current_size_in_pages);
-				dbg("current_memory 0x%x\n", d->memory.current_size_in_pages);
-				break;
-			}
-			case 0x40: // grow_memory
-			{
-				// [2] Return value: The previous size of the memory, in units of WebAssembly pages.
-				// Not tested, seems emscripten use emscripten_resize_heap instead.
-				uint32_t memory_index = leb_read(&d->pc, 32);
-				if (memory_index != 0) {return DWAC_ONLY_ONE_MEMORY_IS_SUPPORTED;}
-				const uint32_t current_size_in_pages = d->memory.current_size_in_pages;
-				const uint32_t requested_increase = TOP_U32(d);
-				if ((requested_increase + current_size_in_pages) > d->memory.maximum_size_in_pages)
-				{
-					// TODO Deny growing of memory?
-				}
-				SET_U32(d, current_size_in_pages);
-				dbg("grow_memory %u %u\n", current_size_in_pages, requested_increase);
-				if (--d->gas_meter <= 0) {return DWAC_NEED_MORE_GAS;}
-				break;
-			}
+static void reg_emit(reg_translator_type *t, uint32_t word)
+{
+	dwac_linear_storage_32_push(t->code, word);
+}
 
-			case 0x41: // i32.const
-				// Push i32 immediate operand to stack.
-				PUSH_I32(d, leb_read_signed(&d->pc, 32));
-				dbg("i32.const 0x%x\n", TOP_U32(d));
-				break;
-			case 0x42: // i64.const
-				PUSH_I64(d, leb_read_signed(&d->pc, 64));
-				dbg("i64.const 0x%llx\n", (long long unsigned)TOP_U64(d));
-				break;
+static void reg_emit_op(reg_translator_type *t, uint32_t op)
+{
+	t->last_dst = 0;
+	reg_emit(t, op);
+}
 
-			#ifndef SKIP_FLOAT
-			case 0x43: // f32.const
-			{
-				// Push f32 immediate operand to stack.
-				// [1] 5.2.3. Floating-Point
-				// Floating-point values are encoded directly by their [IEEE-754-2019]
-				// (Section 3.4) bit pattern in little endian byte order:
-				// So not LEB128 encoded. An alternative would have been to have two LEB values,
-				// one for mantissa and one for exponent.
-				// TODO This might fail on a big endian host (not tested).
-				const uint32_t a = leb_read_uint32(&d->pc);
-				PUSH_F32I(d, a);
-				dbg("f32.const 0x%x %g\n", a, TOP_F32(d));
-				break;
-			}
-			case 0x44: // f64.const
-			{
-				// TODO This might fail on a big endian host (not tested).
-				const uint64_t a = leb_read_uint64(&d->pc);
-				PUSH_F64I(d, a);
-				dbg("f64.const 0x%llx %g\n", (unsigned long long)a, TOP_F64(d));
-				break;
-			}
-			#endif
+// Emit the dst operand of an instruction that produce a value.
+static void reg_emit_dst(reg_translator_type *t, uint32_t dst)
+{
+	t->last_dst = t->code->size;
+	reg_emit(t, dst);
+}
+
+// Address of next instruction, to be used as a branch target.
+static uint32_t reg_label_here(reg_translator_type *t)
+{
+	t->last_dst = 0;
+	return t->code->size;
+}
+
+// Set the branch target operand at pos. Targets at end of a block are not
+// known yet, those are linked into a list (through the operands) until then.
+static void reg_set_target(reg_translator_type *t, reg_label_type *l, uint32_t pos)
+{
+	if (l->kind == dwac_block_type_loop)
+	{
+		t->code->array[pos] = l->loop_addr;
+	}
+	else
+	{
+		t->code->array[pos] = l->end_links;
+		l->end_links = pos;
+	}
+}
+
+static void reg_emit_target(reg_translator_type *t, reg_label_type *l)
+{
+	reg_emit(t, 0);
+	reg_set_target(t, l, t->code->size - 1);
+}
+
+// Emit instruction to put a value into slot dst (the operand stack is not changed).
+static void reg_emit_move(reg_translator_type *t, const reg_value_type *v, uint32_t height, uint32_t dst)
+{
+	switch (v->kind)
+	{
+		case reg_value_in_local:
+			if (v->localidx == dst) {return;}
+			reg_emit_op(t, 0x20);
+			reg_emit_dst(t, dst);
+			reg_emit(t, v->localidx);
+			break;
+		case reg_value_const:
+			reg_emit_op(t, 0x42);
+			reg_emit_dst(t, dst);
+			reg_emit(t, (uint32_t) v->c);
+			reg_emit(t, (uint32_t) (v->c >> 32));
+			break;
+		default:
+			if (reg_slot(t, height) == dst) {return;}
+			reg_emit_op(t, 0x20);
+			reg_emit_dst(t, dst);
+			reg_emit(t, reg_slot(t, height));
+			break;
+	}
+}
+
+// Put a value in the slot for its level of the operand stack.
+static void reg_materialize(reg_translator_type *t, uint32_t height)
+{
+	reg_value_type *v = reg_value(t, height);
+	if (v->kind != reg_value_in_slot)
+	{
+		reg_emit_move(t, v, height, reg_slot(t, height));
+		v->kind = reg_value_in_slot;
+	}
+}
+
+static void reg_materialize_all(reg_translator_type *t)
+{
+	for (uint32_t i = 0; i < reg_height(t); i++)
+	{
+		reg_materialize(t, i);
+	}
+}
+
+// Get the slot to use as operand for a value.
+static uint32_t reg_operand(reg_translator_type *t, uint32_t height)
+{
+	const reg_value_type *v = reg_value(t, height);
+	switch (v->kind)
+	{
+		case reg_value_in_local: return v->localidx;
+		case reg_value_const: reg_materialize(t, height); break;
+		default: break;
+	}
+	return reg_slot(t, height);
+}
+
+// Replace the top n values with a value in its slot.
+static uint32_t reg_replace(reg_translator_type *t, uint32_t n)
+{
+	t->values.size -= n;
+	reg_push(t, reg_value_in_slot, 0, 0);
+	return reg_slot(t, reg_height(t) - 1);
+}
+
+static dwac_result reg_unary(reg_translator_type *t, uint32_t op)
+{
+	if (reg_need(t, 1)) {return DWAC_NO_RESULT_ON_STACK;}
+	const uint32_t h = reg_height(t) - 1;
+	const uint32_t a = reg_operand(t, h);
+	reg_emit_op(t, op);
+	reg_emit_dst(t, reg_replace(t, 1));
+	reg_emit(t, a);
+	return DWAC_OK;
+}
+
+static dwac_result reg_binary(reg_translator_type *t, uint32_t op, uint8_t immediate_allowed)
+{
+	if (reg_need(t, 2)) {return DWAC_NO_RESULT_ON_STACK;}
+	const uint32_t h = reg_height(t) - 2;
+	const uint32_t a = reg_operand(t, h);
+	const reg_value_type *v = reg_value(t, h + 1);
+	if (immediate_allowed && (v->kind == reg_value_const))
+	{
+		const uint32_t b = (uint32_t) v->c;
+		reg_emit_op(t, 0x100 | op);
+		reg_emit_dst(t, reg_replace(t, 2));
+		reg_emit(t, a);
+		reg_emit(t, b);
+	}
+	else
+	{
+		const uint32_t b = reg_operand(t, h + 1);
+		reg_emit_op(t, op);
+		reg_emit_dst(t, reg_replace(t, 2));
+		reg_emit(t, a);
+		reg_emit(t, b);
+	}
+	return DWAC_OK;
+}
+
+static dwac_result reg_load(reg_translator_type *t, uint32_t op, uint32_t offset)
+{
+	if (reg_need(t, 1)) {return DWAC_NO_RESULT_ON_STACK;}
+	const uint32_t addr = reg_operand(t, reg_height(t) - 1);
+	reg_emit_op(t, op);
+	reg_emit_dst(t, reg_replace(t, 1));
+	reg_emit(t, addr);
+	reg_emit(t, offset);
+	return DWAC_OK;
+}
+
+static dwac_result reg_store(reg_translator_type *t, uint32_t op, uint32_t offset)
+{
+	if (reg_need(t, 2)) {return DWAC_NO_RESULT_ON_STACK;}
+	const uint32_t h = reg_height(t) - 2;
+	const uint32_t addr = reg_operand(t, h);
+	const uint32_t src = reg_operand(t, h + 1);
+	reg_emit_op(t, op);
+	reg_emit(t, addr);
+	reg_emit(t, src);
+	reg_emit(t, offset);
+	t->values.size -= 2;
+	return DWAC_OK;
+}
+
+static dwac_result reg_local_get(reg_translator_type *t, uint32_t localidx)
+{
+	if (localidx >= t->nof_locals) {return DWAC_FEATURE_NOT_SUPPORTED_YET;}
+	reg_push(t, reg_value_in_local, localidx, 0);
+	return DWAC_OK;
+}
+
+static dwac_result reg_local_set(reg_translator_type *t, uint32_t localidx, uint8_t tee)
+{
+	if (localidx >= t->nof_locals) {return DWAC_FEATURE_NOT_SUPPORTED_YET;}
+	if (reg_need(t, 1)) {return DWAC_NO_RESULT_ON_STACK;}
+	const uint32_t h = reg_height(t) - 1;
+
+	// Values on stack that are still in this local must be moved before it is changed.
+	for (uint32_t i = 0; i < h; i++)
+	{
+		const reg_value_type *v = reg_value(t, i);
+		if ((v->kind == reg_value_in_local) && (v->localidx == localidx)) {reg_materialize(t, i);}
+	}
+
+	reg_value_type *v = reg_value(t, h);
+	if ((v->kind == reg_value_in_slot) && (t->last_dst != 0) && (t->code->array[t->last_dst] == reg_slot(t, h)))
+	{
+		// Let the instruction that made the value put it in the local variable directly.
+		t->code->array[t->last_dst] = localidx;
+	}
+	else
+	{
+		reg_emit_move(t, v, h, localidx);
+	}
+	t->last_dst = 0;
+
+	if (!tee)
+	{
+		t->values.size--;
+	}
+	else if (v->kind != reg_value_const)
+	{
+		v->kind = reg_value_in_local;
+		v->localidx = localidx;
+	}
+	return DWAC_OK;
+}
+
+// If the results of a branch to the label are already where they shall be.
+static uint8_t reg_branch_in_place(reg_translator_type *t, const reg_label_type *l)
+{
+	if (l->kind == dwac_block_type_internal_func) {return 0;}
+	const uint32_t n = (l->kind == dwac_block_type_loop) ? 0 : l->nof_results;
+	const uint32_t h = reg_height(t) - n;
+	for (uint32_t i = 0; i < n; i++)
+	{
+		if ((h != l->height) || (reg_value(t, h + i)->kind != reg_value_in_slot)) {return 0;}
+	}
+	return 1;
+}
+
+static dwac_result reg_emit_return(reg_translator_type *t, uint32_t n)
+{
+	if (reg_height(t) < n) {return DWAC_MISSING_RETURN_VALUES;}
+	uint32_t src[8];
+	const uint32_t h = reg_height(t) - n;
+	for (uint32_t i = 0; i < n; i++)
+	{
+		src[i] = reg_operand(t, h + i);
+	}
+	reg_emit_op(t, 0x0f);
+	reg_emit(t, n);
+	for (uint32_t i = 0; i < n; i++)
+	{
+		reg_emit(t, src[i]);
+	}
+	return DWAC_OK;
+}
+
+// Unconditional branch, results (if any) are moved to the label first.
+static dwac_result reg_emit_branch(reg_translator_type *t, uint32_t labelidx, uint32_t gas)
+{
+	if (labelidx >= t->labels.size) {return DWAC_LABEL_OUT_OF_RANGE;}
+	reg_label_type *l = reg_label(t, labelidx);
+	if (l->kind == dwac_block_type_internal_func) {return reg_emit_return(t, l->nof_results);}
+	const uint32_t n = (l->kind == dwac_block_type_loop) ? 0 : l->nof_results;
+	if (reg_height(t) < l->height + n) {return DWAC_MISSING_RETURN_VALUES;}
+	const uint32_t h = reg_height(t) - n;
+	for (uint32_t i = 0; i < n; i++)
+	{
+		reg_emit_move(t, reg_value(t, h + i), h + i, reg_slot(t, l->height + i));
+	}
+	reg_emit_op(t, 0x0c);
+	reg_emit_target(t, l);
+	reg_emit(t, gas);
+	return DWAC_OK;
+}
+
+// This is br_if, or if if_zero is set, i32.eqz followed by br_if.
+static dwac_result reg_conditional_branch(reg_translator_type *t, uint32_t labelidx, uint32_t gas, uint8_t if_zero)
+{
+	if (labelidx >= t->labels.size) {return DWAC_LABEL_OUT_OF_RANGE;}
+	if (reg_need(t, 1)) {return DWAC_NO_RESULT_ON_STACK;}
+	const uint32_t cond = reg_operand(t, reg_height(t) - 1);
+	t->values.size--;
+	reg_label_type *l = reg_label(t, labelidx);
+	if (reg_branch_in_place(t, l))
+	{
+		reg_emit_op(t, if_zero ? 0x200 : 0x0d);
+		reg_emit(t, cond);
+		reg_emit_target(t, l);
+		reg_emit(t, gas);
+		return DWAC_OK;
+	}
+
+	// Constants must be put in slots before the branch since reg_emit_return
+	// would do that only if branch is taken.
+	if (l->kind == dwac_block_type_internal_func)
+	{
+		if (reg_height(t) < l->nof_results) {return DWAC_MISSING_RETURN_VALUES;}
+		for (uint32_t i = reg_height(t) - l->nof_results; i < reg_height(t); i++)
+		{
+			if (reg_value(t, i)->kind == reg_value_const) {reg_materialize(t, i);}
+		}
+	}
+
+	// Skip the moves and branch if condition is not met (that costs no gas).
+	reg_emit_op(t, if_zero ? 0x0d : 0x200);
+	reg_emit(t, cond);
+	const uint32_t skip = t->code->size;
+	reg_emit(t, 0);
+	reg_emit(t, 0);
+	const dwac_result r = reg_emit_branch(t, labelidx, gas);
+	t->code->array[skip] = reg_label_here(t);
+	return r;
+}
+
+static dwac_result reg_branch_table(reg_translator_type *t, const uint32_t *op)
+{
+	// Entries in translated code are labelidx, a target not used here and gas.
+	const uint32_t n = op[1];
+	for (uint32_t i = 0; i <= n; i++)
+	{
+		if (op[2 + 5 * i] >= t->labels.size) {return DWAC_LABEL_OUT_OF_RANGE;}
+	}
+	if (reg_need(t, 1)) {return DWAC_NO_RESULT_ON_STACK;}
+	const uint32_t idx = reg_operand(t, reg_height(t) - 1);
+	t->values.size--;
+	reg_emit_op(t, 0x0e);
+	reg_emit(t, idx);
+	reg_emit(t, n);
+	const uint32_t table = t->code->size;
+	for (uint32_t i = 0; i <= n; i++)
+	{
+		reg_emit(t, 0);
+		reg_emit(t, 0);
+	}
+
+	// Branches that need to move results first go via code after the table.
+	for (uint32_t i = 0; i <= n; i++)
+	{
+		reg_label_type *l = reg_label(t, op[2 + 5 * i]);
+		if (reg_branch_in_place(t, l))
+		{
+			reg_set_target(t, l, table + 2 * i);
+			t->code->array[table + 2 * i + 1] = op[6 + 5 * i];
+		}
+		else
+		{
+			t->code->array[table + 2 * i] = reg_label_here(t);
+			const dwac_result r = reg_emit_branch(t, op[2 + 5 * i], op[6 + 5 * i]);
+			if (r) {return r;}
+		}
+	}
+	return DWAC_OK;
+}
+
+// Put results of a block in their slots at else or end of the block.
+static dwac_result reg_block_results(reg_translator_type *t, const reg_label_type *l)
+{
+	if (reg_height(t) != l->height + l->nof_results) {return DWAC_MISSING_RETURN_VALUES;}
+	for (uint32_t i = 0; i < l->nof_results; i++)
+	{
+		reg_materialize(t, l->height + i);
+	}
+	return DWAC_OK;
+}
+
+static dwac_result reg_begin_block(reg_translator_type *t, const uint32_t *op)
+{
+	const dwac_func_type_type *bt = dwac_get_func_type_ptr(t->p, (int32_t) op[1]);
+	if ((bt == NULL) || (bt->nof_parameters != 0) || (bt->nof_results > 8)) {return DWAC_FEATURE_NOT_SUPPORTED_YET;}
+
+	uint32_t cond = 0;
+	if (op[0] == 0x04)
+	{
+		if (reg_need(t, 1)) {return DWAC_NO_RESULT_ON_STACK;}
+		cond = reg_operand(t, reg_height(t) - 1);
+		t->values.size--;
+	}
+
+	// Values shall be in slots when block begin, so that all branches
+	// to end of block have the same values in the same slots.
+	reg_materialize_all(t);
+
+	uint32_t else_link = 0;
+	if (op[0] == 0x04)
+	{
+		reg_emit_op(t, 0x200);
+		reg_emit(t, cond);
+		else_link = t->code->size;
+		reg_emit(t, 0);
+		reg_emit(t, op[4]);
+	}
+
+	reg_label_type *l = reg_push_label(t, op[0], bt->nof_results);
+	l->else_link = else_link;
+	l->loop_addr = reg_label_here(t);
+	return DWAC_OK;
+}
+
+static dwac_result reg_else(reg_translator_type *t, uint32_t gas)
+{
+	reg_label_type *l = reg_label(t, 0);
+	if (l->kind != dwac_block_type_if) {return DWAC_ELSE_WITHOUT_IF;}
+	if (l->dead) {return DWAC_OK;}
+	if (!l->unreachable)
+	{
+		const dwac_result r = reg_block_results(t, l);
+		if (r) {return r;}
+		reg_emit_op(t, 0x0c);
+		reg_emit_target(t, l);
+		reg_emit(t, gas);
+	}
+	t->code->array[l->else_link] = reg_label_here(t);
+	l->else_link = 0;
+	l->unreachable = 0;
+	t->values.size = l->height;
+	return DWAC_OK;
+}
+
+static dwac_result reg_end_block(reg_translator_type *t)
+{
+	reg_label_type *l = reg_label(t, 0);
+	if (!l->unreachable)
+	{
+		const dwac_result r = reg_block_results(t, l);
+		if (r) {return r;}
+	}
+	if (!l->dead)
+	{
+		const uint32_t here = reg_label_here(t);
+		if (l->else_link != 0) {t->code->array[l->else_link] = here;}
+		uint32_t pos = l->end_links;
+		while (pos != 0)
+		{
+			const uint32_t next = t->code->array[pos];
+			t->code->array[pos] = here;
+			pos = next;
+		}
+	}
+	const uint32_t height = l->height;
+	const uint32_t nof_results = l->nof_results;
+	dwac_linear_storage_size_pop(&t->labels);
+	t->values.size = height;
+	for (uint32_t i = 0; i < nof_results; i++)
+	{
+		reg_push(t, reg_value_in_slot, 0, 0);
+	}
+	return DWAC_OK;
+}
+
+static dwac_result reg_translate_op(reg_translator_type *t, const uint32_t *op)
+{
+	switch (op[0])
+	{
+		case 0x00: // unreachable
+			reg_emit_op(t, 0x00);
+			reg_label(t, 0)->unreachable = 1;
+			return DWAC_OK;
+		case 0x01: // nop
+			return DWAC_OK;
+		case 0x02: // block
+		case 0x03: // loop
+		case 0x04: // if
+			return reg_begin_block(t, op);
+		case 0x05: // else
+			return reg_else(t, op[2]);
+		case 0x0b: // end
+			return reg_end_block(t);
+		case 0x0c: // br
+		{
+			const dwac_result r = reg_emit_branch(t, op[1], op[5]);
+			reg_label(t, 0)->unreachable = 1;
+			return r;
+		}
+		case 0x0d: // br_if
+			return reg_conditional_branch(t, op[1], op[5], 0);
+		case 0x0e: // br_table
+		{
+			const dwac_result r = reg_branch_table(t, op);
+			reg_label(t, 0)->unreachable = 1;
+			return r;
+		}
+		case 0x0f: // return
+		{
+			const dwac_result r = reg_emit_branch(t, t->labels.size - 1, 0);
+			reg_label(t, 0)->unreachable = 1;
+			return r;
+		}
+		case 0x1a: // drop
+			if (reg_need(t, 1)) {return DWAC_NO_RESULT_ON_STACK;}
+			t->values.size--;
+			return DWAC_OK;
+		case 0x1b: // select
+		{
+			if (reg_need(t, 3)) {return DWAC_NO_RESULT_ON_STACK;}
+			const uint32_t h = reg_height(t) - 3;
+			const uint32_t a = reg_operand(t, h);
+			const uint32_t b = reg_operand(t, h + 1);
+			const uint32_t cond = reg_operand(t, h + 2);
+			reg_emit_op(t, 0x1b);
+			reg_emit_dst(t, reg_replace(t, 3));
+			reg_emit(t, a);
+			reg_emit(t, b);
+			reg_emit(t, cond);
+			return DWAC_OK;
+		}
+		case 0x20: // local.get
+			return reg_local_get(t, op[1]);
+		case 0x21: // local.set
+			return reg_local_set(t, op[1], 0);
+		case 0x22: // local.tee
+			return reg_local_set(t, op[1], 1);
+		case 0x23: // global.get
+			reg_push(t, reg_value_in_slot, 0, 0);
+			reg_emit_op(t, 0x23);
+			reg_emit_dst(t, reg_slot(t, reg_height(t) - 1));
+			reg_emit(t, op[1]);
+			return DWAC_OK;
+		case 0x24: // global.set
+		{
+			if (reg_need(t, 1)) {return DWAC_NO_RESULT_ON_STACK;}
+			const uint32_t src = reg_operand(t, reg_height(t) - 1);
+			reg_emit_op(t, 0x24);
+			reg_emit(t, src);
+			reg_emit(t, op[1]);
+			t->values.size--;
+			return DWAC_OK;
+		}
+		case 0x28 ... 0x29: // i32.load, i64.load
+		case 0x2c ... 0x35: // i32.load8_s ... i64.load32_u
+			return reg_load(t, op[0], op[1]);
+		case 0x36 ... 0x37: // i32.store, i64.store
+		case 0x3a ... 0x3e: // i32.store8 ... i64.store32
+			return reg_store(t, op[0], op[1]);
+		case 0x41: // i32.const
+			reg_push(t, reg_value_const, 0, (uint64_t) (int64_t) (int32_t) op[1]);
+			return DWAC_OK;
+		case 0x42: // i64.const
+			reg_push(t, reg_value_const, 0, op[1] | ((uint64_t) op[2] << 32));
+			return DWAC_OK;
+		case 0x45: // i32.eqz
+		case 0x50: // i64.eqz
+		case 0x67 ... 0x69: // i32.clz, i32.ctz, i32.popcnt
+		case 0x79 ... 0x7b: // i64.clz, i64.ctz, i64.popcnt
+		case 0xa7: // i32.wrap_i64
+		case 0xac ... 0xad: // i64.extend_i32_s, i64.extend_i32_u
+		case 0xc0 ... 0xc4: // i32.extend8_s ... i64.extend32_s
+			return reg_unary(t, op[0]);
+		case 0x46 ... 0x4f: // i32.eq ... i32.ge_u
+		case 0x6a ... 0x6c: // i32.add, i32.sub, i32.mul
+		case 0x71 ... 0x78: // i32.and ... i32.rotr
+			return reg_binary(t, op[0], 1);
+		case 0x51 ... 0x5a: // i64.eq ... i64.ge_u
+		case 0x6d ... 0x70: // i32.div_s ... i32.rem_u
+		case 0x7c ... 0x8a: // i64.add ... i64.rotr
+			return reg_binary(t, op[0], 0);
+		#ifdef DWAC_FUSE_OPCODES
+		case 0x100: // local.get, i32.const, i32.add
+		{
+			const dwac_result r = reg_local_get(t, op[1]);
+			if (r) {return r;}
+			reg_push(t, reg_value_const, 0, (uint64_t) (int64_t) (int32_t) op[2]);
+			return reg_binary(t, 0x6a, 1);
+		}
+		case 0x101: // local.get, i32.load
+		{
+			const dwac_result r = reg_local_get(t, op[1]);
+			if (r) {return r;}
+			return reg_load(t, 0x28, op[2]);
+		}
+		case 0x102: // i32.eqz, br_if
+			return reg_conditional_branch(t, op[1], op[5], 1);
+		case 0x103: // local.get, local.get, i32.add
+		{
+			dwac_result r = reg_local_get(t, op[1]);
+			if (r == DWAC_OK) {r = reg_local_get(t, op[2]);}
+			if (r) {return r;}
+			return reg_binary(t, 0x6a, 1);
+		}
+		#endif
+		default:
+			// Calls, floats, memory.grow etc are not done by register code.
+			return DWAC_FEATURE_NOT_SUPPORTED_YET;
+	}
+}
+
+// Translate the code of a function into register code. If that can not be
+// done the function is run by dwac_tick instead.
+static dwac_result reg_translate_function(const dwac_prog *p, dwac_function *f)
+{
+	dwac_internal_function_type *func = &f->internal_function;
+	const dwac_func_type_type *type = dwac_get_func_type_ptr(p, f->func_type_idx);
+	if ((type == NULL) || (type->nof_results > 8)) {return DWAC_TO_MANY_RESULT_VALUES;}
+
+	reg_translator_type t;
+	t.p = p;
+	t.code = &func->reg_code;
+	t.nof_locals = type->nof_parameters + func->nof_local;
+	t.max_height = 0;
+	t.last_dst = 0;
+	dwac_linear_storage_size_init(&t.values, sizeof(reg_value_type));
+	dwac_linear_storage_size_init(&t.labels, sizeof(reg_label_type));
+	reg_push_label(&t, dwac_block_type_internal_func, type->nof_results);
+
+	dwac_result r = DWAC_NO_END;
+	uint32_t pos = 0;
+	while (pos < func->code.size)
+	{
+		const uint32_t *op = func->code.array + pos;
+		pos += get_oplen(op);
+		reg_label_type *l = reg_label(&t, 0);
+		if ((op[0] == 0x0b) && (l->kind == dwac_block_type_internal_func))
+		{
+			// End of the function.
+			r = l->unreachable ? DWAC_OK : reg_emit_return(&t, l->nof_results);
+			if ((r == DWAC_OK) && (pos != func->code.size)) {r = DWAC_MISSING_CODE_AT_END;}
+			break;
+		}
+
+		r = DWAC_OK;
+		if (!l->unreachable)
+		{
+			r = reg_translate_op(&t, op);
+		}
+		else if ((op[0] >= 0x02) && (op[0] <= 0x04))
+		{
+			// A block in code that can not be reached, skip all of it.
+			l = reg_push_label(&t, op[0], 0);
+			l->unreachable = 1;
+			l->dead = 1;
+		}
+		else if (op[0] == 0x05)
+		{
+			r = reg_else(&t, op[2]);
+		}
+		else if (op[0] == 0x0b)
+		{
+			r = reg_end_block(&t);
+		}
+		if (r != DWAC_OK) {break;}
+		r = DWAC_NO_END;
+	}
+
+	if (r == DWAC_OK)
+	{
+		func->reg_nof_slots = t.nof_locals + t.max_height;
+	}
+	else
+	{
+		dbg("register code not used for %u, %d\n", f->func_idx, r);
+		dwac_linear_storage_32_deinit(&func->reg_code);
+		dwac_linear_storage_32_init(&func->reg_code);
+	}
+	dwac_linear_storage_size_deinit(&t.values);
+	dwac_linear_storage_size_deinit(&t.labels);
+	return r;
+}
+#endif
+
+#ifdef DWAC_TRANSLATE_THREADS
+#define TRANSLATION_STATE(f) __atomic_load_n(&(f)->internal_function.translation_state, __ATOMIC_ACQUIRE)
+#define SET_TRANSLATION_STATE(f, s) __atomic_store_n(&(f)->internal_function.translation_state, (s), __ATOMIC_RELEASE)
+#define ADD_CALL_SITE(f) __atomic_fetch_add(&(f)->internal_function.nof_call_sites, 1, __ATOMIC_RELAXED)
+#define NOF_CALL_SITES(f) __atomic_load_n(&(f)->internal_function.nof_call_sites, __ATOMIC_RELAXED)
+#define FRAME_CODE(frame) __atomic_load_n(&(frame)->code, __ATOMIC_ACQUIRE)
+#define SET_FRAME_CODE(frame, c) __atomic_store_n(&(frame)->code, (c), __ATOMIC_RELEASE)
+#else
+#define TRANSLATION_STATE(f) ((f)->internal_function.translation_state)
+#define SET_TRANSLATION_STATE(f, s) ((f)->internal_function.translation_state = (s))
+#define ADD_CALL_SITE(f) ((f)->internal_function.nof_call_sites++)
+#define NOF_CALL_SITES(f) ((f)->internal_function.nof_call_sites)
+#define FRAME_CODE(frame) ((frame)->code)
+#define SET_FRAME_CODE(frame, c) ((frame)->code = (c))
+#endif
+
+// Count the calls in a translated function. Functions called from code
+// that is translated are likely to be called soon, see translate_thread.
+static void count_call_sites(const dwac_prog *p, const dwac_function *f)
+{
+	const uint32_t *code = f->internal_function.code.array;
+	const uint32_t nof = f->internal_function.code.size;
+	uint32_t pos = 0;
+	while (pos < nof)
+	{
+		if ((code[pos] == 0x10) && (code[pos + 1] >= p->funcs_vector.nof_imported) && (code[pos + 1] < p->funcs_vector.total_nof))
+		{
+			ADD_CALL_SITE(&p->funcs_vector.functions_array[code[pos + 1]]);
+		}
+		pos += get_oplen(code + pos);
+	}
+}
+
+// Translate the body of an internal function and find its blocks, unless
+// that is done already. Ref [3] looked up blocks in a hash when they were
+// executed. Here it is done once per function. Unless TRANSLATE_ALL_AT_LOAD
+// is defined this is done the first time a function is called, or by a
+// translate thread (see DWAC_TRANSLATE_THREADS) before that.
+static dwac_result translate_internal_function(const dwac_prog *p, uint32_t func_idx)
+{
+	if ((func_idx < p->funcs_vector.nof_imported) || (func_idx >= p->funcs_vector.total_nof)) {return DWAC_FUNC_IDX_OUT_OF_RANGE;}
+	dwac_function *f = &p->funcs_vector.functions_array[func_idx];
+	for (;;)
+	{
+		uint8_t state = TRANSLATION_STATE(f);
+		if (state == dwac_translation_done) {return f->internal_function.translation_result;}
+		#ifdef DWAC_TRANSLATE_THREADS
+		if ((state == dwac_translation_in_progress) || (!__atomic_compare_exchange_n(&f->internal_function.translation_state, &state, dwac_translation_in_progress, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)))
+		{
+			// Some other thread is translating this function, wait for it.
+			sched_yield();
+			continue;
+		}
+		#endif
+		break;
+	}
+
+	const dwac_func_type_type *type = dwac_get_func_type_ptr(p, f->func_type_idx);
+	dwac_result r = (type != NULL) ? translate_function(p, f) : DWAC_NO_TYPE_INFO;
+	if (r == DWAC_OK) {r = find_blocks_in_code(p, f->internal_function.code.array, f->internal_function.code.size, type->nof_parameters + f->internal_function.nof_local, type);}
+	if (r == DWAC_OK) {f->internal_function.entry_gas = count_gas_in_code(f->internal_function.code.array, f->internal_function.code.size);}
+	#ifdef DWAC_REGISTER_CODE
+	if (r == DWAC_OK) {reg_translate_function(p, f);}
+	#endif
+	if (r == DWAC_OK) {count_call_sites(p, f);}
+
+	// The fast call path in dwac_tick is for functions run by the interpreter.
+	#ifdef DWAC_REGISTER_CODE
+	if ((r == DWAC_OK) && (f->internal_function.reg_code.size == 0))
+	#else
+	if (r == DWAC_OK)
+	#endif
+	{
+		dwac_frame_type *frame = &p->frames[func_idx];
+		frame->code_size = f->internal_function.code.size;
+		frame->entry_gas = f->internal_function.entry_gas;
+		SET_FRAME_CODE(frame, f->internal_function.code.array);
+	}
+
+	f->internal_function.translation_result = r;
+	SET_TRANSLATION_STATE(f, dwac_translation_done);
+	return r;
+}
+
+#ifdef DWAC_TRANSLATE_THREADS
+static int compare_u64(const void *a, const void *b)
+{
+	const uint64_t x = *(const uint64_t*)a;
+	const uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+// Get the next function for a translate thread to translate. Returns
+// total_nof if there is nothing more to do.
+//
+// Functions are taken from a queue. When it is empty, the half of the
+// functions not yet translated that have the most call sites in translated
+// code are put in it. Then when those are translated their calls are also
+// counted before the queue is filled again.
+static uint32_t next_function_to_translate(dwac_prog *p)
+{
+	uint32_t func_idx = p->funcs_vector.total_nof;
+	pthread_mutex_lock(&p->translate_mutex);
+	while ((!p->translate_stop) && (func_idx == p->funcs_vector.total_nof))
+	{
+		if (p->translate_queue_pos < p->translate_queue.size)
+		{
+			const uint32_t i = p->translate_queue.array[p->translate_queue_pos++];
+			if (TRANSLATION_STATE(&p->funcs_vector.functions_array[i]) == dwac_translation_not_started) {func_idx = i;}
+			continue;
+		}
+
+		// Sort on number of call sites (inverted so most is first) and then function index.
+		const uint32_t nof_internal = p->funcs_vector.total_nof - p->funcs_vector.nof_imported;
+		uint64_t *keys = DWAC_ST_MALLOC(nof_internal * sizeof(uint64_t));
+		uint32_t n = 0;
+		for (uint32_t i = p->funcs_vector.nof_imported; i < p->funcs_vector.total_nof; i++)
+		{
+			const dwac_function *f = &p->funcs_vector.functions_array[i];
+			if (TRANSLATION_STATE(f) == dwac_translation_not_started)
+			{
+				keys[n++] = ((uint64_t)(~NOF_CALL_SITES(f)) << 32) | i;
+			}
+		}
+		qsort(keys, n, sizeof(uint64_t), compare_u64);
+		p->translate_queue.size = 0;
+		p->translate_queue_pos = 0;
+		for (uint32_t i = 0; i < (n + 1) / 2; i++)
+		{
+			dwac_linear_storage_32_push(&p->translate_queue, (uint32_t)keys[i]);
+		}
+		DWAC_ST_FREE(keys);
+		if (n == 0) {break;}
+	}
+	pthread_mutex_unlock(&p->translate_mutex);
+	return func_idx;
+}
+
+static void* translate_thread(void *arg)
+{
+	dwac_prog *p = arg;
+	for (;;)
+	{
+		const uint32_t func_idx = next_function_to_translate(p);
+		if (func_idx >= p->funcs_vector.total_nof) {break;}
+		translate_internal_function(p, func_idx);
+	}
+	return NULL;
+}
+
+static void start_translate_threads(dwac_prog *p)
+{
+	while (p->nof_translate_threads < DWAC_TRANSLATE_THREADS)
+	{
+		if (pthread_create(&p->translate_threads[p->nof_translate_threads], NULL, translate_thread, p) != 0) {break;}
+		p->nof_translate_threads++;
+	}
+}
+
+static void stop_translate_threads(dwac_prog *p)
+{
+	pthread_mutex_lock(&p->translate_mutex);
+	p->translate_stop = 1;
+	pthread_mutex_unlock(&p->translate_mutex);
+	while (p->nof_translate_threads > 0)
+	{
+		pthread_join(p->translate_threads[--p->nof_translate_threads], NULL);
+	}
+}
+#endif
+
+
+// Parameters and local variables are pushed to stack.
+// Return address is pushed on call stack.
+// PC is set to the begin of the function.
+// Parameters: function_idx is index to the function to be called.
+//
+// If "gas metering" is not needed it would have been possible
+// to recursively call wa_tick instead of this call stack stuff.
+dwac_result dwac_setup_function_call(dwac_data *d, uint32_t function_idx)
+{
+	dbg("dwac_setup_function_call %d %s\n", function_idx, dwac_get_func_name(d->p, function_idx));
+	const dwac_prog *p = d->p;
+	if (function_idx < p->funcs_vector.nof_imported) {return DWAC_CAN_NOT_CALL_IMPORTED_HERE;}
+	if (function_idx >= p->funcs_vector.total_nof) {return DWAC_FUNC_IDX_OUT_OF_RANGE;}
+	dwac_function *func = &p->funcs_vector.functions_array[function_idx];
+	assert(func && (func->func_type_idx >= 0));
+	const dwac_func_type_type *type = dwac_get_func_type_ptr(p, func->func_type_idx);
+	assert(type);
+	const dwac_stack_pointer_signed_type stack_size = STACK_SIZE(d);
+	if (stack_size < type->nof_parameters)
+	{
+		snprintf(d->exception, sizeof(d->exception), "Insufficient number of parameters calling %u.", function_idx);
+		return DWAC_INSUFFICIENT_PARRAMETERS_FOR_CALL;
+	}
+	const dwac_stack_pointer_type expected_sp_after_call = d->sp - type->nof_parameters; // not counting results here
+
+	// Some data to save until returning.
+	dwac_call_stack_entry *e = (dwac_call_stack_entry*) dwac_linear_storage_size_push(&d->call_stack);
+	e->call_type = dwac_block_type_internal_func;
+	e->func_idx = function_idx;
+	e->nof_results = type->nof_results;
+	e->stack_pointer = expected_sp_after_call;
+	e->frame_pointer = d->fp;
+	e->return_pc = d->pc;
+
+	// Remember current stack pointer, as it was before call.
+	// The called function need this to know where its parameters and local variables on stack begin.
+	// Add one since SP started at -1 as part of small CPU optimize (see WA_SP_INITIAL).
+	d->fp = expected_sp_after_call + DWAC_SP_OFFSET;
+
+	#ifdef DWAC_AOT
+	if (p->aot_functions != NULL)
+	{
+		// Compiled ahead of time, run it all now. Calls it does are
+		// native calls, not on call stack.
+		if ((dwac_stack_pointer_type)stack_size + func->internal_function.nof_local >= DWAC_STACK_CAPACITY - 1)
+		{
+			snprintf(d->exception, sizeof(d->exception), "Stack overflow calling %u.", function_idx);
+			return DWAC_STACK_OVERFLOW;
+		}
+		d->sp += func->internal_function.nof_local;
+		const dwac_result r = p->aot_functions[function_idx - p->funcs_vector.nof_imported](d);
+		if (r != DWAC_OK) {return r;}
+		d->fp = e->frame_pointer;
+		d->sp = expected_sp_after_call + type->nof_results;
+		d->call_stack.size--;
+		return DWAC_OK;
+	}
+	#endif
+
+	#ifndef TRANSLATE_ALL_AT_LOAD
+	// Returns the stored result if the function is translated already,
+	// a translate thread may have done it and failed.
+	{
+		const dwac_result r = translate_internal_function(p, function_idx);
+		if (r != DWAC_OK)
+		{
+			snprintf(d->exception, sizeof(d->exception), "Could not translate function %u.", function_idx);
+			return r;
+		}
+	}
+	#endif
+
+	#ifdef DWAC_VALIDATE
+	// Code that passed validation is not checked for stack overflow when
+	// running, so check here that the frame of the function fits on stack.
+	if ((p->validated) && ((dwac_stack_pointer_type)stack_size + func->internal_function.nof_local + func->internal_function.max_stack_height >= DWAC_STACK_CAPACITY - 1))
+	{
+		snprintf(d->exception, sizeof(d->exception), "Stack overflow calling %u.", function_idx);
+		return DWAC_STACK_OVERFLOW;
+	}
+	#endif
+
+	// Reserve space on operand stack for local variables of the function to be called.
+	// [1] 4.4.10. Function Calls, the local variables are zero to begin with.
+	d->sp += func->internal_function.nof_local;
+	for (uint32_t i = 0; i < func->internal_function.nof_local; i++) {d->stack[SP_MASK(d->sp - i)].u64 = 0;}
+
+	// The caller checks the gas meter, see count_gas_in_code.
+	d->gas_meter -= func->internal_function.entry_gas;
+
+	#ifdef DWAC_REGISTER_CODE
+	// Use register code if there is, and its frame fits on stack.
+	if ((func->internal_function.reg_code.size != 0) && (d->fp + func->internal_function.reg_nof_slots < DWAC_STACK_CAPACITY - 1))
+	{
+		e->call_type = dwac_block_type_register_func;
+		d->pc.array = func->internal_function.reg_code.array;
+		d->pc.nof = func->internal_function.reg_code.size;
+		d->pc.pos = 0;
+		return DWAC_OK;
+	}
+	#endif
+
+	// Set program counter to start of function.
+	d->pc.array = func->internal_function.code.array;
+	d->pc.nof = func->internal_function.code.size;
+	d->pc.pos = 0;
+
+	//printf("wa_setup_function_call 0x%x 0x%x 0x%x  0x%x 0x%x 0x%x\n", d->fp, d->sp, d->pc.pos, type->nof_results, type->nof_parameters, func->internal_function.nof_local);
+	return DWAC_OK;
+}
+
+static dwac_result call_imported_function(dwac_data *d, uint32_t function_idx)
+{
+	dbg("dwac_call_imported_function %d %s\n", function_idx, dwac_get_func_name(d->p, function_idx));
+	const dwac_prog *p = d->p;
+	if (function_idx >= p->funcs_vector.nof_imported) {return DWAC_NOT_AN_IDX_OF_IMPORTED_FUNCTION;}
+	dwac_function *func = &p->funcs_vector.functions_array[function_idx];
+
+	const dwac_host_function_type *h = func->external_function.host_function;
+	if (h != NULL)
+	{
+		// Type of import was checked when linking (it is h->type) so the
+		// trampoline takes the parameters and puts the result without more
+		// checks.
+		const dwac_stack_pointer_signed_type stack_size = STACK_SIZE(d);
+		if (stack_size < h->type.nof_parameters)
+		{
+			snprintf(d->exception, sizeof(d->exception), "Insufficient nof parameters calling %u.", function_idx);
+			return DWAC_INSUFFICIENT_PARRAMETERS_FOR_CALL;
+		}
+		h->trampoline(d, &d->stack[stack_size - h->type.nof_parameters]);
+		if (d->exception[0] != 0)
+		{
+			return DWAC_EXCEPTION_FROM_IMPORTED_FUNCTION;
+		}
+		d->sp += h->type.nof_results - h->type.nof_parameters;
+		return DWAC_OK;
+	}
+
+	assert(func && (func->func_type_idx >= 0));
+	const dwac_func_type_type *type = dwac_get_func_type_ptr(p, func->func_type_idx);
+	assert(type);
+	const dwac_stack_pointer_signed_type stack_size = STACK_SIZE(d);
+	if (stack_size < type->nof_parameters)
+	{
+		snprintf(d->exception, sizeof(d->exception), "Insufficient nof parameters calling %u.", function_idx);
+		return DWAC_INSUFFICIENT_PARRAMETERS_FOR_CALL;
+	}
+	const dwac_stack_pointer_type expected_sp_after_call = d->sp - type->nof_parameters; // not counting results here
+	dwac_stack_pointer_type saved_frame_pointer = d->fp;
+	d->fp = expected_sp_after_call + DWAC_SP_OFFSET;
+
+	//printf("Calling '%s'\n", func->import_info.name);
+
+	dwac_func_ptr f = func->external_function.func_ptr;
+	(f)(d);
+
+	if (d->exception[0] != 0)
+	{
+		return DWAC_EXCEPTION_FROM_IMPORTED_FUNCTION;
+	}
+	else if (d->sp != expected_sp_after_call + type->nof_results)
+	{
+		char tmp[256];
+		dwac_func_type_to_string(tmp, sizeof(tmp), type);
+		snprintf(d->exception, sizeof(d->exception), "Unexpected nof parameters and/or arguments, %d != %d + %d, %s.", (int) d->sp, (int) expected_sp_after_call, type->nof_results, tmp);
+		return DWAC_EXTERNAL_STACK_MISMATCH;
+	}
+
+	d->fp = saved_frame_pointer;
+
+	dbg("done %d '%s'\n", function_idx, dwac_get_func_name(d->p, function_idx));
+
+	return DWAC_OK;
+}
+
+dwac_result dwac_call_imported_function(dwac_data *d, uint32_t function_idx)
+{
+	const dwac_result r = call_imported_function(d, function_idx);
+	#ifndef DWAC_GUARD_PAGES
+	memory_free_merged_blocks(d);
+	#endif
+	return r;
+}
+
+#ifdef LOG_FUNC_NAMES
+const char* dwac_get_func_name(const dwac_prog *p, long function_idx)
+{
+	#ifdef LOG_FUNC_NAMES
+	const char* func_name = dwac_linear_storage_size_get_const(&p->func_names, function_idx);
+	return func_name ? func_name : "";
+	#else
+	return "";
+	#endif
+}
+#endif
+
+#ifdef DWAC_JIT
+// A template JIT, register code of functions that run often is compiled into
+// x86-64 machine code. Each register code instruction becomes a fixed sequence
+// of machine code using the same frame slots (and dwac_data) as
+// run_register_code does, so a function can continue in machine code where
+// the register code was interrupted and the other way around. Branches count
+// gas as in run_register_code. Instructions without a template here, and the
+// slow path of loads and stores, call reg_step to run that one instruction.
+//
+// Registers while running: rbx is d, r12 is slots. The machine code begins
+// with an entry and exit that other code jumps to:
+//   jit_entry: called as dwac_result f(dwac_data *d, dwac_value_type *slots, void *addr)
+//   jit_exit: return with result in eax
+//   jit_gas_exit: save position in register code (in esi) and return DWAC_NEED_MORE_GAS
+
+typedef dwac_result (*jit_func_ptr)(dwac_data *d, dwac_value_type *slots, const void *addr);
+
+static dwac_result reg_step(dwac_data *d, uint32_t pos);
+
+typedef struct jit_type
+{
+	dwac_linear_storage_8_type buf;
+	size_t pos;
+	size_t exit_addr;
+	size_t gas_exit_addr;
+	dwac_linear_storage_32_type fixups; // Pairs of position of rel32 operand and register code target.
+} jit_type;
+
+#define JIT_SLOT(slot) ((uint32_t)((slot) * sizeof(dwac_value_type)))
+#define JIT_RAX 0
+#define JIT_RCX 1
+#define JIT_RDX 2
+
+static void jit_u8(jit_type *j, uint8_t b)
+{
+	dwac_linear_storage_8_set_uint8_t(&j->buf, j->pos, b);
+	j->pos += 1;
+}
+
+static void jit_u32(jit_type *j, uint32_t v)
+{
+	dwac_linear_storage_8_set_uint32_t(&j->buf, j->pos, v);
+	j->pos += 4;
+}
+
+static void jit_u64(jit_type *j, uint64_t v)
+{
+	dwac_linear_storage_8_set_uint64_t(&j->buf, j->pos, v);
+	j->pos += 8;
+}
+
+static void jit_bytes(jit_type *j, const uint8_t *b, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {jit_u8(j, b[i]);}
+}
+#define JIT_BYTES(j, ...) {static const uint8_t b[] = {__VA_ARGS__}; jit_bytes(j, b, sizeof(b));}
 
-			case 0x45: // i32.eqz
-				SET_I32(d, (TOP_I32(d) == 0));
-				dbg("i32.eqz 0x%x\n", TOP_I32(d));
-				break;
-			case 0x46: // i32.eq
-			{
-				const int32_t b = POP_I32(d);
-				SET_I32(d, (TOP_I32(d) == b));
-				dbg("i32.eq 0x%x\n", TOP_I32(d));
-				break;
-			}
-			case 0x47: // i32.ne
-			{
-				const int32_t b = POP_I32(d);
-				SET_I32(d, (TOP_I32(d) != b));
-				dbg("i32.ne 0x%x\n", TOP_I32(d));
-				break;
-			}
-			case 0x48: // i32.lt_s
-			{
-				const int32_t b = POP_I32(d);
-				SET_I32(d, (TOP_I32(d) < b));
-				dbg("i32.lt_s 0x%x\n", TOP_I32(d));
-				break;
-			}
-			case 0x49: // i32.lt_u
-			{
-				const uint32_t b = POP_U32(d);
-				SET_I32(d, (TOP_U32(d) < b));
-				dbg("i32.lt_u 0x%x\n", TOP_I32(d));
-				break;
-			}
-			case 0x4a: // i32.gt_s
-			{
-				const int32_t b = POP_I32(d);
-				SET_I32(d, (TOP_I32(d) > b));
-				dbg("i32.gt_s 0x%x\n", TOP_I32(d));
-				break;
-			}
-			case 0x4b: // i32.gt_u
-			{
-				const uint32_t b = POP_U32(d);
-				SET_I32(d, (TOP_U32(d) > b));
-				dbg("i32.gt_u 0x%x\n", TOP_I32(d));
-				break;
-			}
-			case 0x4c: // i32.le_s
-			{
-				const int32_t b = POP_I32(d);
-				SET_I32(d, (TOP_I32(d) <= b));
-				dbg("i32.le_s 0x%x\n", TOP_I32(d));
-				break;
-			}
-			case 0x4d: // i32.le_u
-			{
-				const uint32_t b = POP_U32(d);
-				SET_I32(d, (TOP_U32(d) <= b));
-				dbg("i32.le_u 0x%x\n", TOP_I32(d));
-				break;
-			}
-			case 0x4e: // i32.ge_s
-			{
-				const int32_t b = POP_I32(d);
-				SET_I32(d, (TOP_I32(d) >= b));
-				dbg("i32.ge_s 0x%x\n", TOP_I32(d));
-				break;
-			}
-			case 0x4f: // i32.ge_u
-			{
-				const uint32_t b = POP_U32(d);
-				SET_I32(d, (TOP_U32(d) >= b));
-				dbg("i32.ge_u 0x%x\n", TOP_I32(d));
-				break;
-			}
-			case 0x50: // i64.eqz
-				SET_I32(d, (TOP_I64(d) == 0));
-				dbg("i32.eqz 0x%x\n", TOP_I32(d));
-				break;
-			case 0x51: // i64.eq
-			{
-				const int64_t b = POP_I64(d);
-				SET_I32(d, (TOP_I64(d) == b));
-				dbg("i32.eq 0x%x\n", TOP_I32(d));
-				break;
-			}
-			case 0x52: // i64.ne
-			{
-				const int64_t b = POP_I64(d);
-				SET_I32(d, (TOP_I64(d) != b));
-				dbg("i32.ne 0x%x\n", TOP_I32(d));
-				break;
-			}
-			case 0x53: // i64.lt_s
-			{
-				const int64_t b = POP_I64(d);
-				SET_I32(d, (TOP_I64(d) < b));
-				dbg("i32.lt_s 0x%x\n", TOP_I32(d));
-				break;
-			}
-			case 0x54: // i64.lt_u
-			{
-				const uint64_t b = POP_U64(d);
-				SET_I32(d, (TOP_U64(d) < b));
-				dbg("i32.lt_u 0x%x\n", TOP_I32(d));
-				break;
-			}
-			case 0x55: // i64.gt_s
-			{
-				const int64_t b = POP_I64(d);
-				SET_I32(d, (TOP_I64(d) > b));
-				dbg("i32.gt_s 0x%x\n", TOP_I32(d));
-				break;
-			}
-			case 0x56: // i64.gt_u
-			{
-				const uint64_t b = POP_U64(d);
-				SET_I32(d, (TOP_U64(d) > b));
-				dbg("i32.gt_u 0x%x\n", TOP_I32(d));
-				break;
-			}
-			case 0x57: // i64.le_s
-			{
-				const int64_t b = POP_I64(d);
-				SET_I32(d, (TOP_I64(d) <= b));
-				dbg("i32.le_s 0x%x\n", TOP_I32(d));
-				break;
-			}
-			case 0x58: // i64.le_u
-			{
-				const uint64_t b = POP_U64(d);
-				SET_I32(d, (TOP_U64(d) <= b));
-				dbg("i32.le_u 0x%x\n", TOP_I32(d));
-				break;
-			}
-			case 0x59: // i64.ge_s
-			{
-				const int64_t b = POP_I64(d);
-				SET_I32(d, (TOP_I64(d) >= b));
-				dbg("i32.ge_s 0x%x\n", TOP_I32(d));
-				break;
-			}
-			case 0x5a: // i64.ge_u
-			{
-				const uint64_t b = POP_U64(d);
-				SET_I32(d, (TOP_U64(d) >= b));
-				dbg("i32.ge_u 0x%x\n", TOP_I32(d));
-				break;
-			}
+// Set a rel32 operand at pos so that it jumps to addr.
+static void jit_patch(jit_type *j, size_t pos, size_t addr)
+{
+	dwac_linear_storage_8_set_uint32_t(&j->buf, pos, (uint32_t)(addr - (pos + 4)));
+}
 
-			#ifndef SKIP_FLOAT
-			case 0x5b: // f32.eq
-			{ // not tested
-				const float b = POP_F32(d);
-				const float a = TOP_F32(d);
-				const int c = nearly_equal_float(a, b);
-				SET_I32(d, c);
-				dbg("f32.eq %g %g %d\n", a, b, c);
-				break;
-			}
-			case 0x5c: // f32.ne
-			{ // not tested
-				const float b = POP_F32(d);
-				const float a = TOP_F32(d);
-				const int c = !nearly_equal_float(a, b);
-				SET_I32(d, c);
-				dbg("f32.ne %g %g %d\n", a, b, c);
-				break;
-			}
-			case 0x5d: // f32.lt
-			{
-				const float b = POP_F32(d);
-				const float a = TOP_F32(d);
-				const int c = (a < b);
-				SET_I32(d, c);
-				dbg("f32.lt %g %g %d\n", a, b, c);
-				break;
-			}
-			case 0x5e: // f32.gt
-			{
-				const float b = POP_F32(d);
-				const float a = TOP_F32(d);
-				const int c = a > b;
-				SET_I32(d, c);
-				dbg("f32.gt %g %g %d\n", a, b, c);
-				break;
-			}
-			case 0x5f: // f32.le
-			{
-				const float b = POP_F32(d);
-				const float a = TOP_F32(d);
-				const int c = (a <= b);
-				SET_I32(d, c);
-				dbg("f32.le %g %g %d\n", a, b, c);
-				break;
-			}
-			case 0x60: // f32.ge
-			{
-				const float b = POP_F32(d);
-				const float a = TOP_F32(d);
-				const int c = (a >= b);
-				SET_I32(d, c);
-				dbg("f32.ge %g %g %d\n", a, b, c);
-				break;
-			}
-			case 0x61: // f64.eq
-			{
-				const double b = POP_F64(d);
-				const double a = TOP_F64(d);
-				SET_I32(d, nearly_equal_double(a, b));
-				dbg("f64.eq %g %g %d\n", a, b, TOP_I32(d));
-				break;
-			}
-			case 0x62: // f64.ne
-			{
-				const double b = POP_F64(d);
-				const double a = TOP_F64(d);
-				SET_I32(d, !nearly_equal_float(a, b));
-				dbg("f64.ne %g %g %d\n", a, b, TOP_I32(d));
-				break;
-			}
-			case 0x63: // f64.lt
-			{
-				const double b = POP_F64(d);
-				const double a = TOP_F64(d);
-				SET_I32(d, (a < b));
-				dbg("f64.lt %g %g %d\n", a, b, TOP_I32(d));
-				break;
-			}
-			case 0x64: // f64.gt
-			{
-				const double b = POP_F64(d);
-				const double a = TOP_F64(d);
-				SET_I32(d, (a > b));
-				dbg("f64.gt %g %g %d\n", a, b, TOP_I32(d));
-				break;
-			}
-			case 0x65: // f64.le
-			{
-				const double b = POP_F64(d);
-				const double a = TOP_F64(d);
-				SET_I32(d, (a <= b));
-				dbg("f64.le %g %g %d\n", a, b, TOP_I32(d));
-				break;
-			}
-			case 0x66: // f64.ge
-			{
-				const double b = POP_F64(d);
-				const double a = TOP_F64(d);
-				SET_I32(d, (a >= b));
-				dbg("f64.ge %g %g %d\n", a, b, TOP_I32(d));
-				break;
-			}
-			#endif
+// Jump (or jcc if cc is not zero) to an address already emitted.
+static void jit_jump_back(jit_type *j, uint8_t cc, size_t addr)
+{
+	if (cc) {jit_u8(j, 0x0f); jit_u8(j, cc);} else {jit_u8(j, 0xe9);}
+	jit_u32(j, 0);
+	jit_patch(j, j->pos - 4, addr);
+}
 
-			case 0x67: // i32.clz
-			{   // Not tested
-				// Count leading zeros in a binary number.
-				const int32_t a = TOP_I32(d);
-				const int32_t c = __builtin_clz(a);
-				SET_I32(d, c);
-				printf("i32.clz 0x%x 0x%x\n", a, c);
-				break;
-			}
-			case 0x68: // i32.ctz
-			{   // Not tested
-				// Count trailing zeros in a binary number.
-				const int32_t a = TOP_I32(d);
-				const int32_t c = __builtin_ctz(a);
-				SET_I32(d, c);
-				printf("i32.ctz 0x%x 0x%x\n", a, c);
-				break;
-			}
-			case 0x69: // i32.popcnt
-			{   // Not tested
-				// Count number of 1s in a binary number.
-				const int32_t a = TOP_I32(d);
-				const int32_t c = __builtin_popcount(a);
-				SET_I32(d, c);
-				printf("i32.popcnt 0x%x 0x%x\n", a, c);
-				break;
-			}
-			case 0x6a: // i32.add
-			{
-				const int32_t b = POP_I32(d);
-				dbg("i32.add 0x%x 0x%x 0x%x\n", TOP_I32(d), b, TOP_I32(d) + b);
-				SET_I32(d, TOP_I32(d) + b);
-				break;
-			}
-			case 0x6b: // i32.sub
-			{
-				const int32_t b = POP_I32(d);
-				dbg("i32.sub 0x%x 0x%x 0x%x\n", TOP_I32(d), b, TOP_I32(d) + b);
-				SET_I32(d, TOP_I32(d) - b);
-				break;
-			}
-			case 0x6c: // i32.mul
-			{
-				const int32_t b = POP_I32(d);
-				dbg("i32.mul 0x%x 0x%x 0x%x\n", TOP_I32(d), b, TOP_I32(d) + b);
-				SET_I32(d, TOP_I32(d) * b);
-				break;
-			}
-			case 0x6d: // i32.div_s
-			{
-				const int32_t b = POP_I32(d);
-				const int32_t a = TOP_I32(d);
-				if (b == 0)
-				{
-					sprintf(d->exception, "Divide %d by zero", a);
-					return DWAC_DIVIDE_BY_ZERO;
-				}
-				// When examining ref [3], they had some addition check here.
-				// if (a == 0x80000000 && b == -1) {return WA_INTEGER_OVERFLOW;}
-				// https://stackoverflow.com/questions/46378104/why-does-integer-division-by-1-negative-one-result-in-fpe
-				// Don't want undefined behavior so will just replicate that code from ref [3].
-				// Need to do some testing some day.
-				if ((a == 0x80000000) && (b == -1))
-				{
-					sprintf(d->exception, "Integer overflow (a == 0x80000000) && (b == -1).");
-					return DWAC_INTEGER_OVERFLOW;
-				}
-				SET_I32(d, a / b);
-				dbg("i32.div_s 0x%x 0x%x 0x%x\n", a, b, TOP_I32(d));
-				break;
-			}
-			case 0x6e: // i32.div_u
-			{
-				const uint32_t b = POP_U32(d);
-				const uint32_t a = TOP_U32(d);
-				if (b == 0)
-				{
-					sprintf(d->exception, "Divide %u by zero.", a);
-					return DWAC_DIVIDE_BY_ZERO;
-				}
-				SET_U32(d, a / b);
-				dbg("i32.div_u 0x%x 0x%x 0x%x\n", a, b, TOP_I32(d));
-				break;
-			}
-			case 0x6f: // i32.rem_s
-			{
-				const int32_t b = POP_I32(d);
-				const int32_t a = TOP_I32(d);
-				if (b == 0)
-				{
-					sprintf(d->exception, "Divide %d by zero", a);
-					return DWAC_DIVIDE_BY_ZERO;
-				}
-				SET_I32(d, ((a == 0x80000000) && (b == -1)) ? 0 : a % b);
-				dbg("i32.rem_s 0x%x 0x%x 0x%x\n", a, b, TOP_I32(d));
-				break;
-			}
-			case 0x70: // i32.rem_u
-			{
-				const uint32_t b = POP_U32(d);
-				const uint32_t a = TOP_U32(d);
-				if (b == 0)
-				{
-					sprintf(d->exception, "Divide %u by zero.", a);
-					return DWAC_DIVIDE_BY_ZERO;
-				}
-				SET_U32(d, a % b);
-				dbg("i32.rem_u 0x%x 0x%x 0x%x\n", a, b, TOP_I32(d));
-				break;
-			}
-			case 0x71: // i32.and
-			{
-				const uint32_t b = POP_U32(d);
-				dbg("i32.and 0x%x 0x%x 0x%x\n", TOP_I32(d), b, TOP_I32(d) + b);
-				SET_U32(d, TOP_U32(d) & b);
-				break;
-			}
-			case 0x72: // i32.or
-			{
-				const uint32_t b = POP_U32(d);
-				dbg("i32.or 0x%x 0x%x 0x%x\n", TOP_I32(d), b, TOP_I32(d) + b);
-				SET_U32(d, TOP_U32(d) | b);
-				break;
-			}
-			case 0x73: // i32.xor
-			{
-				const int32_t b = POP_I32(d);
-				dbg("i32.xor 0x%x 0x%x 0x%x\n", TOP_I32(d), b, TOP_I32(d) + b);
-				SET_I32(d, TOP_I32(d) ^ b);
-				break;
-			}
-			case 0x74: // i32.shl
-			{
-				const int32_t b = POP_I32(d);
-				dbg("i32.shl 0x%x 0x%x 0x%x\n", TOP_I32(d), b, TOP_I32(d) << b);
-				SET_I32(d, TOP_I32(d) << b);
-				break;
-			}
-			case 0x75: // i32.shr_S
-			{
-				const int32_t b = POP_I32(d);
-				const int32_t a = TOP_I32(d);
-				SET_I32(d, a >> b);
-				dbg("i32.shl 0x%x 0x%x 0x%x\n", a, b, TOP_I32(d));
-				break;
-			}
-			case 0x76: // i32.shr_u
-			{
-				const uint32_t b = POP_U32(d);
-				const uint32_t a = TOP_U32(d);
-				SET_U32(d, a >> b);
-				dbg("i32.shr_u 0x%x 0x%x 0x%x\n", a, b, TOP_I32(d));
-				break;
-			}
-			case 0x77: // i32.rotl
-			{ // not tested.
-				// Rotate left.
-				const uint32_t b = POP_U32(d);
-				const uint32_t a = TOP_U32(d);
-				const uint32_t c = rotl32(a, b);
-				SET_U32(d, c);
-				dbg("i32.rotl 0x%x 0x%x 0x%x\n", a, b, c);
-				break;
-			}
-			case 0x78: // i32.rotr
-			{ // not tested.
-				const uint32_t b = POP_U32(d);
-				const uint32_t a = TOP_U32(d);
-				const uint32_t c = rotr32(a, b);
-				SET_U32(d, c);
-				dbg("i32.rotr 0x%x 0x%x 0x%x\n", a, b, c);
-				break;
-			}
-			case 0x79: // i64.clz
-			{   // Not tested
-				// Count leading zeros  in a binary number.
-				const int64_t a = TOP_I64(d);
-				const int32_t c = __builtin_clzll(a);
-				SET_I32(d, c);
-				dbg("i64.clz 0x%llx %d\n", (long long)a, c);
-				break;
-			}
-			case 0x7a: // i64.ctz
-			{   // Not tested
-				// Count trailing zeros in a binary number.
-				const int64_t a = TOP_I64(d);
-				const int32_t c = __builtin_ctzll(a);
-				SET_I32(d, c);
-				dbg("i64.ctz 0x%llx %d\n", (long long)a, c);
-				break;
-			}
-			case 0x7b: // i64.popcnt
-			{   // Not tested
-				// Count number of 1s in a binary number.
-				const int64_t a = TOP_I64(d);
-				const int32_t c = __builtin_popcountll(a);
-				SET_I32(d, c);
-				dbg("i64.popcnt 0x%llx %d\n", (long long)a, c);
-				break;
-			}
-			case 0x7c: // i64.add
-			{
-				const int64_t b = POP_I64(d);
-				dbg("i64.add 0x%llx 0x%llx 0x%llx\n", (long long)TOP_I64(d), (long long)b, (long long)TOP_I64(d)+b);
-				SET_I64(d, TOP_I64(d) + b);
-				break;
-			}
-			case 0x7d: // i64.sub
-			{
-				const int64_t b = POP_I64(d);
-				dbg("i64.sub 0x%llx 0x%llx 0x%llx\n", (long long)TOP_I64(d), (long long)b, (long long)TOP_I64(d)-b);
-				SET_I64(d, TOP_I64(d) - b);
-				break;
-			}
-			case 0x7e: // i64.mul
-			{
-				const int64_t b = POP_I64(d);
-				dbg("i64.mul 0x%llx 0x%llx 0x%llx\n", (long long)TOP_I64(d), (long long)b, (long long)TOP_I64(d)*b);
-				SET_I64(d, TOP_I64(d) * b);
-				break;
-			}
-			case 0x7f: // i64.div_s
-			{
-				const int64_t b = POP_I64(d);
-				const int64_t a = TOP_I64(d);
-				if (b == 0)
-				{
-					sprintf(d->exception, "Divide %lld by zero", (long long)a);
-					return DWAC_DIVIDE_BY_ZERO;
-				}
-				if ((a == 0x8000000000000000LL) && (b == -1))
-				{
-					sprintf(d->exception, "Integer overflow (a == 0x80000000) && (b == -1).");
-					return DWAC_INTEGER_OVERFLOW;
-				}
-				SET_I64(d, a / b);
-				dbg("i64.div_s 0x%llx 0x%llx 0x%llx\n", (long long unsigned)a, (long long unsigned)b, (long long unsigned)TOP_U64(d));
-				break;
-			}
-			case 0x80: // i64.div_u
-			{
-				const uint64_t b = POP_U64(d);
-				const uint64_t a = TOP_U64(d);
-				if (b == 0)
-				{
-					sprintf(d->exception, "Divide %llu by zero.", (long long unsigned) a);
-					return DWAC_DIVIDE_BY_ZERO;
-				}
-				SET_U64(d, a / b);
-				dbg("i64.div_u 0x%llx 0x%llx 0x%llx\n", (long long unsigned)a, (long long unsigned)b, (long long unsigned)TOP_U64(d));
-				break;
-			}
-			case 0x81: // i64.rem_s
-			{
-				const int64_t b = POP_I64(d);
-				const int64_t a = TOP_I64(d);
-				if (b == 0)
-				{
-					sprintf(d->exception, "Divide %lld by zero", (long long) a);
-					return DWAC_DIVIDE_BY_ZERO;
-				}
-				SET_I64(d, ((a == 0x8000000000000000LL) && (b == -1)) ? 0 : a % b);
-				dbg("i64.rem_s 0x%llx 0x%llx 0x%llx\n", (long long unsigned)a, (long long unsigned)b, (long long unsigned)TOP_U64(d));
-				break;
-			}
-			case 0x82: // i64.rem_u
-			{
-				const uint64_t b = POP_U64(d);
-				const uint64_t a = TOP_U64(d);
-				if (b == 0)
-				{
-					sprintf(d->exception, "Divide %llu by zero.", (long long unsigned) a);
-					return DWAC_DIVIDE_BY_ZERO;
-				}
-				SET_U64(d, a % b);
-				dbg("i64.rem_u 0x%llx 0x%llx 0x%llx\n", (long long unsigned)a, (long long unsigned)b, (long long unsigned)TOP_U64(d));
-				break;
-			}
-			case 0x83: // i64.and
-			{
-				const int64_t b = POP_I64(d);
-				dbg("i64.and 0x%llx 0x%llx 0x%llx\n", (unsigned long long)TOP_U64(d), (unsigned long long)b, (unsigned long long)(TOP_U64(d) & b));
-				SET_I64(d, TOP_I64(d) & b);
-				break;
-			}
-			case 0x84: // i64.or
-			{
-				const int64_t b = POP_I64(d);
-				dbg("i64.or 0x%llx 0x%llx 0x%llx\n", (unsigned long long)TOP_U64(d), (unsigned long long)b, (unsigned long long)(TOP_U64(d) | b));
-				SET_I64(d, TOP_I64(d) | b);
-				break;
-			}
-			case 0x85: // i64.xor
-			{
-				const int64_t b = POP_I64(d);
-				dbg("i64.xor 0x%llx 0x%llx 0x%llx\n", (unsigned long long)TOP_U64(d), (unsigned long long)b, (unsigned long long)(TOP_U64(d) ^ b));
-				SET_I64(d, TOP_I64(d) ^ b);
-				break;
-			}
-			case 0x86: // i64.shl
-			{
-				const int64_t b = POP_I64(d);
-				const int64_t a = TOP_I64(d);
-				SET_I64(d, a << b);
-				dbg("i64.shl 0x%llx 0x%llx 0x%llx\n", (unsigned long long)a, (unsigned long long)b, (unsigned long long)(TOP_U64(d)));
-				break;
-			}
-			case 0x87: // i64.shr_S
-			{
-				const int64_t b = POP_I64(d);
-				const int64_t a = TOP_I64(d);
-				SET_I64(d, a >> b);
-				dbg("i64.shr_S 0x%llx 0x%llx 0x%llx\n", (unsigned long long)a, (unsigned long long)b, (unsigned long long)(TOP_U64(d)));
-				break;
-			}
-			case 0x88: // i64.shr_u
-			{
-				const uint64_t b = POP_U64(d);
-				const uint64_t a = TOP_I64(d);
-				SET_U64(d, a >> b);
-				dbg("i64.shr_u 0x%llx 0x%llx 0x%llx\n", (long long)a, (long long)b, (long long)TOP_I64(d));
-				break;
-			}
-			case 0x89: // i64.rotl
-			{ // not tested.
-				// Rotate left.
-				const uint64_t b = POP_U64(d);
-				const uint64_t a = TOP_U64(d);
-				const uint64_t c = rotl64(a, b);
-				SET_U64(d, c);
-				printf("i64.rotl 0x%llx 0x%llx 0x%llx\n", (unsigned long long)a, (unsigned long long)b, (unsigned long long)c);
-				break;
-			}
-			case 0x8a: // i64.rotr
-			{ // not tested.
-				// Rotate right.
-				const uint64_t b = POP_U64(d);
-				const uint64_t a = TOP_U64(d);
-				const uint64_t c = rotr64(a, b);
-				SET_U64(d, c);
-				printf("i64.rotr 0x%llx 0x%llx 0x%llx\n", (unsigned long long)a, (unsigned long long)b, (unsigned long long)c);
-				break;
-			}
+// Jump (or jcc) forward, returns position of operand to patch with jit_bind.
+static size_t jit_jump_forward(jit_type *j, uint8_t cc)
+{
+	if (cc) {jit_u8(j, 0x0f); jit_u8(j, cc);} else {jit_u8(j, 0xe9);}
+	jit_u32(j, 0);
+	return j->pos - 4;
+}
+
+static void jit_bind(jit_type *j, size_t pos)
+{
+	jit_patch(j, pos, j->pos);
+}
+
+// Jump (or jcc) to a position in register code, see jit_compile.
+static void jit_jump_to_target(jit_type *j, uint8_t cc, uint32_t target)
+{
+	const size_t pos = jit_jump_forward(j, cc);
+	dwac_linear_storage_32_push(&j->fixups, (uint32_t)pos);
+	dwac_linear_storage_32_push(&j->fixups, target);
+}
+
+// mov reg, [r12 + slot] (32 bit loads are zero extended)
+static void jit_load_slot(jit_type *j, uint8_t reg, uint32_t slot, uint8_t is64)
+{
+	jit_u8(j, is64 ? 0x49 : 0x41);
+	jit_u8(j, 0x8b);
+	jit_u8(j, 0x84 | (reg << 3));
+	jit_u8(j, 0x24);
+	jit_u32(j, JIT_SLOT(slot));
+}
 
-			#ifndef SKIP_FLOAT
-			case 0x8b: // f32.abs
-			{
-				const float a = TOP_F32(d);
-				const float c = fabs(a);
-				dbg("f32.abs %g %g\n", a, c);
-				SET_F32(d, c);
-				break;
-			}
-			case 0x8c: // f32.neg
-			{ // not tested
-				const float a = TOP_F32(d);
-				const float c = -a;
-				dbg("f32.neg %g %g\n", a, c);
-				SET_F32(d, c);
-				break;
-			}
-			case 0x8d: // f32.ceil
-			{ // not tested
-				float a = TOP_F32(d);
-				SET_F32(d, ceil(a));
-				dbg("f32.ceil %g %g\n", a, ceil(a));
-				break;
-			}
-			case 0x8e: // f32.floor
-			{
-				float a = TOP_F32(d);
-				SET_F32(d, floor(a));
-				dbg("f32.floor %g %g\n", a, floor(a));
-				break;
-			}
-			case 0x8f: // f32.trunc
-			{ // not tested
-				float a = TOP_F32(d);
-				SET_F32(d, trunc(a));
-				dbg("f32.trunc %g %g\n", a, trunc(a));
-				break;
-			}
-			case 0x90: // f32.nearest
-			{ // not tested
-				float a = TOP_F32(d);
-				SET_F32(d, rint(a));
-				dbg("f32.nearest %g %g\n", a, rint(a));
-				break;
-			}
-			case 0x91: // f32.sqrt
-			{ // not tested
-				float a = TOP_F32(d);
-				SET_F32(d, sqrt(a));
-				dbg("f32.sqrt %g %g\n", a, sqrt(a));
-				break;
-			}
-			case 0x92: // f32.add
-			{
-				const float b = POP_F32(d);
-				const float a = TOP_F32(d);
-				const float c = a + b;
-				dbg("f32.add %g %g %g\n", a,b,c);
-				SET_F32(d, c);
-				break;
-			}
-			case 0x93: // f32.sub
-			{
-				const float b = POP_F32(d);
-				const float a = TOP_F32(d);
-				const float c = a - b;
-				dbg("f32.sub %g %g %g\n", a,b,c);
-				SET_F32(d, c);
-				break;
-			}
-			case 0x94: // f32.mul
-			{
-				const float b = POP_F32(d);
-				const float a = TOP_F32(d);
-				const float c = a * b;
-				dbg("f32.mul %g %g %g\n", a,b,c);
-				SET_F32(d, c);
-				break;
-			}
-			case 0x95: // f32.div
-			{ // not tested
-				const float b = POP_F32(d);
-				const float a = TOP_F32(d);
-				const float c = a / b;
-				dbg("f32.div %g %g %g\n", a,b,c);
-				SET_F32(d, c);
-				break;
-			}
-			case 0x96: // f32.min
-			{ // not tested
-				const float b = POP_F32(d);
-				const float a = TOP_F32(d);
-				const float c = fmin(a, b);
-				SET_F32(d, c);
-				dbg("f32.min %g %g %g\n", a,b,c);
-				break;
-			}
-			case 0x97: // f32.max
-			{ // not tested
-				const float b = POP_F32(d);
-				const float a = TOP_F32(d);
-				const float c = fmax(a, b);
-				SET_F32(d, c);
-				dbg("f32.max %g %g %g\n", a,b,c);
-				break;
-			}
-			case 0x98: // f32.copysign
-			{ // not tested
-				const float b = POP_F32(d);
-				const float a = TOP_F32(d);
-				const float c = signbit(b) ? -fabs(a) : fabs(a);
-				SET_F32(d, c);
-				dbg("f32.copysign %g %g %g\n", a,b,c);
-				break;
-			}
+// mov [r12 + slot], rax
+static void jit_store_slot(jit_type *j, uint32_t slot)
+{
+	JIT_BYTES(j, 0x49, 0x89, 0x84, 0x24);
+	jit_u32(j, JIT_SLOT(slot));
+}
 
-			case 0x99: // f64.abs
-			{
-				const double a = TOP_F64(d);
-				SET_F64(d, fabs(a));
-				dbg("f64.abs %g %g\n", a, TOP_F64(d));
-				break;
-			}
-			case 0x9a: // f64.neg
-				SET_F64(d, -TOP_F64(d));
-				dbg("f64.neg %g\n", TOP_F64(d));
-				break;
-			case 0x9b: // f64.ceil
-				SET_F64(d, ceil(TOP_F64(d)));
-				dbg("f64.ceil %g\n", TOP_F64(d));
-				break;
-			case 0x9c: // f64.floor
-				SET_F64(d, floor(TOP_F64(d)));
-				dbg("f64.floor %g\n", TOP_F64(d));
-				break;
-			case 0x9d: // f64.trunc
-				SET_F64(d, trunc(TOP_F64(d)));
-				dbg("f64.trunc %g\n", TOP_F64(d));
-				break;
-			case 0x9e: // f64.nearest
-				SET_F64(d, rint(TOP_F64(d)));
-				dbg("f64.nearest %g\n", TOP_F64(d));
-				break;
-			case 0x9f: // f64.sqrt
-				SET_F64(d, sqrt(TOP_F64(d)));
-				dbg("f64.sqrt %g\n", TOP_F64(d));
-				break;
+// Call reg_step to run the instruction at pos, go to jit_exit if it fails.
+static void jit_call_step(jit_type *j, uint32_t pos, uint8_t exit_always)
+{
+	JIT_BYTES(j, 0x48, 0x89, 0xdf); // mov rdi, rbx
+	jit_u8(j, 0xbe); jit_u32(j, pos); // mov esi, pos
+	jit_u8(j, 0x48); jit_u8(j, 0xb8); jit_u64(j, (uint64_t)(uintptr_t)reg_step); // mov rax, reg_step
+	JIT_BYTES(j, 0xff, 0xd0); // call rax
+	if (exit_always)
+	{
+		jit_jump_back(j, 0, j->exit_addr);
+	}
+	else
+	{
+		JIT_BYTES(j, 0x85, 0xc0); // test eax, eax
+		jit_jump_back(j, 0x85, j->exit_addr); // jnz
+	}
+}
 
-			case 0xa0: // f64.add
-			{
-				const double b = POP_F64(d);
-				const double a = TOP_F64(d);
-				SET_F64(d, a + b);
-				dbg("f64.add %g %g %g\n", a,b,TOP_F64(d));
-				break;
-			}
-			case 0xa1: // f64.sub
-			{
-				const double b = POP_F64(d);
-				const double a = TOP_F64(d);
-				SET_F64(d, a - b);
-				dbg("f64.sub %g %g %g\n", a,b,TOP_F64(d));
-				break;
-			}
-			case 0xa2: // f64.mul
-			{
-				const double b = POP_F64(d);
-				const double a = TOP_F64(d);
-				SET_F64(d, a * b);
-				dbg("f64.mul %g %g %g\n", a,b,TOP_F64(d));
-				break;
-			}
-			case 0xa3: // f64.div
-			{
-				const double b = POP_F64(d);
-				const double a = TOP_F64(d);
-				SET_F64(d, a / b);
-				dbg("f64.div %g %g %g\n", a,b,TOP_F64(d));
-				break;
-			}
-			case 0xa4: // f64.min
-			{
-				double b = POP_F64(d);
-				double a = TOP_F64(d);
-				SET_F64(d, fmin(a, b));
-				dbg("f64.min %g %g %g\n", a, b, TOP_F64(d));
-				break;
-			}
-			case 0xa5: // f64.max
+// Charge the gas of a branch that is taken. If no more gas (or an
+// interrupt, see GAS_EXHAUSTED), go to jit_gas_exit with esi set to the
+// target, to continue there later.
+static void jit_branch_gas(jit_type *j, uint32_t target, uint32_t gas)
+{
+	JIT_BYTES(j, 0x48, 0x81, 0xab); jit_u32(j, offsetof(dwac_data, gas_meter)); jit_u32(j, gas); // sub qword [rbx + gas_meter], gas
+	#ifdef DWAC_INTERRUPT
+	const size_t slow = jit_jump_forward(j, 0x8e); // jle
+	JIT_BYTES(j, 0x80, 0xbb); jit_u32(j, offsetof(dwac_data, interrupt_requested)); jit_u8(j, 0); // cmp byte [rbx + interrupt_requested], 0
+	const size_t fast = jit_jump_forward(j, 0x84); // je
+	jit_bind(j, slow);
+	#else
+	const size_t fast = jit_jump_forward(j, 0x8f); // jg
+	#endif
+	jit_u8(j, 0xbe); jit_u32(j, target); // mov esi, target
+	jit_jump_back(j, 0, j->gas_exit_addr);
+	jit_bind(j, fast);
+}
+
+// Binary operation on eax and ecx (or rax and rcx), see jit_binary.
+static uint8_t jit_alu_op(uint32_t op, uint8_t *setcc)
+{
+	// Compare instructions 0x46 ... 0x4f and 0x51 ... 0x5a are the same for i32 and i64.
+	static const uint8_t setcc_codes[] = {0x94, 0x95, 0x9c, 0x92, 0x9f, 0x97, 0x9e, 0x96, 0x9d, 0x93};
+	*setcc = 0;
+	if ((op >= 0x46) && (op <= 0x4f)) {*setcc = setcc_codes[op - 0x46]; return 1;}
+	if ((op >= 0x51) && (op <= 0x5a)) {*setcc = setcc_codes[op - 0x51]; return 1;}
+	switch (op)
+	{
+		case 0x6a: case 0x7c: case 0x6b: case 0x7d: case 0x6c: case 0x7e:
+		case 0x71: case 0x83: case 0x72: case 0x84: case 0x73: case 0x85:
+		case 0x74: case 0x86: case 0x75: case 0x87: case 0x76: case 0x88:
+		case 0x77: case 0x89: case 0x78: case 0x8a:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+// dst = a op b, for i32 (result sign extended to 64 bits as in run_register_code) and i64.
+static void jit_binary(jit_type *j, uint32_t op, const uint32_t *ip, uint8_t immediate)
+{
+	const uint8_t is64 = ((op >= 0x51) && (op <= 0x5a)) || (op >= 0x7c);
+	uint8_t setcc;
+	jit_alu_op(op, &setcc);
+	jit_load_slot(j, JIT_RAX, ip[2], is64);
+	if (immediate)
+	{
+		jit_u8(j, 0xb9); jit_u32(j, ip[3]); // mov ecx, imm
+	}
+	else
+	{
+		jit_load_slot(j, JIT_RCX, ip[3], is64);
+	}
+	if (is64) {jit_u8(j, 0x48);}
+	if (setcc)
+	{
+		JIT_BYTES(j, 0x39, 0xc8); // cmp eax, ecx
+		jit_u8(j, 0x0f); jit_u8(j, setcc); jit_u8(j, 0xc0); // setcc al
+		JIT_BYTES(j, 0x0f, 0xb6, 0xc0); // movzx eax, al
+	}
+	else
+	{
+		switch (op)
+		{
+			case 0x6a: case 0x7c: JIT_BYTES(j, 0x01, 0xc8); break; // add eax, ecx
+			case 0x6b: case 0x7d: JIT_BYTES(j, 0x29, 0xc8); break; // sub eax, ecx
+			case 0x6c: case 0x7e: JIT_BYTES(j, 0x0f, 0xaf, 0xc1); break; // imul eax, ecx
+			case 0x71: case 0x83: JIT_BYTES(j, 0x21, 0xc8); break; // and eax, ecx
+			case 0x72: case 0x84: JIT_BYTES(j, 0x09, 0xc8); break; // or eax, ecx
+			case 0x73: case 0x85: JIT_BYTES(j, 0x31, 0xc8); break; // xor eax, ecx
+			case 0x74: case 0x86: JIT_BYTES(j, 0xd3, 0xe0); break; // shl eax, cl
+			case 0x75: case 0x87: JIT_BYTES(j, 0xd3, 0xf8); break; // sar eax, cl
+			case 0x76: case 0x88: JIT_BYTES(j, 0xd3, 0xe8); break; // shr eax, cl
+			case 0x77: case 0x89: JIT_BYTES(j, 0xd3, 0xc0); break; // rol eax, cl
+			case 0x78: case 0x8a: JIT_BYTES(j, 0xd3, 0xc8); break; // ror eax, cl
+			default: assert(0); break;
+		}
+		if (!is64) {JIT_BYTES(j, 0x48, 0x63, 0xc0);} // movsxd rax, eax
+	}
+	jit_store_slot(j, ip[1]);
+}
+
+// Loads and stores, if the page is in the translation cache it is accessed
+// directly, if not reg_step does it (so that memory can grow etc). With
+// DWAC_GUARD_PAGES all are accessed directly.
+static void jit_memory(jit_type *j, uint32_t pos, const uint32_t *ip)
+{
+	const uint32_t op = ip[0];
+	const uint8_t is_store = (op >= 0x36);
+	static const uint8_t sizes[] = {4, 8, 4, 8, 1, 1, 2, 2, 1, 1, 2, 2, 4, 4, 4, 8, 4, 8, 1, 2, 1, 2, 4}; // 0x28 ... 0x3e
+	const uint8_t size = sizes[op - 0x28];
+
+	jit_load_slot(j, JIT_RAX, is_store ? ip[1] : ip[2], 0);
+	jit_u8(j, 0x05); jit_u32(j, ip[3]); // add eax, offset (wraps as in run_register_code)
+	#ifdef DWAC_GUARD_PAGES
+	JIT_BYTES(j, 0x48, 0x8b, 0x8b); jit_u32(j, offsetof(dwac_data, memory.base)); // mov rcx, [rbx + base]
+	#else
+	// As translate_addr_grow_if_needed, rax becomes offset in the page. To
+	// make it shorter accesses that are not aligned take the slow path.
+	JIT_BYTES(j, 0x89, 0xc1); // mov ecx, eax
+	JIT_BYTES(j, 0x89, 0xc2); // mov edx, eax
+	JIT_BYTES(j, 0x81, 0xe1); jit_u32(j, 0xffff0000 | (size - 1)); // and ecx, 0xffff0000 | (size - 1)
+	JIT_BYTES(j, 0xc1, 0xea, 0x10); // shr edx, 16
+	JIT_BYTES(j, 0x83, 0xe2, DWAC_MEMORY_CACHE_SIZE - 1); // and edx, DWAC_MEMORY_CACHE_SIZE - 1
+	JIT_BYTES(j, 0x3b, 0x8c, 0x93); jit_u32(j, offsetof(dwac_data, memory.cache_addr)); // cmp ecx, [rbx + rdx * 4 + cache_addr]
+	const size_t slow = jit_jump_forward(j, 0x85); // jne
+	JIT_BYTES(j, 0x0f, 0xb7, 0xc0); // movzx eax, ax
+	JIT_BYTES(j, 0x48, 0x8b, 0x8c, 0xd3); jit_u32(j, offsetof(dwac_data, memory.cache_array)); // mov rcx, [rbx + rdx * 8 + cache_array]
+	#endif
+	if (is_store)
+	{
+		jit_load_slot(j, JIT_RDX, ip[2], size == 8);
+		switch (size)
+		{
+			case 1: JIT_BYTES(j, 0x88, 0x14, 0x01); break; // mov [rcx + rax], dl
+			case 2: JIT_BYTES(j, 0x66, 0x89, 0x14, 0x01); break; // mov [rcx + rax], dx
+			case 4: JIT_BYTES(j, 0x89, 0x14, 0x01); break; // mov [rcx + rax], edx
+			default: JIT_BYTES(j, 0x48, 0x89, 0x14, 0x01); break; // mov [rcx + rax], rdx
+		}
+	}
+	else
+	{
+		switch (op)
+		{
+			case 0x28: case 0x34: JIT_BYTES(j, 0x48, 0x63, 0x04, 0x01); break; // movsxd rax, dword [rcx + rax]
+			case 0x35: JIT_BYTES(j, 0x8b, 0x04, 0x01); break; // mov eax, [rcx + rax]
+			case 0x29: JIT_BYTES(j, 0x48, 0x8b, 0x04, 0x01); break; // mov rax, [rcx + rax]
+			case 0x2c: case 0x30: JIT_BYTES(j, 0x48, 0x0f, 0xbe, 0x04, 0x01); break; // movsx rax, byte [rcx + rax]
+			case 0x2d: case 0x31: JIT_BYTES(j, 0x0f, 0xb6, 0x04, 0x01); break; // movzx eax, byte [rcx + rax]
+			case 0x2e: case 0x32: JIT_BYTES(j, 0x48, 0x0f, 0xbf, 0x04, 0x01); break; // movsx rax, word [rcx + rax]
+			default: JIT_BYTES(j, 0x0f, 0xb7, 0x04, 0x01); break; // movzx eax, word [rcx + rax]
+		}
+		jit_store_slot(j, ip[1]);
+	}
+	#ifndef DWAC_GUARD_PAGES
+	const size_t done = jit_jump_forward(j, 0);
+	jit_bind(j, slow);
+	jit_call_step(j, pos, 0);
+	jit_bind(j, done);
+	#endif
+}
+
+// Number of words in a register code instruction.
+static uint32_t reg_oplen(const uint32_t *ip)
+{
+	switch (ip[0])
+	{
+		case 0x00: return 1;
+		case 0x0c: return 3;
+		case 0x0e: return 5 + 2 * ip[2];
+		case 0x0f: return 2 + ip[1];
+		case 0x1b: return 5;
+		case 0x0d: case 0x200: return 4;
+		case 0x20: case 0x23: case 0x24: return 3;
+		case 0x45: case 0x50: case 0x67: case 0x68: case 0x69: case 0x79: case 0x7a: case 0x7b:
+		case 0xa7: case 0xac: case 0xad: case 0xc0: case 0xc1: case 0xc2: case 0xc3: case 0xc4:
+			return 3;
+		default: return 4;
+	}
+}
+
+// Emit machine code for one register code instruction.
+static void jit_instruction(jit_type *j, const uint32_t *code, uint32_t pos)
+{
+	const uint32_t *ip = code + pos;
+	const uint32_t op = ip[0];
+	uint8_t setcc;
+	switch (op)
+	{
+		case 0x0c: // br
+			jit_branch_gas(j, ip[1], ip[2]);
+			jit_jump_to_target(j, 0, ip[1]);
+			break;
+		case 0x0d: // br_if
+		case 0x200: // branch if zero
+		{
+			jit_load_slot(j, JIT_RAX, ip[1], 0);
+			JIT_BYTES(j, 0x85, 0xc0); // test eax, eax
+			const size_t not_taken = jit_jump_forward(j, (op == 0x0d) ? 0x84 : 0x85); // jz or jnz
+			jit_branch_gas(j, ip[2], ip[3]);
+			jit_jump_to_target(j, 0, ip[2]);
+			jit_bind(j, not_taken);
+			break;
+		}
+		case 0x0e: // br_table
+			// reg_step does the branch (and gas), then continue where it went.
+			jit_call_step(j, pos, 0);
+			JIT_BYTES(j, 0x8b, 0x83); jit_u32(j, offsetof(dwac_data, pc.pos)); // mov eax, [rbx + pc.pos]
+			jit_u8(j, 0x48); jit_u8(j, 0xb9); jit_u64(j, 0); // mov rcx, jit_offsets (set by jit_compile)
+			dwac_linear_storage_32_push(&j->fixups, (uint32_t)(j->pos - 8));
+			dwac_linear_storage_32_push(&j->fixups, UINT32_MAX);
+			JIT_BYTES(j, 0x8b, 0x04, 0x81); // mov eax, [rcx + rax * 4]
+			JIT_BYTES(j, 0x48, 0x8d, 0x0d); jit_u32(j, (uint32_t)(-(int32_t)(j->pos + 4))); // lea rcx, [jit_entry]
+			JIT_BYTES(j, 0x48, 0x01, 0xc8); // add rax, rcx
+			JIT_BYTES(j, 0xff, 0xe0); // jmp rax
+			break;
+		case 0x0f: // return
+		case 0x00: // unreachable
+			jit_call_step(j, pos, 1);
+			break;
+		case 0x1b: // select
+			jit_load_slot(j, JIT_RCX, ip[4], 0);
+			jit_load_slot(j, JIT_RAX, ip[2], 1);
+			jit_load_slot(j, JIT_RDX, ip[3], 1);
+			JIT_BYTES(j, 0x85, 0xc9); // test ecx, ecx
+			JIT_BYTES(j, 0x48, 0x0f, 0x44, 0xc2); // cmovz rax, rdx
+			jit_store_slot(j, ip[1]);
+			break;
+		case 0x20: // move
+			jit_load_slot(j, JIT_RAX, ip[2], 1);
+			jit_store_slot(j, ip[1]);
+			break;
+		case 0x42: // const
+			jit_u8(j, 0x48); jit_u8(j, 0xb8); jit_u32(j, ip[2]); jit_u32(j, ip[3]); // mov rax, imm64
+			jit_store_slot(j, ip[1]);
+			break;
+		case 0x45: // i32.eqz
+		case 0x50: // i64.eqz
+			jit_load_slot(j, JIT_RAX, ip[2], op == 0x50);
+			if (op == 0x50) {jit_u8(j, 0x48);}
+			JIT_BYTES(j, 0x85, 0xc0, 0x0f, 0x94, 0xc0, 0x0f, 0xb6, 0xc0); // test eax, eax; sete al; movzx eax, al
+			jit_store_slot(j, ip[1]);
+			break;
+		case 0xa7: // i32.wrap_i64
+		case 0xad: // i64.extend_i32_u
+			jit_load_slot(j, JIT_RAX, ip[2], 0);
+			jit_store_slot(j, ip[1]);
+			break;
+		case 0xac: // i64.extend_i32_s
+			jit_load_slot(j, JIT_RAX, ip[2], 0);
+			JIT_BYTES(j, 0x48, 0x63, 0xc0); // movsxd rax, eax
+			jit_store_slot(j, ip[1]);
+			break;
+		case 0x28 ... 0x29: // loads
+		case 0x2c ... 0x35:
+		case 0x36 ... 0x37: // stores
+		case 0x3a ... 0x3e:
+			jit_memory(j, pos, ip);
+			break;
+		default:
+		{
+			// Numeric instructions, those with an immediate are i32 only.
+			const uint8_t immediate = (op & 0x100) != 0;
+			if ((op <= 0x1ff) && jit_alu_op(op & 0xff, &setcc) && (!immediate || ((op & 0xff) <= 0x78)))
 			{
-				double b = POP_F64(d);
-				double a = TOP_F64(d);
-				SET_F64(d, fmax(a, b));
-				dbg("f64.max %g %g %g\n", a, b, TOP_F64(d));
-				break;
-			}
-			case 0xa6: // f64.copysign
-			{ // not tested
-				double b = POP_F64(d);
-				double a = TOP_F64(d);
-				double c = signbit(b) ? -fabs(a) : fabs(a);
-				SET_F64(d, c);
-				dbg("f64.copysign %g %g %g\n", a, b, c);
-				break;
+				jit_binary(j, op & 0xff, ip, immediate);
 			}
-			#endif
-			case 0xa7: // i32.wrap_i64
+			else
 			{
-				// [2] The wrap instruction, is used to convert numbers of type i64
-				// to type i32. If the number is larger than what an i32 can hold
-				// this operation will wrap, resulting in a different number.
-				SET_U64(d, TOP_U64(d) & 0x00000000ffffffff);
-				dbg("i32.wrap_i64 0x%llx\n", (unsigned long long)TOP_U64(d));
-				break;
+				jit_call_step(j, pos, 0);
 			}
+			break;
+		}
+	}
+}
 
-			#ifndef SKIP_FLOAT
-			case 0xa8: // i32.trunc_f32_s
-			{ // not tested
-				const float a = TOP_F32(d);
-				if (isnan(a))
-				{
-					sprintf(d->exception, "Not a number.");
-					return DWAC_INVALID_INTEGER_CONVERSION;
-				}
-				else if ((a > INT32_MAX) || (a < INT32_MIN))
-				{
-					sprintf(d->exception, "Can't convert %g to int32.", a);
-					return DWAC_INTEGER_OVERFLOW;
-				}
-				const int32_t c = a;
-				SET_I32(d, c);
-				dbg("i32.trunc_f32_s %g %d\n", a, c);
-				break;
-			}
-			case 0xa9: // i32.trunc_f32_u
+// A program may be run by instances in different threads, so the machine
+// code is compiled once (by the thread that sets jit_state in progress, see
+// jit_hot) and given to others by jit_code. On x86-64 (needed by DWAC_JIT)
+// these atomic loads and stores are plain moves.
+#define JIT_CODE(f) __atomic_load_n(&(f)->internal_function.jit_code, __ATOMIC_ACQUIRE)
+#define SET_JIT_CODE(f, c) __atomic_store_n(&(f)->internal_function.jit_code, (c), __ATOMIC_RELEASE)
+
+// Compile register code of a function into machine code, see DWAC_JIT.
+static dwac_result jit_compile(dwac_function *f)
+{
+	const uint32_t *code = f->internal_function.reg_code.array;
+	const uint32_t nof = f->internal_function.reg_code.size;
+	jit_type j;
+	memset(&j, 0, sizeof(j));
+	dwac_linear_storage_8_init(&j.buf);
+	dwac_linear_storage_32_init(&j.fixups);
+	dwac_linear_storage_32_type *offsets = &f->internal_function.jit_offsets;
+
+	// jit_entry
+	JIT_BYTES(&j, 0x53, 0x41, 0x54, 0x41, 0x55); // push rbx; push r12; push r13
+	JIT_BYTES(&j, 0x48, 0x89, 0xfb); // mov rbx, rdi
+	JIT_BYTES(&j, 0x49, 0x89, 0xf4); // mov r12, rsi
+	JIT_BYTES(&j, 0xff, 0xe2); // jmp rdx
+
+	// jit_exit
+	j.exit_addr = j.pos;
+	JIT_BYTES(&j, 0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3); // pop r13; pop r12; pop rbx; ret
+
+	// jit_gas_exit
+	j.gas_exit_addr = j.pos;
+	JIT_BYTES(&j, 0x89, 0xb3); jit_u32(&j, offsetof(dwac_data, pc.pos)); // mov [rbx + pc.pos], esi
+	jit_u8(&j, 0xb8); jit_u32(&j, DWAC_NEED_MORE_GAS); // mov eax, DWAC_NEED_MORE_GAS
+	jit_jump_back(&j, 0, j.exit_addr);
+
+	offsets->size = 0;
+	uint32_t pos = 0;
+	while (pos < nof)
+	{
+		while (offsets->size < pos) {dwac_linear_storage_32_push(offsets, UINT32_MAX);}
+		dwac_linear_storage_32_push(offsets, (uint32_t)j.pos);
+		jit_instruction(&j, code, pos);
+		pos += reg_oplen(code + pos);
+	}
+	while (offsets->size < nof) {dwac_linear_storage_32_push(offsets, UINT32_MAX);}
+
+	for (uint32_t i = 0; i < j.fixups.size; i += 2)
+	{
+		const uint32_t target = j.fixups.array[i + 1];
+		if (target == UINT32_MAX)
+		{
+			dwac_linear_storage_8_set_uint64_t(&j.buf, j.fixups.array[i], (uint64_t)(uintptr_t)offsets->array);
+		}
+		else
+		{
+			assert((target < nof) && (offsets->array[target] != UINT32_MAX));
+			jit_patch(&j, j.fixups.array[i], offsets->array[target]);
+		}
+	}
+
+	dwac_result r = DWAC_OK;
+	uint8_t *mem = mmap(NULL, j.pos, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+	{
+		r = DWAC_FEATURE_NOT_SUPPORTED_YET;
+	}
+	else
+	{
+		memcpy(mem, j.buf.array, j.pos);
+		if (mprotect(mem, j.pos, PROT_READ | PROT_EXEC) != 0)
+		{
+			munmap(mem, j.pos);
+			r = DWAC_FEATURE_NOT_SUPPORTED_YET;
+		}
+		else
+		{
+			f->internal_function.jit_size = j.pos;
+			SET_JIT_CODE(f, mem);
+		}
+	}
+	dwac_linear_storage_8_deinit(&j.buf);
+	dwac_linear_storage_32_deinit(&j.fixups);
+	return r;
+}
+
+// Continue running a compiled function where register code is at now (d->pc.pos).
+static dwac_result jit_run(dwac_data *d, const dwac_function *f)
+{
+	uint8_t *jit_code = JIT_CODE(f);
+	const uint32_t offset = f->internal_function.jit_offsets.array[d->pc.pos];
+	assert(offset != UINT32_MAX);
+	const jit_func_ptr entry = (jit_func_ptr)(void*) jit_code;
+	return entry(d, &d->stack[d->fp], jit_code + offset);
+}
+
+// Count a call or branch in register code. Returns true if the function
+// got compiled now (by this thread). The count is not exact if threads
+// count at the same time, that only makes it a little later.
+static inline int jit_hot(dwac_function *f)
+{
+	if (__atomic_load_n(&f->internal_function.jit_state, __ATOMIC_RELAXED) != dwac_translation_not_started) {return 0;}
+	const uint32_t hotness = __atomic_load_n(&f->internal_function.jit_hotness, __ATOMIC_RELAXED) + 1;
+	__atomic_store_n(&f->internal_function.jit_hotness, hotness, __ATOMIC_RELAXED);
+	if (hotness < DWAC_JIT_THRESHOLD) {return 0;}
+	uint8_t state = dwac_translation_not_started;
+	if (!__atomic_compare_exchange_n(&f->internal_function.jit_state, &state, dwac_translation_in_progress, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {return 0;}
+	const dwac_result r = jit_compile(f);
+	__atomic_store_n(&f->internal_function.jit_state, dwac_translation_done, __ATOMIC_RELEASE);
+	return r == DWAC_OK;
+}
+#endif
+
+#ifdef DWAC_REGISTER_CODE
+// If the function now running is register code, see dwac_setup_function_call.
+#define IN_REGISTER_CODE(d) (((const dwac_call_stack_entry*) dwac_linear_storage_size_top(&(d)->call_stack))->call_type == dwac_block_type_register_func)
+
+// Register code instructions (see reg_translate_function), operands are ip[1], ip[2] etc.
+#define REG_I32_BINARY(op, expr) \
+	case op: {const uint32_t a = slots[ip[2]].u32; const uint32_t b = slots[ip[3]].u32; slots[ip[1]].s64 = (int32_t) (expr); ip += 4; break;} \
+	case 0x100 | op: {const uint32_t a = slots[ip[2]].u32; const uint32_t b = ip[3]; slots[ip[1]].s64 = (int32_t) (expr); ip += 4; break;}
+#define REG_I64_BINARY(op, expr) \
+	case op: {const uint64_t a = slots[ip[2]].u64; const uint64_t b = slots[ip[3]].u64; slots[ip[1]].u64 = (expr); ip += 4; break;}
+#define REG_I32_UNARY(op, expr) \
+	case op: {const uint32_t a = slots[ip[2]].u32; slots[ip[1]].s64 = (int32_t) (expr); ip += 3; break;}
+#define REG_I64_UNARY(op, expr) \
+	case op: {const uint64_t a = slots[ip[2]].u64; slots[ip[1]].u64 = (uint64_t) (expr); ip += 3; break;}
+#define REG_LOAD(op, type, get, field) \
+	case op: {const type v = get(d, slots[ip[2]].u32 + ip[3]); slots[ip[1]].field = v; ip += 4; break;}
+#define REG_STORE(op, set, field) \
+	case op: {set(d, slots[ip[1]].u32 + ip[3], slots[ip[2]].field); ip += 4; break;}
+
+// Save position in register code and return, it can be continued later.
+#define REG_EXIT(result) {d->pc.pos = ip - code; return result;}
+#ifdef DWAC_JIT
+// Count branches, compile the function and continue in machine code when it is hot.
+#define REG_HOT() {if ((!one_step) && jit_hot(f)) {d->pc.pos = ip - code; return jit_run(d, f);}}
+#else
+#define REG_HOT()
+#endif
+#define REG_GAS(gas) {d->gas_meter -= (int32_t) (gas); if (GAS_EXHAUSTED(d->gas_meter)) {REG_EXIT(DWAC_NEED_MORE_GAS);} REG_HOT();}
+
+// Run register code until the function returns (then DWAC_OK), more gas
+// is needed or some error. If one_step is set only one instruction is run
+// (then DWAC_OK also), see reg_step.
+static inline __attribute__((always_inline)) dwac_result reg_run(dwac_data *d, const uint8_t one_step)
+{
+	dwac_value_type *slots = &d->stack[d->fp];
+	const uint32_t *code = d->pc.array;
+	const uint32_t *ip = code + d->pc.pos;
+	#ifdef DWAC_JIT
+	dwac_function *f = NULL;
+	if (!one_step)
+	{
+		const dwac_call_stack_entry *e = (const dwac_call_stack_entry*) dwac_linear_storage_size_top(&d->call_stack);
+		f = &d->p->funcs_vector.functions_array[e->func_idx];
+		if (JIT_CODE(f) != NULL) {return jit_run(d, f);}
+		REG_HOT();
+	}
+	#endif
+	for(;;)
+	{
+		COUNT_OPCODE();
+		switch (ip[0])
+		{
+			case 0x00: // unreachable
+				sprintf(d->exception, "%s", "unreachable");
+				REG_EXIT(DWAC_OP_CODE_ZERO);
+			case 0x0c: // br
 			{
-				const float a = TOP_F32(d);
-				if (isnan(a))
-				{
-					sprintf(d->exception, "Not a number.");
-					return DWAC_INVALID_INTEGER_CONVERSION;
-				}
-				else if ((a > UINT32_MAX) || (a < (float)0.0))
-				{
-					sprintf(d->exception, "Can't convert %g to uint32.", a);
-					return DWAC_INTEGER_OVERFLOW;
-				}
-				SET_U32(d, a);
-				dbg("i32.trunc_f32_u %g %u\n", a, TOP_U32(d));
+				const uint32_t gas = ip[2];
+				ip = code + ip[1];
+				REG_GAS(gas);
 				break;
 			}
-			case 0xaa: // i32.trunc_f64_s
-			{ // not tested
-				const double a = TOP_F64(d);
-				if (isnan(a))
+			case 0x0d: // br_if
+				if (slots[ip[1]].u32)
 				{
-					sprintf(d->exception, "Not a number.");
-					return DWAC_INVALID_INTEGER_CONVERSION;
+					const uint32_t gas = ip[3];
+					ip = code + ip[2];
+					REG_GAS(gas);
 				}
-				else if ((a > INT32_MAX) || (a < INT32_MIN))
+				else
 				{
-					sprintf(d->exception, "Can't convert %g to int32.", a);
-					return DWAC_INTEGER_OVERFLOW;
+					ip += 4;
 				}
-				const int32_t c = a;
-				SET_I32(d, c);
-				dbg("i32.trunc_f64_s %g %d\n", a, c);
 				break;
-			}
-			case 0xab: // i32.trunc_f64_u
-			{
-				const double a = TOP_F64(d);
-				if (isnan(a))
+			case 0x200: // branch if zero
+				if (!slots[ip[1]].u32)
 				{
-					sprintf(d->exception, "Not a number.");
-					return DWAC_INVALID_INTEGER_CONVERSION;
+					const uint32_t gas = ip[3];
+					ip = code + ip[2];
+					REG_GAS(gas);
 				}
-				else if ((a > UINT32_MAX) || (a < 0.0))
+				else
 				{
-					sprintf(d->exception, "Can't convert %g to uint32.", a);
-					return DWAC_INTEGER_OVERFLOW;
+					ip += 4;
 				}
-				SET_U32(d, a);
-				dbg("i32.trunc_f64_u %g %u\n", a, TOP_U32(d));
-				break;
-			}
-			#endif
-			case 0xac: // i64.extend_i32_s
-			{
-				// [2] The extend instructions, are used to convert (extend) numbers of type
-				// i32 to type i64. There are signed and unsigned versions of this instruction.
-				const int32_t a = TOP_I32(d);
-				SET_I64(d, (int64_t)a);
-				dbg("i64.extend_i32_s %d %lld\n", a, (long long)TOP_I64(d));
 				break;
-			}
-			case 0xad: // i64.extend_i32_u
+			case 0x0e: // br_table
 			{
-				uint32_t a = TOP_U32(d);
-				SET_U64(d, (uint64_t)a);
-				dbg("i64.extend_i32_u 0x%x 0x%llx\n", a, (unsigned long long)TOP_U64(d));
-				break;
-			}
-
-			#ifndef SKIP_FLOAT
-			case 0xae: // i64.trunc_f32_s
-			{ // not tested
-				const float a = TOP_F32(d);
-				if (isnan(a))
-				{
-					sprintf(d->exception, "Not a number.");
-					return DWAC_INVALID_INTEGER_CONVERSION;
-				}
-				else if ((a > INT64_MAX) || (a < INT64_MIN))
-				{
-					sprintf(d->exception, "Can't convert %g to int64.", a);
-					return DWAC_INTEGER_OVERFLOW;
-				}
-				const int64_t c = a;
-				SET_I64(d, c);
-				dbg("i64.trunc_f32_s %g %lld\n", a, (long long)c);
-				break;
-			}
-			case 0xaf: // i64.trunc_f32_u
-			{ // not tested
-				const double a = TOP_F32(d);
-				if (isnan(a))
-				{
-					sprintf(d->exception, "Not a number.");
-					return DWAC_INVALID_INTEGER_CONVERSION;
-				}
-				else if ((a > UINT64_MAX) || (a < 0.0))
-				{
-					sprintf(d->exception, "Can't convert %g to uint64.", a);
-					return DWAC_INTEGER_OVERFLOW;
-				}
-				const uint64_t c = a;
-				SET_U64(d, c);
-				dbg("i64.trunc_f32_u %g %llu\n", a, (unsigned long long)c);
-				break;
-			}
-			case 0xb0: // i64.trunc_f64_s
-			{ // not tested
-				const double a = TOP_F64(d);
-				if (isnan(a))
-				{
-					sprintf(d->exception, "Not a number.");
-					return DWAC_INVALID_INTEGER_CONVERSION;
-				}
-				else if (a > INT64_MAX || a < INT64_MIN)
-				{
-					sprintf(d->exception, "Can't convert %g to int64.", a);
-					return DWAC_INTEGER_OVERFLOW;
-				}
-				const int64_t c = a;
-				SET_I64(d, c);
-				dbg("i64.trunc_f64_s %g %llu\n", a, (long long)c);
+				const uint32_t idx = slots[ip[1]].u32;
+				const uint32_t n = ip[2];
+				const uint32_t *entry = ip + 3 + 2 * ((idx < n) ? idx : n);
+				ip = code + entry[0];
+				REG_GAS(entry[1]);
 				break;
 			}
-			case 0xb1: // i64.trunc_f64_u
+			case 0x0f: // return
 			{
-				const double a = TOP_F64(d);
-				if (isnan(a))
+				// Same as end of a function in dwac_tick. The results are
+				// put where the parameters were, that is first in frame.
+				const uint32_t n = ip[1];
+				dwac_value_type results[8];
+				for (uint32_t i = 0; i < n; i++)
 				{
-					sprintf(d->exception, "Not a number.");
-					return DWAC_INVALID_INTEGER_CONVERSION;
+					results[i] = slots[ip[2 + i]];
 				}
-				else if ((a > UINT64_MAX) || (a <= -0.5))
+				for (uint32_t i = 0; i < n; i++)
 				{
-					sprintf(d->exception, "Can't convert %g to uint64.", TOP_F64(d));
-					return DWAC_INTEGER_OVERFLOW;
+					slots[i] = results[i];
 				}
-				const uint64_t c = a;
-				SET_U64(d, c);
-				dbg("i64.trunc_f64_u %g %llu\n", a, (unsigned long long)c);
-				break;
-			}
-			case 0xb2: // f32.convert_i32_s
-			{
-				int32_t a = TOP_I32(d);
-				SET_F32I(d, a);
-				dbg("f32.convert_i32_s 0x%x %g\n", a, TOP_F32(d));
-				break;
-			}
-			case 0xb3: // f32.convert_i32_u
-			{// not tested
-				SET_F32(d, TOP_U64(d));
-				dbg("f32.convert_i32_u %g\n", TOP_F32(d));
-				break;
-			}
-			case 0xb4: // f32.convert_i64_s
-				SET_F32(d, TOP_I64(d));
-				dbg("f32.convert_i64_s %g\n", TOP_F32(d));
-				break;
-			case 0xb5: // f32.convert_i64_u
-				SET_F32(d, TOP_U64(d));
-				dbg("f32.convert_i64_u %g\n", TOP_F32(d));
-				break;
-			case 0xb6: // f32.demote_f64
-			{
-				const double a = TOP_F64(d);
-				const float b = a;
-				SET_F32(d, b);
-				dbg("f32.demote_f64 %g\n", TOP_F32(d));
-				break;
-			}
-			case 0xb7: // f64.convert_i32_s
-				SET_F64(d, TOP_I32(d));
-				dbg("f64.convert_i32_s %g\n", TOP_F64(d));
-				break;
-			case 0xb8: // f64.convert_i32_u
-				SET_F64(d, TOP_U32(d));
-				dbg("f64.convert_i32_u %g\n", TOP_F64(d));
-				break;
-			case 0xb9: // f64.convert_i64_s
-				SET_F64(d, TOP_I64(d));
-				dbg("f64.convert_i64_s %g\n", TOP_F64(d));
-				break;
-			case 0xba: // f64.convert_i64_u
-				SET_F64(d, TOP_U64(d));
-				dbg("f64.convert_i64_u %g\n", TOP_F64(d));
-				break;
-			case 0xbb: // f64.promote_f32
-			{
-				const float a = TOP_F32(d);
-				const double b = a;
-				SET_F64(d, b);
-				dbg("f64.promote_f32 %g\n", TOP_F64(d));
-				break;
-			}
-			case 0xbc: // i32.reinterpret_f32
-			{// not tested
-				// [2] The reinterpret instructions, are used to reinterpret the bits of a number as a different type.
-				// do nothing.
-				dbg("i32.reinterpret_f32 0x%x %g\n", TOP_I32(d), TOP_F32(d));
-				break;
-			}
-			case 0xbd: // i64.reinterpret_f64
-			{
-				// do nothing.
-				dbg("i64.reinterpret_f64 0x%llx %g\n", (long long unsigned)TOP_I64(d), TOP_F64(d));
-				break;
+				const dwac_call_stack_entry *e = (dwac_call_stack_entry*) dwac_linear_storage_size_pop(&d->call_stack);
+				d->sp = e->stack_pointer + n;
+				d->fp = e->frame_pointer;
+				d->pc = e->return_pc;
+				return DWAC_OK;
 			}
-			case 0xbe: // f32.reinterpret_i32
-			{   // not tested
-				// do nothing.
-				dbg("f32.reinterpret_i32 0x%x %g\n", TOP_I32(d), TOP_F32(d));
-				break;
-			}
-			case 0xbf: // f64.reinterpret_i64
-			{   // not tested
-				// do nothing.
-				dbg("f64.reinterpret_i64 0x%llx %g\n", (long long unsigned)TOP_I64(d), TOP_F64(d));
+			case 0x1b: // select
+				slots[ip[1]] = slots[ip[4]].u32 ? slots[ip[2]] : slots[ip[3]];
+				ip += 5;
 				break;
-			}
-			#endif
-			#if 1
-			// https://github.com/WebAssembly/sign-extension-ops/blob/master/proposals/sign-extension-ops/Overview.md
-			case 0xc0: // i32.extend8_s
-			{ // not tested
-				int8_t a = TOP_I32(d);
-				SET_I32(d, a);
+			case 0x20: // move
+				slots[ip[1]] = slots[ip[2]];
+				ip += 3;
 				break;
-			}
-			case 0xc1: // i32.extend16_s
-			{ // not tested
-				int16_t a = TOP_I32(d);
-				SET_I32(d, a);
+			case 0x23: // global.get
+				if (ip[2] >= d->globals.size) {REG_EXIT(DWAC_GLOBAL_IDX_OUT_OF_RANGE);}
+				slots[ip[1]].u64 = d->globals.array[ip[2]];
+				ip += 3;
 				break;
-			}
-			case 0xc2: // i64.extend8_s
-			{ // not tested
-				int8_t a = TOP_I64(d);
-				SET_I64(d, a);
+			case 0x24: // global.set
+				if (ip[2] >= d->globals.size) {REG_EXIT(DWAC_GLOBAL_IDX_OUT_OF_RANGE);}
+				d->globals.array[ip[2]] = slots[ip[1]].u64;
+				ip += 3;
+				break;
+			REG_LOAD(0x28, int32_t, translate_get_int32, s64) // i32.load
+			REG_LOAD(0x29, int64_t, translate_get_int64, s64) // i64.load
+			REG_LOAD(0x2c, int8_t, translate_get_int8, s64) // i32.load8_s
+			REG_LOAD(0x2d, uint8_t, translate_get_int8, u64) // i32.load8_u
+			REG_LOAD(0x2e, int16_t, translate_get_int16, s64) // i32.load16_s
+			REG_LOAD(0x2f, uint16_t, translate_get_int16, u64) // i32.load16_u
+			REG_LOAD(0x30, int8_t, translate_get_int8, s64) // i64.load8_s
+			REG_LOAD(0x31, uint8_t, translate_get_int8, u64) // i64.load8_u
+			REG_LOAD(0x32, int16_t, translate_get_int16, s64) // i64.load16_s
+			REG_LOAD(0x33, uint16_t, translate_get_int16, u64) // i64.load16_u
+			REG_LOAD(0x34, int32_t, translate_get_int32, s64) // i64.load32_s
+			REG_LOAD(0x35, uint32_t, translate_get_int32, u64) // i64.load32_u
+			REG_STORE(0x36, translate_set_int32, s32) // i32.store
+			REG_STORE(0x37, translate_set_int64, s64) // i64.store
+			REG_STORE(0x3a, translate_set_int8, s32) // i32.store8
+			REG_STORE(0x3b, translate_set_int16, s32) // i32.store16
+			REG_STORE(0x3c, translate_set_int8, s32) // i64.store8
+			REG_STORE(0x3d, translate_set_int16, s32) // i64.store16
+			REG_STORE(0x3e, translate_set_int32, s32) // i64.store32
+			case 0x42: // const
+				slots[ip[1]].u64 = ip[2] | ((uint64_t) ip[3] << 32);
+				ip += 4;
+				break;
+			REG_I32_UNARY(0x45, a == 0) // i32.eqz
+			REG_I32_BINARY(0x46, a == b) // i32.eq
+			REG_I32_BINARY(0x47, a != b) // i32.ne
+			REG_I32_BINARY(0x48, (int32_t) a < (int32_t) b) // i32.lt_s
+			REG_I32_BINARY(0x49, a < b) // i32.lt_u
+			REG_I32_BINARY(0x4a, (int32_t) a > (int32_t) b) // i32.gt_s
+			REG_I32_BINARY(0x4b, a > b) // i32.gt_u
+			REG_I32_BINARY(0x4c, (int32_t) a <= (int32_t) b) // i32.le_s
+			REG_I32_BINARY(0x4d, a <= b) // i32.le_u
+			REG_I32_BINARY(0x4e, (int32_t) a >= (int32_t) b) // i32.ge_s
+			REG_I32_BINARY(0x4f, a >= b) // i32.ge_u
+			REG_I64_UNARY(0x50, a == 0) // i64.eqz
+			REG_I64_BINARY(0x51, a == b) // i64.eq
+			REG_I64_BINARY(0x52, a != b) // i64.ne
+			REG_I64_BINARY(0x53, (int64_t) a < (int64_t) b) // i64.lt_s
+			REG_I64_BINARY(0x54, a < b) // i64.lt_u
+			REG_I64_BINARY(0x55, (int64_t) a > (int64_t) b) // i64.gt_s
+			REG_I64_BINARY(0x56, a > b) // i64.gt_u
+			REG_I64_BINARY(0x57, (int64_t) a <= (int64_t) b) // i64.le_s
+			REG_I64_BINARY(0x58, a <= b) // i64.le_u
+			REG_I64_BINARY(0x59, (int64_t) a >= (int64_t) b) // i64.ge_s
+			REG_I64_BINARY(0x5a, a >= b) // i64.ge_u
+			REG_I32_UNARY(0x67, a ? __builtin_clz(a) : 32) // i32.clz
+			REG_I32_UNARY(0x68, a ? __builtin_ctz(a) : 32) // i32.ctz
+			REG_I32_UNARY(0x69, __builtin_popcount(a)) // i32.popcnt
+			REG_I32_BINARY(0x6a, a + b) // i32.add
+			REG_I32_BINARY(0x6b, a - b) // i32.sub
+			REG_I32_BINARY(0x6c, a * b) // i32.mul
+			case 0x6d: // i32.div_s
+			{
+				const int32_t a = slots[ip[2]].s32;
+				const int32_t b = slots[ip[3]].s32;
+				if (b == 0)
+				{
+					sprintf(d->exception, "Divide %d by zero", a);
+					REG_EXIT(DWAC_DIVIDE_BY_ZERO);
+				}
+				if ((a == INT32_MIN) && (b == -1))
+				{
+					sprintf(d->exception, "Integer overflow (a == 0x80000000) && (b == -1).");
+					REG_EXIT(DWAC_INTEGER_OVERFLOW);
+				}
+				slots[ip[1]].s64 = a / b;
+				ip += 4;
 				break;
 			}
-			case 0xc3: // i64.extend16_s
-			{ // not tested
-				int16_t a = TOP_I64(d);
-				SET_I64(d, a);
+			case 0x6e: // i32.div_u
+			case 0x70: // i32.rem_u
+			{
+				const uint32_t a = slots[ip[2]].u32;
+				const uint32_t b = slots[ip[3]].u32;
+				if (b == 0)
+				{
+					sprintf(d->exception, "Divide %u by zero.", a);
+					REG_EXIT(DWAC_DIVIDE_BY_ZERO);
+				}
+				slots[ip[1]].u64 = (ip[0] == 0x6e) ? a / b : a % b;
+				ip += 4;
 				break;
 			}
-			case 0xc4: // i64.extend32_s
-			{ // not tested
-				int32_t a = TOP_I64(d);
-				SET_I64(d, a);
+			case 0x6f: // i32.rem_s
+			{
+				const int32_t a = slots[ip[2]].s32;
+				const int32_t b = slots[ip[3]].s32;
+				if (b == 0)
+				{
+					sprintf(d->exception, "Divide %d by zero", a);
+					REG_EXIT(DWAC_DIVIDE_BY_ZERO);
+				}
+				slots[ip[1]].s64 = ((a == INT32_MIN) && (b == -1)) ? 0 : a % b;
+				ip += 4;
+				break;
+			}
+			REG_I32_BINARY(0x71, a & b) // i32.and
+			REG_I32_BINARY(0x72, a | b) // i32.or
+			REG_I32_BINARY(0x73, a ^ b) // i32.xor
+			REG_I32_BINARY(0x74, a << (b & 31)) // i32.shl
+			REG_I32_BINARY(0x75, (int32_t) a >> (b & 31)) // i32.shr_s
+			REG_I32_BINARY(0x76, a >> (b & 31)) // i32.shr_u
+			REG_I32_BINARY(0x77, rotl32(a, b)) // i32.rotl
+			REG_I32_BINARY(0x78, rotr32(a, b)) // i32.rotr
+			REG_I64_UNARY(0x79, a ? __builtin_clzll(a) : 64) // i64.clz
+			REG_I64_UNARY(0x7a, a ? __builtin_ctzll(a) : 64) // i64.ctz
+			REG_I64_UNARY(0x7b, __builtin_popcountll(a)) // i64.popcnt
+			REG_I64_BINARY(0x7c, a + b) // i64.add
+			REG_I64_BINARY(0x7d, a - b) // i64.sub
+			REG_I64_BINARY(0x7e, a * b) // i64.mul
+			case 0x7f: // i64.div_s
+			{
+				const int64_t a = slots[ip[2]].s64;
+				const int64_t b = slots[ip[3]].s64;
+				if (b == 0)
+				{
+					sprintf(d->exception, "Divide %lld by zero", (long long)a);
+					REG_EXIT(DWAC_DIVIDE_BY_ZERO);
+				}
+				if ((a == INT64_MIN) && (b == -1))
+				{
+					sprintf(d->exception, "Integer overflow (a == 0x80000000) && (b == -1).");
+					REG_EXIT(DWAC_INTEGER_OVERFLOW);
+				}
+				slots[ip[1]].s64 = a / b;
+				ip += 4;
 				break;
 			}
-			#endif
-			case 0xfc: // memory.init. data.drop, memory.copy, memory.fill
+			case 0x80: // i64.div_u
+			case 0x82: // i64.rem_u
 			{
-				// 5.4.7. Numeric Instructions
-				// The saturating truncation instructions all have a one byte prefix,
-				// whereas the actual opcode is encoded by a variable-length unsigned integer.
-				const uint32_t actual_opcode = leb_read(&d->pc, 32);
-				sprintf(d->exception, "0x%x", actual_opcode);
-				// TODO
-				return DWAC_SATURATING_NOT_SUPPORTED_YET;
+				const uint64_t a = slots[ip[2]].u64;
+				const uint64_t b = slots[ip[3]].u64;
+				if (b == 0)
+				{
+					sprintf(d->exception, "Divide %llu by zero.", (long long unsigned) a);
+					REG_EXIT(DWAC_DIVIDE_BY_ZERO);
+				}
+				slots[ip[1]].u64 = (ip[0] == 0x80) ? a / b : a % b;
+				ip += 4;
+				break;
 			}
-			case 0xfd:
+			case 0x81: // i64.rem_s
 			{
-				// [1] 5.4.8. Vector Instructions
-				//     All variants of vector instructions are represented by separate byte codes.
-				//     They all have a one byte prefix, whereas the actual opcode is encoded by a
-				//     variable-length unsigned integer.
-				// So the one byte is probably the opcode (0xfd). Then follows a LEB.
-				uint32_t memarg = leb_read(&d->pc, 32);
-				// TODO This is like an entire additional instruction set.
-				sprintf(d->exception, "No vectors implemented 0x%x 0x%x", opcode, memarg);
-				return DWAC_VECTORS_NOT_SUPPORTED;
-			}
+				const int64_t a = slots[ip[2]].s64;
+				const int64_t b = slots[ip[3]].s64;
+				if (b == 0)
+				{
+					sprintf(d->exception, "Divide %lld by zero", (long long) a);
+					REG_EXIT(DWAC_DIVIDE_BY_ZERO);
+				}
+				slots[ip[1]].s64 = ((a == INT64_MIN) && (b == -1)) ? 0 : a % b;
+				ip += 4;
+				break;
+			}
+			REG_I64_BINARY(0x83, a & b) // i64.and
+			REG_I64_BINARY(0x84, a | b) // i64.or
+			REG_I64_BINARY(0x85, a ^ b) // i64.xor
+			REG_I64_BINARY(0x86, a << (b & 63)) // i64.shl
+			REG_I64_BINARY(0x87, (int64_t) a >> (b & 63)) // i64.shr_s
+			REG_I64_BINARY(0x88, a >> (b & 63)) // i64.shr_u
+			REG_I64_BINARY(0x89, rotl64(a, b)) // i64.rotl
+			REG_I64_BINARY(0x8a, rotr64(a, b)) // i64.rotr
+			REG_I64_UNARY(0xa7, (uint32_t) a) // i32.wrap_i64
+			REG_I64_UNARY(0xac, (int32_t) a) // i64.extend_i32_s
+			REG_I64_UNARY(0xad, (uint32_t) a) // i64.extend_i32_u
+			REG_I32_UNARY(0xc0, (int8_t) a) // i32.extend8_s
+			REG_I32_UNARY(0xc1, (int16_t) a) // i32.extend16_s
+			REG_I64_UNARY(0xc2, (int8_t) a) // i64.extend8_s
+			REG_I64_UNARY(0xc3, (int16_t) a) // i64.extend16_s
+			REG_I64_UNARY(0xc4, (int32_t) a) // i64.extend32_s
 			default:
-				sprintf(d->exception, "unrecognized opcode 0x%x", opcode);
-				return DWAC_UNKNOWN_OPCODE;
+				sprintf(d->exception, "unrecognized register code 0x%x", ip[0]);
+				REG_EXIT(DWAC_UNKNOWN_OPCODE);
+		}
+		if (one_step) {REG_EXIT(DWAC_OK);}
+	}
+}
+
+static dwac_result run_register_code(dwac_data *d)
+{
+	return reg_run(d, 0);
+}
+
+#ifdef DWAC_JIT
+// Run the register code instruction at pos, used by machine code, see jit_call_step.
+static dwac_result reg_step(dwac_data *d, uint32_t pos)
+{
+	d->pc.pos = pos;
+	return reg_run(d, 1);
+}
+#endif
+#endif
+
+// Opcode dispatch in dwac_tick, see DWAC_COMPUTED_GOTO.
+// Both variants use the same handlers. A handler begins with OPCODE(n) instead
+// of "case n" and ends with NEXT_OPCODE() instead of "break". With computed goto
+// each handler jumps directly to the handler of the next opcode.
+#if defined(DWAC_COMPUTED_GOTO) && defined(__GNUC__)
+#define USE_COMPUTED_GOTO
+#define OPCODE(n) case n: op_##n
+#define OPCODE_DEFAULT default: op_default
+#define NEXT_OPCODE() {FETCH_OPCODE(); goto *dispatch_table[opcode];}
+#else
+#define OPCODE(n) case n
+#define OPCODE_DEFAULT default
+#define NEXT_OPCODE() break
+#endif
+
+#define FETCH_OPCODE() {assert(s->pc.pos < s->pc.nof); opcode = code_read_u32(&s->pc); COUNT_OPCODE(); dbg("<%02x> ", opcode);}
+
+// While running, dwac_tick keeps the program counter, stack pointer, frame
+// pointer, stack base and gas meter in local variables (the struct pointed
+// to by s) instead of using the fields in dwac_data for every opcode. The
+// compiler can then keep them in CPU registers. The stack macros (PUSH, POP,
+// TOP etc) work on s as they do on dwac_data.
+//
+// With DWAC_TOS_CACHE the value on top of stack is kept in tos. The stack
+// memory at sp is then not up to date, TICK_SPILL writes tos to it and
+// TICK_FILL reads tos from it. Code in dwac_tick that reads the stack memory
+// directly (such as local variables, which may be at top of stack) must
+// spill first. The tos is an integer and not a dwac_value_type since the
+// compiler will not keep a union in a register when it is accessed as
+// different types.
+//
+// Anything outside dwac_tick uses the fields in dwac_data so TICK_SAVE must
+// be done before calling imported functions, dwac_setup_function_call and
+// register code (and TICK_LOAD after) and before returning.
+typedef struct
+{
+	dwac_code_reader_type pc;
+	dwac_stack_pointer_type sp;
+	dwac_stack_pointer_type fp;
+	long gas_meter;
+	dwac_value_type *stack;
+	#ifdef DWAC_TOS_CACHE
+	uint64_t tos;
+	#endif
+} dwac_tick_state_type;
+
+#ifdef DWAC_TOS_CACHE
+#define TICK_SPILL() {s->stack[SP_MASK(s->sp)].u64 = s->tos;}
+#define TICK_FILL() {s->tos = s->stack[SP_MASK(s->sp)].u64;}
+
+static inline dwac_value_type tick_pop(dwac_tick_state_type *s)
+{
+	const dwac_value_type v = {.u64 = s->tos};
+	s->sp--;
+	TICK_FILL();
+	return v;
+}
+
+// The stack macros used by dwac_tick, the ones for dwac_data are restored
+// after it. TOP is not an lvalue here, use SET_xxx to change top of stack.
+#undef PUSH
+#undef POP
+#undef TOP
+#undef PUSH_VALUE
+#undef SET_VALUE
+#define POP(s) (tick_pop(s))
+#define TOP(s) ((const dwac_value_type){.u64 = (s)->tos})
+#define SET_VALUE(s, m, v) {dwac_value_type tos_value = TOP(s); tos_value.m = v; (s)->tos = tos_value.u64;}
+#define PUSH_VALUE(s, m, v) {TICK_PUSH_SLOT(); SET_VALUE(s, m, v)}
+#else
+#define TICK_SPILL()
+#define TICK_FILL()
+#endif
+
+// Push a value that is not yet known, set it with SET_xxx. Use this
+// instead of PUSH_xxx if the value is read from the stack memory.
+#define TICK_PUSH_SLOT() {TICK_SPILL(); s->sp++;}
+
+// Branch to a target found by find_blocks_in_code: the address, the stack
+// pointer of the label (relative to fp) and number of values to take along.
+// Values on the operand stack above those are dropped. If metered the gas
+// of the branch (see count_gas_in_code) is charged, the caller checks the
+// meter.
+static inline __attribute__((always_inline)) void tick_branch(dwac_tick_state_type *s, const uint32_t *target, const int metered)
+{
+	if (metered) {s->gas_meter -= (int32_t) target[3];}
+	const dwac_stack_pointer_type sp = s->fp + target[1];
+	const uint32_t nof_values = target[2];
+	if (nof_values == 1)
+	{
+		const uint64_t v = TOP_U64(s);
+		s->sp = sp + 1;
+		SET_U64(s, v);
+	}
+	else if (nof_values == 0)
+	{
+		if (s->sp != sp)
+		{
+			TICK_SPILL();
+			s->sp = sp;
+			TICK_FILL();
+		}
+	}
+	else
+	{
+		TICK_SPILL();
+		for (uint32_t n = 0; n < nof_values; ++n)
+		{
+			s->stack[SP_MASK(sp + nof_values - n)] = s->stack[SP_MASK(s->sp - n)];
 		}
+		s->sp = sp + nof_values;
+		TICK_FILL();
+	}
+	s->pc.pos = target[0];
+}
+
+#ifdef DWAC_CALL_INDIRECT_CACHE
+// The inline cache of a call_indirect is in the translated code after its
+// operands, DWAC_CALL_INDIRECT_CACHE entries of table index (upper 32 bits)
+// and function index, all ones if not used. A function is put in the cache
+// only when it has passed the checks of table index, function index and
+// type. The table is in the program and does not change while running, so
+// a call that hits the cache can skip those.
+//
+// Instances in different threads may share the translated code. Each entry
+// is one 64 bit word that is read and written atomically, so an entry
+// seen is always one that some thread put there. The entries are aligned
+// here, one word more than needed is reserved for that (the code is not
+// always 8 byte aligned).
+static inline __attribute__((always_inline)) uint64_t* call_indirect_cache(const uint32_t *code)
+{
+	return (uint64_t*)(((uintptr_t) code + 7) & ~(uintptr_t) 7);
+}
+
+// Returns INVALID_FUNCTION_INDEX if not in cache.
+static inline __attribute__((always_inline)) uint32_t call_indirect_cache_lookup(const uint64_t *cache, uint32_t idx_into_table)
+{
+	for (uint32_t i = 0; i < DWAC_CALL_INDIRECT_CACHE; i++)
+	{
+		const uint64_t entry = __atomic_load_n(&cache[i], __ATOMIC_RELAXED);
+		if ((uint32_t)(entry >> 32) == idx_into_table) {return (uint32_t) entry;}
+	}
+	return INVALID_FUNCTION_INDEX;
+}
+
+// Put a function first in the cache, the last entry is dropped if all are used.
+static void call_indirect_cache_add(uint64_t *cache, uint32_t idx_into_table, uint32_t function_idx)
+{
+	for (uint32_t i = DWAC_CALL_INDIRECT_CACHE - 1; i > 0; i--)
+	{
+		__atomic_store_n(&cache[i], __atomic_load_n(&cache[i - 1], __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&cache[0], ((uint64_t) idx_into_table << 32) | function_idx, __ATOMIC_RELAXED);
+}
+#endif
+
+// Fast path for calls from dwac_tick to functions that are run by the
+// interpreter, does what dwac_setup_function_call does but using the frame
+// (see dwac_frame_type). Returns zero if the call shall be done by
+// dwac_setup_function_call (not yet translated, register code, ahead of
+// time compiled, stack overflow or missing parameters).
+static inline __attribute__((always_inline)) int tick_call(dwac_data *d, dwac_tick_state_type *s, uint32_t function_idx, const int metered)
+{
+	const dwac_frame_type *frame = &d->p->frames[function_idx];
+	const uint32_t *code = FRAME_CODE(frame);
+	const dwac_stack_pointer_signed_type stack_size = STACK_SIZE(s);
+	if ((code == NULL) || (stack_size < frame->nof_parameters) ||
+		((dwac_stack_pointer_type)stack_size + frame->nof_local + frame->max_stack_height >= DWAC_STACK_CAPACITY - 1))
+	{
+		return 0;
+	}
+	const dwac_stack_pointer_type expected_sp_after_call = s->sp - frame->nof_parameters;
+
+	dwac_call_stack_entry *e = (dwac_call_stack_entry*) dwac_linear_storage_size_push(&d->call_stack);
+	e->call_type = dwac_block_type_internal_func;
+	e->func_idx = function_idx;
+	e->nof_results = frame->nof_results;
+	e->stack_pointer = expected_sp_after_call;
+	e->frame_pointer = s->fp;
+	e->return_pc = s->pc;
+
+	s->fp = expected_sp_after_call + DWAC_SP_OFFSET;
+	TICK_SPILL();
+	s->sp += frame->nof_local;
+	for (uint32_t i = 0; i < frame->nof_local; i++) {s->stack[SP_MASK(s->sp - i)].u64 = 0;}
+	TICK_FILL();
+	s->pc.array = code;
+	s->pc.nof = frame->code_size;
+	s->pc.pos = 0;
+	if (metered) {s->gas_meter -= frame->entry_gas;}
+	return 1;
+}
+
+#define TICK_SAVE() {TICK_SPILL(); d->pc = s->pc; d->sp = s->sp; d->fp = s->fp; d->gas_meter = s->gas_meter;}
+#define TICK_LOAD() {s->pc = d->pc; s->sp = d->sp; s->fp = d->fp; s->gas_meter = d->gas_meter; TICK_FILL();}
+#define TICK_RETURN(r) {TICK_SAVE(); return r;}
+
+// Gas is charged and checked by these in dwac_tick. In the variants without
+// metering (TICK_METERED is zero) nothing is charged and only an interrupt
+// stops the program at the checkpoints.
+#define TICK_CHARGE(gas) {if (TICK_METERED) {s->gas_meter -= (gas);}}
+#define TICK_CHECKPOINT() {if (TICK_METERED ? GAS_EXHAUSTED(s->gas_meter) : INTERRUPT_REQUESTED(d)) {TICK_RETURN(DWAC_NEED_MORE_GAS);}}
+
+// This is then main state event machine that runs the program.
+// Returns DWAC_OK or DWAC_NEED_MORE_GAS if OK.
+// Something else if not OK.
+//
+// The interpreter is in drekkar_wa_tick.h. Checks there that validation
+// makes unnecessary begin with "(!TICK_VALIDATED) &&", those are left out
+// by the compiler in the variant for code that passed validation. Same for
+// gas metering and TICK_METERED. Which variant to use is selected for each
+// dwac_data, see select_tick.
+
+#define TICK_NAME tick_checked
+#define TICK_VALIDATED 0
+#define TICK_METERED 1
+#include "drekkar_wa_tick.h"
+#undef TICK_NAME
+#undef TICK_METERED
+
+#define TICK_NAME tick_checked_unmetered
+#define TICK_METERED 0
+#include "drekkar_wa_tick.h"
+#undef TICK_NAME
+#undef TICK_VALIDATED
+#undef TICK_METERED
+
+#ifdef DWAC_VALIDATE
+#define TICK_NAME tick_validated
+#define TICK_VALIDATED 1
+#define TICK_METERED 1
+#include "drekkar_wa_tick.h"
+#undef TICK_NAME
+#undef TICK_METERED
+
+#define TICK_NAME tick_validated_unmetered
+#define TICK_METERED 0
+#include "drekkar_wa_tick.h"
+#undef TICK_NAME
+#undef TICK_VALIDATED
+#undef TICK_METERED
+#endif
+
+// Set the variant of the interpreter that dwac_tick uses, this is done
+// when the program has been loaded (if it passed validation is known then)
+// and if gas metering is turned on or off.
+static void select_tick(dwac_data *d)
+{
+	#ifdef DWAC_VALIDATE
+	if (d->p->validated)
+	{
+		d->tick = d->gas_metering ? tick_validated : tick_validated_unmetered;
+		return;
+	}
+	#endif
+	d->tick = d->gas_metering ? tick_checked : tick_checked_unmetered;
+}
+
+#ifdef DWAC_TOS_CACHE
+#undef POP
+#undef TOP
+#undef PUSH_VALUE
+#undef SET_VALUE
+#define PUSH(d) (d->stack[SP_INC(d)])
+#define POP(d) (d->stack[SP_DEC(d)])
+#define TOP(d) (d->stack[d->sp])
+#define PUSH_VALUE(d, m, v) {PUSH(d).m = v;}
+#define SET_VALUE(d, m, v) TOP(d).m = v;
+#endif
+
+// Gas there is for the current call, at most max.
+static long gas_available(const dwac_data *d, long max)
+{
+	if ((d->gas_limit == DWAC_GAS_UNLIMITED) || (!d->gas_metering)) {return max;}
+	const int64_t remaining = d->gas_limit - d->gas_consumed;
+	return (remaining < max) ? (long) remaining : max;
+}
+
+#ifdef DWAC_INTERRUPT
+static int64_t monotonic_time_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool deadline_passed(const dwac_data *d)
+{
+	return (d->deadline_us != 0) && (monotonic_time_us() >= d->deadline_us);
+}
+#endif
+
+// Run the program for one slice of gas (see dwac_set_gas_slice). Returns
+// DWAC_NEED_MORE_GAS if it shall continue by another call to this, or
+// DWAC_GAS_BUDGET_USED if the budget (see dwac_set_gas_budget) is used.
+// With DWAC_INTERRUPT it can also return DWAC_INTERRUPTED or
+// DWAC_DEADLINE_EXCEEDED, the deadline is only looked at between slices so
+// a short slice (or a watchdog thread calling dwac_interrupt) stops it sooner.
+// Without gas metering (see dwac_set_gas_metering) it runs until done or
+// interrupted, the deadline is then only looked at before it starts.
+//
+// Regarding gas metering. As a CPU optimization: Instead of counting every
+// opcode the gas of the code up to the next branch is charged when a
+// branch is taken or a function called, see count_gas_in_code. Gas charged
+// while not in dwac_tick (calling a function) is taken from the slice.
+dwac_result dwac_tick(dwac_data *d)
+{
+	#ifdef DWAC_INTERRUPT
+	if (deadline_passed(d)) {return DWAC_DEADLINE_EXCEEDED;}
+	#endif
+	// Without metering the meter is only used by register code, it gets
+	// so much it will not run out.
+	const long slice = d->gas_metering ? gas_available(d, d->gas_slice) : LONG_MAX;
+	if (slice <= 0) {return DWAC_GAS_BUDGET_USED;}
+	d->gas_meter += slice;
+	// If there is a trap the meter of the interpreter (kept in a local
+	// variable, see dwac_tick_state_type) is lost, all the slice is charged.
+	GUARD_BEGIN(d, slice);
+	const dwac_result r = d->tick(d);
+	GUARD_END();
+	if (d->gas_metering) {d->gas_consumed += slice - d->gas_meter;}
+	d->gas_meter = 0;
+	#ifdef DWAC_INTERRUPT
+	if (r == DWAC_NEED_MORE_GAS)
+	{
+		if (__atomic_exchange_n(&d->interrupt_requested, 0, __ATOMIC_RELAXED)) {return DWAC_INTERRUPTED;}
+		if (deadline_passed(d)) {return DWAC_DEADLINE_EXCEEDED;}
 	}
-	return DWAC_NEED_MORE_GAS;
+	#endif
+	if ((r == DWAC_NEED_MORE_GAS) && (gas_available(d, 1) <= 0)) {return DWAC_GAS_BUDGET_USED;}
+	return r;
 }
 
 // This is used to run some code to get a value.
@@ -3931,27 +5515,50 @@ dwac_result dwac_tick(dwac_data *d)
 //     explicit 0x0B opcode for end.
 //
 // So we need to run some instructions. The result is expected to be placed on the stack.
-static dwac_result run_init_expr(const dwac_prog *p, dwac_data *d, uint8_t type, uint32_t maxlen)
-{
-	dwac_block_stack_entry *block = (dwac_block_stack_entry*) dwac_linear_storage_size_push(&d->block_stack);
-	block->block_type_code = dwac_block_type_init_exp;
-	block->func_type_idx = -type; // Positive numbers are for function types (section 1) so make it negative here.
-	block->stack_pointer = DWAC_SP_INITIAL;
-	block->func_info.frame_pointer = 0;
-	block->func_info.return_addr = 0;
+static dwac_result run_init_expr(const dwac_prog *p, dwac_data *d, uint8_t type, dwac_leb128_reader_type *r)
+{
+	// The expression is translated into a temporary buffer just as function bodies are.
+	dwac_linear_storage_32_type code;
+	dwac_linear_storage_32_init(&code);
+	// Negative numbers are value types, positive are for function types (section 1).
+	const dwac_func_type_type *t = dwac_get_func_type_ptr(p, -type);
+	dwac_result result = (t != NULL) ? translate_code(r, &code) : DWAC_NO_TYPE_INFO;
+	if (result == DWAC_OK) {result = find_blocks_in_code(p, code.array, code.size, 0, t);}
+	if (result != DWAC_OK)
+	{
+		snprintf(d->exception, sizeof(d->exception), "Could not translate expression.");
+		dwac_linear_storage_32_deinit(&code);
+		return result;
+	}
+
+	dwac_call_stack_entry *e = (dwac_call_stack_entry*) dwac_linear_storage_size_push(&d->call_stack);
+	memset(e, 0, sizeof(dwac_call_stack_entry));
+	e->call_type = dwac_block_type_init_exp;
+	e->nof_results = t->nof_results;
+	e->stack_pointer = DWAC_SP_INITIAL;
 
 	assert(d->sp == DWAC_SP_INITIAL);
 	d->fp = STACK_SIZE(d);
 
-	dbg("run_init_expr 0x%x 0x%x 0x%llx\n", d->fp, d->sp, (long long)d->pc.pos);
+	d->pc.array = code.array;
+	d->pc.nof = code.size;
+	d->pc.pos = 0;
+
+	dbg("run_init_expr 0x%x 0x%x 0x%llx\n", d->fp, d->sp, (long long)r->pos);
+
+	// Init expressions are not validated. They use no gas of the budget.
+	d->gas_meter = d->gas_slice;
+	result = tick_checked(d);
+	d->gas_meter = 0;
 
-	long r = dwac_tick(d);
+	dwac_linear_storage_32_deinit(&code);
+	memset(&d->pc, 0, sizeof(d->pc));
 
-	if ((r == DWAC_OK) && (d->sp == DWAC_SP_INITIAL))
+	if ((result == DWAC_OK) && (d->sp == DWAC_SP_INITIAL))
 	{
 		return DWAC_NO_RESULT_ON_STACK;
 	}
-	return r;
+	return result;
 }
 
 // Returns NULL if not found.
@@ -3968,6 +5575,11 @@ static void* find_imported_function(const dwac_prog *p, const char *name)
 	return dwac_hash_list_find(&p->available_functions_list, name);
 }
 
+#ifdef DWAC_AOT
+// Defined by the code drekkar_wasm2c generates, if that is linked in.
+extern const dwac_aot_module_type dwac_aot_module __attribute__((weak));
+#endif
+
 // TODO Perhaps take a pointer to dwac_data instead of "char *exception, size_t exception_size".
 // We need some dwac_data in "Element Section" anyway.
 dwac_result dwac_parse_prog_sections(dwac_prog *p, dwac_data *d, const uint8_t *bytes, uint32_t byte_count, FILE* log)
@@ -3975,6 +5587,9 @@ dwac_result dwac_parse_prog_sections(dwac_prog *p, dwac_data *d, const uint8_t *
 	dbg("dwac_parse_prog_sections %d\n", byte_count);
 
 	const size_t max_nof = 16 + byte_count/16;
+	#ifdef DWAC_VALIDATE
+	uint32_t nof_valid = 0;
+	#endif
 
 	p->bytecodes.array = bytes;
 	p->bytecodes.nof = byte_count;
@@ -4107,6 +5722,7 @@ dwac_result dwac_parse_prog_sections(dwac_prog *p, dwac_data *d, const uint8_t *
 					dwac_func_type_to_string(tmp, sizeof(tmp), type);
 					dbg("Type %u %s\n", i, tmp);
 				}
+				canonicalize_types(p);
 				break;
 			case 2:
 			{
@@ -4166,6 +5782,23 @@ dwac_result dwac_parse_prog_sections(dwac_prog *p, dwac_data *d, const uint8_t *
 							dwac_func_type_to_string(tmp, sizeof(tmp), type);
 							if (log) {fprintf(log, "Import 0x%x '%s' %s\n", p->funcs_vector.nof_imported, m, tmp);}
 
+							f->external_function.func_ptr = NULL;
+							f->external_function.host_function = dwac_hash_list_find(&p->host_functions_list, m);
+							if (f->external_function.host_function != NULL)
+							{
+								// The trampoline takes its parameters and puts its result without
+								// checking so the types must be the same.
+								if (!func_types_equal(type, &f->external_function.host_function->type))
+								{
+									char host_type[256];
+									dwac_func_type_to_string(host_type, sizeof(host_type), &f->external_function.host_function->type);
+									snprintf(d->exception, sizeof(d->exception), "'%s' is not %s", m, host_type);
+									return DWAC_IMPORT_TYPE_MISMATCH;
+								}
+								p->funcs_vector.nof_imported++;
+								break;
+							}
+
 							void *ptr = find_imported_function(p, m);
 							if (ptr == NULL)
 							{
@@ -4210,6 +5843,22 @@ dwac_result dwac_parse_prog_sections(dwac_prog *p, dwac_data *d, const uint8_t *
 					f->block_type_code = dwac_block_type_internal_func;
 					p->funcs_vector.functions_array[i].func_type_idx = leb_read(&p->bytecodes, 32);
 					p->funcs_vector.functions_array[i].func_idx = i;
+					// Function bodies are translated later, see translate_internal_function.
+					dwac_linear_storage_32_init(&f->internal_function.code);
+					#ifdef DWAC_REGISTER_CODE
+					dwac_linear_storage_32_init(&f->internal_function.reg_code);
+					#endif
+					#ifdef DWAC_JIT
+					f->internal_function.jit_code = NULL;
+					f->internal_function.jit_size = 0;
+					dwac_linear_storage_32_init(&f->internal_function.jit_offsets);
+					f->internal_function.jit_hotness = 0;
+					f->internal_function.jit_state = dwac_translation_not_started;
+					#endif
+					f->internal_function.start_addr = 0;
+					f->internal_function.end_addr = 0;
+					f->internal_function.translation_state = dwac_translation_not_started;
+					f->internal_function.nof_call_sites = 0;
 				}
 				break;
 			case 4:
@@ -4253,8 +5902,27 @@ dwac_result dwac_parse_prog_sections(dwac_prog *p, dwac_data *d, const uint8_t *
 				p->bytecodes.pos += section_len;
 				break;
 			case 6: // Global Section
-				p->bytecodes.pos += section_len;
+			{
+				// Values of globals are set in dwac_parse_data_sections.
+				#ifdef DWAC_VALIDATE
+				// Only their types are kept here (for validate_function).
+				const uint32_t nof_globals = leb_read(&p->bytecodes, 32);
+				if (nof_globals > max_nof) {return DWAC_TO_MANY_GLOBALS;}
+				for (uint32_t i = 0; i < nof_globals; i++)
+				{
+					dwac_linear_storage_8_push_uint8_t(&p->global_types, leb_read(&p->bytecodes, 32));
+					/*int mutable =*/leb_read(&p->bytecodes, 1);
+					// Skip the init_expr, translate_code stops after its end.
+					dwac_linear_storage_32_type code;
+					dwac_linear_storage_32_init(&code);
+					const dwac_result r = translate_code(&p->bytecodes, &code);
+					dwac_linear_storage_32_deinit(&code);
+					if (r != DWAC_OK) {return r;}
+				}
+				#endif
+				p->bytecodes.pos = section_begin + section_len;
 				break;
+			}
 			case 7:
 			{
 				// [1] 5.5.10. Export Section
@@ -4320,38 +5988,39 @@ dwac_result dwac_parse_prog_sections(dwac_prog *p, dwac_data *d, const uint8_t *
 				#ifndef PARSE_ELEMENTS_IN_DATA
 
 				// Need to run some script code in this section so need a runtime here.
-				leb128_reader_init(&d->pc, p->bytecodes.array, p->bytecodes.nof);
-				d->pc.pos = p->bytecodes.pos;
+				dwac_leb128_reader_type r;
+				leb128_reader_init(&r, p->bytecodes.array, p->bytecodes.nof);
+				r.pos = p->bytecodes.pos;
 
 				// The initial contents of a table is uninitialized. Element segments can be
 				// used to initialize a subrange of a table from a static vector of elements.
-				uint32_t nof_elements = leb_read(&d->pc, 32);
+				uint32_t nof_elements = leb_read(&r, 32);
 				if (nof_elements > max_nof) {return DWAC_TO_MANY_ELEMENTS;}
 				for (uint32_t i = 0; i < nof_elements; i++)
 				{
 					{
-						const uint32_t index = leb_read(&d->pc, 32);
+						const uint32_t index = leb_read(&r, 32);
 						if (index != 0) {return DWAC_ONLY_ONE_TABLE_IS_SUPPORTED;}
 					}
 
 					// Run the init_expr to get offset into table on the stack.
-					run_init_expr(p, d, DWAC_I32, section_len);
+					run_init_expr(p, d, DWAC_I32, &r);
 
 					size_t offset = POP_I32(d);
 
-					uint32_t nof_entries = leb_read(&d->pc, 32);
+					uint32_t nof_entries = leb_read(&r, 32);
 					if (nof_entries > max_nof) {return DWAC_TO_MANY_ENTRIES;}
 
 					dwac_linear_storage_64_grow_if_needed(&p->func_table, offset + nof_entries);
 
 					for (uint32_t j = 0; j < nof_entries; ++j)
 					{
-						const uint64_t v = leb_read(&d->pc, 64);
+						const uint64_t v = leb_read(&r, 64);
 						dwac_linear_storage_64_set(&p->func_table, offset + j, v);
 					}
 				}
 				p->bytecodes.pos += section_len;
-				assert(p->bytecodes.pos == d->pc.pos);
+				assert(p->bytecodes.pos == r.pos);
 				#else
 				p->bytecodes.pos += section_len;
 				#endif
@@ -4418,15 +6087,28 @@ dwac_result dwac_parse_prog_sections(dwac_prog *p, dwac_data *d, const uint8_t *
 						return DWAC_MISSING_OPCODE_END;
 					}
 
+					#ifdef DWAC_VALIDATE
+					if (validate_function(p, f, code_start) == DWAC_OK)
+					{
+						nof_valid++;
+					}
+					else if (log)
+					{
+						fprintf(log, "Function %u did not pass validation\n", p->funcs_vector.nof_imported + i);
+					}
+					#endif
+
 					p->bytecodes.pos = f->internal_function.end_addr + 1;
 				}
 				break;
 			}
 			case 11: // [1] 5.5.14. Data Section
-			case 12: // [1] 5.5.15. Data Count Section
-				// Not implemented yet.
+				// Taken care of by dwac_parse_data_sections.
 				p->bytecodes.pos += section_len;
 				break;
+			case 12: // [1] 5.5.15. Data Count Section
+				p->nof_data_segments = leb_read(&p->bytecodes, 32);
+				break;
 			default:
 				snprintf(d->exception, sizeof(d->exception), "Section %d unimplemented\n", section_id);
 				return DWAC_UNKNOWN_SECTION;
@@ -4439,14 +6121,62 @@ dwac_result dwac_parse_prog_sections(dwac_prog *p, dwac_data *d, const uint8_t *
 		}
 	}
 
+	#ifdef DWAC_VALIDATE
+	p->validated = (nof_valid == p->funcs_vector.total_nof - p->funcs_vector.nof_imported);
+	if (log && p->validated) {fprintf(log, "All functions passed validation\n");}
+	#endif
+	select_tick(d);
+
+	// Frames, code is set when a function is translated.
+	p->frames = DWAC_ST_MALLOC(p->funcs_vector.total_nof * sizeof(dwac_frame_type));
+	memset(p->frames, 0, p->funcs_vector.total_nof * sizeof(dwac_frame_type));
+	for (uint32_t func_idx = p->funcs_vector.nof_imported; func_idx < p->funcs_vector.total_nof; func_idx++)
+	{
+		const dwac_function *f = &p->funcs_vector.functions_array[func_idx];
+		const dwac_func_type_type *type = dwac_get_func_type_ptr(p, f->func_type_idx);
+		if (type == NULL) {return DWAC_NO_TYPE_INFO;}
+		dwac_frame_type *frame = &p->frames[func_idx];
+		frame->func_type_idx = f->func_type_idx;
+		frame->nof_parameters = type->nof_parameters;
+		frame->nof_results = type->nof_results;
+		frame->nof_local = f->internal_function.nof_local;
+		#ifdef DWAC_VALIDATE
+		if (p->validated) {frame->max_stack_height = f->internal_function.max_stack_height;}
+		#endif
+	}
+
 	#ifdef TRANSLATE_ALL_AT_LOAD
 	for (uint32_t func_idx = p->funcs_vector.nof_imported; func_idx < p->funcs_vector.total_nof; func_idx++)
 	{
-		const long r = find_blocks_for_internal_function(p, func_idx);
-		if (r != DWAC_OK) {return r;}
+		const long r = translate_internal_function(p, func_idx);
+		if (r != DWAC_OK)
+		{
+			snprintf(d->exception, sizeof(d->exception), "Could not translate function %u.", func_idx);
+			return r;
+		}
+	}
+	#endif
+
+	#ifdef DWAC_AOT
+	if ((&dwac_aot_module != NULL) &&
+		(dwac_aot_module.nof_functions == p->funcs_vector.total_nof - p->funcs_vector.nof_imported) &&
+		(dwac_aot_module.hash == dwac_module_hash(bytes, byte_count)))
+	{
+		if (log) {fprintf(log, "Using code compiled ahead of time\n");}
+		p->aot_functions = dwac_aot_module.functions;
+		for (uint32_t func_idx = 0; func_idx < p->funcs_vector.total_nof; func_idx++)
+		{
+			// So that calls go via dwac_setup_function_call.
+			p->frames[func_idx].code = NULL;
+		}
+		return DWAC_OK;
 	}
 	#endif
 
+	#ifdef DWAC_TRANSLATE_THREADS
+	start_translate_threads(p);
+	#endif
+
 	return DWAC_OK;
 }
 
@@ -4460,17 +6190,18 @@ dwac_result dwac_parse_data_sections(dwac_data *d)
 
 	const size_t max_nof = 16 + p->bytecodes.nof/16;
 
-	leb128_reader_init(&d->pc, p->bytecodes.array, p->bytecodes.nof);
+	dwac_leb128_reader_type r;
+	leb128_reader_init(&r, p->bytecodes.array, p->bytecodes.nof);
 
 	// Skip the magic numbers, already checked in "wa_parse_prog_sections".
-	d->pc.pos += 8;
+	r.pos += 8;
 
 	// Read the sections
-	while (d->pc.pos < d->pc.nof)
+	while (r.pos < r.nof)
 	{
-		uint32_t id = leb_read(&d->pc, 7);
-		uint32_t section_len = leb_read(&d->pc, 32);
-		const uint32_t section_begin = d->pc.pos;
+		uint32_t id = leb_read(&r, 7);
+		uint32_t section_len = leb_read(&r, 32);
+		const uint32_t section_begin = r.pos;
 		dbg("Parsing data section %d, pos 0x%llx, len %d\n", id, (long long)p->bytecodes.pos, section_len);
 
 		switch (id)
@@ -4481,21 +6212,21 @@ dwac_result dwac_parse_data_sections(dwac_data *d)
 			case 3: // Function Section
 			case 4: // [1] 5.5.7. Table Section
 				// Taken care of by prog so skip these now.
-				d->pc.pos += section_len;
+				r.pos += section_len;
 				break;
 			case 5: // Memory Section
 			{
 				// [1] 5.3.8. Memory Types
-				uint32_t lim = leb_read(&d->pc, 32);
-				if ((lim != 1) || (d->memory.lower_mem.array != NULL)) {return DWAC_ONLY_ONE_MEMORY_IS_SUPPORTED;}
+				uint32_t lim = leb_read(&r, 32);
+				if ((lim != 1) || (d->memory.maximum_size_in_pages != 0)) {return DWAC_ONLY_ONE_MEMORY_IS_SUPPORTED;}
 
-				uint32_t flags = leb_read(&d->pc, 32);
+				uint32_t flags = leb_read(&r, 32);
 
 				// Initial size in pages, as requested by compiler, one page is 0x10000 (PAGE_SIZE).
-				d->memory.current_size_in_pages = leb_read(&d->pc, 32);
+				d->memory.current_size_in_pages = leb_read(&r, 32);
 				if (flags & 0x1)
 				{
-					d->memory.maximum_size_in_pages = leb_read(&d->pc, 32);
+					d->memory.maximum_size_in_pages = leb_read(&r, 32);
 					if (d->memory.maximum_size_in_pages > DWAC_MAX_NOF_PAGES)
 					{
 						snprintf(d->exception, sizeof(d->exception), "0x%x", d->memory.maximum_size_in_pages);
@@ -4509,6 +6240,13 @@ dwac_result dwac_parse_data_sections(dwac_data *d)
 				}
 
 				dbg("Memory: nof pages %u, page_size %u, total in bytes %zu\n", d->memory.current_size_in_pages, DWAC_PAGE_SIZE, (size_t) wa_get_mem_size(d));
+				#ifdef DWAC_GUARD_PAGES
+				if (!guard_memory_update(d))
+				{
+					snprintf(d->exception, sizeof(d->exception), "Could not reserve memory 0x%x", wa_get_mem_size(d));
+					return DWAC_TO_MUCH_MEMORY_REQUESTED;
+				}
+				#endif
 				break;
 			}
 			case 6: // [1] 5.5.9. Global Section
@@ -4516,7 +6254,7 @@ dwac_result dwac_parse_data_sections(dwac_data *d)
 				// See also Import(2) section where globals can be added by finding their initial value in a DLL/SO.
 				// Here the value is found by running some code.
 				assert(d->globals.size == 0);
-				uint32_t nof_globals = leb_read(&d->pc, 32);
+				uint32_t nof_globals = leb_read(&r, 32);
 				if (nof_globals > max_nof) {return DWAC_TO_MANY_GLOBALS;}
 				dwac_linear_storage_64_grow_if_needed(&d->globals, nof_globals);
 				for (uint32_t i = 0; i < nof_globals; i++)
@@ -4525,12 +6263,12 @@ dwac_result dwac_parse_data_sections(dwac_data *d)
 
 					// [1] 5.3.10. Global Types
 					//     Global types are encoded by their value type and a flag for their mutability.
-					uint32_t globaltype = leb_read(&d->pc, 32); // Or should it be leb_read_signed 33 bit?
-					/*int mutable =*/leb_read(&d->pc, 1);
+					uint32_t globaltype = leb_read(&r, 32); // Or should it be leb_read_signed 33 bit?
+					/*int mutable =*/leb_read(&r, 1);
 
 					// Run the init_expr to get global value, it will get pushed to stack.
-					long r = run_init_expr(p, d, globaltype, section_len);
-					if (r != DWAC_OK)	{return r;}
+					const long e = run_init_expr(p, d, globaltype, &r);
+					if (e != DWAC_OK)	{return e;}
 
 					char tmp[64];
 					dwac_value_and_type_to_string(tmp, sizeof(tmp), &TOP(d), globaltype);
@@ -4540,25 +6278,25 @@ dwac_result dwac_parse_data_sections(dwac_data *d)
 					int64_t v = POP_I64(d);
 					dwac_linear_storage_64_push(&d->globals, v);
 				}
-				d->pc.pos = section_begin + section_len;
+				r.pos = section_begin + section_len;
 				break;
 			}
 			case 7: // Export Section
 			case 8: // Start Section
 				// Taken care of by prog so skip these now.
-				d->pc.pos += section_len;
+				r.pos += section_len;
 				break;
 			case 9: // [1] 5.5.12. Element Section
 			{
 				#ifdef PARSE_ELEMENTS_IN_DATA
 				// The initial contents of a table is uninitialized. Element segments can be
 				// used to initialize a subrange of a table from a static vector of elements.
-				uint32_t nof_elements = leb_read(&d->pc, 32);
+				uint32_t nof_elements = leb_read(&r, 32);
 				if (nof_globals > max_nof) {return DWAC_TO_MANY_ELEMENTS;}
 				for (uint32_t i = 0; i < nof_elements; i++)
 				{
 					{
-						const uint32_t index = leb_read(&d->pc, 32);
+						const uint32_t index = leb_read(&r, 32);
 						if (index != 0)
 						{
 							snprintf(d->exception, sizeof(d->exception), "Only one table is supported 0x%x\n", index);
@@ -4567,37 +6305,38 @@ dwac_result dwac_parse_data_sections(dwac_data *d)
 					}
 
 					// Run the init_expr to get offset into table on the stack.
-					run_init_expr(p, d, DWAC_I32, section_len);
+					run_init_expr(p, d, DWAC_I32, &r);
 
 					size_t offset = POP_I32(d);
 
-					uint32_t nof_entries = leb_read(&d->pc, 32);
+					uint32_t nof_entries = leb_read(&r, 32);
 
 					dwac_linear_storage_64_grow_if_needed(&p->func_table, offset + nof_entries);
 
 					for (uint32_t j = 0; j < nof_entries; ++j)
 					{
-						const uint64_t v = leb_read(&d->pc, 64);
+						const uint64_t v = leb_read(&r, 64);
 						dwac_linear_storage_64_set(&p->func_table, offset + j, v);
 					}
 				}
 				#else
-				d->pc.pos += section_len;
+				r.pos += section_len;
 				#endif
 				break;
 			}
 			case 10: // Code Section
 				// Taken care of by prog so skip this now.
-				d->pc.pos += section_len;
+				r.pos += section_len;
 				break;
 			case 11: // [1] 5.5.14. Data Section
 			{
-				uint32_t nof_data_segments = leb_read(&d->pc, 32);
+				uint32_t nof_data_segments = leb_read(&r, 32);
 				if (nof_data_segments > max_nof) {return DWAC_TO_MANY_DATA_SEGMENTS;}
 				for (uint32_t s = 0; s < nof_data_segments; s++)
 				{
-					uint32_t mem = leb_read(&d->pc, 32);
-					if (mem != 0)
+					// [1] 5.5.14. 0 is active in memory 0, 1 is passive and 2 is active with a memory index.
+					const uint32_t kind = leb_read(&r, 32);
+					if ((kind > 2) || ((kind == 2) && (leb_read(&r, 32) != 0)))
 					{
 						// In the current version of WebAssembly, at most one memory may be defined or imported
 						// in a single module, so all valid active data segments have a memory value of 0.
@@ -4605,37 +6344,39 @@ dwac_result dwac_parse_data_sections(dwac_data *d)
 						return DWAC_ONLY_ONE_MEMORY_IS_SUPPORTED;
 					}
 
-					// Run the init_expr to get the offset onto stack.
-					run_init_expr(d->p, d, DWAC_I32, section_len);
-					uint32_t offset = POP_U32(d);
+					uint32_t offset = 0;
+					if (kind != 1)
+					{
+						// Run the init_expr to get the offset onto stack.
+						run_init_expr(d->p, d, DWAC_I32, &r);
+						offset = POP_U32(d);
+					}
 
-					uint32_t size = leb_read(&d->pc, 32);
+					dwac_data_segment_type *segment = dwac_linear_storage_size_push(&d->data_segments);
+					segment->size = leb_read(&r, 32);
+					segment->pos = r.pos;
+					r.pos += segment->size;
 
-					if (offset + size > wa_get_mem_size(d))
+					if (kind != 1)
 					{
-						snprintf(d->exception, sizeof(d->exception), "Memory of of range 0x%x 0x%x 0x%x 0x%x\n", offset, size, DWAC_PAGE_SIZE,
-								wa_get_mem_size(d));
-						return DWAC_MEMORY_OUT_OF_RANGE;
+						// Copy the data, the segment is then dropped.
+						if (dwac_memory_init(d, s, offset, 0, segment->size) != DWAC_OK) {return DWAC_MEMORY_OUT_OF_RANGE;}
+						dwac_data_drop(d, s);
 					}
-
-					// Copy the data.
-					uint8_t *ptr = translate_addr_grow_if_needed(d, offset, size);
-					memcpy(ptr, d->pc.array + d->pc.pos, size);
-					d->pc.pos += size;
 				}
 				break;
 			}
 			case 12: // Data Count Section
-				d->pc.pos += section_len;
+				r.pos += section_len;
 				break;
 
 			default:
 				snprintf(d->exception, sizeof(d->exception), "Section %d unimplemented\n", id);
 				return DWAC_UNKNOWN_SECTION;
 
-				d->pc.pos += section_len;
+				r.pos += section_len;
 		}
-		if (d->pc.pos != (section_begin + section_len))
+		if (r.pos != (section_begin + section_len))
 		{
 			snprintf(d->exception, sizeof(d->exception), "Data section did not add up.\n");
 			return DWAC_MISALLIGNED_SECTION;
@@ -4702,8 +6443,10 @@ dwac_result dwac_set_command_line_arguments(dwac_data *d, uint32_t argc, const c
 {
 	const size_t arg_size_in_bytes = wa_get_command_line_arguments_size(argc, argv);
 	if (arg_size_in_bytes >= (0x100000000LL - DWAC_ARGUMENTS_BASE)) {return DWAC_TO_MUCH_ARGUMENTS;}
-	dwac_linear_storage_8_grow_if_needed(&d->memory.arguments, arg_size_in_bytes);
-	assert(d->memory.arguments.size >= wa_get_command_line_arguments_size(argc, argv));
+	#ifdef DWAC_GUARD_PAGES
+	if (!guard_memory_open(d, DWAC_ARGUMENTS_BASE, arg_size_in_bytes)) {return DWAC_TO_MUCH_ARGUMENTS;}
+	#endif
+	d->memory.arguments_size = arg_size_in_bytes;
 
 	const uint32_t memory_reserved_by_compiler = DWAC_ARGUMENTS_BASE;
 
@@ -4716,7 +6459,7 @@ dwac_result dwac_set_command_line_arguments(dwac_data *d, uint32_t argc, const c
 
 	for (int i = 0; i < argc; ++i)
 	{
-		put32(d->memory.arguments.array + (DWAC_PTR_SIZE * i), arg_pos);
+		put32(translate_addr_grow_if_needed(d, memory_reserved_by_compiler + (DWAC_PTR_SIZE * i), DWAC_PTR_SIZE), arg_pos);
 		const uint32_t n = strlen(argv[i]);
 		uint8_t *ptr = translate_addr_grow_if_needed(d, arg_pos, n);
 		memcpy(ptr, argv[i], n);
@@ -4730,13 +6473,49 @@ dwac_result dwac_set_command_line_arguments(dwac_data *d, uint32_t argc, const c
 	return DWAC_OK;
 }
 
+// Call a function, the call gets the gas of the budget (see
+// dwac_set_gas_budget). Use dwac_tick to continue if DWAC_NEED_MORE_GAS
+// is returned.
 dwac_result dwac_call_exported_function(dwac_data *d, uint32_t func_idx)
 {
+	const size_t call_stack_size = d->call_stack.size;
+	d->gas_limit = d->gas_budget;
+	d->gas_consumed = 0;
+
+	// Code compiled ahead of time can not stop and continue later, it gets
+	// all the gas there is. Else the gas of the call is charged by dwac_tick.
+	#ifdef DWAC_AOT
+	const long gas = (d->p->aot_functions != NULL) ? gas_available(d, LONG_MAX) : 0;
+	#else
+	const long gas = 0;
+	#endif
+	d->gas_meter = gas;
+	GUARD_BEGIN(d, gas - d->gas_meter);
 	dwac_result r = dwac_setup_function_call(d, func_idx);
-	if (r) {return r;}
+	GUARD_END();
+
+	// Functions compiled ahead of time are done already.
+	if ((r != DWAC_OK) || (d->call_stack.size == call_stack_size))
+	{
+		if (d->gas_metering) {d->gas_consumed += gas - d->gas_meter;}
+		d->gas_meter = 0;
+		return r;
+	}
 	return dwac_tick(d);
 }
 
+// FNV-1a of the whole program, tells if code from drekkar_wasm2c was made
+// from the program loaded.
+uint64_t dwac_module_hash(const uint8_t *bytes, size_t size)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < size; i++)
+	{
+		h = (h ^ bytes[i]) * 0x100000001b3ULL;
+	}
+	return h;
+}
+
 // Environment shall call this to register all available functions.
 // That is functions the WebAsm program can import.
 void dwac_register_function(dwac_prog *p, const char *name, dwac_func_ptr ptr)
@@ -4744,15 +6523,26 @@ void dwac_register_function(dwac_prog *p, const char *name, dwac_func_ptr ptr)
 	dwac_hash_list_put(&p->available_functions_list, name, ptr);
 }
 
+// Same as dwac_register_function but for a function bound with its native
+// signature (see drekkar_wa_host.h). The import must have the same type as
+// the function, that is checked when the program is loaded.
+void dwac_register_host_function(dwac_prog *p, const char *name, const dwac_host_function_type *f)
+{
+	dwac_hash_list_put(&p->host_functions_list, name, (void*) f);
+}
+
 long long dwac_total_memory_usage(dwac_data *d)
 {
-	return d->memory.lower_mem.capacity +
-	(d->memory.upper_mem.end - d->memory.upper_mem.begin) +
-	d->memory.arguments.capacity +
+	#ifdef DWAC_GUARD_PAGES
+	return d->memory.accessible +
+	d->memory.arguments_size +
+	#else
+	return d->memory.nof_bytes +
+	#endif
 	(d->globals.capacity * 8) +
-	(d->block_stack.capacity * sizeof(dwac_block_stack_entry)) +
+	(d->call_stack.capacity * sizeof(dwac_call_stack_entry)) +
 	DWAC_STACK_CAPACITY * 8 +
-	d->pc.nof;
+	d->p->bytecodes.nof;
 }
 
 // The return value is the topmost value on stack.
@@ -4761,6 +6551,76 @@ int dwac_get_return_value(const dwac_data *d)
 	return (STACK_SIZE(d) > 0) ? (d->stack[d->sp].s64) : 0;
 }
 
+// Set the gas for each call of dwac_tick. A short slice gives control back
+// to the caller more often, a long one has less overhead.
+void dwac_set_gas_slice(dwac_data *d, long gas)
+{
+	d->gas_slice = (gas > 0) ? gas : 1;
+}
+
+// Set the total gas for each call of dwac_call_exported_function, including
+// all the dwac_tick it takes to complete (DWAC_GAS_UNLIMITED for no limit).
+void dwac_set_gas_budget(dwac_data *d, int64_t gas)
+{
+	d->gas_budget = gas;
+}
+
+// Give the current call more gas, when dwac_tick has returned
+// DWAC_GAS_BUDGET_USED it can continue after this.
+void dwac_refuel(dwac_data *d, int64_t gas)
+{
+	if (d->gas_limit != DWAC_GAS_UNLIMITED) {d->gas_limit += gas;}
+}
+
+// Gas the current call has left, DWAC_GAS_UNLIMITED if there is no limit.
+int64_t dwac_gas_remaining(const dwac_data *d)
+{
+	if (d->gas_limit == DWAC_GAS_UNLIMITED) {return DWAC_GAS_UNLIMITED;}
+	return (d->gas_limit > d->gas_consumed) ? d->gas_limit - d->gas_consumed : 0;
+}
+
+// Gas used by the current call so far.
+int64_t dwac_gas_consumed(const dwac_data *d)
+{
+	return d->gas_consumed;
+}
+
+// Turn gas metering on (the default) or off for an instance. Without it a
+// variant of the interpreter that does not count gas is used, for programs
+// that are trusted and shall run at full speed. No gas is then consumed
+// and slice and budget are not used.
+void dwac_set_gas_metering(dwac_data *d, int on)
+{
+	d->gas_metering = (on != 0);
+	select_tick(d);
+}
+
+#ifdef DWAC_COUNT_OPCODES
+// Number of opcodes run by this instance, see DWAC_COUNT_OPCODES.
+uint64_t dwac_nof_opcodes(const dwac_data *d)
+{
+	return d->nof_opcodes;
+}
+#endif
+
+#ifdef DWAC_INTERRUPT
+// Stop the running program at its next gas checkpoint, dwac_tick (or
+// dwac_call_exported_function) then returns DWAC_INTERRUPTED. Can be called
+// from another thread, for example a watchdog. If no program is running the
+// next one called is stopped.
+void dwac_interrupt(dwac_data *d)
+{
+	__atomic_store_n(&d->interrupt_requested, 1, __ATOMIC_RELAXED);
+}
+
+// Set a deadline timeout_us microseconds from now, zero for no deadline.
+// When it has passed dwac_tick returns DWAC_DEADLINE_EXCEEDED.
+void dwac_set_deadline(dwac_data *d, int64_t timeout_us)
+{
+	d->deadline_us = (timeout_us > 0) ? monotonic_time_us() + timeout_us : 0;
+}
+#endif
+
 void dwac_log_result(const dwac_data *d, const dwac_function *f, FILE* log)
 {
 	dbg("report_result\n");
@@ -4792,19 +6652,20 @@ void dwac_log_result(const dwac_data *d, const dwac_function *f, FILE* log)
 }
 
 #ifdef LOG_FUNC_NAMES
-void dwac_log_block_stack(dwac_data *d)
+void dwac_log_call_stack(dwac_data *d)
 {
 	printf("call stack:\n");
 	for(;;)
 	{
-		dwac_block_stack_entry *e = dwac_linear_storage_size_pop(&d->block_stack);
+		dwac_call_stack_entry *e = dwac_linear_storage_size_pop(&d->call_stack);
 		if (e == NULL) {break;}
-		switch(e->block_type_code)
+		switch(e->call_type)
 		{
 			case dwac_block_type_internal_func:
 			case dwac_block_type_imported_func:
+			case dwac_block_type_register_func:
 			{
-				printf("%4d %s\n", e->func_info.func_idx, dwac_get_func_name(d->p, e->func_info.func_idx));
+				printf("%4d %s\n", e->func_idx, dwac_get_func_name(d->p, e->func_idx));
 				break;
 			}
 			default:
@@ -4817,7 +6678,7 @@ void dwac_log_block_stack(dwac_data *d)
 	}
 }
 #else
-void dwac_log_block_stack(const dwac_prog *p, dwac_data *d)
+void dwac_log_call_stack(const dwac_prog *p, dwac_data *d)
 {
 	printf("Hint: Recompile dwac/dwae with LOG_FUNC_NAMES macro to display call stack.\n");
 }
@@ -4827,11 +6688,22 @@ void dwac_prog_deinit(dwac_prog *p)
 {
 	dbg("dwac_prog_deinit\n");
 
+	#ifdef DWAC_TRANSLATE_THREADS
+	stop_translate_threads(p);
+	dwac_linear_storage_32_deinit(&p->translate_queue);
+	pthread_mutex_destroy(&p->translate_mutex);
+	#endif
+
 	#ifdef LOG_FUNC_NAMES
 	dwac_linear_storage_size_deinit(&p->func_names);
 	#endif
 
+	#ifdef DWAC_VALIDATE
+	dwac_linear_storage_8_deinit(&p->global_types);
+	#endif
+
 	dwac_linear_storage_size_deinit(&p->function_types_vector);
+	dwac_linear_storage_32_deinit(&p->canonical_types);
 
 	for (uint32_t i = 0; i < p->funcs_vector.nof_imported; i++)
 	{
@@ -4842,8 +6714,17 @@ void dwac_prog_deinit(dwac_prog *p)
 	{
 		dwac_function *f = &p->funcs_vector.functions_array[i];
 		assert(f->block_type_code == dwac_block_type_internal_func);
+		dwac_linear_storage_32_deinit(&f->internal_function.code);
+		#ifdef DWAC_REGISTER_CODE
+		dwac_linear_storage_32_deinit(&f->internal_function.reg_code);
+		#endif
+		#ifdef DWAC_JIT
+		if (f->internal_function.jit_code != NULL) {munmap(f->internal_function.jit_code, f->internal_function.jit_size);}
+		dwac_linear_storage_32_deinit(&f->internal_function.jit_offsets);
+		#endif
 	}
 	DWAC_ST_FREE(p->funcs_vector.functions_array);
+	if (p->frames != NULL) {DWAC_ST_FREE(p->frames);}
 
 	dwac_hash_list_deinit(&p->exported_functions_list);
 
@@ -4851,6 +6732,7 @@ void dwac_prog_deinit(dwac_prog *p)
 	DWAC_ST_FREE(p->globals.array_of_func_types);
 	#endif
 	dwac_hash_list_deinit(&p->available_functions_list);
+	dwac_hash_list_deinit(&p->host_functions_list);
 	dwac_linear_storage_64_deinit(&p->func_table);
 }
 
@@ -4909,18 +6791,29 @@ void dwac_data_init(dwac_data *d, const dwac_prog* p)
 	d->stack[DWAC_STACK_CAPACITY - 1].s64 = WA_MAGIC_STACK_VALUE;
 
 	dwac_linear_storage_64_init(&d->globals);
-	dwac_linear_storage_8_init(&d->memory.lower_mem);
-	dwac_virtual_storage_init(&d->memory.upper_mem);
-	dwac_linear_storage_size_init(&d->block_stack, sizeof(dwac_block_stack_entry));
+	#ifdef DWAC_GUARD_PAGES
+	guard_memory_reserve(d);
+	#else
+	memory_pages_init(d);
+	#endif
+	dwac_linear_storage_size_init(&d->call_stack, sizeof(dwac_call_stack_entry));
+	dwac_linear_storage_size_init(&d->data_segments, sizeof(dwac_data_segment_type));
 
-	d->memory.arguments.size = 0;
-	d->memory.arguments.array = NULL;
+	#ifdef DWAC_GAS
+	d->gas_slice = DWAC_GAS;
+	#else
+	d->gas_slice = LONG_MAX;
+	#endif
+	d->gas_budget = DWAC_GAS_UNLIMITED;
+	d->gas_limit = DWAC_GAS_UNLIMITED;
+	d->gas_metering = 1;
+	select_tick(d);
 
 	// Initialize stack pointers.
 	d->sp = DWAC_SP_INITIAL; // Not zero but -1 here (CPU optimize from ref [3]).
 	d->fp = STACK_SIZE(d);
-	d->block_stack.size = 0;
-	dbg("wa_data_init 0x%x 0x%x 0x%llx\n", d->fp, d->sp, (long long)d->pc.pos);
+	d->call_stack.size = 0;
+	dbg("wa_data_init 0x%x 0x%x\n", d->fp, d->sp);
 
 }
 
@@ -4930,21 +6823,27 @@ void dwac_data_deinit(dwac_data *d, FILE* log)
 	assert(d->exception[sizeof(d->exception)-1]==0);
 
 	if (log) {
-		fprintf(log, "Memory usage: %zu + %zu + %zu  +  %zu + %zu + %u + %zu\n",
-			d->memory.lower_mem.capacity,
-			d->memory.upper_mem.end - d->memory.upper_mem.begin,
-			d->memory.arguments.capacity,
+		fprintf(log, "Memory usage: %zu + %u  +  %zu + %zu + %u + %zu\n",
+			#ifdef DWAC_GUARD_PAGES
+			d->memory.accessible,
+			#else
+			d->memory.nof_bytes,
+			#endif
+			d->memory.arguments_size,
 			d->globals.capacity * 8,
-			d->block_stack.capacity * sizeof(dwac_block_stack_entry),
+			d->call_stack.capacity * sizeof(dwac_call_stack_entry),
 			DWAC_STACK_CAPACITY * 8,
-			d->pc.nof);}
+			d->p->bytecodes.nof);}
 
 	dwac_linear_storage_64_deinit(&d->globals);
 
-	dwac_linear_storage_8_deinit(&d->memory.arguments);
-	dwac_linear_storage_size_deinit(&d->block_stack);
-	dwac_linear_storage_8_deinit(&d->memory.lower_mem);
-	dwac_virtual_storage_deinit(&d->memory.upper_mem);
+	dwac_linear_storage_size_deinit(&d->call_stack);
+	dwac_linear_storage_size_deinit(&d->data_segments);
+	#ifdef DWAC_GUARD_PAGES
+	if (d->memory.base != NULL) {munmap(d->memory.base, GUARD_RESERVED_SIZE);}
+	#else
+	memory_pages_deinit(d);
+	#endif
 
 	#ifdef LOOKUP_HASH_INIT_CAPACITY
 	dwac_lookup_hash_deinit(&d->lookup);
@@ -4958,11 +6857,22 @@ void dwac_prog_init(dwac_prog *p)
 	dbg("dwac_prog_init\n");
 	memset(p, 0, sizeof(dwac_prog));
 	dwac_hash_list_init(&p->available_functions_list);
+	dwac_hash_list_init(&p->host_functions_list);
 	dwac_hash_list_init(&p->exported_functions_list);
 	dwac_linear_storage_64_init(&p->func_table);
 	dwac_linear_storage_size_init(&p->function_types_vector, sizeof(dwac_func_type_type));
+	dwac_linear_storage_32_init(&p->canonical_types);
 
 	#ifdef LOG_FUNC_NAMES
 	dwac_linear_storage_size_init(&p->func_names, DWAC_HASH_LIST_MAX_KEY_SIZE+1);
 	#endif
+
+	#ifdef DWAC_VALIDATE
+	dwac_linear_storage_8_init(&p->global_types);
+	#endif
+
+	#ifdef DWAC_TRANSLATE_THREADS
+	pthread_mutex_init(&p->translate_mutex, NULL);
+	dwac_linear_storage_32_init(&p->translate_queue);
+	#endif
 }
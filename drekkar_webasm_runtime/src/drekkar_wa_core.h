@@ -205,6 +205,31 @@ uint64_t dwac_linear_storage_64_pop(dwac_linear_storage_64_type *s);
 
 
 
+// Begin of file linear_storage_32.h
+
+typedef struct dwac_linear_storage_32_type dwac_linear_storage_32_type;
+
+
+struct dwac_linear_storage_32_type
+{
+	size_t size;
+	size_t capacity;
+	uint32_t* array;
+};
+
+void dwac_linear_storage_32_init(dwac_linear_storage_32_type *list);
+void dwac_linear_storage_32_deinit(dwac_linear_storage_32_type *list);
+
+void dwac_linear_storage_32_grow_if_needed(dwac_linear_storage_32_type *s, size_t needed_size);
+void dwac_linear_storage_32_set(dwac_linear_storage_32_type *s, size_t idx, const uint32_t u);
+uint32_t dwac_linear_storage_32_get(dwac_linear_storage_32_type *s, size_t idx);
+void dwac_linear_storage_32_push(dwac_linear_storage_32_type *s, uint32_t value);
+uint32_t dwac_linear_storage_32_pop(dwac_linear_storage_32_type *s);
+
+// End of file linear_storage_32.h
+
+
+
 // Begin of file linear_storage_8.h
 
 
@@ -277,39 +302,6 @@ void* dwac_linear_storage_size_get_const(const dwac_linear_storage_size_type *s,
 
 
 
-// Begin of file virtual_storage.h
-
-
-typedef struct dwac_virtual_storage_type dwac_virtual_storage_type;
-
-
-struct dwac_virtual_storage_type
-{
-	size_t begin;
-	size_t end;
-	size_t inc;
-	uint8_t* array;
-};
-
-void dwac_virtual_storage_init(dwac_virtual_storage_type *list);
-void dwac_virtual_storage_deinit(dwac_virtual_storage_type *list);
-void dwac_virtual_storage_grow_buffer_if_needed(dwac_virtual_storage_type *s, size_t begin, size_t nof_bytes, size_t min, size_t max);
-
-void dwac_virtual_storage_set_mem(dwac_virtual_storage_type *s, size_t offset, const uint8_t *src, size_t nof_bytes);
-void dwac_virtual_storage_set_uint64_t(dwac_virtual_storage_type *s, size_t offset, const uint64_t i);
-void dwac_virtual_storage_set_uint32_t(dwac_virtual_storage_type *s, size_t offset, const uint32_t i);
-void dwac_virtual_storage_set_uint16_t(dwac_virtual_storage_type *s, size_t offset, const uint16_t i);
-void dwac_virtual_storage_set_uint8_t(dwac_virtual_storage_type *s, size_t offset, const uint8_t i);
-void* dwac_virtual_storage_get_ptr(dwac_virtual_storage_type *s, size_t offset, size_t nof_bytes);
-uint64_t dwac_virtual_storage_get_uint64_t(dwac_virtual_storage_type *s, size_t offset);
-uint32_t dwac_virtual_storage_get_uint32_t(dwac_virtual_storage_type *s, size_t offset);
-uint16_t dwac_virtual_storage_get_uint16_t(dwac_virtual_storage_type *s, size_t offset);
-uint8_t dwac_virtual_storage_get_uint8_t(dwac_virtual_storage_type *s, size_t offset);
-
-// End of file virtual_storage.h
-
-
-
 // Begin of file wa_leb.h
 
 
@@ -328,20 +320,61 @@ struct dwac_leb128_reader_type
 
 
 
+// Begin of file wa_code.h
+
+// Function bodies are translated from LEB128 encoded bytecodes into
+// 32 bit words when a program is loaded. Opcodes are one word and
+// all immediate operands follow as whole words so no LEB128 decoding
+// is needed while running. See translate_code.
+typedef struct dwac_code_reader_type dwac_code_reader_type;
+
+struct dwac_code_reader_type
+{
+	uint32_t pos;
+	uint32_t nof;
+	const uint32_t* array;
+};
+
+// End of file wa_code.h
+
+
+
 
 
 
 
 
 // Define this macro if gas metering feature is needed.
-// This defines the number of operations to do per tick.
+// This defines the default amount of gas to use per tick, it can be
+// changed when running by dwac_set_gas_slice. Each opcode has a cost
+// (see opcode_gas in drekkar_wa_core.c), the cost of the code from a branch
+// target up to the next branch is summed when the function is translated
+// and charged once when the branch is taken (see count_gas_in_code).
 // Comment the line below out if gas metering is not need.
 #define DWAC_GAS 0x10000
 
+// No limit for dwac_set_gas_budget.
+#define DWAC_GAS_UNLIMITED -1
+
+// Define this macro so that a running program can be stopped by another
+// thread (see dwac_interrupt) or when a deadline has passed (see
+// dwac_set_deadline). The interrupt is seen at the same places gas is
+// checked, the deadline when a slice of gas is used.
+#define DWAC_INTERRUPT
+
 // Shall code be translated during load of program or when a function is called?
 // Define macro below if it shall be during load.
 //#define TRANSLATE_ALL_AT_LOAD
 
+// Number of threads translating functions in background, while the program
+// runs, before they are called. Functions referenced from code already
+// translated are translated first. Comment out to not use threads, then
+// functions are only translated when called. Needs pthread (see Makefile).
+//#define DWAC_TRANSLATE_THREADS 1
+#ifdef DWAC_TRANSLATE_THREADS
+#include <pthread.h>
+#endif
+
 #define DWAC_MAGIC 0x6d736100
 #define DWAC_VERSION 0x01
 
@@ -372,6 +405,78 @@ struct dwac_leb128_reader_type
 // Enable this macro if floating point is not needed.
 //#define SKIP_FLOAT
 
+// Define this macro to let dwac_tick dispatch opcodes using computed goto
+// (labels as values) instead of a switch. Then each opcode handler ends with its
+// own jump to the next handler, these are easier for the CPU to predict than
+// the one shared jump of a switch. It is ignored (switch is used) if the compiler
+// does not have this extension (GCC and Clang have it).
+#define DWAC_COMPUTED_GOTO
+
+// Define this macro to validate (type check) all functions when a program is
+// loaded, see validate_function. If all are valid dwac_tick uses a variant of
+// the interpreter without the checks that validation has made unnecessary
+// (stack overflow, program counter out of range, missing block types etc).
+// Programs that do not pass validation still run, with those checks.
+#define DWAC_VALIDATE
+
+// Define this macro to replace some common sequences of opcodes with internal
+// opcodes (superinstructions) when functions are translated, see fuse_code.
+#define DWAC_FUSE_OPCODES
+
+// Define this macro to let dwac_tick keep the value on top of the operand
+// stack in a local variable (a CPU register) instead of in the stack memory.
+// Most opcodes take their operands from top of stack and leave the result
+// there so then a binary operation is one load from memory instead of two
+// loads and a store. See dwac_tick_state_type.
+#define DWAC_TOS_CACHE
+
+// Define this macro to give each call_indirect an inline cache of the last
+// functions it called, the value is the number of entries per call site. A
+// call to a table entry in the cache skips the lookup in the table and the
+// checks of it. See call_indirect_cache_lookup.
+#define DWAC_CALL_INDIRECT_CACHE 2
+
+// Define this macro to translate functions that do not call other functions
+// (and only use integer instructions) into register code, where operands are
+// slots in the frame instead of the operand stack. That is fewer instructions
+// to run and less moving of values to and from stack.
+#define DWAC_REGISTER_CODE
+
+// Define this macro to compile register code of functions that run often
+// into x86-64 machine code, see jit_compile. Functions are compiled when
+// the number of calls and branches done in them reach DWAC_JIT_THRESHOLD.
+// Needs DWAC_REGISTER_CODE, only used on x86-64 Linux.
+#define DWAC_JIT
+#define DWAC_JIT_THRESHOLD 1000
+#if defined(DWAC_JIT) && !(defined(DWAC_REGISTER_CODE) && defined(__x86_64__) && defined(__linux__))
+#undef DWAC_JIT
+#endif
+
+// Define this macro to run functions compiled ahead of time by drekkar_wasm2c
+// instead of interpreting them. That code is used if it is linked in and was
+// made from the same program (see dwac_aot_module_type). Needs weak symbols
+// so only used with GCC or Clang on ELF targets.
+#define DWAC_AOT
+#if defined(DWAC_AOT) && !(defined(__GNUC__) && defined(__ELF__))
+#undef DWAC_AOT
+#endif
+
+// Define this macro to reserve the whole 4 GiB address space of the memory
+// (and a guard after it) for each dwac_data instead of using lower and upper
+// memory (see translate_addr_grow_if_needed). Pages are made accessible as
+// the memory grows, an access outside of those is caught by a SIGSEGV
+// handler and the program stops with DWAC_ADDR_OUT_OF_RANGE. Loads and
+// stores are then done without any checks. Only used on 64 bit Linux.
+#define DWAC_GUARD_PAGES
+#if defined(DWAC_GUARD_PAGES) && !(defined(__linux__) && defined(__LP64__))
+#undef DWAC_GUARD_PAGES
+#endif
+
+// Define this macro to count the opcodes run by dwac_tick and the register
+// code (not machine code from DWAC_JIT), see dwac_nof_opcodes. It is for
+// benchmarks ("make bench" in test_code), counting makes the runtime slower.
+//#define DWAC_COUNT_OPCODES
+
 // Enable this macro if logging call stack is needed when exceptions happen.
 #define LOG_FUNC_NAMES
 
@@ -483,6 +588,12 @@ typedef enum {
 	DWAC_ADDR_OUT_OF_RANGE,
 	DWAC_TABLE_INSTRUCTIONS_NOT_SUPPORTED,
 	DWAC_SATURATING_NOT_SUPPORTED_YET,
+	DWAC_OUT_OF_GAS, // Code compiled ahead of time can not stop and continue later, so this is final.
+	DWAC_NOT_VALID, // Function did not pass validation, see DWAC_VALIDATE.
+	DWAC_IMPORT_TYPE_MISMATCH, // Type of import is not that of the host function, see dwac_register_host_function.
+	DWAC_GAS_BUDGET_USED, // All gas of dwac_set_gas_budget is used, can continue by dwac_tick after dwac_refuel.
+	DWAC_INTERRUPTED, // Stopped by dwac_interrupt, can continue by dwac_tick.
+	DWAC_DEADLINE_EXCEEDED, // The time of dwac_set_deadline has passed, can continue by dwac_tick after a new deadline.
 } dwac_result;
 
 typedef struct dwac_data dwac_data;
@@ -543,6 +654,7 @@ enum dwac_block_type_enum
 	dwac_block_type_if = 4,
 	dwac_block_type_internal_func = 5,
 	dwac_block_type_imported_func = 6,
+	dwac_block_type_register_func = 7, // An internal function running register code.
 };
 
 typedef struct dwac_value_type
@@ -570,56 +682,82 @@ typedef struct dwac_func_type_type
 // The type for function pointers to imported functions.
 typedef void (*dwac_func_ptr)(dwac_data *d);
 
+// An imported function can also be bound with its native signature, see
+// drekkar_wa_host.h. The trampoline reads the parameters from frame (the
+// first parameter is at frame[0]) and writes the result to frame[0]. Type
+// is checked against the type of the import when linking so the call needs
+// no checks of the stack.
+typedef void (*dwac_host_trampoline_ptr)(dwac_data *d, dwac_value_type *frame);
 
-// For function idx >= nof_imported &  dwac_block_type_init_exp.
-typedef struct dwac_func_info_type
+typedef struct dwac_host_function_type
 {
-	uint32_t func_idx;
-	uint32_t return_addr;
-	dwac_stack_pointer_type frame_pointer; // The saved frame pointer (as used by previous function).
-} dwac_func_info_type;
+	dwac_host_trampoline_ptr trampoline;
+	dwac_func_type_type type;
+} dwac_host_function_type;
 
-// branch address for branching out of a block or loop back in a loop.
-// If it is a loop then br_addr will point to the first instruction after the loop opcode.
-typedef struct dwac_block_info_type
-{
-	uint32_t br_addr;
-} dwac_block_info_type;
 
-// Then else and end addresses in an if block.
-typedef struct dwac_if_else_info
+// This is the type of data that is pushed on the call stack, one entry per
+// function called (and one for an init expression). Blocks, loops and ifs
+// have no entries, where branches go and what they take with them is found
+// by find_blocks_in_code.
+typedef struct dwac_call_stack_entry
 {
-	uint32_t end_addr;
-	uint32_t else_addr;
-} dwac_if_else_info;
-
-// This is the type of data that is pushed on the call/block stack.
-typedef struct dwac_block_stack_entry
+	dwac_code_reader_type return_pc; // Code and position to continue with in calling function.
+	uint32_t func_idx;
+	uint16_t nof_results;
+	uint8_t call_type; // dwac_block_type_internal_func, dwac_block_type_register_func or dwac_block_type_init_exp.
+	dwac_stack_pointer_type frame_pointer; // The saved frame pointer (as used by previous function).
+	dwac_stack_pointer_type stack_pointer; // The saved stack pointer, not counting parameters.
+} dwac_call_stack_entry;
+
+// [1] 2.5.12. Data Segments
+// The bytes of a data segment are where they are in the module (pos is the
+// offset in bytecodes). Used by memory.init, the size becomes zero when the
+// segment is dropped (active ones are dropped once they are copied).
+typedef struct dwac_data_segment_type
 {
-	// The type of the block and function currently being executed.
-	int32_t func_type_idx; // Index into types from section 1, or -64 for empty type (see value_type_enum).
-	uint8_t block_type_code; // See dwac_block_type_enum for possible values.
-	union {
-		dwac_func_info_type func_info; // For function idx >= nof_imported &  dwac_block_type_init_exp.
-		dwac_block_info_type block_and_loop_info; // For non functions, blocks loops etc.
-		dwac_if_else_info if_else_info; // For non functions, blocks loops etc.
-	};
+	uint32_t pos;
+	uint32_t size;
+} dwac_data_segment_type;
 
-	// The saved stack pointer (as used by previous function or block).
-	dwac_stack_pointer_type stack_pointer;
-} dwac_block_stack_entry;
 
+typedef enum
+{
+	dwac_translation_not_started = 0,
+	dwac_translation_in_progress = 1,
+	dwac_translation_done = 2,
+} dwac_translation_state_enum;
 
 typedef struct dwac_internal_function_type
 {
 		uint32_t nof_local;
-		uint32_t start_addr; // Location of the first opcode of a function or block.
-		uint32_t end_addr; // Location of the "end" opcode.
+		uint32_t start_addr; // Location of the first opcode of a function in bytecodes.
+		uint32_t end_addr; // Location of the "end" opcode in bytecodes.
+		dwac_linear_storage_32_type code; // The function body as translated code (see wa_code.h).
+		uint8_t translation_state; // See dwac_translation_state_enum and TRANSLATE_ALL_AT_LOAD.
+		uint8_t translation_result; // A dwac_result, valid when translation_state is dwac_translation_done.
+		uint32_t nof_call_sites; // Number of calls to this function seen in translated code.
+		uint32_t entry_gas; // Gas charged when the function is called, see count_gas_in_code.
+		#ifdef DWAC_VALIDATE
+		uint32_t max_stack_height; // Max number of values on operand stack (not counting local variables).
+		#endif
+		#ifdef DWAC_REGISTER_CODE
+		dwac_linear_storage_32_type reg_code; // Empty if function is not translated to register code.
+		uint32_t reg_nof_slots; // Size of frame (local variables and operand stack) in register code.
+		#endif
+		#ifdef DWAC_JIT
+		uint8_t *jit_code; // Machine code, NULL until compiled (see JIT_CODE).
+		size_t jit_size;
+		dwac_linear_storage_32_type jit_offsets; // Offset in jit_code for each position in reg_code.
+		uint32_t jit_hotness; // Number of calls and branches done in register code (about, see jit_hot).
+		uint8_t jit_state; // A dwac_translation_state_enum, see jit_hot.
+		#endif
 } dwac_internal_function_type;
 
 typedef struct dwac_imported_func_type
 {
 	dwac_func_ptr func_ptr;
+	const dwac_host_function_type *host_function; // NULL unless registered with dwac_register_host_function.
 } dwac_imported_func_type;
 
 typedef struct dwac_function
@@ -633,6 +771,35 @@ typedef struct dwac_function
 	};
 } dwac_function;
 
+// A function compiled ahead of time by drekkar_wasm2c. It takes its
+// parameters from the frame at d->fp and puts its results there.
+typedef dwac_result (*dwac_aot_func_ptr)(dwac_data *d);
+
+// The code drekkar_wasm2c generates for a program defines one of these
+// named dwac_aot_module, see DWAC_AOT.
+typedef struct dwac_aot_module_type
+{
+	uint64_t hash; // dwac_module_hash of the program the code was made from.
+	uint32_t nof_functions; // Number of internal functions.
+	const dwac_aot_func_ptr *functions; // One per internal function.
+} dwac_aot_module_type;
+
+// What is needed to call and return from an internal function, one per
+// function (imported ones are not used). It is made when a program is loaded
+// and code is set when the function is translated. It is used by dwac_tick
+// for calls and returns without looking up the function type.
+typedef struct dwac_frame_type
+{
+	const uint32_t *code; // Translated code, NULL if dwac_setup_function_call must be used.
+	uint32_t code_size;
+	int32_t func_type_idx;
+	uint16_t nof_parameters;
+	uint16_t nof_results;
+	uint32_t nof_local;
+	uint32_t max_stack_height; // Zero unless the function passed validation.
+	uint32_t entry_gas;
+} dwac_frame_type;
+
 // Imported and internal functions. Imported first then the internal ones.
 typedef struct dwac_functions_vector_type
 {
@@ -646,10 +813,13 @@ typedef struct dwac_prog
 {
 	dwac_leb128_reader_type bytecodes;
 	dwac_linear_storage_size_type function_types_vector;
+	dwac_linear_storage_32_type canonical_types; // For each function type the index of the first equal one, see canonicalize_types.
 	dwac_functions_vector_type funcs_vector;
+	dwac_frame_type *frames; // One per function, see dwac_frame_type.
 	dwac_hash_list exported_functions_list;
 	uint32_t start_function_idx;
 	dwac_hash_list available_functions_list;
+	dwac_hash_list host_functions_list; // Functions registered with dwac_register_host_function.
 
 	// Ref [2] WebAssembly.Table()
 	//   A WebAssembly.Table object is a resizable typed array of opaque values,
@@ -659,22 +829,60 @@ typedef struct dwac_prog
 	// by a running program, see not yet implemented instruction table.set.
 	dwac_linear_storage_64_type func_table;
 
+	uint32_t nof_data_segments; // As given by the data count section, memory.init and data.drop need it.
+
 	#ifdef LOG_FUNC_NAMES
 	dwac_linear_storage_size_type func_names;
 	#endif
 
+	#ifdef DWAC_VALIDATE
+	dwac_linear_storage_8_type global_types; // Value type of each global, needed by validate_function.
+	uint8_t validated; // Set if all functions passed validation.
+	#endif
+
+	#ifdef DWAC_AOT
+	const dwac_aot_func_ptr *aot_functions; // NULL unless code compiled ahead of time is used.
+	#endif
+
+	#ifdef DWAC_TRANSLATE_THREADS
+	pthread_t translate_threads[DWAC_TRANSLATE_THREADS];
+	uint32_t nof_translate_threads; // Number of threads started.
+	pthread_mutex_t translate_mutex; // Protects translate_queue.
+	dwac_linear_storage_32_type translate_queue; // Functions to translate in background, see translate_thread.
+	uint32_t translate_queue_pos;
+	uint8_t translate_stop; // Set to make translate threads stop.
+	#endif
+
 } dwac_prog;
 
 
+// Without DWAC_GUARD_PAGES memory is a two level table of 64 KiB pages that
+// are allocated when first used, see translate_addr_grow_if_needed. The
+// directory is indexed by the upper 8 bits of the address, it has one more
+// entry so that an access at the very end of the address space can go a
+// few bytes over it. The translation cache has the host address of the
+// pages used most recently, the size must be a power of 2.
+#define DWAC_MEMORY_DIRECTORY_SIZE 0x101
+#define DWAC_MEMORY_CACHE_SIZE 8
+
 // [2] WebAssembly.Memory()
 // A WebAssembly.Memory object is a resizable ArrayBuffer that holds the raw bytes of memory accessed by an Instance.
 typedef struct dwac_memory
 {
 	uint32_t maximum_size_in_pages;
 	uint32_t current_size_in_pages; // current size (64K pages)
-	dwac_linear_storage_8_type lower_mem;
-	dwac_virtual_storage_type upper_mem;
-	dwac_linear_storage_8_type  arguments; // Area where command line arguments are stored.
+	uint32_t arguments_size; // Bytes at DWAC_ARGUMENTS_BASE where command line arguments are stored.
+	#ifdef DWAC_GUARD_PAGES
+	uint8_t *base; // The reserved address space, see guard_memory_reserve.
+	size_t accessible; // Bytes from base that can be accessed (memory size when last updated).
+	#else
+	uint8_t **directory[DWAC_MEMORY_DIRECTORY_SIZE]; // Host address of each page, NULL if not used yet.
+	uint32_t cache_addr[DWAC_MEMORY_CACHE_SIZE]; // Address of page in cache, UINT32_MAX if none.
+	uint8_t *cache_array[DWAC_MEMORY_CACHE_SIZE]; // Host address of that page.
+	dwac_linear_storage_size_type blocks; // The allocated pages, see memory_block_type.
+	dwac_linear_storage_size_type merged_blocks; // Blocks moved into another, freed when the host function that may read them returns.
+	size_t nof_bytes; // Bytes allocated for pages.
+	#endif
 } dwac_memory;
 
 // Stores all data for a WebAssembly instance. Also called context.
@@ -682,21 +890,39 @@ typedef struct dwac_memory
 struct dwac_data
 {
 	const dwac_prog* p;
-	dwac_leb128_reader_type pc;
+	dwac_code_reader_type pc;
 
 	// Main stack and stack pointer.
 	dwac_stack_pointer_type sp; // NOTE offset by minus DWAC_SP_OFFSET
 	dwac_stack_pointer_type fp;
 	dwac_value_type stack[DWAC_STACK_CAPACITY];
 
-	// The call and block stack.
-	dwac_linear_storage_size_type block_stack; // Storage for entries of type dwac_block_stack_entry.
+	// The call stack.
+	dwac_linear_storage_size_type call_stack; // Storage for entries of type dwac_call_stack_entry.
 
 	// Globals and memory
 	dwac_linear_storage_64_type globals;
 	dwac_memory memory;
+	dwac_linear_storage_size_type data_segments; // Entries of type dwac_data_segment_type.
 	uint64_t temp_value;
+
+	// Gas, see dwac_tick. The meter is what is left of the current slice,
+	// it is zero when not in dwac_tick.
 	long gas_meter;
+	long gas_slice; // Gas for each call of dwac_tick.
+	int64_t gas_budget; // Gas for each call of dwac_call_exported_function (or DWAC_GAS_UNLIMITED).
+	int64_t gas_limit; // Gas the current call may use, the budget and refuels.
+	int64_t gas_consumed; // Gas used by the current call.
+	uint8_t gas_metering; // See dwac_set_gas_metering.
+	dwac_result (*tick)(dwac_data *d); // The variant of the interpreter used by dwac_tick, see select_tick.
+
+	#ifdef DWAC_COUNT_OPCODES
+	uint64_t nof_opcodes; // Opcodes run, see DWAC_COUNT_OPCODES.
+	#endif
+
+	// See dwac_interrupt and dwac_set_deadline.
+	uint8_t interrupt_requested; // Set by another thread, only use with __atomic.
+	int64_t deadline_us; // CLOCK_MONOTONIC in microseconds, zero if no deadline.
 
 	// Typically errno is set if there was a fail from syscalls.
 	// This can be removed if no syscalls will be used.
@@ -723,6 +949,14 @@ void dwac_data_deinit(dwac_data *d, FILE* log);
 dwac_result dwac_set_command_line_arguments(dwac_data *d, uint32_t argc, const char **argv);
 void* dwac_translate_to_host_addr_space(dwac_data *d, uint32_t offset, size_t size);
 void dwac_register_function(dwac_prog *p, const char* name, dwac_func_ptr ptr);
+void dwac_register_host_function(dwac_prog *p, const char* name, const dwac_host_function_type *f);
+dwac_result dwac_call_imported_function(dwac_data *d, uint32_t function_idx);
+uint32_t dwac_memory_grow(dwac_data *d, uint32_t delta_in_pages);
+dwac_result dwac_memory_init(dwac_data *d, uint32_t dataidx, uint32_t dst, uint32_t src, uint32_t n);
+dwac_result dwac_data_drop(dwac_data *d, uint32_t dataidx);
+dwac_result dwac_memory_copy(dwac_data *d, uint32_t dst, uint32_t src, uint32_t n);
+dwac_result dwac_memory_fill(dwac_data *d, uint32_t dst, uint8_t value, uint32_t n);
+uint64_t dwac_module_hash(const uint8_t *bytes, size_t size);
 void dwac_push_value_i64(dwac_data *d, int64_t v);
 int64_t dwac_pop_value_i64(dwac_data *d);
 const dwac_func_type_type* dwac_get_func_type_ptr(const dwac_prog *p, int32_t type_idx);
@@ -730,7 +964,18 @@ dwac_result dwac_call_exported_function(dwac_data *d, uint32_t func_idx);
 const char* dwac_get_func_name(const dwac_prog *p, long function_idx);
 long long dwac_total_memory_usage(dwac_data *d);
 void dwac_log_result(const dwac_data *d, const dwac_function *f, FILE* log);
-void dwac_log_block_stack(dwac_data *d);
+void dwac_log_call_stack(dwac_data *d);
 int dwac_get_return_value(const dwac_data *d);
+void dwac_set_gas_slice(dwac_data *d, long gas);
+void dwac_set_gas_budget(dwac_data *d, int64_t gas);
+void dwac_refuel(dwac_data *d, int64_t gas);
+int64_t dwac_gas_remaining(const dwac_data *d);
+int64_t dwac_gas_consumed(const dwac_data *d);
+void dwac_set_gas_metering(dwac_data *d, int on);
+#ifdef DWAC_COUNT_OPCODES
+uint64_t dwac_nof_opcodes(const dwac_data *d);
+#endif
+void dwac_interrupt(dwac_data *d);
+void dwac_set_deadline(dwac_data *d, int64_t timeout_us);
 
 #endif
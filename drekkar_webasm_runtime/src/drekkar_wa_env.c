@@ -30,6 +30,7 @@ Created October 2023 by Henrik
 #include <stdio.h>
 #include <ctype.h>
 #include <assert.h>
+#include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -45,6 +46,7 @@ Created October 2023 by Henrik
 #endif
 
 #include "drekkar_wa_core.h"
+#include "drekkar_wa_host.h"
 #include "drekkar_wa_env.h"
 
 // Enable this macro if lots of debug logging is needed.
@@ -131,62 +133,52 @@ static int is_param_ok(dwac_data *d, int expected_nof_params)
 
 /*uint32_fd_write(int32_t  fd, uint32_t iovs_offset, uint32_t iovs_len, uint32_t nwritten_offset);*/
 // https://wasix.org/docs/api-reference/wasi/fd_write
-static void dwae_fd_write(dwac_data *d)
+static int32_t dwae_fd_write(dwac_data *d, int32_t fd, uint32_t iovs_offset, uint32_t iovs_len, uint32_t nwritten_offset)
 {
-	if (!is_param_ok(d, 4)) {return;}
-
-    // POP last parameter first.
-	uint32_t nwritten_offset = dwac_pop_value_i64(d);
-    uint32_t iovs_len = dwac_pop_value_i64(d);
-    uint32_t iovs_offset = dwac_pop_value_i64(d);
-    int32_t  fd = dwac_pop_value_i64(d);
-
 	int n = 0;
 
-	// Translate from script internal to host addresses.
-	const wa_ciovec_type* iovs_offset_ptr = (wa_ciovec_type*) (dwac_translate_to_host_addr_space(d, iovs_offset, 4));
-	uint32_t* nwritten_offset_ptr = (uint32_t*) (dwac_translate_to_host_addr_space(d, nwritten_offset, 4));
-
 	//printf("iovs_len %d\n", iovs_len);
 
 	assert((fd>=1) && (fd<=2));
 	for(unsigned int i=0; i < iovs_len; ++i)
 	{
-		const wa_ciovec_type *v = &iovs_offset_ptr[i];
+		// Translate from script internal to host addresses. The iovec is
+		// copied since translating the buffer may move its page (see
+		// dwac_translate_to_host_addr_space).
+		const wa_ciovec_type v = *(const wa_ciovec_type*) dwac_translate_to_host_addr_space(d, iovs_offset + i * sizeof(wa_ciovec_type), sizeof(wa_ciovec_type));
 
-		//printf(" <v->buf_len %d> ", v->buf_len);
-		const uint8_t* ptr = (uint8_t*)dwac_translate_to_host_addr_space(d, v->buf, v->buf_len);
+		//printf(" <v.buf_len %d> ", v.buf_len);
+		const uint8_t* ptr = (uint8_t*)dwac_translate_to_host_addr_space(d, v.buf, v.buf_len);
 
-		write(fd, ptr, v->buf_len);
-		n += v->buf_len;
+		write(fd, ptr, v.buf_len);
+		n += v.buf_len;
 	}
 
+	uint32_t* nwritten_offset_ptr = (uint32_t*) (dwac_translate_to_host_addr_space(d, nwritten_offset, 4));
 	*nwritten_offset_ptr = n;
 
 	//snprintf(d->exception, sizeof(d->exception), "Not implemented: wa_fd_write");
 
-	// Push return value.
-	dwac_push_value_i64(d, WASI_ESUCCESS);
+	return WASI_ESUCCESS;
 }
+DWAC_HOST_FUNCTION(dwae_fd_write_binding, int32_t, dwae_fd_write, int32_t, uint32_t, uint32_t, uint32_t)
 
 // int32_t emscripten_memcpy_big(int32_t dest, int32_t src, int32_t num);
 // (import "env" "emscripten_memcpy_big" (func $fimport$1 (param i32 i32 i32) (result i32)))
-static void memcpy_big(dwac_data *d)
+// Same as memory.copy, translating both dest and src could move the pages
+// of dest (see dwac_translate_to_host_addr_space).
+static void memcpy_js(dwac_data *d, uint32_t dest, uint32_t src, uint32_t num)
 {
-	if (!is_param_ok(d, 3)) {return;}
-	//long n = 0;
-
-    // POP last parameter first.
-	uint32_t num = dwac_pop_value_i64(d);
-    uint32_t src = dwac_pop_value_i64(d);
-    uint32_t dest = dwac_pop_value_i64(d);
-
-	void* dest_ptr = dwac_translate_to_host_addr_space(d, dest, num);
-	const void* src_ptr = dwac_translate_to_host_addr_space(d, src, num);
-	memcpy(dest_ptr, src_ptr, num);
+	dwac_memory_copy(d, dest, src, num);
+}
+DWAC_HOST_PROCEDURE(memcpy_js_binding, memcpy_js, uint32_t, uint32_t, uint32_t)
 
-	dwac_push_value_i64(d, WASI_ESUCCESS);
+static int32_t memcpy_big(dwac_data *d, uint32_t dest, uint32_t src, uint32_t num)
+{
+	memcpy_js(d, dest, src, num);
+	return WASI_ESUCCESS;
 }
+DWAC_HOST_FUNCTION(memcpy_big_binding, int32_t, memcpy_big, uint32_t, uint32_t, uint32_t)
 
 // https://github.com/emscripten-core/emscripten/issues/6024
 // setTempRet0 is an import in that module, which you must provide. It's a temp
@@ -195,34 +187,35 @@ static void memcpy_big(dwac_data *d)
 // low 32 bits and calls setTempRet0 with the higher 32 bits.
 //
 // Not tested.
-static void setTempRet0(dwac_data *d)
+static void setTempRet0(dwac_data *d, int32_t v)
 {
-	d->temp_value = dwac_pop_value_i64(d);
+	d->temp_value = v;
 }
+DWAC_HOST_PROCEDURE(setTempRet0_binding, setTempRet0, int32_t)
 
 // Not tested.
-static void getTempRet0(dwac_data *d)
+static int32_t getTempRet0(dwac_data *d)
 {
-	dwac_push_value_i64(d, d->temp_value);
+	return d->temp_value;
 }
+DWAC_HOST_FUNCTION(getTempRet0_binding, int32_t, getTempRet0)
 
 // Import 0x2 'emscripten_resize_heap'  param i32, result i32
-static void emscripten_resize_heap(dwac_data *d)
+// Grow memory to at least the requested size in bytes, gives 1 if
+// memory is that big now and 0 if not.
+static int32_t emscripten_resize_heap(dwac_data *d, uint32_t a)
 {
-	if (!is_param_ok(d, 1)) {return;}
-	uint64_t a = dwac_pop_value_i64(d);
-    printf("emscripten_resize_heap %llu\n", (unsigned long long)a);
-    // Will assume we just change current_size_in_pages.
-    uint64_t requestedSize = ((a + (DWAC_PAGE_SIZE-1)) / DWAC_PAGE_SIZE) * DWAC_PAGE_SIZE;
-    requestedSize = (requestedSize <= DWAC_ARGUMENTS_BASE) ? requestedSize : DWAC_ARGUMENTS_BASE;
-    d->memory.current_size_in_pages = requestedSize / DWAC_PAGE_SIZE;
-    if (d->memory.current_size_in_pages > d->memory.maximum_size_in_pages)
-    {
-    	printf("maximum_size_in_pages exceeded 0x%x > 0x%x\n", d->memory.current_size_in_pages, d->memory.maximum_size_in_pages);
-    }
-
-	dwac_push_value_i64(d, d->memory.current_size_in_pages * DWAC_PAGE_SIZE);
+	const uint64_t requested_pages = ((uint64_t)a + (DWAC_PAGE_SIZE-1)) / DWAC_PAGE_SIZE;
+	dbg("emscripten_resize_heap %u\n", a);
+	if (requested_pages <= d->memory.current_size_in_pages) {return 1;}
+	if (dwac_memory_grow(d, requested_pages - d->memory.current_size_in_pages) == UINT32_MAX)
+	{
+		printf("emscripten_resize_heap 0x%x exceeds maximum_size_in_pages 0x%x\n", a, d->memory.maximum_size_in_pages);
+		return 0;
+	}
+	return 1;
 }
+DWAC_HOST_FUNCTION(emscripten_resize_heap_binding, int32_t, emscripten_resize_heap, uint32_t)
 
 // TODO Have not found a specification for what this one shall do.
 // Search at emscripten.org gave no hit.
@@ -300,22 +293,15 @@ static void log_empty_line(dwac_data *d)
 
 // https://refspecs.linuxbase.org/LSB_5.0.0/LSB-Core-generic/LSB-Core-generic/baselib---assert-fail-1.html
 // void __assert_fail(const char * assertion, const char * file, unsigned int line, const char * function);
-static void assert_fail(dwac_data *d)
+static void assert_fail(dwac_data *d, uint32_t cond, uint32_t file, uint32_t line, uint32_t func)
 {
-	if (!is_param_ok(d, 4)) {return;}
-
-	// param i32 i32 i32 i32
-	uint32_t func = dwac_pop_value_i64(d);
-	uint32_t line = dwac_pop_value_i64(d);
-	uint32_t file = dwac_pop_value_i64(d);
-	uint32_t cond = dwac_pop_value_i64(d);
-
 	const uint8_t* cond_str = (uint8_t*)dwac_translate_to_host_addr_space(d, cond, 256);
 	const uint8_t* file_name = (uint8_t*)dwac_translate_to_host_addr_space(d, file, 256);
 	const uint8_t* func_name = (uint8_t*)dwac_translate_to_host_addr_space(d, func, 256);
 
 	snprintf(d->exception, sizeof(d->exception), "Assertion failed: %.32s %.32s %u %.32s", cond_str, file_name, line, func_name);
 }
+DWAC_HOST_PROCEDURE(assert_fail_binding, assert_fail, uint32_t, uint32_t, uint32_t, uint32_t)
 
 static void drekkar_wart_version(dwac_data *d)
 {
@@ -327,15 +313,8 @@ static void drekkar_wart_version(dwac_data *d)
 //  (import "env" "__syscall_open" (func $fimport$2 (param i32 i32 i32) (result i32)))
 // https://man7.org/linux/man-pages/man2/open.2.html
 // int open(const char *pathname, int flags, mode_t mode);
-// Remember last argument pops up first.
-static void dwae_syscall_open(dwac_data *d)
+static int32_t dwae_syscall_open(dwac_data *d, uint32_t pathname_i, int32_t flags, uint32_t mode_i)
 {
-	if (!is_param_ok(d, 3)) {return;}
-
-	int mode_i = dwac_pop_value_i64(d);
-	int flags = dwac_pop_value_i64(d);
-	int pathname_i = dwac_pop_value_i64(d);
-
 	mode_t *mode = dwac_translate_to_host_addr_space(d, mode_i, sizeof(mode_t));
 	const char* pathname = dwac_translate_to_host_addr_space(d, pathname_i, 1);
 
@@ -343,25 +322,21 @@ static void dwae_syscall_open(dwac_data *d)
 
 	printf("syscall_open '%s' 0x%x  %d\n", pathname, flags, r);
 
-	dwac_push_value_i64(d, r);
+	return r;
 }
+DWAC_HOST_FUNCTION(dwae_syscall_open_binding, int32_t, dwae_syscall_open, uint32_t, int32_t, uint32_t)
 
 
 // Not tested.
 // 'env/__syscall_fcntl64' param i32 i32 i32, result i32'
-static void dwae_syscall_fcntl64(dwac_data *d)
+static int32_t dwae_syscall_fcntl64(dwac_data *d, int32_t p0, int32_t p1, int32_t p2)
 {
-	if (!is_param_ok(d, 3)) {return;}
-
-	/*uint32_t p2 =*/ dwac_pop_value_i64(d);
-	/*uint32_t p1 =*/ dwac_pop_value_i64(d);
-	/*uint32_t p0 =*/ dwac_pop_value_i64(d);
-
 	// TODO
 	snprintf(d->exception, sizeof(d->exception), "Not implemented: env/__syscall_fcntl64");
 
-	dwac_push_value_i64(d, 0);
+	return 0;
 }
+DWAC_HOST_FUNCTION(dwae_syscall_fcntl64_binding, int32_t, dwae_syscall_fcntl64, int32_t, int32_t, int32_t)
 
 // Not tested.
 // int ioctl(int fd, unsigned long request, ...);
@@ -424,35 +399,26 @@ static void dwae_syscall_ioctl(dwac_data *d)
 //
 // The implementation below is not as described above but is
 // tested using emscripten.
-static void dwae_fd_read(dwac_data *d)
+static int32_t dwae_fd_read(dwac_data *d, int32_t fd, uint32_t iovs_offset, uint32_t iovs_len, uint32_t nread_offset)
 {
-	if (!is_param_ok(d, 4)) {return;}
 	long n = 0;
 
-    // POP last parameter first.
-	uint32_t nread_offset = dwac_pop_value_i64(d);
-    uint32_t iovs_len = dwac_pop_value_i64(d);
-    uint32_t iovs_offset = dwac_pop_value_i64(d);
-    int32_t  fd = dwac_pop_value_i64(d);
-
     dbg("fd_read %d %d %d %d\n", fd, iovs_offset, iovs_len, nread_offset);
 
 
-	// Translate from script internal to host addresses.
-	wa_ciovec_type* iovs_offset_ptr = (wa_ciovec_type*) (dwac_translate_to_host_addr_space(d, iovs_offset, 4));
-	uint32_t* nread_offset_ptr = (uint32_t*) (dwac_translate_to_host_addr_space(d, nread_offset, 4));
-
 	//printf("iovs_len %d\n", iovs_len);
 
 	assert((fd>=0) || (fd<=3)); // TODO Don't hard code 3.
 	for(unsigned int i=0; i < iovs_len; ++i)
 	{
-		wa_ciovec_type *v = &iovs_offset_ptr[i];
+		// Translate from script internal to host addresses. The iovec is
+		// copied, as in dwae_fd_write.
+		const wa_ciovec_type v = *(const wa_ciovec_type*) dwac_translate_to_host_addr_space(d, iovs_offset + i * sizeof(wa_ciovec_type), sizeof(wa_ciovec_type));
 
-		//printf(" <v->buf_len %d> ", v->buf_len);
-		uint8_t* ptr = (uint8_t*)dwac_translate_to_host_addr_space(d, v->buf, v->buf_len);
+		//printf(" <v.buf_len %d> ", v.buf_len);
+		uint8_t* ptr = (uint8_t*)dwac_translate_to_host_addr_space(d, v.buf, v.buf_len);
 
-		ssize_t r = read(fd, ptr, v->buf_len);
+		ssize_t r = read(fd, ptr, v.buf_len);
 		if (r>=0)
 		{
 			/*printf("fd_read ");
@@ -463,62 +429,49 @@ static void dwae_fd_read(dwac_data *d)
 		else
 		{
 			printf("fd_read fail %zd\n", r);
-			dwac_push_value_i64(d, r);
-			return;
+			return r;
 		}
 	}
 
+	uint32_t* nread_offset_ptr = (uint32_t*) (dwac_translate_to_host_addr_space(d, nread_offset, 4));
 	*nread_offset_ptr = n;
 
     dbg("fd_read n = %ld\n", n);
 
 	//snprintf(d->exception, sizeof(d->exception), "Not implemented:fd_read");
 
-	// Push return value.
-	dwac_push_value_i64(d, WASI_ESUCCESS);
+	return WASI_ESUCCESS;
 }
+DWAC_HOST_FUNCTION(dwae_fd_read_binding, int32_t, dwae_fd_read, int32_t, uint32_t, uint32_t, uint32_t)
 
 // 'wasi_snapshot_preview1/fd_close' param i32, result i32'
 //  (import "wasi_snapshot_preview1" "fd_close" (func $fimport$7 (param i32) (result i32)))
-static void dwae_fd_close(dwac_data *d)
+static int32_t dwae_fd_close(dwac_data *d, uint32_t fd)
 {
-	if (!is_param_ok(d, 1)) {return;}
-
-	uint32_t fd = dwac_pop_value_i64(d);
-
 	assert(fd == 3); // TODO
 	dbg("fd_close %d\n", fd);
 	close(fd);
 
-	dwac_push_value_i64(d, WASI_ESUCCESS);
+	return WASI_ESUCCESS;
 }
+DWAC_HOST_FUNCTION(dwae_fd_close_binding, int32_t, dwae_fd_close, uint32_t)
 
 // Not tested.
 // 'env/__syscall_getcwd' param i32 i32, result i32'
-static void dwae_syscall_getcwd(dwac_data *d)
+static int32_t dwae_syscall_getcwd(dwac_data *d, int32_t p0, int32_t p1)
 {
-	if (!is_param_ok(d, 2)) {return;}
-
-	/*uint32_t p1 =*/ dwac_pop_value_i64(d);
-	/*uint32_t p0 =*/ dwac_pop_value_i64(d);
-
 	// TODO
 	snprintf(d->exception, sizeof(d->exception), "Not implemented: env/__syscall_getcwd");
 
-	dwac_push_value_i64(d, 0);
+	return 0;
 }
+DWAC_HOST_FUNCTION(dwae_syscall_getcwd_binding, int32_t, dwae_syscall_getcwd, int32_t, int32_t)
 
 // Not tested.
 // 'env/__syscall_readlink' param i32 i32 i32, result i32'
 // ssize_t readlink(const char *restrict pathname, char *restrict buf, size_t bufsiz);
-static void dwae_syscall_readlink(dwac_data *d)
+static int32_t dwae_syscall_readlink(dwac_data *d, uint32_t pathname, uint32_t buf, uint32_t bufsiz)
 {
-	if (!is_param_ok(d, 3)) {return;}
-
-	uint32_t bufsiz = dwac_pop_value_i64(d);
-	uint32_t buf = dwac_pop_value_i64(d);
-	uint32_t pathname = dwac_pop_value_i64(d);
-
 	const char* pathname_ptr = dwac_translate_to_host_addr_space(d, pathname, 1);
 	char* buf_ptr = dwac_translate_to_host_addr_space(d, buf, bufsiz);
 
@@ -526,23 +479,20 @@ static void dwae_syscall_readlink(dwac_data *d)
 
 	dbg("env/__syscall_readlink '%s' %zd %u '%s'\n", pathname_ptr, r, bufsiz, buf_ptr);
 
-	dwac_push_value_i64(d, r);
+	return r;
 }
+DWAC_HOST_FUNCTION(dwae_syscall_readlink_binding, int32_t, dwae_syscall_readlink, uint32_t, uint32_t, uint32_t)
 
 // Not tested.
 // 'env/__syscall_fstat64' param i32 i32, result i32'
-static void dwae_syscall_fstat64(dwac_data *d)
+static int32_t dwae_syscall_fstat64(dwac_data *d, int32_t p0, int32_t p1)
 {
-	if (!is_param_ok(d, 2)) {return;}
-
-	/*uint32_t p1 =*/ dwac_pop_value_i64(d);
-	/*uint32_t p0 =*/ dwac_pop_value_i64(d);
-
 	// TODO
 	snprintf(d->exception, sizeof(d->exception), "Not implemented: env/__syscall_fstat64");
 
-	dwac_push_value_i64(d, 0);
+	return 0;
 }
+DWAC_HOST_FUNCTION(dwae_syscall_fstat64_binding, int32_t, dwae_syscall_fstat64, int32_t, int32_t)
 
 #if 0
 // https://linux.die.net/man/2/getdents64
@@ -577,22 +527,21 @@ struct dwae_guest_stat {
 // https://gist.github.com/mejedi/e0a5ee813c88effaa146ad6bd65fc482
 // When I was experimenting here it turned out someone else was also at same time:
 // https://github.com/emscripten-core/emscripten/issues/20840
-static void dwae_syscall_stat64(dwac_data *d)
+static int32_t dwae_syscall_stat64(dwac_data *d, uint32_t path, uint32_t buf)
 {
-	if (!is_param_ok(d, 2)) {return;}
-
     #ifdef __EMSCRIPTEN__
 
 	// Unable to use system calls
 	// https://github.com/emscripten-core/emscripten/issues/6708
-	const char* pathname = (const char*)dwac_translate_to_host_addr_space(d, dwac_pop_value_i64(d), 1);
+	const char* pathname = (const char*)dwac_translate_to_host_addr_space(d, path, 1);
 	snprintf(d->exception, sizeof(d->exception), "Not implemented: env/__syscall_stat64 '%s'", pathname);
 	int r = -1;
 
 	#elif 1
 
-	struct dwae_guest_stat *statbuf = (struct dwae_guest_stat *)dwac_translate_to_host_addr_space(d, dwac_pop_value_i64(d), sizeof(struct dwae_guest_stat));
-	const char* pathname = (const char*)dwac_translate_to_host_addr_space(d, dwac_pop_value_i64(d), 256);
+	// The buffer written is translated last, see dwac_translate_to_host_addr_space.
+	const char* pathname = (const char*)dwac_translate_to_host_addr_space(d, path, 256);
+	struct dwae_guest_stat *statbuf = (struct dwae_guest_stat *)dwac_translate_to_host_addr_space(d, buf, sizeof(struct dwae_guest_stat));
 
 	struct stat sb;
 	int r = stat(pathname, &sb);
@@ -603,8 +552,8 @@ static void dwae_syscall_stat64(dwac_data *d)
 
     #else
 
-	struct linux_dirent* statbuf = dwac_translate_to_host_addr_space(d, dwac_pop_value_i64(d), sizeof(struct linux_dirent));
-	const char* pathname = (const char*)dwac_translate_to_host_addr_space(d, dwac_pop_value_i64(d), 1);
+	struct linux_dirent* statbuf = dwac_translate_to_host_addr_space(d, buf, sizeof(struct linux_dirent));
+	const char* pathname = (const char*)dwac_translate_to_host_addr_space(d, path, 1);
 
 	//uint32_t r = syscall(SYS_getdents64, pathname, statbuf);
 	uint32_t r = getdents64(pathname, statbuf);
@@ -619,61 +568,45 @@ static void dwae_syscall_stat64(dwac_data *d)
 		*e = errno;
 	}
 
-	dwac_push_value_i64(d, r);
+	return r;
 }
+DWAC_HOST_FUNCTION(dwae_syscall_stat64_binding, int32_t, dwae_syscall_stat64, uint32_t, uint32_t)
 
 // Not implemented.
 // 'env/__syscall_lstat64' param i32 i32, result i32'
 // int __syscall_lstat64(intptr_t path, intptr_t buf);
-static void dwae_syscall_lstat64(dwac_data *d)
+static int32_t dwae_syscall_lstat64(dwac_data *d, int32_t p0, int32_t p1)
 {
-	if (!is_param_ok(d, 2)) {return;}
-
-	/*uint32_t p1 =*/ dwac_pop_value_i64(d);
-	/*uint32_t p0 =*/ dwac_pop_value_i64(d);
-
 	// TODO
 	snprintf(d->exception, sizeof(d->exception), "Not implemented: env/__syscall_lstat64");
 
-	dwac_push_value_i64(d, 0);
+	return 0;
 }
+DWAC_HOST_FUNCTION(dwae_syscall_lstat64_binding, int32_t, dwae_syscall_lstat64, int32_t, int32_t)
 
 
 // Not implemented.
 // 'env/__syscall_fstatat64' param i32 i32 i32 i32, result i32'
 //  (import "env" "__syscall_fstatat64" (func $fimport$12 (param i32 i32 i32 i32) (result i32)))
-static void dwae_syscall_fstatat64(dwac_data *d)
+static int32_t dwae_syscall_fstatat64(dwac_data *d, int32_t p0, int32_t p1, int32_t p2, int32_t p3)
 {
-	if (!is_param_ok(d, 4)) {return;}
-
-	/*uint32_t p3 =*/ dwac_pop_value_i64(d);
-	/*uint32_t p2 =*/ dwac_pop_value_i64(d);
-	/*uint32_t p1 =*/ dwac_pop_value_i64(d);
-	/*uint32_t p0 =*/ dwac_pop_value_i64(d);
-
 	// TODO
 	snprintf(d->exception, sizeof(d->exception), "Not implemented: env/__syscall_fstatat64");
 
-	dwac_push_value_i64(d, 0);
+	return 0;
 }
+DWAC_HOST_FUNCTION(dwae_syscall_fstatat64_binding, int32_t, dwae_syscall_fstatat64, int32_t, int32_t, int32_t, int32_t)
 
 // Not implemented.
 // 'wasi_snapshot_preview1/fd_seek' param i32 i32 i32 i32 i32, result i32'
-static void dwae_fd_seek(dwac_data *ctx)
+static int32_t dwae_fd_seek(dwac_data *ctx, int32_t p0, int32_t p1, int32_t p2, int32_t p3, int32_t p4)
 {
-	if (!is_param_ok(ctx, 5)) {return;}
-
-	/*uint32_t p4 =*/ dwac_pop_value_i64(ctx);
-	/*uint32_t p3 =*/ dwac_pop_value_i64(ctx);
-	/*uint32_t p2 =*/ dwac_pop_value_i64(ctx);
-	/*uint32_t p1 =*/ dwac_pop_value_i64(ctx);
-	/*uint32_t p0 =*/ dwac_pop_value_i64(ctx);
-
 	// TODO
 	snprintf(ctx->exception, sizeof(ctx->exception), "Not implemented: wasi_snapshot_preview1/fd_seek");
 
-	dwac_push_value_i64(ctx, 0);
+	return 0;
 }
+DWAC_HOST_FUNCTION(dwae_fd_seek_binding, int32_t, dwae_fd_seek, int32_t, int32_t, int32_t, int32_t, int32_t)
 
 static size_t dwae_get_command_line_arguments_string_size(uint32_t argc, const char **argv)
 {
@@ -695,40 +628,29 @@ static void put32(uint8_t *ptr, uint32_t v)
 }
 
 // https://wasix.org/docs/api-reference/wasi/args_sizes_get
-static void dwae_args_sizes_get(dwac_data *ctx)
+static int32_t dwae_args_sizes_get(dwac_data *ctx, uint32_t argc, uint32_t argv_buf_size)
 {
-	if (!is_param_ok(ctx, 2)) {return;}
-
-	uint32_t argv_buf_size = dwac_pop_value_i64(ctx);
-	uint32_t argc = dwac_pop_value_i64(ctx);
-
 	uint32_t* argc_ptr = (uint32_t*)dwac_translate_to_host_addr_space(ctx, argc, 4);
-	uint32_t* argv_buf_size_ptr = (uint32_t*)dwac_translate_to_host_addr_space(ctx, argv_buf_size, 4);
-
 	*argc_ptr = ctx->dwac_emscripten_argc;
+	uint32_t* argv_buf_size_ptr = (uint32_t*)dwac_translate_to_host_addr_space(ctx, argv_buf_size, 4);
 	*argv_buf_size_ptr = dwae_get_command_line_arguments_string_size(ctx->dwac_emscripten_argc, ctx->dwac_emscripten_argv);
 
-	dbg("args_sizes_get %u %u %d %zu\n", argc, argv_buf_size, ctx->dwac_emscripten_argc, ctx->memory.arguments.size);
+	dbg("args_sizes_get %u %u %d %u\n", argc, argv_buf_size, ctx->dwac_emscripten_argc, ctx->memory.arguments_size);
 
-	dwac_push_value_i64(ctx, 0);
+	return 0;
 }
+DWAC_HOST_FUNCTION(dwae_args_sizes_get_binding, int32_t, dwae_args_sizes_get, uint32_t, uint32_t)
 
 // https://wasix.org/docs/api-reference/wasi/args_get
-static void dwae_args_get(dwac_data *ctx)
+static int32_t dwae_args_get(dwac_data *ctx, uint32_t argv, uint32_t argv_buf)
 {
-	if (!is_param_ok(ctx, 2)) {return;}
-
-	uint32_t argv_buf = dwac_pop_value_i64(ctx);
-	uint32_t argv = dwac_pop_value_i64(ctx);
-
 	dbg("args_get %u %u\n", argv, argv_buf);
 
-	uint8_t* argv_ptr = (uint8_t*)dwac_translate_to_host_addr_space(ctx, argv, (DWAC_PTR_SIZE * ctx->dwac_emscripten_argc));
-
-	// Copy the strings over to guest memory.
+	// Copy the strings over to guest memory. Each address is translated
+	// just before it is written, see dwac_translate_to_host_addr_space.
 	for (int i = 0; i < ctx->dwac_emscripten_argc; ++i)
 	{
-		put32(argv_ptr + (DWAC_PTR_SIZE * i), argv_buf);
+		put32(dwac_translate_to_host_addr_space(ctx, argv + (DWAC_PTR_SIZE * i), DWAC_PTR_SIZE), argv_buf);
 		const uint32_t n = strlen(ctx->dwac_emscripten_argv[i]);
 		uint8_t *ptr = dwac_translate_to_host_addr_space(ctx, argv_buf, n);
 		memcpy(ptr, ctx->dwac_emscripten_argv[i], n);
@@ -752,41 +674,33 @@ static void dwae_args_get(dwac_data *ctx)
 	//memcpy(argv_ptr, memory_reserved_by_compiler_ptr, DWAC_PTR_SIZE * ctx->dwac_emscripten_argc);
 	//memcpy(argv_buf_ptr, memory_reserved_by_compiler_ptr + (DWAC_PTR_SIZE * ctx->dwac_emscripten_argc), ctx->arg_string_size_in_bytes);
 
-	dwac_push_value_i64(ctx, 0);
+	return 0;
 }
+DWAC_HOST_FUNCTION(dwae_args_get_binding, int32_t, dwae_args_get, uint32_t, uint32_t)
 
 // https://wasix.org/docs/api-reference/wasi/proc_exit
-static void dwae_proc_exit(dwac_data *ctx)
+static void dwae_proc_exit(dwac_data *ctx, int32_t exit_code)
 {
-	if (!is_param_ok(ctx, 1)) {return;}
-
-	int64_t exit_code = dwac_get_return_value(ctx);
-
 	snprintf(ctx->exception, sizeof(ctx->exception), "exit %lld", (long long int)exit_code);
 }
+DWAC_HOST_PROCEDURE(dwae_proc_exit_binding, dwae_proc_exit, int32_t)
 
 #ifndef __EMSCRIPTEN__
 // 'env/__syscall_getdents64' param i32 i32 i32, result i32'
 // fd, buf, BUF_SIZE
 // https://linux.die.net/man/2/getdents64
 // int getdents(unsigned int fd, struct linux_dirent *dirp, unsigned int count);
-static void dwae_syscall_getdents64(dwac_data *d)
+static int32_t dwae_syscall_getdents64(dwac_data *d, uint32_t fd, uint32_t buf, uint32_t buf_size)
 {
-	if (!is_param_ok(d, 3)) {return;}
-
-	uint32_t buf_size = dwac_pop_value_i64(d);
-	uint32_t buf = dwac_pop_value_i64(d);
-	uint32_t fd = dwac_pop_value_i64(d);
-
-
 	const char* buf_ptr = (const char*)dwac_translate_to_host_addr_space(d, buf, buf_size);
 
 	uint32_t nread = syscall(SYS_getdents64, fd, buf_ptr, buf_size);
 
 	dbg("env/__syscall_getdents64 %x %x\n", fd, buf_size);
 
-	dwac_push_value_i64(d, nread);
+	return nread;
 }
+DWAC_HOST_FUNCTION(dwae_syscall_getdents64_binding, int32_t, dwae_syscall_getdents64, uint32_t, uint32_t, uint32_t)
 #endif
 
 // TODO Duplicate code see: dwac_report_result(p, d, f, log);
@@ -808,33 +722,34 @@ static void register_functions(dwac_prog *p)
 {
 	dbg("register_functions\n");
 
-	dwac_register_function(p, "wasi_snapshot_preview1/fd_write", dwae_fd_write);
-	dwac_register_function(p, "wasi_snapshot_preview1/fd_read", dwae_fd_read);
-	dwac_register_function(p, "wasi_snapshot_preview1/fd_close", dwae_fd_close);
-	dwac_register_function(p, "wasi_snapshot_preview1/fd_seek", dwae_fd_seek);
-	dwac_register_function(p, "wasi_snapshot_preview1/args_sizes_get", dwae_args_sizes_get);
-	dwac_register_function(p, "wasi_snapshot_preview1/args_get", dwae_args_get);
-	dwac_register_function(p, "wasi_snapshot_preview1/proc_exit", dwae_proc_exit);
-
-	dwac_register_function(p, "env/__assert_fail", assert_fail);
-	dwac_register_function(p, "env/emscripten_memcpy_big", memcpy_big);
-	dwac_register_function(p, "env/emscripten_resize_heap", emscripten_resize_heap);
-	dwac_register_function(p, "env/emscripten_memcpy_js", memcpy_big);
-	dwac_register_function(p, "env/setTempRet0", setTempRet0);
-	dwac_register_function(p, "env/getTempRet0", getTempRet0);
+	dwac_register_host_function(p, "wasi_snapshot_preview1/fd_write", &dwae_fd_write_binding);
+	dwac_register_host_function(p, "wasi_snapshot_preview1/fd_read", &dwae_fd_read_binding);
+	dwac_register_host_function(p, "wasi_snapshot_preview1/fd_close", &dwae_fd_close_binding);
+	dwac_register_host_function(p, "wasi_snapshot_preview1/fd_seek", &dwae_fd_seek_binding);
+	dwac_register_host_function(p, "wasi_snapshot_preview1/args_sizes_get", &dwae_args_sizes_get_binding);
+	dwac_register_host_function(p, "wasi_snapshot_preview1/args_get", &dwae_args_get_binding);
+	dwac_register_host_function(p, "wasi_snapshot_preview1/proc_exit", &dwae_proc_exit_binding);
+
+	dwac_register_host_function(p, "env/__assert_fail", &assert_fail_binding);
+	dwac_register_host_function(p, "env/emscripten_memcpy_big", &memcpy_big_binding);
+	dwac_register_host_function(p, "env/emscripten_resize_heap", &emscripten_resize_heap_binding);
+	dwac_register_host_function(p, "env/emscripten_memcpy_js", &memcpy_js_binding);
+	dwac_register_host_function(p, "env/setTempRet0", &setTempRet0_binding);
+	dwac_register_host_function(p, "env/getTempRet0", &getTempRet0_binding);
 	//dwac_register_function(p, "env/emscripten_asm_const_int", emscripten_asm_const_int);
 
-	dwac_register_function(p, "env/__syscall_open", dwae_syscall_open);
-	dwac_register_function(p, "env/__syscall_fcntl64", dwae_syscall_fcntl64);
+	dwac_register_host_function(p, "env/__syscall_open", &dwae_syscall_open_binding);
+	dwac_register_host_function(p, "env/__syscall_fcntl64", &dwae_syscall_fcntl64_binding);
+	// Takes a variable number of parameters so not bound with its native signature.
 	dwac_register_function(p, "env/__syscall_ioctl", dwae_syscall_ioctl);
-	dwac_register_function(p, "env/__syscall_getcwd", dwae_syscall_getcwd);
-	dwac_register_function(p, "env/__syscall_readlink", dwae_syscall_readlink);
-	dwac_register_function(p, "env/__syscall_fstat64", dwae_syscall_fstat64);
-	dwac_register_function(p, "env/__syscall_stat64", dwae_syscall_stat64);
-	dwac_register_function(p, "env/__syscall_fstatat64", dwae_syscall_fstatat64);
-	dwac_register_function(p, "env/__syscall_lstat64", dwae_syscall_lstat64);
+	dwac_register_host_function(p, "env/__syscall_getcwd", &dwae_syscall_getcwd_binding);
+	dwac_register_host_function(p, "env/__syscall_readlink", &dwae_syscall_readlink_binding);
+	dwac_register_host_function(p, "env/__syscall_fstat64", &dwae_syscall_fstat64_binding);
+	dwac_register_host_function(p, "env/__syscall_stat64", &dwae_syscall_stat64_binding);
+	dwac_register_host_function(p, "env/__syscall_fstatat64", &dwae_syscall_fstatat64_binding);
+	dwac_register_host_function(p, "env/__syscall_lstat64", &dwae_syscall_lstat64_binding);
 	#ifndef __EMSCRIPTEN__
-	dwac_register_function(p, "env/__syscall_getdents64", dwae_syscall_getdents64);
+	dwac_register_host_function(p, "env/__syscall_getdents64", &dwae_syscall_getdents64_binding);
 	#endif
 
 	dwac_register_function(p, "drekkar/wart_version", drekkar_wart_version);
@@ -860,31 +775,34 @@ static dwac_result check_exception(const dwac_prog *p, dwac_data *d, dwac_result
 			else
 			{
 				printf("exception %d '%s'\n", r, d->exception);
-				dwac_log_block_stack(d);
+				dwac_log_call_stack(d);
 				log_data_stack(d);
 			}
 			break;
 		case DWAC_OK:
 		case DWAC_EXIT:
 		case DWAC_NEED_MORE_GAS:
+		case DWAC_GAS_BUDGET_USED:
+		case DWAC_INTERRUPTED:
+		case DWAC_DEADLINE_EXCEEDED:
 			if (d->exception[0] != 0)
 			{
 				printf("Unhandled exception '%s'\n", d->exception);
-				dwac_log_block_stack(d);
+				dwac_log_call_stack(d);
 				log_data_stack(d);
 				return DWAC_EXCEPTION;
 			}
 			else if (dwac_total_memory_usage(d) > MAX_MEM_QUOTA)
 			{
 				printf("To much memory used %lld > %d\n", dwac_total_memory_usage(d), MAX_MEM_QUOTA);
-				dwac_log_block_stack(d);
+				dwac_log_call_stack(d);
 				log_data_stack(d);
 				return DWAC_MAX_MEM_QUOTA_EXCEEDED;
 			}
 			break;
 	}
 	d->exception[0] = 0;
-	return DWAC_OK;
+	return r;
 }
 
 static dwac_result set_command_line_arguments(dwac_env_type *e)
@@ -925,14 +843,29 @@ static dwac_result parse_data_sections(const dwac_prog *p, dwac_data *d)
 	return check_exception(p, d, r);;
 }
 
-static dwac_result call_and_run_exported_function(const dwac_prog *p, dwac_data *d, const dwac_function *f, FILE* log)
+// Calls the function and runs it until done. The gas options of e (see
+// main.c) are used here, a budget used is refuelled and interrupts (to test
+// dwac_interrupt) are done and the program continued.
+static dwac_result call_and_run_exported_function(dwac_env_type *e, const dwac_function *f)
 {
 	dbg("call_and_run_exported_function\n");
-	long long total_gas_usage = 0;
+	const dwac_prog *p = e->p;
+	dwac_data *d = e->d;
+	FILE *log = e->log;
+	if (e->gas_slice > 0) {dwac_set_gas_slice(d, e->gas_slice);}
+	if (e->gas_budget > 0) {dwac_set_gas_budget(d, e->gas_budget);}
+	int nof_refuels = 0;
+	int nof_interrupts = 0;
+	#ifdef DWAC_INTERRUPT
+	if (e->deadline_ms > 0) {dwac_set_deadline(d, e->deadline_ms * 1000);}
+	if (nof_interrupts < e->interrupts) {dwac_interrupt(d);}
+	#endif
+	#ifdef DWAC_COUNT_OPCODES
+	const clock_t start = clock();
+	#endif
 	dwac_result r = dwac_call_exported_function(d, f->func_idx);
 	for(;;)
 	{
-		total_gas_usage += (DWAC_GAS - d->gas_meter);
 		r = check_exception(p, d, r);
 		switch(r)
 		{
@@ -940,16 +873,39 @@ static dwac_result call_and_run_exported_function(const dwac_prog *p, dwac_data
 				// Guest has more work to do. Let it continue some more.
 				r = dwac_tick(d);
 				break;
+			case DWAC_GAS_BUDGET_USED:
+				if (e->gas_budget <= 0) {return r;}
+				nof_refuels++;
+				dwac_refuel(d, e->gas_budget);
+				r = dwac_tick(d);
+				break;
+			#ifdef DWAC_INTERRUPT
+			case DWAC_INTERRUPTED:
+				nof_interrupts++;
+				if (nof_interrupts < e->interrupts) {dwac_interrupt(d);}
+				r = dwac_tick(d);
+				break;
+			case DWAC_DEADLINE_EXCEEDED:
+				printf("Deadline exceeded, gas used %lld\n", (long long) dwac_gas_consumed(d));
+				return r;
+			#endif
 			case DWAC_OK:
 			case DWAC_EXIT:
 				// Guest is done.
 				if (log)
 				{
 					dwac_log_result(d, f, log);
-					fprintf(log, "Total gas and memory usage: %lld %lld\n", total_gas_usage, dwac_total_memory_usage(d));
+					fprintf(log, "Total gas and memory usage: %lld %lld\n", (long long) dwac_gas_consumed(d), dwac_total_memory_usage(d));
+					if ((nof_refuels != 0) || (nof_interrupts != 0)) {fprintf(log, "Refuels and interrupts: %d %d\n", nof_refuels, nof_interrupts);}
+					#ifdef DWAC_COUNT_OPCODES
+					const double ns = (double)(clock() - start) * 1e9 / CLOCKS_PER_SEC;
+					const unsigned long long n = dwac_nof_opcodes(d);
+					fprintf(log, "Opcodes run: %llu, CPU time %.0f ms, %.2f ns per opcode\n", n, ns / 1e6, n ? ns / n : 0.0);
+					#endif
 				}
 				return r;
 			default:
+				if (log) {fprintf(log, "Gas used until stopped: %lld\n", (long long) dwac_gas_consumed(d));}
 				return r;
 		}
 	}
@@ -1021,7 +977,7 @@ static dwac_result find_and_call(dwac_env_type *e)
 		}
 	}
 
-	return call_and_run_exported_function(e->p, e->d, f, e->log);
+	return call_and_run_exported_function(e, f);
 }
 
 // Returns zero (DWAC_OK) if OK.
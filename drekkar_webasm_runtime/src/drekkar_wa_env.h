@@ -107,6 +107,10 @@ struct dwae_type
 	int argc;
 	const char* argv[DREKKAR_MAX_ARGUMENTS];
 	const char* function_name;
+	long gas_slice; // If not zero, see dwac_set_gas_slice.
+	int64_t gas_budget; // If not zero, see dwac_set_gas_budget. Refuelled by as much when used.
+	int interrupts; // Times to interrupt (and continue) the program, see dwac_interrupt.
+	int64_t deadline_ms; // If not zero, see dwac_set_deadline.
 	dwac_linear_storage_8_type bytes;
 	dwac_prog *p;
 	dwac_data *d;
@@ -0,0 +1,102 @@
+/*
+ * drekkar_wa_host.h
+ *
+ * Drekkar WebAsm Core (DWAC)
+ * http://www.drekkar.com/
+ * https://github.com/xehp/drekkar_webasm.git
+ * Copyright (C) 2023 Henrik Bjorkman http://www.eit.se/hb
+ *
+ * Macros to bind a host function with its native signature, so that the
+ * runtime can call it without popping the parameters one at a time. For
+ * C++ see drekkar_wa_host.hpp.
+ *
+ * The host function takes dwac_data first, then the parameters as seen by
+ * the WebAsm program. Use the types from stdint.h, float and double, all
+ * integers of 32 bits or less are i32. For example:
+ *
+ *   static int32_t my_add(dwac_data *d, uint32_t a, uint32_t b) {return a + b;}
+ *   DWAC_HOST_FUNCTION(my_add_binding, int32_t, my_add, uint32_t, uint32_t)
+ *   ...
+ *   dwac_register_host_function(p, "env/my_add", &my_add_binding);
+ *
+ * Use DWAC_HOST_PROCEDURE for functions that return void. The binding
+ * gets a trampoline that reads the parameters directly from the frame and
+ * writes the result there. The type of the binding is compared with the
+ * type of the import when the program is loaded (DWAC_IMPORT_TYPE_MISMATCH
+ * if they differ) so no checks are needed when calling.
+ *
+ * To signal an error a host function shall write to d->exception.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "drekkar_wa_core.h"
+
+// The value type of a native type.
+#ifndef SKIP_FLOAT
+#define DWAC_HOST_TYPE(T) _Generic((T)0, float: DWAC_F32, double: DWAC_F64, int64_t: DWAC_I64, uint64_t: DWAC_I64, default: DWAC_I32)
+#else
+#define DWAC_HOST_TYPE(T) _Generic((T)0, int64_t: DWAC_I64, uint64_t: DWAC_I64, default: DWAC_I32)
+#endif
+
+// Parameter i of type T in frame.
+#ifndef SKIP_FLOAT
+#define DWAC_HOST_ARG(T, i) ((T) _Generic((T)0, float: frame[i].f32, double: frame[i].f64, int64_t: frame[i].s64, uint64_t: frame[i].u64, uint32_t: frame[i].u32, default: frame[i].s32))
+#else
+#define DWAC_HOST_ARG(T, i) ((T) _Generic((T)0, int64_t: frame[i].s64, uint64_t: frame[i].u64, uint32_t: frame[i].u32, default: frame[i].s32))
+#endif
+
+// Put the result r of type R in frame, as PUSH_I32 etc would.
+#ifndef SKIP_FLOAT
+#define DWAC_HOST_SET_RESULT(R, r) _Generic((R)0, float: (frame[0].f32 = (r)), double: (frame[0].f64 = (r)), uint32_t: (frame[0].u64 = (uint32_t)(r)), uint64_t: (frame[0].u64 = (r)), default: (frame[0].s64 = (r)))
+#else
+#define DWAC_HOST_SET_RESULT(R, r) _Generic((R)0, uint32_t: (frame[0].u64 = (uint32_t)(r)), uint64_t: (frame[0].u64 = (r)), default: (frame[0].s64 = (r)))
+#endif
+
+// Count the parameter types given (up to 8).
+#define DWAC_HOST_NARGS(...) DWAC_HOST_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define DWAC_HOST_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+#define DWAC_HOST_CAT(a, b) DWAC_HOST_CAT_(a, b)
+#define DWAC_HOST_CAT_(a, b) a##b
+
+// The parameters to pass on, each prefixed with a comma (after dwac_data).
+#define DWAC_HOST_ARGS_0()
+#define DWAC_HOST_ARGS_1(T0) , DWAC_HOST_ARG(T0, 0)
+#define DWAC_HOST_ARGS_2(T0, T1) DWAC_HOST_ARGS_1(T0), DWAC_HOST_ARG(T1, 1)
+#define DWAC_HOST_ARGS_3(T0, T1, T2) DWAC_HOST_ARGS_2(T0, T1), DWAC_HOST_ARG(T2, 2)
+#define DWAC_HOST_ARGS_4(T0, T1, T2, T3) DWAC_HOST_ARGS_3(T0, T1, T2), DWAC_HOST_ARG(T3, 3)
+#define DWAC_HOST_ARGS_5(T0, T1, T2, T3, T4) DWAC_HOST_ARGS_4(T0, T1, T2, T3), DWAC_HOST_ARG(T4, 4)
+#define DWAC_HOST_ARGS_6(T0, T1, T2, T3, T4, T5) DWAC_HOST_ARGS_5(T0, T1, T2, T3, T4), DWAC_HOST_ARG(T5, 5)
+#define DWAC_HOST_ARGS_7(T0, T1, T2, T3, T4, T5, T6) DWAC_HOST_ARGS_6(T0, T1, T2, T3, T4, T5), DWAC_HOST_ARG(T6, 6)
+#define DWAC_HOST_ARGS_8(T0, T1, T2, T3, T4, T5, T6, T7) DWAC_HOST_ARGS_7(T0, T1, T2, T3, T4, T5, T6), DWAC_HOST_ARG(T7, 7)
+#define DWAC_HOST_ARGS(...) DWAC_HOST_CAT(DWAC_HOST_ARGS_, DWAC_HOST_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
+// The value types of the parameters, for parameters_list.
+#define DWAC_HOST_TYPES_0() 0
+#define DWAC_HOST_TYPES_1(T0) DWAC_HOST_TYPE(T0)
+#define DWAC_HOST_TYPES_2(T0, T1) DWAC_HOST_TYPES_1(T0), DWAC_HOST_TYPE(T1)
+#define DWAC_HOST_TYPES_3(T0, T1, T2) DWAC_HOST_TYPES_2(T0, T1), DWAC_HOST_TYPE(T2)
+#define DWAC_HOST_TYPES_4(T0, T1, T2, T3) DWAC_HOST_TYPES_3(T0, T1, T2), DWAC_HOST_TYPE(T3)
+#define DWAC_HOST_TYPES_5(T0, T1, T2, T3, T4) DWAC_HOST_TYPES_4(T0, T1, T2, T3), DWAC_HOST_TYPE(T4)
+#define DWAC_HOST_TYPES_6(T0, T1, T2, T3, T4, T5) DWAC_HOST_TYPES_5(T0, T1, T2, T3, T4), DWAC_HOST_TYPE(T5)
+#define DWAC_HOST_TYPES_7(T0, T1, T2, T3, T4, T5, T6) DWAC_HOST_TYPES_6(T0, T1, T2, T3, T4, T5), DWAC_HOST_TYPE(T6)
+#define DWAC_HOST_TYPES_8(T0, T1, T2, T3, T4, T5, T6, T7) DWAC_HOST_TYPES_7(T0, T1, T2, T3, T4, T5, T6), DWAC_HOST_TYPE(T7)
+#define DWAC_HOST_TYPES(...) DWAC_HOST_CAT(DWAC_HOST_TYPES_, DWAC_HOST_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
+// Defines a dwac_host_function_type named name for the host function fn
+// that returns R and takes the parameter types given after fn.
+#define DWAC_HOST_FUNCTION(name, R, fn, ...) \
+	static void name##_trampoline(dwac_data *d, dwac_value_type *frame) \
+	{ \
+		DWAC_HOST_SET_RESULT(R, fn(d DWAC_HOST_ARGS(__VA_ARGS__))); \
+	} \
+	static const dwac_host_function_type name = {name##_trampoline, {DWAC_HOST_NARGS(__VA_ARGS__), {DWAC_HOST_TYPES(__VA_ARGS__)}, 1, {DWAC_HOST_TYPE(R)}}};
+
+// Same as DWAC_HOST_FUNCTION but for a host function that returns void.
+#define DWAC_HOST_PROCEDURE(name, fn, ...) \
+	static void name##_trampoline(dwac_data *d, dwac_value_type *frame) \
+	{ \
+		fn(d DWAC_HOST_ARGS(__VA_ARGS__)); \
+	} \
+	static const dwac_host_function_type name = {name##_trampoline, {DWAC_HOST_NARGS(__VA_ARGS__), {DWAC_HOST_TYPES(__VA_ARGS__)}, 0, {0}}};
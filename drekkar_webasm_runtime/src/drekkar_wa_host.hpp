@@ -0,0 +1,119 @@
+/*
+ * drekkar_wa_host.hpp
+ *
+ * Drekkar WebAsm Core (DWAC)
+ * http://www.drekkar.com/
+ * https://github.com/xehp/drekkar_webasm.git
+ * Copyright (C) 2023 Henrik Bjorkman http://www.eit.se/hb
+ *
+ * The C++ variant of drekkar_wa_host.h (needs C++17). The signature is
+ * given as the parameters and result seen by the WebAsm program, the host
+ * function takes dwac_data first. For example:
+ *
+ *   static int32_t my_add(dwac_data *d, uint32_t a, uint32_t b) {return a + b;}
+ *   ...
+ *   dwac::register_host_function<int32_t(uint32_t, uint32_t), my_add>(p, "env/my_add");
+ *
+ * The trampoline is made for that function and signature so the call of
+ * the host function can be inlined into it.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <utility>
+#include <type_traits>
+
+extern "C" {
+#include "drekkar_wa_core.h"
+}
+
+namespace dwac {
+
+// How a native type is stored in a dwac_value_type, as PUSH_I32 etc would.
+template <typename T> struct value;
+template <> struct value<int32_t>
+{
+	static constexpr uint8_t type = DWAC_I32;
+	static int32_t get(const dwac_value_type &v) {return v.s32;}
+	static void set(dwac_value_type &v, int32_t r) {v.s64 = r;}
+};
+template <> struct value<uint32_t>
+{
+	static constexpr uint8_t type = DWAC_I32;
+	static uint32_t get(const dwac_value_type &v) {return v.u32;}
+	static void set(dwac_value_type &v, uint32_t r) {v.u64 = r;}
+};
+template <> struct value<int64_t>
+{
+	static constexpr uint8_t type = DWAC_I64;
+	static int64_t get(const dwac_value_type &v) {return v.s64;}
+	static void set(dwac_value_type &v, int64_t r) {v.s64 = r;}
+};
+template <> struct value<uint64_t>
+{
+	static constexpr uint8_t type = DWAC_I64;
+	static uint64_t get(const dwac_value_type &v) {return v.u64;}
+	static void set(dwac_value_type &v, uint64_t r) {v.u64 = r;}
+};
+#ifndef SKIP_FLOAT
+template <> struct value<float>
+{
+	static constexpr uint8_t type = DWAC_F32;
+	static float get(const dwac_value_type &v) {return v.f32;}
+	static void set(dwac_value_type &v, float r) {v.f32 = r;}
+};
+template <> struct value<double>
+{
+	static constexpr uint8_t type = DWAC_F64;
+	static double get(const dwac_value_type &v) {return v.f64;}
+	static void set(dwac_value_type &v, double r) {v.f64 = r;}
+};
+#endif
+
+template <typename Signature> struct host;
+
+template <typename R, typename... A> struct host<R(A...)>
+{
+	static_assert(sizeof...(A) <= sizeof(dwac_func_type_type::parameters_list), "To many parameters");
+
+	typedef R (*function)(dwac_data *d, A...);
+
+	template <function F, size_t... I>
+	static void call(dwac_data *d, dwac_value_type *frame, std::index_sequence<I...>)
+	{
+		if constexpr (std::is_void<R>::value)
+		{
+			F(d, value<A>::get(frame[I])...);
+		}
+		else
+		{
+			value<R>::set(frame[0], F(d, value<A>::get(frame[I])...));
+		}
+	}
+
+	template <function F>
+	static void trampoline(dwac_data *d, dwac_value_type *frame)
+	{
+		call<F>(d, frame, std::index_sequence_for<A...>{});
+	}
+
+	static constexpr uint8_t result_type()
+	{
+		if constexpr (std::is_void<R>::value) {return 0;} else {return value<R>::type;}
+	}
+
+	template <function F>
+	static constexpr dwac_host_function_type binding = {trampoline<F>, {sizeof...(A), {value<A>::type...}, std::is_void<R>::value ? 0u : 1u, {result_type()}}};
+};
+
+// Register the host function F with the given signature, see
+// dwac_register_host_function.
+template <typename Signature, typename host<Signature>::function F>
+void register_host_function(dwac_prog *p, const char *name)
+{
+	dwac_register_host_function(p, name, &host<Signature>::template binding<F>);
+}
+
+}
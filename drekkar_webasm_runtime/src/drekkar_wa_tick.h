@@ -0,0 +1,2021 @@
+/*
+drekkar_wa_tick.h
+
+Drekkar WebAsm runtime environment
+https://www.drekkar.com/
+https://github.com/xehp/drekkar_webasm.git
+
+The interpreter (the stack machine) of dwac_tick. This is included by
+drekkar_wa_core.c once for each variant of the interpreter. TICK_NAME is the
+name of the function to make and TICK_VALIDATED tells if it runs code that
+has passed validation (see DWAC_VALIDATE), then checks that validation has
+made unnecessary are left out. TICK_METERED tells if gas is counted, see
+TICK_CHARGE and TICK_CHECKPOINT.
+
+Inside the interpreter loop pc, sp, fp and the gas meter are used via s
+(see dwac_tick_state_type) and not via d. Use TICK_RETURN to return from it.
+
+Copyright (C) 2023 Henrik Bjorkman http://www.eit.se/hb/.
+*/
+
+static dwac_result TICK_NAME(dwac_data *d)
+{
+	dbg("dwac_tick\n");
+
+	const dwac_prog *p = d->p;
+
+	assert(d->call_stack.size != 0);
+	if (d->stack[DWAC_STACK_CAPACITY - 1].s64 != WA_MAGIC_STACK_VALUE) {return DWAC_STACK_OVERFLOW;}
+	if (d->pc.pos >= d->pc.nof) {return DWAC_PC_ADDR_OUT_OF_RANGE;}
+	if (d->exception[0] !=  0) {return DWAC_EXCEPTION;}
+
+	#ifdef DWAC_REGISTER_CODE
+	if (IN_REGISTER_CODE(d))
+	{
+		const dwac_result r = run_register_code(d);
+		if ((r != DWAC_OK) || (d->call_stack.size == 0)) {return r;}
+	}
+	#endif
+
+	// From here on pc, sp, fp and the gas meter are kept in s, see TICK_SAVE.
+	dwac_tick_state_type state = {.stack = d->stack};
+	dwac_tick_state_type *const s = &state;
+	TICK_LOAD();
+
+	#ifdef USE_COMPUTED_GOTO
+	// Address of the handler for each opcode, see DWAC_COMPUTED_GOTO.
+	#pragma GCC diagnostic push
+	#pragma GCC diagnostic ignored "-Woverride-init"
+	static const void* const dispatch_table[0x104] =
+	{
+		[0 ... 0x103] = &&op_default,
+		[0x00] = &&op_0x00, [0x01] = &&op_0x01, [0x02] = &&op_0x02, [0x03] = &&op_0x03, [0x04] = &&op_0x04, [0x05] = &&op_0x05,
+		[0x0b] = &&op_0x0b, [0x0c] = &&op_0x0c, [0x0d] = &&op_0x0d, [0x0e] = &&op_0x0e, [0x0f] = &&op_0x0f, [0x10] = &&op_0x10,
+		[0x11] = &&op_0x11, [0x1a] = &&op_0x1a, [0x1b] = &&op_0x1b, [0x1c] = &&op_0x1c, [0x20] = &&op_0x20, [0x21] = &&op_0x21,
+		[0x22] = &&op_0x22, [0x23] = &&op_0x23, [0x24] = &&op_0x24, [0x25] = &&op_0x25, [0x26] = &&op_0x26, [0x28] = &&op_0x28,
+		[0x29] = &&op_0x29,
+		#ifndef SKIP_FLOAT
+		[0x2a] = &&op_0x2a, [0x2b] = &&op_0x2b,
+		#endif
+		[0x2c] = &&op_0x2c, [0x2d] = &&op_0x2d, [0x2e] = &&op_0x2e, [0x2f] = &&op_0x2f, [0x30] = &&op_0x30, [0x31] = &&op_0x31,
+		[0x32] = &&op_0x32, [0x33] = &&op_0x33, [0x34] = &&op_0x34, [0x35] = &&op_0x35, [0x36] = &&op_0x36, [0x37] = &&op_0x37,
+		[0x38] = &&op_0x38, [0x39] = &&op_0x39, [0x3a] = &&op_0x3a, [0x3b] = &&op_0x3b, [0x3c] = &&op_0x3c, [0x3d] = &&op_0x3d,
+		[0x3e] = &&op_0x3e, [0x3f] = &&op_0x3f, [0x40] = &&op_0x40, [0x41] = &&op_0x41, [0x42] = &&op_0x42,
+		#ifndef SKIP_FLOAT
+		[0x43] = &&op_0x43, [0x44] = &&op_0x44,
+		#endif
+		[0x45] = &&op_0x45, [0x46] = &&op_0x46, [0x47] = &&op_0x47, [0x48] = &&op_0x48, [0x49] = &&op_0x49, [0x4a] = &&op_0x4a,
+		[0x4b] = &&op_0x4b, [0x4c] = &&op_0x4c, [0x4d] = &&op_0x4d, [0x4e] = &&op_0x4e, [0x4f] = &&op_0x4f, [0x50] = &&op_0x50,
+		[0x51] = &&op_0x51, [0x52] = &&op_0x52, [0x53] = &&op_0x53, [0x54] = &&op_0x54, [0x55] = &&op_0x55, [0x56] = &&op_0x56,
+		[0x57] = &&op_0x57, [0x58] = &&op_0x58, [0x59] = &&op_0x59, [0x5a] = &&op_0x5a,
+		#ifndef SKIP_FLOAT
+		[0x5b] = &&op_0x5b, [0x5c] = &&op_0x5c, [0x5d] = &&op_0x5d, [0x5e] = &&op_0x5e, [0x5f] = &&op_0x5f, [0x60] = &&op_0x60,
+		[0x61] = &&op_0x61, [0x62] = &&op_0x62, [0x63] = &&op_0x63, [0x64] = &&op_0x64, [0x65] = &&op_0x65, [0x66] = &&op_0x66,
+		#endif
+		[0x67] = &&op_0x67, [0x68] = &&op_0x68, [0x69] = &&op_0x69, [0x6a] = &&op_0x6a, [0x6b] = &&op_0x6b, [0x6c] = &&op_0x6c,
+		[0x6d] = &&op_0x6d, [0x6e] = &&op_0x6e, [0x6f] = &&op_0x6f, [0x70] = &&op_0x70, [0x71] = &&op_0x71, [0x72] = &&op_0x72,
+		[0x73] = &&op_0x73, [0x74] = &&op_0x74, [0x75] = &&op_0x75, [0x76] = &&op_0x76, [0x77] = &&op_0x77, [0x78] = &&op_0x78,
+		[0x79] = &&op_0x79, [0x7a] = &&op_0x7a, [0x7b] = &&op_0x7b, [0x7c] = &&op_0x7c, [0x7d] = &&op_0x7d, [0x7e] = &&op_0x7e,
+		[0x7f] = &&op_0x7f, [0x80] = &&op_0x80, [0x81] = &&op_0x81, [0x82] = &&op_0x82, [0x83] = &&op_0x83, [0x84] = &&op_0x84,
+		[0x85] = &&op_0x85, [0x86] = &&op_0x86, [0x87] = &&op_0x87, [0x88] = &&op_0x88, [0x89] = &&op_0x89, [0x8a] = &&op_0x8a,
+		#ifndef SKIP_FLOAT
+		[0x8b] = &&op_0x8b, [0x8c] = &&op_0x8c, [0x8d] = &&op_0x8d, [0x8e] = &&op_0x8e, [0x8f] = &&op_0x8f, [0x90] = &&op_0x90,
+		[0x91] = &&op_0x91, [0x92] = &&op_0x92, [0x93] = &&op_0x93, [0x94] = &&op_0x94, [0x95] = &&op_0x95, [0x96] = &&op_0x96,
+		[0x97] = &&op_0x97, [0x98] = &&op_0x98, [0x99] = &&op_0x99, [0x9a] = &&op_0x9a, [0x9b] = &&op_0x9b, [0x9c] = &&op_0x9c,
+		[0x9d] = &&op_0x9d, [0x9e] = &&op_0x9e, [0x9f] = &&op_0x9f, [0xa0] = &&op_0xa0, [0xa1] = &&op_0xa1, [0xa2] = &&op_0xa2,
+		[0xa3] = &&op_0xa3, [0xa4] = &&op_0xa4, [0xa5] = &&op_0xa5, [0xa6] = &&op_0xa6,
+		#endif
+		[0xa7] = &&op_0xa7,
+		#ifndef SKIP_FLOAT
+		[0xa8] = &&op_0xa8, [0xa9] = &&op_0xa9, [0xaa] = &&op_0xaa, [0xab] = &&op_0xab,
+		#endif
+		[0xac] = &&op_0xac, [0xad] = &&op_0xad,
+		#ifndef SKIP_FLOAT
+		[0xae] = &&op_0xae, [0xaf] = &&op_0xaf, [0xb0] = &&op_0xb0, [0xb1] = &&op_0xb1, [0xb2] = &&op_0xb2, [0xb3] = &&op_0xb3,
+		[0xb4] = &&op_0xb4, [0xb5] = &&op_0xb5, [0xb6] = &&op_0xb6, [0xb7] = &&op_0xb7, [0xb8] = &&op_0xb8, [0xb9] = &&op_0xb9,
+		[0xba] = &&op_0xba, [0xbb] = &&op_0xbb, [0xbc] = &&op_0xbc, [0xbd] = &&op_0xbd, [0xbe] = &&op_0xbe, [0xbf] = &&op_0xbf,
+		#endif
+		[0xc0] = &&op_0xc0, [0xc1] = &&op_0xc1, [0xc2] = &&op_0xc2, [0xc3] = &&op_0xc3, [0xc4] = &&op_0xc4, [0xfc] = &&op_0xfc,
+		[0xfd] = &&op_0xfd,
+		#ifdef DWAC_FUSE_OPCODES
+		[0x100] = &&op_0x100, [0x101] = &&op_0x101, [0x102] = &&op_0x102, [0x103] = &&op_0x103,
+		#endif
+	};
+	#pragma GCC diagnostic pop
+	#endif
+
+	uint32_t opcode;
+	for(;;)
+	{
+		FETCH_OPCODE();
+		switch (opcode)
+		{
+			OPCODE(0x00): // unreachable
+				dbg("unreachable\n");
+				// The unreachable instruction causes an unconditional trap.
+				sprintf(d->exception, "%s", "unreachable");
+				TICK_RETURN(DWAC_OP_CODE_ZERO);
+			OPCODE(0x01): // nop
+				// The nop instruction does nothing.
+				dbg("nop\n");
+				NEXT_OPCODE();
+			OPCODE(0x02): // block
+			{
+				// Blocks have no entries on the call stack, where branches to it
+				// go was found by find_blocks_in_code. Skip blocktype and end_addr.
+				s->pc.pos += 2;
+
+				dbg("block\n");
+
+				if ((!TICK_VALIDATED) && (s->pc.pos >= s->pc.nof)) {TICK_RETURN(DWAC_PC_ADDR_OUT_OF_RANGE);}
+				NEXT_OPCODE();
+			}
+			OPCODE(0x03): // loop
+			{
+				// The loop statement creates a label that can later be branched back to with a
+				// br or br_if. Nothing to do here, skip blocktype.
+				s->pc.pos += 1;
+
+				dbg("loop\n");
+
+				if ((!TICK_VALIDATED) && (s->pc.pos >= s->pc.nof)) {TICK_RETURN(DWAC_PC_ADDR_OUT_OF_RANGE);}
+				NEXT_OPCODE();
+			}
+			OPCODE(0x04): // if
+			{
+				// Addresses of else and end were found by find_blocks_in_code.
+				/*const int32_t blocktype =*/ code_read_s32(&s->pc);
+				const uint32_t else_addr = code_read_u32(&s->pc);
+				const uint32_t end_addr = code_read_u32(&s->pc);
+				const int32_t gas = code_read_s32(&s->pc);
+
+				const uint32_t cond = POP_I32(s);
+
+				dbg("if %u\n", cond);
+
+				if (cond == 0)
+				{
+					// Condition was not true, continue after the else
+					// if there is one, else after the end.
+					s->pc.pos = ((else_addr != 0) ? else_addr + 3 : end_addr + 1);
+					if ((!TICK_VALIDATED) && (s->pc.pos >= s->pc.nof)) {TICK_RETURN(DWAC_PC_ADDR_OUT_OF_RANGE);}
+					TICK_CHARGE(gas);
+					TICK_CHECKPOINT();
+				}
+				else
+				{
+					// Condition was true, do nothing here, continue until else opcode is found.
+				}
+
+				NEXT_OPCODE();
+			}
+			OPCODE(0x05): // else
+			{
+				// Program has reached an else, so the if part is done. Skip to the end of it.
+				const uint32_t end_addr = code_read_u32(&s->pc);
+				TICK_CHARGE((int32_t) s->pc.array[s->pc.pos]);
+				s->pc.pos = end_addr;
+
+				dbg("else\n");
+
+				if ((!TICK_VALIDATED) && (s->pc.pos >= s->pc.nof)) {TICK_RETURN(DWAC_PC_ADDR_OUT_OF_RANGE);}
+				TICK_CHECKPOINT();
+				NEXT_OPCODE();
+			}
+			OPCODE(0x0b): // end
+			{
+				// The end of a block, loop or if has nothing to do, its results
+				// are on top of the operand stack already. Only the end of the
+				// function (its last word) returns.
+				dbg("end\n");
+				if (s->pc.pos != s->pc.nof)
+				{
+					NEXT_OPCODE();
+				}
+
+				// Pop from call stack.
+				const dwac_call_stack_entry *e = (dwac_call_stack_entry*) dwac_linear_storage_size_pop(&d->call_stack);
+
+				if ((!TICK_VALIDATED) && (e == NULL))
+				{
+					snprintf(d->exception, sizeof(d->exception), "callstack underflow");
+					TICK_RETURN(DWAC_BLOCK_STACK_UNDER_FLOW);
+				}
+
+				// Move the results down to where the parameters were.
+				const uint32_t nof_results = e->nof_results;
+				const dwac_stack_pointer_signed_type entries_available_on_stack = (dwac_stack_pointer_signed_type)(s->sp) - (dwac_stack_pointer_signed_type)e->stack_pointer;
+				if ((!TICK_VALIDATED) && (entries_available_on_stack < (dwac_stack_pointer_signed_type)nof_results))
+				{
+					snprintf(d->exception, sizeof(d->exception), "missing return values");
+					TICK_RETURN(DWAC_MISSING_RETURN_VALUES);
+				}
+				if (nof_results == 1)
+				{
+					const uint64_t result = TOP_U64(s);
+					s->sp = e->stack_pointer + 1;
+					SET_U64(s, result);
+				}
+				else
+				{
+					TICK_SPILL();
+					for (uint32_t n = 0; n < nof_results; ++n)
+					{
+						const dwac_stack_pointer_type to = e->stack_pointer + nof_results - n;
+						const dwac_stack_pointer_type from = s->sp - n;
+						s->stack[SP_MASK(to)] = s->stack[SP_MASK(from)];
+					}
+					s->sp = e->stack_pointer + nof_results;
+					TICK_FILL();
+				}
+
+				// Restore frame pointer and program counter of the calling function.
+				s->fp = e->frame_pointer;
+				s->pc = e->return_pc;
+				if ((d->call_stack.size == 0) || (e->call_type == dwac_block_type_init_exp))
+				{
+					TICK_RETURN(DWAC_OK);
+				}
+
+				if ((!TICK_VALIDATED) && (s->stack[DWAC_STACK_CAPACITY - 1].s64 != WA_MAGIC_STACK_VALUE)) {TICK_RETURN(DWAC_STACK_OVERFLOW);}
+				if ((!TICK_VALIDATED) && (s->pc.pos >= s->pc.nof)) {TICK_RETURN(DWAC_PC_ADDR_OUT_OF_RANGE);}
+				NEXT_OPCODE();
+			}
+			OPCODE(0x0c): // br
+			{
+				// The br statement branches out of a block or back in a loop.
+				// Label index is not needed, the target is (see tick_branch).
+				tick_branch(s, s->pc.array + s->pc.pos + 1, TICK_METERED);
+
+				dbg("br\n");
+
+				if ((!TICK_VALIDATED) && (s->stack[DWAC_STACK_CAPACITY - 1].s64 != WA_MAGIC_STACK_VALUE)) {TICK_RETURN(DWAC_STACK_OVERFLOW);}
+				if ((!TICK_VALIDATED) && (s->pc.pos >= s->pc.nof)) {TICK_RETURN(DWAC_PC_ADDR_OUT_OF_RANGE);}
+				TICK_CHECKPOINT();
+				NEXT_OPCODE();
+			}
+			OPCODE(0x0d): // br_if
+			{
+				dbg("br_if\n");
+				// This is the end of a loop, check condition to see if loop shall continue?
+				// Take condition value from stack.
+				const uint32_t cond = POP_I32(s);
+				if (cond)
+				{
+					tick_branch(s, s->pc.array + s->pc.pos + 1, TICK_METERED);
+					if ((!TICK_VALIDATED) && (s->stack[DWAC_STACK_CAPACITY - 1].s64 != WA_MAGIC_STACK_VALUE)) {TICK_RETURN(DWAC_STACK_OVERFLOW);}
+					if ((!TICK_VALIDATED) && (s->pc.pos >= s->pc.nof)) {TICK_RETURN(DWAC_PC_ADDR_OUT_OF_RANGE);}
+					TICK_CHECKPOINT();
+				}
+				else
+				{
+					// Just continue with next opcode, skip label and target.
+					s->pc.pos += 5;
+				}
+				NEXT_OPCODE();
+			}
+			OPCODE(0x0e): // br_table
+			{
+				// Branch using br_table to get labelidx.
+
+				// [1] 2.4.8. Control Instructions
+				// br_table performs an indirect branch through an operand indexing into the
+				// label vector that is an immediate to the instruction, or to a default target
+				// if the operand is out of bounds.
+
+				// The table was decoded by translate_code and the branch targets
+				// found by find_blocks_in_code. Each entry is labelidx and target,
+				// the default entry is last.
+				const uint32_t table_size = code_read_u32(&s->pc);
+				const uint32_t idx = POP_U32(s);
+				const uint32_t *entry = s->pc.array + s->pc.pos + 5 * ((idx < table_size) ? idx : table_size);
+				tick_branch(s, entry + 1, TICK_METERED);
+
+				dbg("br_table %u %u\n", idx, entry[0]);
+
+				if ((!TICK_VALIDATED) && (s->pc.pos >= s->pc.nof)) {TICK_RETURN(DWAC_PC_ADDR_OUT_OF_RANGE);}
+				TICK_CHECKPOINT();
+				NEXT_OPCODE();
+			}
+			OPCODE(0x0f): // return
+			{
+				// The last word in the translated code is the "end" of the
+				// function, it moves the results and returns.
+				s->pc.pos = s->pc.nof - 1;
+
+				dbg("return\n");
+
+				NEXT_OPCODE();
+			}
+			OPCODE(0x10): // call
+			{
+				// 0x10 x:funcidx
+				const uint32_t function_idx = code_read_u32(&s->pc);
+
+				dbg("call %u %s\n", function_idx, dwac_get_func_name(p, function_idx));
+
+				if (function_idx < p->funcs_vector.nof_imported)
+				{
+					TICK_SAVE();
+					const long r = dwac_call_imported_function(d, function_idx);
+					if (r)
+					{
+						return r;
+					}
+					TICK_LOAD();
+				}
+				else if (!tick_call(d, s, function_idx, TICK_METERED))
+				{
+					TICK_SAVE();
+					long r = dwac_setup_function_call(d, function_idx);
+					if (r)
+					{
+						return r;
+					}
+					#ifdef DWAC_REGISTER_CODE
+					if (IN_REGISTER_CODE(d))
+					{
+						r = run_register_code(d);
+						if (r) {return r;}
+					}
+					#endif
+					TICK_LOAD();
+				}
+
+				if ((!TICK_VALIDATED) && (s->stack[DWAC_STACK_CAPACITY - 1].s64 != WA_MAGIC_STACK_VALUE)) {TICK_RETURN(DWAC_STACK_OVERFLOW);}
+				if ((!TICK_VALIDATED) && (s->pc.pos >= s->pc.nof)) {TICK_RETURN(DWAC_PC_ADDR_OUT_OF_RANGE);}
+				TICK_CHECKPOINT();
+				NEXT_OPCODE();
+			}
+			OPCODE(0x11): // call_indirect
+			{
+				// [2] 4.4.8.11. call_indirect x y
+				// [2] call_indirect calls a function in a table.
+				// Indirect call, the function to call is taken via table.
+				// call_indirect tableidx typeidx
+				//
+				// [1] 5.4.1 Control Instructions
+				// 0x11 y:typeidx x:tableidx
+
+				const uint32_t typeidx = code_read_u32(&s->pc);
+
+				const uint32_t tableidx = code_read_u32(&s->pc);
+				if (tableidx != 0) {TICK_RETURN(DWAC_ONLY_ONE_TABLE_IS_SUPPORTED);}
+
+				// Get index into table from stack.
+				uint32_t idx_into_table = POP_I32(s);
+
+				// Ref [3] had some code "if (m->options.mangle_table_index)..." here.
+				// No idea what that was about.
+
+				uint32_t function_idx = INVALID_FUNCTION_INDEX;
+				#ifdef DWAC_CALL_INDIRECT_CACHE
+				// The inline cache of this call site is next in code (see call_indirect_cache_lookup).
+				uint64_t *cache = call_indirect_cache(s->pc.array + s->pc.pos);
+				s->pc.pos += CALL_INDIRECT_CACHE_WORDS;
+				function_idx = call_indirect_cache_lookup(cache, idx_into_table);
+				#endif
+
+				if (function_idx == INVALID_FUNCTION_INDEX)
+				{
+					//  Check that its in range.
+					if (idx_into_table >= p->func_table.size)
+					{
+						// br_if had also a default. Not so here then.
+						sprintf(d->exception, "%d", idx_into_table);
+						TICK_RETURN(DWAC_OUT_OF_RANGE_IN_TABLE);
+					}
+
+					// Get function index via table.
+					const uint64_t table_entry = p->func_table.array[idx_into_table];
+
+					dbg("call_indirect %lld '%s'\n", (long long int)table_entry, dwac_get_func_name(p, table_entry));
+
+					//  Check that its in range.
+					if (table_entry >= p->funcs_vector.total_nof)
+					{
+						sprintf(d->exception, "%lu %u", (long) table_entry, p->funcs_vector.total_nof);
+						TICK_RETURN(DWAC_FUNCTION_INDEX_OUT_OF_RANGE);
+					}
+					function_idx = table_entry;
+
+					// The type of the function must match the typeidx​. Types that are
+					// equal have the same canonical type, see canonicalize_types.
+					const int32_t func_typeidx = p->funcs_vector.functions_array[function_idx].func_type_idx;
+					if (((!TICK_VALIDATED) && (typeidx >= p->canonical_types.size)) ||
+						(p->canonical_types.array[typeidx] != p->canonical_types.array[func_typeidx]))
+					{
+						sprintf(d->exception, "%lld != %lld", (long long)func_typeidx, (long long)typeidx);
+						TICK_RETURN(DWAC_WRONG_FUNCTION_TYPE);
+					}
+
+					#ifdef DWAC_CALL_INDIRECT_CACHE
+					call_indirect_cache_add(cache, idx_into_table, function_idx);
+					#endif
+				}
+
+				// Do we at have enough parameters on stack?
+				if (!TICK_VALIDATED)
+				{
+					const dwac_func_type_type *ft_ptr = dwac_get_func_type_ptr(p, p->funcs_vector.functions_array[function_idx].func_type_idx);
+					const int64_t available = STACK_SIZE(s) - s->fp;
+					if (ft_ptr->nof_parameters > available)
+					{
+						sprintf(d->exception, "%d > %lld.", ft_ptr->nof_parameters, (long long)available);
+						TICK_RETURN(DWAC_INDIRECT_CALL_INSUFFICIENT_NOF_PARAM);
+					}
+				}
+
+				// Is it an imported or internal function to call?
+				if (function_idx < p->funcs_vector.nof_imported)
+				{
+					TICK_SAVE();
+					const long r = dwac_call_imported_function(d, function_idx);
+					if (r) {return r;}
+					TICK_LOAD();
+				}
+				else if (!tick_call(d, s, function_idx, TICK_METERED))
+				{
+					TICK_SAVE();
+					const int r = dwac_setup_function_call(d, function_idx);
+					if (r) {return DWAC_INDIRECT_CALL_FAILED;}
+					#ifdef DWAC_REGISTER_CODE
+					if (IN_REGISTER_CODE(d))
+					{
+						const dwac_result r = run_register_code(d);
+						if (r) {return r;}
+					}
+					#endif
+					TICK_LOAD();
+				}
+
+				dbg("call_indirect %u %u %u %u %s\n", typeidx, tableidx, idx_into_table, function_idx, dwac_get_func_name(p, function_idx));
+
+				if ((!TICK_VALIDATED) && (s->stack[DWAC_STACK_CAPACITY - 1].s64 != WA_MAGIC_STACK_VALUE)) {TICK_RETURN(DWAC_STACK_OVERFLOW);}
+				if ((!TICK_VALIDATED) && (s->pc.pos >= s->pc.nof)) {TICK_RETURN(DWAC_PC_ADDR_OUT_OF_RANGE);}
+				TICK_CHECKPOINT();
+				NEXT_OPCODE();
+			}
+
+			OPCODE(0x1a): // drop
+				s->sp--;
+				TICK_FILL();
+				dbg("drop\n");
+				NEXT_OPCODE();
+			OPCODE(0x1b): // select
+			{
+				// Select one of the two topmost values, put it back to stack.
+				const uint32_t cond = POP_I32(s);
+				const dwac_value_type b = POP(s);
+				if (!cond)
+				{
+					SET_U64(s, b.u64);
+				}
+				dbg("select %u\n", cond);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x1c):
+				// 5.4.3. Parametric Instructions
+				TICK_RETURN(DWAC_PARAMETRIC_INSTRUCTIONS_NOT_SUPPORTED_YET);
+				NEXT_OPCODE();
+
+			OPCODE(0x20): // local.get
+			{
+				// Get a local variable value, push it to stack.
+				const uint32_t localidx = code_read_u32(&s->pc);
+				TICK_PUSH_SLOT();
+				SET_U64(s, s->stack[SP_MASK(s->fp + localidx)].u64);
+				dbg("local.get %u 0x%llx\n", localidx, (unsigned long long)TOP_U64(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x21): // local.set
+			{
+				// Pop value from stack, set a local variable.
+				// Set the local before popping, the new top of stack may be that local.
+				const uint32_t localidx = code_read_u32(&s->pc);
+				const dwac_value_type a = TOP(s);
+				s->stack[SP_MASK(s->fp + localidx)] = a;
+				s->sp--;
+				TICK_FILL();
+				dbg("local.set 0x%x 0x%llx\n", localidx, (unsigned long long)a.u64);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x22): // local.tee
+			{
+				// Same as local.set but value also stay on stack instead of popped.
+				const uint32_t localidx = code_read_u32(&s->pc);
+				s->stack[SP_MASK(s->fp + localidx)] = TOP(s);
+				dbg("local.tee 0x%x 0x%llx  0x%x 0x%x\n", localidx, (unsigned long long)TOP_U64(s), s->fp, s->sp);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x23): // global.get
+			{
+				// Get a global variable, push it to stack.
+				const uint32_t globalidx = code_read_u32(&s->pc);
+				if (globalidx >= d->globals.size) {TICK_RETURN(DWAC_GLOBAL_IDX_OUT_OF_RANGE);}
+				PUSH_U64(s, d->globals.array[globalidx]);
+				dbg("global.get 0x%x 0x%llx\n", globalidx, (long long unsigned)TOP_U64(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x24): // global.set
+			{
+				const uint32_t globalidx = code_read_u32(&s->pc);
+				if (globalidx >= d->globals.size) {TICK_RETURN(DWAC_GLOBAL_IDX_OUT_OF_RANGE);}
+				d->globals.array[globalidx] = POP_U64(s);
+				dbg("global.set 0x%x 0x%llx\n", globalidx, (long long unsigned)d->globals.array[globalidx]);
+				NEXT_OPCODE();
+			}
+
+			OPCODE(0x25): // table.get
+			OPCODE(0x26): // table.set
+				// Remember that if func_table can be changed (table.set is implemented) then
+				// func_table shall be part of dwac_data and not part of dwac_prog structs.
+				// So will not implement this for now.
+				// See also 0xFC codes 12 .. 17.
+				//const uint32_t tableidx = code_read_u32(&s->pc);
+				//sprintf(d->exception, "0x%x 0x%x", opcode, tableidx);
+				TICK_RETURN(DWAC_TABLE_INSTRUCTIONS_NOT_SUPPORTED);
+
+			OPCODE(0x28): // i32.load
+			{
+				const uint32_t offset = code_read_u32(&s->pc);
+				const uint32_t addr = POP_U32(s);
+				PUSH_I32(s, translate_get_int32(d, offset + addr));
+				dbg("i32.load 0x%x 0x%x 0x%x\n", offset, addr, TOP_U32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x29): // i64.load
+			{
+				const uint32_t offset = code_read_u32(&s->pc);
+				const uint32_t addr = POP_U32(s);
+				PUSH_I64(s, translate_get_int64(d, offset + addr));
+				dbg("i64.load 0x%x 0x%x 0x%llx\n", offset, addr, (unsigned long long)TOP_U64(s));
+				NEXT_OPCODE();
+			}
+			#ifndef SKIP_FLOAT
+			OPCODE(0x2a): // f32.load
+			{
+				const uint32_t offset = code_read_u32(&s->pc);
+				const uint32_t addr = POP_U32(s);
+				const uint32_t v = translate_get_int32(d, offset + addr);
+				PUSH_F32I(s, v);
+				dbg("f32.load");
+				NEXT_OPCODE();
+		    }
+		    OPCODE(0x2b): // f64.load
+		    {
+				const uint32_t offset = code_read_u32(&s->pc);
+				const uint32_t addr = POP_U32(s);
+				const uint64_t v = translate_get_int64(d, offset + addr);
+				PUSH_F64I(s, v);
+				dbg("f64.load");
+				NEXT_OPCODE();
+		    }
+			#endif
+		    OPCODE(0x2c): // i32.load8_s
+		    {
+				const uint32_t offset = code_read_u32(&s->pc);
+				const uint32_t addr = POP_U32(s);
+				const int8_t value = translate_get_int8(d, offset + addr);
+				PUSH_I32(s, value);
+				dbg("i32.load8_s 0x%x\n", TOP_U32(s));
+				NEXT_OPCODE();
+		    }
+		    OPCODE(0x2d): // i32.load8_u
+		    {
+				const uint32_t offset = code_read_u32(&s->pc);
+				const uint32_t addr = POP_U32(s);
+				const uint8_t value = translate_get_int8(d, offset + addr);
+				PUSH_U32(s, value);
+				dbg("i32.load8_u 0x%x\n", TOP_U32(s));
+				NEXT_OPCODE();
+		    }
+		    OPCODE(0x2e): // i32.load16_s
+		    {
+				const uint32_t offset = code_read_u32(&s->pc);
+				const uint32_t addr = POP_U32(s);
+				const int16_t value = translate_get_int16(d, offset + addr);
+				PUSH_I32(s, value);
+				dbg("i32.load16_s 0x%x\n", TOP_U32(s));
+				NEXT_OPCODE();
+		    }
+		    OPCODE(0x2f): // i32.load16_u
+		    {
+				const uint32_t offset = code_read_u32(&s->pc);
+				const uint32_t addr = POP_U32(s);
+				const uint16_t value = translate_get_int16(d, offset + addr);
+				PUSH_U32(s, value);
+				dbg("i32.load16_u 0x%x\n", TOP_U32(s));
+				NEXT_OPCODE();
+		    }
+		    OPCODE(0x30): // i64.load8_s
+		    {
+				const uint32_t offset = code_read_u32(&s->pc);
+				const uint32_t addr = POP_U32(s);
+				const int8_t value = translate_get_int8(d, offset + addr);
+				PUSH_I64(s, value);
+				dbg("i64.load8_s 0x%llx\n", (long unsigned long)TOP_U64(s));
+				NEXT_OPCODE();
+		    }
+		    OPCODE(0x31): // i64.load8_u
+		    {
+				const uint32_t offset = code_read_u32(&s->pc);
+				const uint32_t addr = POP_U32(s);
+				const uint8_t value = translate_get_int8(d, offset + addr);
+				PUSH_U64(s, value);
+				dbg("i64.load8_u 0x%llx\n", (long unsigned long)TOP_U64(s));
+				NEXT_OPCODE();
+		    }
+		    OPCODE(0x32): // i64.load16_s
+		    {
+				const uint32_t offset = code_read_u32(&s->pc);
+				const uint32_t addr = POP_U32(s);
+				const int16_t value = translate_get_int16(d, offset + addr);
+				PUSH_I64(s, value);
+				dbg("i64.load16_s 0x%llx\n", (long unsigned long)TOP_U64(s));
+				NEXT_OPCODE();
+		    }
+		    OPCODE(0x33): // i64.load16_u
+		    {
+				const uint32_t offset = code_read_u32(&s->pc);
+				const uint32_t addr = POP_U32(s);
+				const uint16_t value = translate_get_int16(d, offset + addr);
+				PUSH_U64(s, value);
+				dbg("i64.load16_u 0x%llx\n", (long unsigned long)TOP_U64(s));
+				NEXT_OPCODE();
+		    }
+		    OPCODE(0x34): // i64.load32_s
+		    {
+				const uint32_t offset = code_read_u32(&s->pc);
+				const uint32_t addr = POP_U32(s);
+				const int32_t value = translate_get_int32(d, offset + addr);
+				PUSH_I64(s, value);
+				dbg("i64.load32_s 0x%llx\n", (long unsigned long)TOP_U64(s));
+				NEXT_OPCODE();
+		    }
+		    OPCODE(0x35): // i64.load32_u
+		    {
+				const uint32_t offset = code_read_u32(&s->pc);
+				const uint32_t addr = POP_U32(s);
+				const uint32_t value = translate_get_int32(d, offset + addr);
+				PUSH_U64(s, value);
+				dbg("i64.load32_u 0x%llx\n", (long unsigned long)TOP_U64(s));
+				NEXT_OPCODE();
+		    }
+
+		    OPCODE(0x36): // i32.store
+		    {
+				const uint32_t offset = code_read_u32(&s->pc);
+				const int32_t value = POP_I32(s);
+				const uint32_t addr = POP_U32(s);
+				translate_set_int32(d, offset + addr, value);
+				dbg("i32.store 0x%llx\n", (long unsigned long)value);
+				NEXT_OPCODE();
+		    }
+		    OPCODE(0x37): // i64.store
+		    {
+				const uint32_t offset = code_read_u32(&s->pc);
+				const int64_t value = POP_I64(s);
+				const uint32_t addr = POP_U32(s);
+				translate_set_int64(d, offset + addr, value);
+				dbg("i64.store 0x%llx\n", (long unsigned long)value);
+				NEXT_OPCODE();
+		    }
+		    OPCODE(0x38): // f32.store
+		    {
+				const uint32_t offset = code_read_u32(&s->pc);
+				const uint32_t value = POP_U32(s);
+				const uint32_t addr = POP_U32(s);
+				translate_set_int32(d, offset + addr, value);
+				dbg("f32.store");
+				NEXT_OPCODE();
+		    }
+		    OPCODE(0x39): // f64.store
+		    {
+				const uint32_t offset = code_read_u32(&s->pc);
+				// Take value and address from stack.
+				const uint64_t value = POP_U64(s);
+				const uint32_t addr = POP_U32(s);
+				translate_set_int64(d, offset + addr, value);
+				dbg("f64.store");
+				NEXT_OPCODE();
+		    }
+		    OPCODE(0x3a): // i32.store8
+		    {
+				const uint32_t offset = code_read_u32(&s->pc);
+				const int32_t value = POP_I32(s);
+				const uint32_t addr = POP_U32(s);
+				translate_set_int8(d, offset + addr, value);
+				dbg("i32.store8 0x%x 0x%x 0x%x\n", offset, value, addr);
+				NEXT_OPCODE();
+		    }
+		    OPCODE(0x3b): // i32.store16
+		    {
+				const uint32_t offset = code_read_u32(&s->pc);
+				const int32_t value = POP_I32(s);
+				const uint32_t addr = POP_U32(s);
+				translate_set_int16(d, offset + addr, value);
+				dbg("i32.store16 0x%x 0x%x 0x%x\n", offset, value, addr);
+				NEXT_OPCODE();
+		    }
+		    OPCODE(0x3c): // i64.store8
+		    {
+				const uint32_t offset = code_read_u32(&s->pc);
+				const int8_t value = POP_I32(s);
+				const uint32_t addr = POP_U32(s);
+				translate_set_int8(d, offset + addr, value);
+				dbg("i64.store8 0x%x 0x%llx 0x%x\n", offset, (long long unsigned)value, addr);
+				NEXT_OPCODE();
+		    }
+		    OPCODE(0x3d): // i32.store16
+		    {
+				const uint32_t offset = code_read_u32(&s->pc);
+				const int16_t value = POP_I32(s);
+				const uint32_t addr = POP_U32(s);
+				translate_set_int16(d, offset + addr, value);
+				dbg("i32.store16 0x%x 0x%llx 0x%x\n", offset, (long long unsigned)value, addr);
+				NEXT_OPCODE();
+		    }
+		    OPCODE(0x3e): // i64.store32
+		    {
+				const uint32_t offset = code_read_u32(&s->pc);
+				const int32_t value = POP_I64(s);
+				const int32_t addr = POP_I32(s);
+				translate_set_int32(d, offset + addr, value);
+				dbg("i64.store32 0x%x 0x%llx 0x%x\n", offset, (long long unsigned)value, addr);
+				NEXT_OPCODE();
+		    }
+
+			OPCODE(0x3f): // current_memory
+			{
+				uint32_t memidx = code_read_u32(&s->pc);
+				if (memidx != 0) {TICK_RETURN(DWAC_ONLY_ONE_MEMORY_IS_SUPPORTED);}
+				PUSH_I32(s, d->memory.current_size_in_pages);
+				dbg("current_memory 0x%x\n", d->memory.current_size_in_pages);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x40): // grow_memory
+			{
+				uint32_t memory_index = code_read_u32(&s->pc);
+				if (memory_index != 0) {TICK_RETURN(DWAC_ONLY_ONE_MEMORY_IS_SUPPORTED);}
+				const uint32_t requested_increase = TOP_U32(s);
+				SET_U32(s, dwac_memory_grow(d, requested_increase));
+				dbg("grow_memory %u %u\n", TOP_U32(s), requested_increase);
+				NEXT_OPCODE();
+			}
+
+			OPCODE(0x41): // i32.const
+				// Push i32 immediate operand to stack.
+				PUSH_I32(s, code_read_s32(&s->pc));
+				dbg("i32.const 0x%x\n", TOP_U32(s));
+				NEXT_OPCODE();
+			OPCODE(0x42): // i64.const
+				PUSH_I64(s, (int64_t) code_read_u64(&s->pc));
+				dbg("i64.const 0x%llx\n", (long long unsigned)TOP_U64(s));
+				NEXT_OPCODE();
+
+			#ifndef SKIP_FLOAT
+			OPCODE(0x43): // f32.const
+			{
+				// Push f32 immediate operand to stack.
+				// [1] 5.2.3. Floating-Point
+				// Floating-point values are encoded directly by their [IEEE-754-2019]
+				// (Section 3.4) bit pattern in little endian byte order:
+				// So not LEB128 encoded. An alternative would have been to have two LEB values,
+				// one for mantissa and one for exponent.
+				// TODO This might fail on a big endian host (not tested).
+				const uint32_t a = code_read_u32(&s->pc);
+				PUSH_F32I(s, a);
+				dbg("f32.const 0x%x %g\n", a, TOP_F32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x44): // f64.const
+			{
+				// TODO This might fail on a big endian host (not tested).
+				const uint64_t a = code_read_u64(&s->pc);
+				PUSH_F64I(s, a);
+				dbg("f64.const 0x%llx %g\n", (unsigned long long)a, TOP_F64(s));
+				NEXT_OPCODE();
+			}
+			#endif
+
+			OPCODE(0x45): // i32.eqz
+				SET_I32(s, (TOP_I32(s) == 0));
+				dbg("i32.eqz 0x%x\n", TOP_I32(s));
+				NEXT_OPCODE();
+			OPCODE(0x46): // i32.eq
+			{
+				const int32_t b = POP_I32(s);
+				SET_I32(s, (TOP_I32(s) == b));
+				dbg("i32.eq 0x%x\n", TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x47): // i32.ne
+			{
+				const int32_t b = POP_I32(s);
+				SET_I32(s, (TOP_I32(s) != b));
+				dbg("i32.ne 0x%x\n", TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x48): // i32.lt_s
+			{
+				const int32_t b = POP_I32(s);
+				SET_I32(s, (TOP_I32(s) < b));
+				dbg("i32.lt_s 0x%x\n", TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x49): // i32.lt_u
+			{
+				const uint32_t b = POP_U32(s);
+				SET_I32(s, (TOP_U32(s) < b));
+				dbg("i32.lt_u 0x%x\n", TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x4a): // i32.gt_s
+			{
+				const int32_t b = POP_I32(s);
+				SET_I32(s, (TOP_I32(s) > b));
+				dbg("i32.gt_s 0x%x\n", TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x4b): // i32.gt_u
+			{
+				const uint32_t b = POP_U32(s);
+				SET_I32(s, (TOP_U32(s) > b));
+				dbg("i32.gt_u 0x%x\n", TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x4c): // i32.le_s
+			{
+				const int32_t b = POP_I32(s);
+				SET_I32(s, (TOP_I32(s) <= b));
+				dbg("i32.le_s 0x%x\n", TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x4d): // i32.le_u
+			{
+				const uint32_t b = POP_U32(s);
+				SET_I32(s, (TOP_U32(s) <= b));
+				dbg("i32.le_u 0x%x\n", TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x4e): // i32.ge_s
+			{
+				const int32_t b = POP_I32(s);
+				SET_I32(s, (TOP_I32(s) >= b));
+				dbg("i32.ge_s 0x%x\n", TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x4f): // i32.ge_u
+			{
+				const uint32_t b = POP_U32(s);
+				SET_I32(s, (TOP_U32(s) >= b));
+				dbg("i32.ge_u 0x%x\n", TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x50): // i64.eqz
+				SET_I32(s, (TOP_I64(s) == 0));
+				dbg("i32.eqz 0x%x\n", TOP_I32(s));
+				NEXT_OPCODE();
+			OPCODE(0x51): // i64.eq
+			{
+				const int64_t b = POP_I64(s);
+				SET_I32(s, (TOP_I64(s) == b));
+				dbg("i32.eq 0x%x\n", TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x52): // i64.ne
+			{
+				const int64_t b = POP_I64(s);
+				SET_I32(s, (TOP_I64(s) != b));
+				dbg("i32.ne 0x%x\n", TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x53): // i64.lt_s
+			{
+				const int64_t b = POP_I64(s);
+				SET_I32(s, (TOP_I64(s) < b));
+				dbg("i32.lt_s 0x%x\n", TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x54): // i64.lt_u
+			{
+				const uint64_t b = POP_U64(s);
+				SET_I32(s, (TOP_U64(s) < b));
+				dbg("i32.lt_u 0x%x\n", TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x55): // i64.gt_s
+			{
+				const int64_t b = POP_I64(s);
+				SET_I32(s, (TOP_I64(s) > b));
+				dbg("i32.gt_s 0x%x\n", TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x56): // i64.gt_u
+			{
+				const uint64_t b = POP_U64(s);
+				SET_I32(s, (TOP_U64(s) > b));
+				dbg("i32.gt_u 0x%x\n", TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x57): // i64.le_s
+			{
+				const int64_t b = POP_I64(s);
+				SET_I32(s, (TOP_I64(s) <= b));
+				dbg("i32.le_s 0x%x\n", TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x58): // i64.le_u
+			{
+				const uint64_t b = POP_U64(s);
+				SET_I32(s, (TOP_U64(s) <= b));
+				dbg("i32.le_u 0x%x\n", TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x59): // i64.ge_s
+			{
+				const int64_t b = POP_I64(s);
+				SET_I32(s, (TOP_I64(s) >= b));
+				dbg("i32.ge_s 0x%x\n", TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x5a): // i64.ge_u
+			{
+				const uint64_t b = POP_U64(s);
+				SET_I32(s, (TOP_U64(s) >= b));
+				dbg("i32.ge_u 0x%x\n", TOP_I32(s));
+				NEXT_OPCODE();
+			}
+
+			#ifndef SKIP_FLOAT
+			OPCODE(0x5b): // f32.eq
+			{ // not tested
+				const float b = POP_F32(s);
+				const float a = TOP_F32(s);
+				const int c = nearly_equal_float(a, b);
+				SET_I32(s, c);
+				dbg("f32.eq %g %g %d\n", a, b, c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x5c): // f32.ne
+			{ // not tested
+				const float b = POP_F32(s);
+				const float a = TOP_F32(s);
+				const int c = !nearly_equal_float(a, b);
+				SET_I32(s, c);
+				dbg("f32.ne %g %g %d\n", a, b, c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x5d): // f32.lt
+			{
+				const float b = POP_F32(s);
+				const float a = TOP_F32(s);
+				const int c = (a < b);
+				SET_I32(s, c);
+				dbg("f32.lt %g %g %d\n", a, b, c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x5e): // f32.gt
+			{
+				const float b = POP_F32(s);
+				const float a = TOP_F32(s);
+				const int c = a > b;
+				SET_I32(s, c);
+				dbg("f32.gt %g %g %d\n", a, b, c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x5f): // f32.le
+			{
+				const float b = POP_F32(s);
+				const float a = TOP_F32(s);
+				const int c = (a <= b);
+				SET_I32(s, c);
+				dbg("f32.le %g %g %d\n", a, b, c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x60): // f32.ge
+			{
+				const float b = POP_F32(s);
+				const float a = TOP_F32(s);
+				const int c = (a >= b);
+				SET_I32(s, c);
+				dbg("f32.ge %g %g %d\n", a, b, c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x61): // f64.eq
+			{
+				const double b = POP_F64(s);
+				const double a = TOP_F64(s);
+				SET_I32(s, nearly_equal_double(a, b));
+				dbg("f64.eq %g %g %d\n", a, b, TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x62): // f64.ne
+			{
+				const double b = POP_F64(s);
+				const double a = TOP_F64(s);
+				SET_I32(s, !nearly_equal_float(a, b));
+				dbg("f64.ne %g %g %d\n", a, b, TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x63): // f64.lt
+			{
+				const double b = POP_F64(s);
+				const double a = TOP_F64(s);
+				SET_I32(s, (a < b));
+				dbg("f64.lt %g %g %d\n", a, b, TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x64): // f64.gt
+			{
+				const double b = POP_F64(s);
+				const double a = TOP_F64(s);
+				SET_I32(s, (a > b));
+				dbg("f64.gt %g %g %d\n", a, b, TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x65): // f64.le
+			{
+				const double b = POP_F64(s);
+				const double a = TOP_F64(s);
+				SET_I32(s, (a <= b));
+				dbg("f64.le %g %g %d\n", a, b, TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x66): // f64.ge
+			{
+				const double b = POP_F64(s);
+				const double a = TOP_F64(s);
+				SET_I32(s, (a >= b));
+				dbg("f64.ge %g %g %d\n", a, b, TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			#endif
+
+			OPCODE(0x67): // i32.clz
+			{   // Not tested
+				// Count leading zeros in a binary number.
+				const int32_t a = TOP_I32(s);
+				const int32_t c = a ? __builtin_clz(a) : 32;
+				SET_I32(s, c);
+				dbg("i32.clz 0x%x 0x%x\n", a, c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x68): // i32.ctz
+			{   // Not tested
+				// Count trailing zeros in a binary number.
+				const int32_t a = TOP_I32(s);
+				const int32_t c = a ? __builtin_ctz(a) : 32;
+				SET_I32(s, c);
+				dbg("i32.ctz 0x%x 0x%x\n", a, c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x69): // i32.popcnt
+			{   // Not tested
+				// Count number of 1s in a binary number.
+				const int32_t a = TOP_I32(s);
+				const int32_t c = __builtin_popcount(a);
+				SET_I32(s, c);
+				dbg("i32.popcnt 0x%x 0x%x\n", a, c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x6a): // i32.add
+			{
+				const int32_t b = POP_I32(s);
+				dbg("i32.add 0x%x 0x%x 0x%x\n", TOP_I32(s), b, TOP_I32(s) + b);
+				SET_I32(s, TOP_I32(s) + b);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x6b): // i32.sub
+			{
+				const int32_t b = POP_I32(s);
+				dbg("i32.sub 0x%x 0x%x 0x%x\n", TOP_I32(s), b, TOP_I32(s) + b);
+				SET_I32(s, TOP_I32(s) - b);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x6c): // i32.mul
+			{
+				const int32_t b = POP_I32(s);
+				dbg("i32.mul 0x%x 0x%x 0x%x\n", TOP_I32(s), b, TOP_I32(s) + b);
+				SET_I32(s, TOP_I32(s) * b);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x6d): // i32.div_s
+			{
+				const int32_t b = POP_I32(s);
+				const int32_t a = TOP_I32(s);
+				if (b == 0)
+				{
+					sprintf(d->exception, "Divide %d by zero", a);
+					TICK_RETURN(DWAC_DIVIDE_BY_ZERO);
+				}
+				// When examining ref [3], they had some addition check here.
+				// if (a == 0x80000000 && b == -1) {return WA_INTEGER_OVERFLOW;}
+				// https://stackoverflow.com/questions/46378104/why-does-integer-division-by-1-negative-one-result-in-fpe
+				// Don't want undefined behavior so will just replicate that code from ref [3].
+				// Need to do some testing some day.
+				if ((a == 0x80000000) && (b == -1))
+				{
+					sprintf(d->exception, "Integer overflow (a == 0x80000000) && (b == -1).");
+					TICK_RETURN(DWAC_INTEGER_OVERFLOW);
+				}
+				SET_I32(s, a / b);
+				dbg("i32.div_s 0x%x 0x%x 0x%x\n", a, b, TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x6e): // i32.div_u
+			{
+				const uint32_t b = POP_U32(s);
+				const uint32_t a = TOP_U32(s);
+				if (b == 0)
+				{
+					sprintf(d->exception, "Divide %u by zero.", a);
+					TICK_RETURN(DWAC_DIVIDE_BY_ZERO);
+				}
+				SET_U32(s, a / b);
+				dbg("i32.div_u 0x%x 0x%x 0x%x\n", a, b, TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x6f): // i32.rem_s
+			{
+				const int32_t b = POP_I32(s);
+				const int32_t a = TOP_I32(s);
+				if (b == 0)
+				{
+					sprintf(d->exception, "Divide %d by zero", a);
+					TICK_RETURN(DWAC_DIVIDE_BY_ZERO);
+				}
+				SET_I32(s, ((a == 0x80000000) && (b == -1)) ? 0 : a % b);
+				dbg("i32.rem_s 0x%x 0x%x 0x%x\n", a, b, TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x70): // i32.rem_u
+			{
+				const uint32_t b = POP_U32(s);
+				const uint32_t a = TOP_U32(s);
+				if (b == 0)
+				{
+					sprintf(d->exception, "Divide %u by zero.", a);
+					TICK_RETURN(DWAC_DIVIDE_BY_ZERO);
+				}
+				SET_U32(s, a % b);
+				dbg("i32.rem_u 0x%x 0x%x 0x%x\n", a, b, TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x71): // i32.and
+			{
+				const uint32_t b = POP_U32(s);
+				dbg("i32.and 0x%x 0x%x 0x%x\n", TOP_I32(s), b, TOP_I32(s) + b);
+				SET_U32(s, TOP_U32(s) & b);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x72): // i32.or
+			{
+				const uint32_t b = POP_U32(s);
+				dbg("i32.or 0x%x 0x%x 0x%x\n", TOP_I32(s), b, TOP_I32(s) + b);
+				SET_U32(s, TOP_U32(s) | b);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x73): // i32.xor
+			{
+				const int32_t b = POP_I32(s);
+				dbg("i32.xor 0x%x 0x%x 0x%x\n", TOP_I32(s), b, TOP_I32(s) + b);
+				SET_I32(s, TOP_I32(s) ^ b);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x74): // i32.shl
+			{
+				const int32_t b = POP_I32(s);
+				dbg("i32.shl 0x%x 0x%x 0x%x\n", TOP_I32(s), b, TOP_I32(s) << b);
+				SET_I32(s, TOP_I32(s) << b);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x75): // i32.shr_S
+			{
+				const int32_t b = POP_I32(s);
+				const int32_t a = TOP_I32(s);
+				SET_I32(s, a >> b);
+				dbg("i32.shl 0x%x 0x%x 0x%x\n", a, b, TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x76): // i32.shr_u
+			{
+				const uint32_t b = POP_U32(s);
+				const uint32_t a = TOP_U32(s);
+				SET_U32(s, a >> b);
+				dbg("i32.shr_u 0x%x 0x%x 0x%x\n", a, b, TOP_I32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x77): // i32.rotl
+			{ // not tested.
+				// Rotate left.
+				const uint32_t b = POP_U32(s);
+				const uint32_t a = TOP_U32(s);
+				const uint32_t c = rotl32(a, b);
+				SET_U32(s, c);
+				dbg("i32.rotl 0x%x 0x%x 0x%x\n", a, b, c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x78): // i32.rotr
+			{ // not tested.
+				const uint32_t b = POP_U32(s);
+				const uint32_t a = TOP_U32(s);
+				const uint32_t c = rotr32(a, b);
+				SET_U32(s, c);
+				dbg("i32.rotr 0x%x 0x%x 0x%x\n", a, b, c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x79): // i64.clz
+			{   // Not tested
+				// Count leading zeros  in a binary number.
+				const int64_t a = TOP_I64(s);
+				const int64_t c = a ? __builtin_clzll(a) : 64;
+				SET_I64(s, c);
+				dbg("i64.clz 0x%llx %lld\n", (long long)a, (long long)c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x7a): // i64.ctz
+			{   // Not tested
+				// Count trailing zeros in a binary number.
+				const int64_t a = TOP_I64(s);
+				const int64_t c = a ? __builtin_ctzll(a) : 64;
+				SET_I64(s, c);
+				dbg("i64.ctz 0x%llx %lld\n", (long long)a, (long long)c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x7b): // i64.popcnt
+			{   // Not tested
+				// Count number of 1s in a binary number.
+				const int64_t a = TOP_I64(s);
+				const int64_t c = __builtin_popcountll(a);
+				SET_I64(s, c);
+				dbg("i64.popcnt 0x%llx %lld\n", (long long)a, (long long)c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x7c): // i64.add
+			{
+				const int64_t b = POP_I64(s);
+				dbg("i64.add 0x%llx 0x%llx 0x%llx\n", (long long)TOP_I64(s), (long long)b, (long long)TOP_I64(s)+b);
+				SET_I64(s, TOP_I64(s) + b);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x7d): // i64.sub
+			{
+				const int64_t b = POP_I64(s);
+				dbg("i64.sub 0x%llx 0x%llx 0x%llx\n", (long long)TOP_I64(s), (long long)b, (long long)TOP_I64(s)-b);
+				SET_I64(s, TOP_I64(s) - b);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x7e): // i64.mul
+			{
+				const int64_t b = POP_I64(s);
+				dbg("i64.mul 0x%llx 0x%llx 0x%llx\n", (long long)TOP_I64(s), (long long)b, (long long)TOP_I64(s)*b);
+				SET_I64(s, TOP_I64(s) * b);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x7f): // i64.div_s
+			{
+				const int64_t b = POP_I64(s);
+				const int64_t a = TOP_I64(s);
+				if (b == 0)
+				{
+					sprintf(d->exception, "Divide %lld by zero", (long long)a);
+					TICK_RETURN(DWAC_DIVIDE_BY_ZERO);
+				}
+				if ((a == 0x8000000000000000LL) && (b == -1))
+				{
+					sprintf(d->exception, "Integer overflow (a == 0x80000000) && (b == -1).");
+					TICK_RETURN(DWAC_INTEGER_OVERFLOW);
+				}
+				SET_I64(s, a / b);
+				dbg("i64.div_s 0x%llx 0x%llx 0x%llx\n", (long long unsigned)a, (long long unsigned)b, (long long unsigned)TOP_U64(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x80): // i64.div_u
+			{
+				const uint64_t b = POP_U64(s);
+				const uint64_t a = TOP_U64(s);
+				if (b == 0)
+				{
+					sprintf(d->exception, "Divide %llu by zero.", (long long unsigned) a);
+					TICK_RETURN(DWAC_DIVIDE_BY_ZERO);
+				}
+				SET_U64(s, a / b);
+				dbg("i64.div_u 0x%llx 0x%llx 0x%llx\n", (long long unsigned)a, (long long unsigned)b, (long long unsigned)TOP_U64(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x81): // i64.rem_s
+			{
+				const int64_t b = POP_I64(s);
+				const int64_t a = TOP_I64(s);
+				if (b == 0)
+				{
+					sprintf(d->exception, "Divide %lld by zero", (long long) a);
+					TICK_RETURN(DWAC_DIVIDE_BY_ZERO);
+				}
+				SET_I64(s, ((a == 0x8000000000000000LL) && (b == -1)) ? 0 : a % b);
+				dbg("i64.rem_s 0x%llx 0x%llx 0x%llx\n", (long long unsigned)a, (long long unsigned)b, (long long unsigned)TOP_U64(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x82): // i64.rem_u
+			{
+				const uint64_t b = POP_U64(s);
+				const uint64_t a = TOP_U64(s);
+				if (b == 0)
+				{
+					sprintf(d->exception, "Divide %llu by zero.", (long long unsigned) a);
+					TICK_RETURN(DWAC_DIVIDE_BY_ZERO);
+				}
+				SET_U64(s, a % b);
+				dbg("i64.rem_u 0x%llx 0x%llx 0x%llx\n", (long long unsigned)a, (long long unsigned)b, (long long unsigned)TOP_U64(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x83): // i64.and
+			{
+				const int64_t b = POP_I64(s);
+				dbg("i64.and 0x%llx 0x%llx 0x%llx\n", (unsigned long long)TOP_U64(s), (unsigned long long)b, (unsigned long long)(TOP_U64(s) & b));
+				SET_I64(s, TOP_I64(s) & b);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x84): // i64.or
+			{
+				const int64_t b = POP_I64(s);
+				dbg("i64.or 0x%llx 0x%llx 0x%llx\n", (unsigned long long)TOP_U64(s), (unsigned long long)b, (unsigned long long)(TOP_U64(s) | b));
+				SET_I64(s, TOP_I64(s) | b);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x85): // i64.xor
+			{
+				const int64_t b = POP_I64(s);
+				dbg("i64.xor 0x%llx 0x%llx 0x%llx\n", (unsigned long long)TOP_U64(s), (unsigned long long)b, (unsigned long long)(TOP_U64(s) ^ b));
+				SET_I64(s, TOP_I64(s) ^ b);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x86): // i64.shl
+			{
+				const int64_t b = POP_I64(s);
+				const int64_t a = TOP_I64(s);
+				SET_I64(s, a << b);
+				dbg("i64.shl 0x%llx 0x%llx 0x%llx\n", (unsigned long long)a, (unsigned long long)b, (unsigned long long)(TOP_U64(s)));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x87): // i64.shr_S
+			{
+				const int64_t b = POP_I64(s);
+				const int64_t a = TOP_I64(s);
+				SET_I64(s, a >> b);
+				dbg("i64.shr_S 0x%llx 0x%llx 0x%llx\n", (unsigned long long)a, (unsigned long long)b, (unsigned long long)(TOP_U64(s)));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x88): // i64.shr_u
+			{
+				const uint64_t b = POP_U64(s);
+				const uint64_t a = TOP_I64(s);
+				SET_U64(s, a >> b);
+				dbg("i64.shr_u 0x%llx 0x%llx 0x%llx\n", (long long)a, (long long)b, (long long)TOP_I64(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x89): // i64.rotl
+			{ // not tested.
+				// Rotate left.
+				const uint64_t b = POP_U64(s);
+				const uint64_t a = TOP_U64(s);
+				const uint64_t c = rotl64(a, b);
+				SET_U64(s, c);
+				printf("i64.rotl 0x%llx 0x%llx 0x%llx\n", (unsigned long long)a, (unsigned long long)b, (unsigned long long)c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x8a): // i64.rotr
+			{ // not tested.
+				// Rotate right.
+				const uint64_t b = POP_U64(s);
+				const uint64_t a = TOP_U64(s);
+				const uint64_t c = rotr64(a, b);
+				SET_U64(s, c);
+				printf("i64.rotr 0x%llx 0x%llx 0x%llx\n", (unsigned long long)a, (unsigned long long)b, (unsigned long long)c);
+				NEXT_OPCODE();
+			}
+
+			#ifndef SKIP_FLOAT
+			OPCODE(0x8b): // f32.abs
+			{
+				const float a = TOP_F32(s);
+				const float c = fabs(a);
+				dbg("f32.abs %g %g\n", a, c);
+				SET_F32(s, c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x8c): // f32.neg
+			{ // not tested
+				const float a = TOP_F32(s);
+				const float c = -a;
+				dbg("f32.neg %g %g\n", a, c);
+				SET_F32(s, c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x8d): // f32.ceil
+			{ // not tested
+				float a = TOP_F32(s);
+				SET_F32(s, ceil(a));
+				dbg("f32.ceil %g %g\n", a, ceil(a));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x8e): // f32.floor
+			{
+				float a = TOP_F32(s);
+				SET_F32(s, floor(a));
+				dbg("f32.floor %g %g\n", a, floor(a));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x8f): // f32.trunc
+			{ // not tested
+				float a = TOP_F32(s);
+				SET_F32(s, trunc(a));
+				dbg("f32.trunc %g %g\n", a, trunc(a));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x90): // f32.nearest
+			{ // not tested
+				float a = TOP_F32(s);
+				SET_F32(s, rint(a));
+				dbg("f32.nearest %g %g\n", a, rint(a));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x91): // f32.sqrt
+			{ // not tested
+				float a = TOP_F32(s);
+				SET_F32(s, sqrt(a));
+				dbg("f32.sqrt %g %g\n", a, sqrt(a));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x92): // f32.add
+			{
+				const float b = POP_F32(s);
+				const float a = TOP_F32(s);
+				const float c = a + b;
+				dbg("f32.add %g %g %g\n", a,b,c);
+				SET_F32(s, c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x93): // f32.sub
+			{
+				const float b = POP_F32(s);
+				const float a = TOP_F32(s);
+				const float c = a - b;
+				dbg("f32.sub %g %g %g\n", a,b,c);
+				SET_F32(s, c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x94): // f32.mul
+			{
+				const float b = POP_F32(s);
+				const float a = TOP_F32(s);
+				const float c = a * b;
+				dbg("f32.mul %g %g %g\n", a,b,c);
+				SET_F32(s, c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x95): // f32.div
+			{ // not tested
+				const float b = POP_F32(s);
+				const float a = TOP_F32(s);
+				const float c = a / b;
+				dbg("f32.div %g %g %g\n", a,b,c);
+				SET_F32(s, c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x96): // f32.min
+			{ // not tested
+				const float b = POP_F32(s);
+				const float a = TOP_F32(s);
+				const float c = fmin(a, b);
+				SET_F32(s, c);
+				dbg("f32.min %g %g %g\n", a,b,c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x97): // f32.max
+			{ // not tested
+				const float b = POP_F32(s);
+				const float a = TOP_F32(s);
+				const float c = fmax(a, b);
+				SET_F32(s, c);
+				dbg("f32.max %g %g %g\n", a,b,c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0x98): // f32.copysign
+			{ // not tested
+				const float b = POP_F32(s);
+				const float a = TOP_F32(s);
+				const float c = signbit(b) ? -fabs(a) : fabs(a);
+				SET_F32(s, c);
+				dbg("f32.copysign %g %g %g\n", a,b,c);
+				NEXT_OPCODE();
+			}
+
+			OPCODE(0x99): // f64.abs
+			{
+				const double a = TOP_F64(s);
+				SET_F64(s, fabs(a));
+				dbg("f64.abs %g %g\n", a, TOP_F64(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x9a): // f64.neg
+				SET_F64(s, -TOP_F64(s));
+				dbg("f64.neg %g\n", TOP_F64(s));
+				NEXT_OPCODE();
+			OPCODE(0x9b): // f64.ceil
+				SET_F64(s, ceil(TOP_F64(s)));
+				dbg("f64.ceil %g\n", TOP_F64(s));
+				NEXT_OPCODE();
+			OPCODE(0x9c): // f64.floor
+				SET_F64(s, floor(TOP_F64(s)));
+				dbg("f64.floor %g\n", TOP_F64(s));
+				NEXT_OPCODE();
+			OPCODE(0x9d): // f64.trunc
+				SET_F64(s, trunc(TOP_F64(s)));
+				dbg("f64.trunc %g\n", TOP_F64(s));
+				NEXT_OPCODE();
+			OPCODE(0x9e): // f64.nearest
+				SET_F64(s, rint(TOP_F64(s)));
+				dbg("f64.nearest %g\n", TOP_F64(s));
+				NEXT_OPCODE();
+			OPCODE(0x9f): // f64.sqrt
+				SET_F64(s, sqrt(TOP_F64(s)));
+				dbg("f64.sqrt %g\n", TOP_F64(s));
+				NEXT_OPCODE();
+
+			OPCODE(0xa0): // f64.add
+			{
+				const double b = POP_F64(s);
+				const double a = TOP_F64(s);
+				SET_F64(s, a + b);
+				dbg("f64.add %g %g %g\n", a,b,TOP_F64(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0xa1): // f64.sub
+			{
+				const double b = POP_F64(s);
+				const double a = TOP_F64(s);
+				SET_F64(s, a - b);
+				dbg("f64.sub %g %g %g\n", a,b,TOP_F64(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0xa2): // f64.mul
+			{
+				const double b = POP_F64(s);
+				const double a = TOP_F64(s);
+				SET_F64(s, a * b);
+				dbg("f64.mul %g %g %g\n", a,b,TOP_F64(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0xa3): // f64.div
+			{
+				const double b = POP_F64(s);
+				const double a = TOP_F64(s);
+				SET_F64(s, a / b);
+				dbg("f64.div %g %g %g\n", a,b,TOP_F64(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0xa4): // f64.min
+			{
+				double b = POP_F64(s);
+				double a = TOP_F64(s);
+				SET_F64(s, fmin(a, b));
+				dbg("f64.min %g %g %g\n", a, b, TOP_F64(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0xa5): // f64.max
+			{
+				double b = POP_F64(s);
+				double a = TOP_F64(s);
+				SET_F64(s, fmax(a, b));
+				dbg("f64.max %g %g %g\n", a, b, TOP_F64(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0xa6): // f64.copysign
+			{ // not tested
+				double b = POP_F64(s);
+				double a = TOP_F64(s);
+				double c = signbit(b) ? -fabs(a) : fabs(a);
+				SET_F64(s, c);
+				dbg("f64.copysign %g %g %g\n", a, b, c);
+				NEXT_OPCODE();
+			}
+			#endif
+			OPCODE(0xa7): // i32.wrap_i64
+			{
+				// [2] The wrap instruction, is used to convert numbers of type i64
+				// to type i32. If the number is larger than what an i32 can hold
+				// this operation will wrap, resulting in a different number.
+				SET_U64(s, TOP_U64(s) & 0x00000000ffffffff);
+				dbg("i32.wrap_i64 0x%llx\n", (unsigned long long)TOP_U64(s));
+				NEXT_OPCODE();
+			}
+
+			#ifndef SKIP_FLOAT
+			OPCODE(0xa8): // i32.trunc_f32_s
+			{ // not tested
+				const float a = TOP_F32(s);
+				if (isnan(a))
+				{
+					sprintf(d->exception, "Not a number.");
+					TICK_RETURN(DWAC_INVALID_INTEGER_CONVERSION);
+				}
+				else if ((a > INT32_MAX) || (a < INT32_MIN))
+				{
+					sprintf(d->exception, "Can't convert %g to int32.", a);
+					TICK_RETURN(DWAC_INTEGER_OVERFLOW);
+				}
+				const int32_t c = a;
+				SET_I32(s, c);
+				dbg("i32.trunc_f32_s %g %d\n", a, c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0xa9): // i32.trunc_f32_u
+			{
+				const float a = TOP_F32(s);
+				if (isnan(a))
+				{
+					sprintf(d->exception, "Not a number.");
+					TICK_RETURN(DWAC_INVALID_INTEGER_CONVERSION);
+				}
+				else if ((a > UINT32_MAX) || (a < (float)0.0))
+				{
+					sprintf(d->exception, "Can't convert %g to uint32.", a);
+					TICK_RETURN(DWAC_INTEGER_OVERFLOW);
+				}
+				SET_U32(s, a);
+				dbg("i32.trunc_f32_u %g %u\n", a, TOP_U32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0xaa): // i32.trunc_f64_s
+			{ // not tested
+				const double a = TOP_F64(s);
+				if (isnan(a))
+				{
+					sprintf(d->exception, "Not a number.");
+					TICK_RETURN(DWAC_INVALID_INTEGER_CONVERSION);
+				}
+				else if ((a > INT32_MAX) || (a < INT32_MIN))
+				{
+					sprintf(d->exception, "Can't convert %g to int32.", a);
+					TICK_RETURN(DWAC_INTEGER_OVERFLOW);
+				}
+				const int32_t c = a;
+				SET_I32(s, c);
+				dbg("i32.trunc_f64_s %g %d\n", a, c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0xab): // i32.trunc_f64_u
+			{
+				const double a = TOP_F64(s);
+				if (isnan(a))
+				{
+					sprintf(d->exception, "Not a number.");
+					TICK_RETURN(DWAC_INVALID_INTEGER_CONVERSION);
+				}
+				else if ((a > UINT32_MAX) || (a < 0.0))
+				{
+					sprintf(d->exception, "Can't convert %g to uint32.", a);
+					TICK_RETURN(DWAC_INTEGER_OVERFLOW);
+				}
+				SET_U32(s, a);
+				dbg("i32.trunc_f64_u %g %u\n", a, TOP_U32(s));
+				NEXT_OPCODE();
+			}
+			#endif
+			OPCODE(0xac): // i64.extend_i32_s
+			{
+				// [2] The extend instructions, are used to convert (extend) numbers of type
+				// i32 to type i64. There are signed and unsigned versions of this instruction.
+				const int32_t a = TOP_I32(s);
+				SET_I64(s, (int64_t)a);
+				dbg("i64.extend_i32_s %d %lld\n", a, (long long)TOP_I64(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0xad): // i64.extend_i32_u
+			{
+				uint32_t a = TOP_U32(s);
+				SET_U64(s, (uint64_t)a);
+				dbg("i64.extend_i32_u 0x%x 0x%llx\n", a, (unsigned long long)TOP_U64(s));
+				NEXT_OPCODE();
+			}
+
+			#ifndef SKIP_FLOAT
+			OPCODE(0xae): // i64.trunc_f32_s
+			{ // not tested
+				const float a = TOP_F32(s);
+				if (isnan(a))
+				{
+					sprintf(d->exception, "Not a number.");
+					TICK_RETURN(DWAC_INVALID_INTEGER_CONVERSION);
+				}
+				else if ((a > INT64_MAX) || (a < INT64_MIN))
+				{
+					sprintf(d->exception, "Can't convert %g to int64.", a);
+					TICK_RETURN(DWAC_INTEGER_OVERFLOW);
+				}
+				const int64_t c = a;
+				SET_I64(s, c);
+				dbg("i64.trunc_f32_s %g %lld\n", a, (long long)c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0xaf): // i64.trunc_f32_u
+			{ // not tested
+				const double a = TOP_F32(s);
+				if (isnan(a))
+				{
+					sprintf(d->exception, "Not a number.");
+					TICK_RETURN(DWAC_INVALID_INTEGER_CONVERSION);
+				}
+				else if ((a > UINT64_MAX) || (a < 0.0))
+				{
+					sprintf(d->exception, "Can't convert %g to uint64.", a);
+					TICK_RETURN(DWAC_INTEGER_OVERFLOW);
+				}
+				const uint64_t c = a;
+				SET_U64(s, c);
+				dbg("i64.trunc_f32_u %g %llu\n", a, (unsigned long long)c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0xb0): // i64.trunc_f64_s
+			{ // not tested
+				const double a = TOP_F64(s);
+				if (isnan(a))
+				{
+					sprintf(d->exception, "Not a number.");
+					TICK_RETURN(DWAC_INVALID_INTEGER_CONVERSION);
+				}
+				else if (a > INT64_MAX || a < INT64_MIN)
+				{
+					sprintf(d->exception, "Can't convert %g to int64.", a);
+					TICK_RETURN(DWAC_INTEGER_OVERFLOW);
+				}
+				const int64_t c = a;
+				SET_I64(s, c);
+				dbg("i64.trunc_f64_s %g %llu\n", a, (long long)c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0xb1): // i64.trunc_f64_u
+			{
+				const double a = TOP_F64(s);
+				if (isnan(a))
+				{
+					sprintf(d->exception, "Not a number.");
+					TICK_RETURN(DWAC_INVALID_INTEGER_CONVERSION);
+				}
+				else if ((a > UINT64_MAX) || (a <= -0.5))
+				{
+					sprintf(d->exception, "Can't convert %g to uint64.", TOP_F64(s));
+					TICK_RETURN(DWAC_INTEGER_OVERFLOW);
+				}
+				const uint64_t c = a;
+				SET_U64(s, c);
+				dbg("i64.trunc_f64_u %g %llu\n", a, (unsigned long long)c);
+				NEXT_OPCODE();
+			}
+			OPCODE(0xb2): // f32.convert_i32_s
+			{
+				int32_t a = TOP_I32(s);
+				SET_F32I(s, a);
+				dbg("f32.convert_i32_s 0x%x %g\n", a, TOP_F32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0xb3): // f32.convert_i32_u
+			{// not tested
+				SET_F32(s, TOP_U64(s));
+				dbg("f32.convert_i32_u %g\n", TOP_F32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0xb4): // f32.convert_i64_s
+				SET_F32(s, TOP_I64(s));
+				dbg("f32.convert_i64_s %g\n", TOP_F32(s));
+				NEXT_OPCODE();
+			OPCODE(0xb5): // f32.convert_i64_u
+				SET_F32(s, TOP_U64(s));
+				dbg("f32.convert_i64_u %g\n", TOP_F32(s));
+				NEXT_OPCODE();
+			OPCODE(0xb6): // f32.demote_f64
+			{
+				const double a = TOP_F64(s);
+				const float b = a;
+				SET_F32(s, b);
+				dbg("f32.demote_f64 %g\n", TOP_F32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0xb7): // f64.convert_i32_s
+				SET_F64(s, TOP_I32(s));
+				dbg("f64.convert_i32_s %g\n", TOP_F64(s));
+				NEXT_OPCODE();
+			OPCODE(0xb8): // f64.convert_i32_u
+				SET_F64(s, TOP_U32(s));
+				dbg("f64.convert_i32_u %g\n", TOP_F64(s));
+				NEXT_OPCODE();
+			OPCODE(0xb9): // f64.convert_i64_s
+				SET_F64(s, TOP_I64(s));
+				dbg("f64.convert_i64_s %g\n", TOP_F64(s));
+				NEXT_OPCODE();
+			OPCODE(0xba): // f64.convert_i64_u
+				SET_F64(s, TOP_U64(s));
+				dbg("f64.convert_i64_u %g\n", TOP_F64(s));
+				NEXT_OPCODE();
+			OPCODE(0xbb): // f64.promote_f32
+			{
+				const float a = TOP_F32(s);
+				const double b = a;
+				SET_F64(s, b);
+				dbg("f64.promote_f32 %g\n", TOP_F64(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0xbc): // i32.reinterpret_f32
+			{// not tested
+				// [2] The reinterpret instructions, are used to reinterpret the bits of a number as a different type.
+				// do nothing.
+				dbg("i32.reinterpret_f32 0x%x %g\n", TOP_I32(s), TOP_F32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0xbd): // i64.reinterpret_f64
+			{
+				// do nothing.
+				dbg("i64.reinterpret_f64 0x%llx %g\n", (long long unsigned)TOP_I64(s), TOP_F64(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0xbe): // f32.reinterpret_i32
+			{   // not tested
+				// do nothing.
+				dbg("f32.reinterpret_i32 0x%x %g\n", TOP_I32(s), TOP_F32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0xbf): // f64.reinterpret_i64
+			{   // not tested
+				// do nothing.
+				dbg("f64.reinterpret_i64 0x%llx %g\n", (long long unsigned)TOP_I64(s), TOP_F64(s));
+				NEXT_OPCODE();
+			}
+			#endif
+			#if 1
+			// https://github.com/WebAssembly/sign-extension-ops/blob/master/proposals/sign-extension-ops/Overview.md
+			OPCODE(0xc0): // i32.extend8_s
+			{ // not tested
+				int8_t a = TOP_I32(s);
+				SET_I32(s, a);
+				NEXT_OPCODE();
+			}
+			OPCODE(0xc1): // i32.extend16_s
+			{ // not tested
+				int16_t a = TOP_I32(s);
+				SET_I32(s, a);
+				NEXT_OPCODE();
+			}
+			OPCODE(0xc2): // i64.extend8_s
+			{ // not tested
+				int8_t a = TOP_I64(s);
+				SET_I64(s, a);
+				NEXT_OPCODE();
+			}
+			OPCODE(0xc3): // i64.extend16_s
+			{ // not tested
+				int16_t a = TOP_I64(s);
+				SET_I64(s, a);
+				NEXT_OPCODE();
+			}
+			OPCODE(0xc4): // i64.extend32_s
+			{ // not tested
+				int32_t a = TOP_I64(s);
+				SET_I64(s, a);
+				NEXT_OPCODE();
+			}
+			#endif
+			OPCODE(0xfc): // trunc_sat, memory.init. data.drop, memory.copy, memory.fill
+			{
+				// 5.4.7. Numeric Instructions
+				// The saturating truncation instructions all have a one byte prefix,
+				// whereas the actual opcode is encoded by a variable-length unsigned integer.
+				// [1] 5.4.6. Memory Instructions, the bulk memory ones have the same prefix.
+				const uint32_t actual_opcode = code_read_u32(&s->pc);
+				dwac_result r = DWAC_OK;
+				switch (actual_opcode)
+				{
+					#ifndef SKIP_FLOAT
+					case 0: SET_I32(s, trunc_sat_s32(TOP_F32(s))); break; // i32.trunc_sat_f32_s
+					case 1: SET_U32(s, trunc_sat_u32(TOP_F32(s))); break; // i32.trunc_sat_f32_u
+					case 2: SET_I32(s, trunc_sat_s32(TOP_F64(s))); break; // i32.trunc_sat_f64_s
+					case 3: SET_U32(s, trunc_sat_u32(TOP_F64(s))); break; // i32.trunc_sat_f64_u
+					case 4: SET_I64(s, trunc_sat_s64(TOP_F32(s))); break; // i64.trunc_sat_f32_s
+					case 5: SET_U64(s, trunc_sat_u64(TOP_F32(s))); break; // i64.trunc_sat_f32_u
+					case 6: SET_I64(s, trunc_sat_s64(TOP_F64(s))); break; // i64.trunc_sat_f64_s
+					case 7: SET_U64(s, trunc_sat_u64(TOP_F64(s))); break; // i64.trunc_sat_f64_u
+					#endif
+					case 8: // memory.init
+					{
+						const uint32_t dataidx = code_read_u32(&s->pc);
+						s->pc.pos++; // Memory index, zero.
+						const uint32_t n = POP_U32(s);
+						const uint32_t src = POP_U32(s);
+						const uint32_t dst = POP_U32(s);
+						TICK_CHARGE(n / 64);
+						r = dwac_memory_init(d, dataidx, dst, src, n);
+						dbg("memory.init %u 0x%x 0x%x 0x%x\n", dataidx, dst, src, n);
+						break;
+					}
+					case 9: // data.drop
+						r = dwac_data_drop(d, code_read_u32(&s->pc));
+						break;
+					case 10: // memory.copy
+					{
+						s->pc.pos += 2; // Memory indexes, zero.
+						const uint32_t n = POP_U32(s);
+						const uint32_t src = POP_U32(s);
+						const uint32_t dst = POP_U32(s);
+						TICK_CHARGE(n / 64);
+						r = dwac_memory_copy(d, dst, src, n);
+						dbg("memory.copy 0x%x 0x%x 0x%x\n", dst, src, n);
+						break;
+					}
+					case 11: // memory.fill
+					{
+						s->pc.pos++; // Memory index, zero.
+						const uint32_t n = POP_U32(s);
+						const uint32_t value = POP_U32(s);
+						const uint32_t dst = POP_U32(s);
+						TICK_CHARGE(n / 64);
+						r = dwac_memory_fill(d, dst, value, n);
+						dbg("memory.fill 0x%x 0x%x 0x%x\n", dst, value, n);
+						break;
+					}
+					default:
+						// Such as the table instructions.
+						sprintf(d->exception, "0x%x", actual_opcode);
+						TICK_RETURN(DWAC_SATURATING_NOT_SUPPORTED_YET);
+				}
+				if (r != DWAC_OK) {TICK_RETURN(r);}
+				NEXT_OPCODE();
+			}
+			OPCODE(0xfd):
+			{
+				// [1] 5.4.8. Vector Instructions
+				//     All variants of vector instructions are represented by separate byte codes.
+				//     They all have a one byte prefix, whereas the actual opcode is encoded by a
+				//     variable-length unsigned integer.
+				// So the one byte is probably the opcode (0xfd). Then follows a LEB.
+				uint32_t memarg = code_read_u32(&s->pc);
+				// TODO This is like an entire additional instruction set.
+				sprintf(d->exception, "No vectors implemented 0x%x 0x%x", opcode, memarg);
+				TICK_RETURN(DWAC_VECTORS_NOT_SUPPORTED);
+			}
+			#ifdef DWAC_FUSE_OPCODES
+			// Internal opcodes, superinstructions made by fuse_code.
+			OPCODE(0x100): // local.get, i32.const, i32.add
+			{
+				const uint32_t localidx = code_read_u32(&s->pc);
+				const uint32_t c = code_read_u32(&s->pc);
+				TICK_PUSH_SLOT();
+				SET_I32(s, (int32_t)(s->stack[SP_MASK(s->fp + localidx)].u32 + c));
+				dbg("local.get i32.const i32.add 0x%x 0x%x 0x%x\n", localidx, c, TOP_U32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x101): // local.get, i32.load
+			{
+				const uint32_t localidx = code_read_u32(&s->pc);
+				const uint32_t offset = code_read_u32(&s->pc);
+				TICK_PUSH_SLOT();
+				const uint32_t addr = s->stack[SP_MASK(s->fp + localidx)].u32;
+				SET_I32(s, translate_get_int32(d, offset + addr));
+				dbg("local.get i32.load 0x%x 0x%x 0x%x 0x%x\n", localidx, offset, addr, TOP_U32(s));
+				NEXT_OPCODE();
+			}
+			OPCODE(0x102): // i32.eqz, br_if
+			{
+				dbg("i32.eqz br_if\n");
+				const uint32_t cond = (POP_I32(s) == 0);
+				if (cond)
+				{
+					tick_branch(s, s->pc.array + s->pc.pos + 1, TICK_METERED);
+					if ((!TICK_VALIDATED) && (s->stack[DWAC_STACK_CAPACITY - 1].s64 != WA_MAGIC_STACK_VALUE)) {TICK_RETURN(DWAC_STACK_OVERFLOW);}
+					if ((!TICK_VALIDATED) && (s->pc.pos >= s->pc.nof)) {TICK_RETURN(DWAC_PC_ADDR_OUT_OF_RANGE);}
+					TICK_CHECKPOINT();
+				}
+				else
+				{
+					s->pc.pos += 5;
+				}
+				NEXT_OPCODE();
+			}
+			OPCODE(0x103): // local.get, local.get, i32.add
+			{
+				const uint32_t a = code_read_u32(&s->pc);
+				const uint32_t b = code_read_u32(&s->pc);
+				TICK_PUSH_SLOT();
+				SET_I32(s, (int32_t)(s->stack[SP_MASK(s->fp + a)].u32 + s->stack[SP_MASK(s->fp + b)].u32));
+				dbg("local.get local.get i32.add 0x%x 0x%x 0x%x\n", a, b, TOP_U32(s));
+				NEXT_OPCODE();
+			}
+			#endif
+			OPCODE_DEFAULT:
+				sprintf(d->exception, "unrecognized opcode 0x%x", opcode);
+				TICK_RETURN(DWAC_UNKNOWN_OPCODE);
+		}
+	}
+	TICK_RETURN(DWAC_NEED_MORE_GAS);
+}
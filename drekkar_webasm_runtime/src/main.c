@@ -55,6 +55,10 @@ static void print_help(const char* name) {
 	printf("  --logging-on         More logging.\n");
 	printf("  --function_name <n>  Call other function (that is not main),\n");
 	printf("                       arguments will be pushed as numbers.\n");
+	printf("  --gas_slice <n>      Gas for each dwac_tick.\n");
+	printf("  --gas_budget <n>     Gas for the call, refuel with as much when used.\n");
+	printf("  --interrupts <n>     Interrupt the program n times, continue after each.\n");
+	printf("  --deadline_ms <n>    Stop the program if not done in n milliseconds.\n");
 	printf("Where:\n");
 	printf("  <filename>     shall be the name of a \".wasm\" file.\n");
 	printf("  <argv/argc>    will be passed on to web assembly code.\n");
@@ -210,6 +214,26 @@ int main(int argc, char** argv)
 				e.function_name = argv[n++];
 				e.argc = 0;
 			}
+			else if (strcmp(arg, "--gas_slice") == 0)
+			{
+				if (n >= argc) {return 0;}
+				e.gas_slice = atol(argv[n++]);
+			}
+			else if (strcmp(arg, "--gas_budget") == 0)
+			{
+				if (n >= argc) {return 0;}
+				e.gas_budget = atoll(argv[n++]);
+			}
+			else if (strcmp(arg, "--interrupts") == 0)
+			{
+				if (n >= argc) {return 0;}
+				e.interrupts = atoi(argv[n++]);
+			}
+			else if (strcmp(arg, "--deadline_ms") == 0)
+			{
+				if (n >= argc) {return 0;}
+				e.deadline_ms = atoll(argv[n++]);
+			}
 			else
 			{
 				printf("Unknown argument '%s'. Try --help for more info.\n", arg);
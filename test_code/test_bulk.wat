@@ -0,0 +1,109 @@
+;; Test program for drekkar webasm runtime, bulk memory instructions
+;; (memory.init, data.drop, memory.copy and memory.fill).
+;;
+;; Some tools may be needed to run this:
+;;   sudo apt install binaryen
+;;
+;; To compile this do:
+;;   wasm-as --enable-bulk-memory test_bulk.wat
+;;
+;; To run this:
+;; ../drekkar_webasm_runtime/drekkar_webasm_runtime --function_name test test_bulk.wasm
+;;
+;; The memory is 2 pages (0x20000 bytes). The ranges used by test cross the
+;; page boundary at 0x10000, including copies where the source and
+;; destination overlap (in both directions).
+;;
+;; Expected result:
+;; test returns 0, else the number of the check that failed.
+;;
+;; These shall each stop with exception 92 (DWAC_ADDR_OUT_OF_RANGE),
+;; "memory.init out of range" etc.
+;;   init_dst_oob, init_src_oob, fill_oob, copy_src_oob, copy_dst_oob,
+;;   init_dropped, fill_past_end
+;;
+(module
+  (memory 2)
+  (data $seg "0123456789abcdef")
+  (export "test" (func $test))
+  (export "init_dst_oob" (func $init_dst_oob))
+  (export "init_src_oob" (func $init_src_oob))
+  (export "fill_oob" (func $fill_oob))
+  (export "copy_src_oob" (func $copy_src_oob))
+  (export "copy_dst_oob" (func $copy_dst_oob))
+  (export "init_dropped" (func $init_dropped))
+  (export "fill_past_end" (func $fill_past_end))
+
+  (func $test (result i32)
+    ;; 32 bytes of 0x11 at 0xfff0, over the page boundary.
+    (memory.fill (i32.const 0xfff0) (i32.const 0x11) (i32.const 32))
+    (if (i32.ne (i32.load8_u (i32.const 0xffef)) (i32.const 0)) (then (return (i32.const 1))))
+    (if (i32.ne (i32.load8_u (i32.const 0xfff0)) (i32.const 0x11)) (then (return (i32.const 2))))
+    (if (i32.ne (i32.load8_u (i32.const 0x1000f)) (i32.const 0x11)) (then (return (i32.const 3))))
+    (if (i32.ne (i32.load8_u (i32.const 0x10010)) (i32.const 0)) (then (return (i32.const 4))))
+
+    ;; "0123456789abcdef" at 0xfff8.
+    (memory.init $seg (i32.const 0xfff8) (i32.const 0) (i32.const 16))
+    (if (i64.ne (i64.load (i32.const 0xfff8)) (i64.const 0x3736353433323130)) (then (return (i32.const 5)))) ;; "01234567"
+    (if (i64.ne (i64.load (i32.const 0x10000)) (i64.const 0x6665646362613938)) (then (return (i32.const 6)))) ;; "89abcdef"
+
+    ;; Overlapping copy to a higher address.
+    (memory.copy (i32.const 0xfffc) (i32.const 0xfff8) (i32.const 16))
+    (if (i64.ne (i64.load (i32.const 0xfff8)) (i64.const 0x3332313033323130)) (then (return (i32.const 7)))) ;; "01230123"
+    (if (i64.ne (i64.load (i32.const 0x10000)) (i64.const 0x6261393837363534)) (then (return (i32.const 8)))) ;; "456789ab"
+    (if (i32.ne (i32.load8_u (i32.const 0x1000c)) (i32.const 0x11)) (then (return (i32.const 9))))
+
+    ;; Overlapping copy to a lower address.
+    (memory.copy (i32.const 0xfff6) (i32.const 0xfffa) (i32.const 16))
+    (if (i64.ne (i64.load (i32.const 0xfff0)) (i64.const 0x3332111111111111)) (then (return (i32.const 10)))) ;; 6 * 0x11, "23"
+    (if (i64.ne (i64.load (i32.const 0xfff8)) (i64.const 0x3736353433323130)) (then (return (i32.const 11)))) ;; "01234567"
+    (if (i64.ne (i64.load (i32.const 0x10000)) (i64.const 0x6261646362613938)) (then (return (i32.const 12)))) ;; "89abcdab"
+
+    ;; Zero bytes at the very end is not out of range.
+    (memory.fill (i32.const 0x20000) (i32.const 0) (i32.const 0))
+    (memory.copy (i32.const 0x20000) (i32.const 0) (i32.const 0))
+    (memory.init $seg (i32.const 0x20000) (i32.const 16) (i32.const 0))
+
+    ;; Nor is zero bytes from a dropped segment.
+    (data.drop $seg)
+    (memory.init $seg (i32.const 0) (i32.const 0) (i32.const 0))
+    (i32.const 0)
+  )
+
+  (func $init_dst_oob (result i32)
+    (memory.init $seg (i32.const 0x1fff8) (i32.const 0) (i32.const 16))
+    (i32.const 0)
+  )
+
+  (func $init_src_oob (result i32)
+    (memory.init $seg (i32.const 0) (i32.const 8) (i32.const 16))
+    (i32.const 0)
+  )
+
+  (func $fill_oob (result i32)
+    (memory.fill (i32.const 0x1fff0) (i32.const 0) (i32.const 0x11))
+    (i32.const 0)
+  )
+
+  (func $copy_src_oob (result i32)
+    (memory.copy (i32.const 0) (i32.const 0x1fff9) (i32.const 8))
+    (i32.const 0)
+  )
+
+  (func $copy_dst_oob (result i32)
+    (memory.copy (i32.const 0x1fff9) (i32.const 0) (i32.const 8))
+    (i32.const 0)
+  )
+
+  (func $init_dropped (result i32)
+    (data.drop $seg)
+    (memory.init $seg (i32.const 0) (i32.const 0) (i32.const 1))
+    (i32.const 0)
+  )
+
+  (func $fill_past_end (result i32)
+    (memory.fill (i32.const 0x20001) (i32.const 0) (i32.const 0))
+    (i32.const 0)
+  )
+
+)
@@ -0,0 +1,87 @@
+;; Test program for drekkar webasm runtime, gas metering.
+;;
+;; Some tools may be needed to run this:
+;;   sudo apt install binaryen
+;;
+;; To compile this do:
+;;   wasm-as test_gas.wat
+;;
+;; To run this:
+;; ../drekkar_webasm_runtime/drekkar_webasm_runtime --logging-on --function_name test test_gas.wasm 10
+;;
+;; The number is n, how many times the loop is run. The result is the sum
+;; of i*i for i from 0 to n-1 (285 if n is 10).
+;;
+;; Each opcode costs 1 gas except call 5, loads and stores 2 and div 4
+;; (see opcode_gas). Per turn of the loop that is 26 (including the 4 of
+;; $square). Before the loop block and loop are 2, the last test of i and
+;; the br_if out are 4, then the end of the block, the code after it and
+;; the end of the function 10.
+;; So the gas used shall be 26*n + 16, the same if the loop is run by the
+;; interpreter, register code or machine code (JIT), with or without fused
+;; opcodes.
+;;
+;; Expected result:
+;;   n = 0:     Total gas and memory usage: 16 ...
+;;   n = 1:     Total gas and memory usage: 42 ...
+;;   n = 10:    Total gas and memory usage: 276 ...
+;;   n = 3000:  Total gas and memory usage: 78016 ...
+;;
+;; The totals shall be the same when the program is stopped and continued,
+;; for example with a budget smaller than the call that is refuelled each
+;; time it is used (dwac_set_gas_budget, dwac_refuel), a short slice or
+;; interrupts (dwac_interrupt):
+;;   --gas_budget 7 --gas_slice 3 ... 10: Total gas and memory usage: 276 ...
+;;   --gas_budget 1000 ... 3000:          Total gas and memory usage: 78016 ...
+;;   --interrupts 5 ... 10:               Total gas and memory usage: 276 ...
+;; And with a deadline it stops, DWAC_DEADLINE_EXCEEDED:
+;;   --deadline_ms 100 ... 2000000000:    Deadline exceeded, gas used ...
+;;
+(module
+  (memory 1)
+  (export "test" (func $test))
+
+  (func $square (param i32) (result i32)
+    (i32.mul
+      (local.get 0)
+      (local.get 0)
+    )
+  )
+
+  (func $test (param $n i32) (result i32)
+    (local $i i32)
+    (local $sum i32)
+    (block
+      (loop
+        (br_if 1
+          (i32.ge_u
+            (local.get $i)
+            (local.get $n)
+          )
+        )
+        (local.set $sum
+          (i32.add
+            (local.get $sum)
+            (call $square (local.get $i))
+          )
+        )
+        (i32.store
+          (i32.const 0)
+          (local.get $sum)
+        )
+        (local.set $i
+          (i32.add
+            (local.get $i)
+            (i32.const 1)
+          )
+        )
+        (br 0)
+      )
+    )
+    (i32.div_u
+      (i32.load (i32.const 0))
+      (i32.const 1)
+    )
+  )
+
+)
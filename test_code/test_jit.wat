@@ -0,0 +1,118 @@
+;; Test program for drekkar webasm runtime, functions compiled into machine
+;; code (DWAC_JIT). Functions without calls are run as register code, they
+;; are compiled when DWAC_JIT_THRESHOLD (1000) calls and branches are done
+;; in them.
+;;
+;; Some tools may be needed to run this:
+;;   sudo apt install binaryen
+;;
+;; To compile this do:
+;;   wasm-as test_jit.wat
+;;
+;; To run this:
+;; ../drekkar_webasm_runtime/drekkar_webasm_runtime --logging-on --function_name test test_jit.wasm
+;;
+;; $sum_loop gets hot and is compiled in the middle of its loop, it then
+;; continues in machine code. $table_loop does br_table in machine code
+;; (that is done by reg_step). $classify is compiled after being called
+;; many times, it returns from inside blocks.
+;;
+;; With a short slice gas runs out (DWAC_NEED_MORE_GAS) many times inside
+;; the machine code, which is then continued where it was:
+;; ../drekkar_webasm_runtime/drekkar_webasm_runtime --logging-on --gas_slice 100 --function_name test test_jit.wasm
+;;
+;; Expected result:
+;; test returns 0, else the number of the check that failed. The total gas
+;; used shall be the same with or without --gas_slice (and the same as with
+;; DWAC_JIT or DWAC_REGISTER_CODE not defined).
+;;
+(module
+  (export "test" (func $test))
+
+  (func $sum_loop (param $n i32) (result i32)
+    (local $i i32)
+    (local $s i32)
+    (block $done
+      (loop $next
+        (br_if $done (i32.ge_u (local.get $i) (local.get $n)))
+        (local.set $s (i32.add (local.get $s) (i32.mul (local.get $i) (local.get $i))))
+        (local.set $i (i32.add (local.get $i) (i32.const 1)))
+        (br $next)
+      )
+    )
+    (local.get $s)
+  )
+
+  (func $table_loop (param $n i32) (result i32)
+    (local $i i32)
+    (local $s i32)
+    (block $done
+      (loop $next
+        (br_if $done (i32.ge_u (local.get $i) (local.get $n)))
+        (block $cont
+          (block $default
+            (block $c2
+              (block $c1
+                (block $c0
+                  (br_table $c0 $c1 $c2 $default (i32.and (local.get $i) (i32.const 3)))
+                )
+                (local.set $s (i32.add (local.get $s) (i32.const 1)))
+                (br $cont)
+              )
+              (local.set $s (i32.add (local.get $s) (i32.const 10)))
+              (br $cont)
+            )
+            (local.set $s (i32.add (local.get $s) (i32.const 100)))
+            (br $cont)
+          )
+          (local.set $s (i32.add (local.get $s) (i32.const 1000)))
+        )
+        (local.set $i (i32.add (local.get $i) (i32.const 1)))
+        (br $next)
+      )
+    )
+    (local.get $s)
+  )
+
+  (func $classify (param $x i32) (result i32)
+    (block $d
+      (block $b2
+        (block $b1
+          (block $b0
+            (br_table $b0 $b1 $b2 $d (local.get $x))
+          )
+          (return (i32.const 7))
+        )
+        (return (i32.const 8))
+      )
+      (return (i32.const 9))
+    )
+    (i32.const 10)
+  )
+
+  (func $test (result i32)
+    (local $i i32)
+    (local $s i32)
+    ;; Sum of i*i for i from 0 to 4999 (modulo 2^32).
+    (if (i32.ne (call $sum_loop (i32.const 5000)) (i32.const -1295505460)) (then (return (i32.const 1))))
+    ;; Compiled now, from the start.
+    (if (i32.ne (call $sum_loop (i32.const 0)) (i32.const 0)) (then (return (i32.const 2))))
+    (if (i32.ne (call $sum_loop (i32.const 3)) (i32.const 5)) (then (return (i32.const 3))))
+
+    ;; 1000 times 1 + 10 + 100 + 1000.
+    (if (i32.ne (call $table_loop (i32.const 4000)) (i32.const 1111000)) (then (return (i32.const 4))))
+
+    ;; 600 times 7 + 8 + 9 + 10 + 10.
+    (block $done
+      (loop $next
+        (br_if $done (i32.ge_u (local.get $i) (i32.const 3000)))
+        (local.set $s (i32.add (local.get $s) (call $classify (i32.rem_u (local.get $i) (i32.const 5)))))
+        (local.set $i (i32.add (local.get $i) (i32.const 1)))
+        (br $next)
+      )
+    )
+    (if (i32.ne (local.get $s) (i32.const 26400)) (then (return (i32.const 5))))
+    (i32.const 0)
+  )
+
+)
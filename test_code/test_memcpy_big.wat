@@ -0,0 +1,57 @@
+;; Test program for drekkar webasm runtime, a host function that translates
+;; two buffers (emscripten_memcpy_big) where the second moves the pages of
+;; the first.
+;;
+;; Some tools may be needed to run this:
+;;   sudo apt install binaryen
+;;
+;; To compile this do:
+;;   wasm-as test_memcpy_big.wat
+;;
+;; To run this:
+;; ../drekkar_webasm_runtime/drekkar_webasm_runtime --function_name test test_memcpy_big.wasm
+;;
+;; This is for the runtime built without DWAC_GUARD_PAGES (where memory is
+;; 64 KiB pages allocated when first used). Pages 0, 1 and 2 are touched one
+;; at a time so each is a block of its own. Translating the destination
+;; 0xfff0 would move pages 0 and 1 into one block, translating the source
+;; 0x1fff0 then that block and page 2 into another, so what was written at
+;; the destination was lost (or written to memory freed, check it with
+;; -fsanitize=address).
+;;
+;; Expected result:
+;; test returns 0, else the number of the check that failed.
+;;
+(module
+  (import "env" "emscripten_memcpy_big" (func $memcpy_big (param i32 i32 i32) (result i32)))
+  (memory 3)
+  (export "test" (func $test))
+
+  (func $test (result i32)
+    ;; Touch the pages one at a time.
+    (i32.store (i32.const 0x0) (i32.const 5))
+    (i32.store (i32.const 0x10000) (i32.const 5))
+    (i32.store (i32.const 0x20000) (i32.const 5))
+
+    ;; 32 bytes to copy at 0x1fff0, over the page boundary (each store is
+    ;; within one page).
+    (i64.store (i32.const 0x1fff0) (i64.const 0x0706050403020100))
+    (i64.store (i32.const 0x1fff8) (i64.const 0x0f0e0d0c0b0a0908))
+    (i64.store (i32.const 0x20000) (i64.const 0x1716151413121110))
+    (i64.store (i32.const 0x20008) (i64.const 0x1f1e1d1c1b1a1918))
+
+    (if (i32.ne (call $memcpy_big (i32.const 0xfff0) (i32.const 0x1fff0) (i32.const 0x20)) (i32.const 0)) (then (return (i32.const 1))))
+
+    (if (i64.ne (i64.load (i32.const 0xfff0)) (i64.const 0x0706050403020100)) (then (return (i32.const 2))))
+    (if (i64.ne (i64.load (i32.const 0xfff8)) (i64.const 0x0f0e0d0c0b0a0908)) (then (return (i32.const 3))))
+    (if (i64.ne (i64.load (i32.const 0x10000)) (i64.const 0x1716151413121110)) (then (return (i32.const 4))))
+    (if (i64.ne (i64.load (i32.const 0x10008)) (i64.const 0x1f1e1d1c1b1a1918)) (then (return (i32.const 5))))
+
+    ;; What was there before is kept.
+    (if (i32.ne (i32.load (i32.const 0x0)) (i32.const 5)) (then (return (i32.const 6))))
+    (if (i32.ne (i32.load (i32.const 0x10010)) (i32.const 0)) (then (return (i32.const 7))))
+    (if (i64.ne (i64.load (i32.const 0x1fff0)) (i64.const 0x0706050403020100)) (then (return (i32.const 8))))
+    (i32.const 0)
+  )
+
+)
@@ -0,0 +1,146 @@
+;; Test program for drekkar webasm runtime, the non-trapping (saturating)
+;; float to integer conversions, 0xFC 0 to 7.
+;;
+;; Some tools may be needed to run this:
+;;   sudo apt install binaryen
+;;
+;; To compile this do:
+;;   wasm-as --enable-nontrapping-float-to-int test_truncsat.wat
+;;
+;; To run this:
+;; ../drekkar_webasm_runtime/drekkar_webasm_runtime --function_name test test_truncsat.wasm
+;;
+;; Each conversion is tested with NaN, infinity, values just inside and
+;; just outside of the range of the integer type and fractions that round
+;; towards zero. NaN gives 0 and values out of range give the smallest or
+;; largest integer (the unsigned ones are compared as signed here, so -1
+;; is the largest).
+;;
+;; Expected result:
+;; test returns 0, else the number of the check that failed.
+;;
+(module
+  (export "test" (func $test))
+
+  (func $test (result i32)
+    ;; i32.trunc_sat_f32_s
+    (if (i32.ne (i32.trunc_sat_f32_s (f32.const nan)) (i32.const 0)) (then (return (i32.const 1))))
+    (if (i32.ne (i32.trunc_sat_f32_s (f32.const -nan)) (i32.const 0)) (then (return (i32.const 2))))
+    (if (i32.ne (i32.trunc_sat_f32_s (f32.const inf)) (i32.const 2147483647)) (then (return (i32.const 3))))
+    (if (i32.ne (i32.trunc_sat_f32_s (f32.const -inf)) (i32.const -2147483648)) (then (return (i32.const 4))))
+    (if (i32.ne (i32.trunc_sat_f32_s (f32.const -0.9)) (i32.const 0)) (then (return (i32.const 5))))
+    (if (i32.ne (i32.trunc_sat_f32_s (f32.const 1.9)) (i32.const 1)) (then (return (i32.const 6))))
+    (if (i32.ne (i32.trunc_sat_f32_s (f32.const -1.9)) (i32.const -1)) (then (return (i32.const 7))))
+    (if (i32.ne (i32.trunc_sat_f32_s (f32.const 1e30)) (i32.const 2147483647)) (then (return (i32.const 8))))
+    (if (i32.ne (i32.trunc_sat_f32_s (f32.const -1e30)) (i32.const -2147483648)) (then (return (i32.const 9))))
+    (if (i32.ne (i32.trunc_sat_f32_s (f32.const 2147483520)) (i32.const 2147483520)) (then (return (i32.const 10))))
+    (if (i32.ne (i32.trunc_sat_f32_s (f32.const 2147483648)) (i32.const 2147483647)) (then (return (i32.const 11))))
+    (if (i32.ne (i32.trunc_sat_f32_s (f32.const -2147483648)) (i32.const -2147483648)) (then (return (i32.const 12))))
+    (if (i32.ne (i32.trunc_sat_f32_s (f32.const -2147483904)) (i32.const -2147483648)) (then (return (i32.const 13))))
+
+    ;; i32.trunc_sat_f32_u
+    (if (i32.ne (i32.trunc_sat_f32_u (f32.const nan)) (i32.const 0)) (then (return (i32.const 14))))
+    (if (i32.ne (i32.trunc_sat_f32_u (f32.const -nan)) (i32.const 0)) (then (return (i32.const 15))))
+    (if (i32.ne (i32.trunc_sat_f32_u (f32.const inf)) (i32.const -1)) (then (return (i32.const 16))))
+    (if (i32.ne (i32.trunc_sat_f32_u (f32.const -inf)) (i32.const 0)) (then (return (i32.const 17))))
+    (if (i32.ne (i32.trunc_sat_f32_u (f32.const -0.9)) (i32.const 0)) (then (return (i32.const 18))))
+    (if (i32.ne (i32.trunc_sat_f32_u (f32.const 1.9)) (i32.const 1)) (then (return (i32.const 19))))
+    (if (i32.ne (i32.trunc_sat_f32_u (f32.const -1.9)) (i32.const 0)) (then (return (i32.const 20))))
+    (if (i32.ne (i32.trunc_sat_f32_u (f32.const 1e30)) (i32.const -1)) (then (return (i32.const 21))))
+    (if (i32.ne (i32.trunc_sat_f32_u (f32.const -1e30)) (i32.const 0)) (then (return (i32.const 22))))
+    (if (i32.ne (i32.trunc_sat_f32_u (f32.const 4294967040)) (i32.const -256)) (then (return (i32.const 23))))
+    (if (i32.ne (i32.trunc_sat_f32_u (f32.const 4294967296)) (i32.const -1)) (then (return (i32.const 24))))
+    (if (i32.ne (i32.trunc_sat_f32_u (f32.const -1)) (i32.const 0)) (then (return (i32.const 25))))
+
+    ;; i32.trunc_sat_f64_s
+    (if (i32.ne (i32.trunc_sat_f64_s (f64.const nan)) (i32.const 0)) (then (return (i32.const 26))))
+    (if (i32.ne (i32.trunc_sat_f64_s (f64.const -nan)) (i32.const 0)) (then (return (i32.const 27))))
+    (if (i32.ne (i32.trunc_sat_f64_s (f64.const inf)) (i32.const 2147483647)) (then (return (i32.const 28))))
+    (if (i32.ne (i32.trunc_sat_f64_s (f64.const -inf)) (i32.const -2147483648)) (then (return (i32.const 29))))
+    (if (i32.ne (i32.trunc_sat_f64_s (f64.const -0.9)) (i32.const 0)) (then (return (i32.const 30))))
+    (if (i32.ne (i32.trunc_sat_f64_s (f64.const 1.9)) (i32.const 1)) (then (return (i32.const 31))))
+    (if (i32.ne (i32.trunc_sat_f64_s (f64.const -1.9)) (i32.const -1)) (then (return (i32.const 32))))
+    (if (i32.ne (i32.trunc_sat_f64_s (f64.const 1e30)) (i32.const 2147483647)) (then (return (i32.const 33))))
+    (if (i32.ne (i32.trunc_sat_f64_s (f64.const -1e30)) (i32.const -2147483648)) (then (return (i32.const 34))))
+    (if (i32.ne (i32.trunc_sat_f64_s (f64.const 2147483647.9)) (i32.const 2147483647)) (then (return (i32.const 35))))
+    (if (i32.ne (i32.trunc_sat_f64_s (f64.const 2147483648)) (i32.const 2147483647)) (then (return (i32.const 36))))
+    (if (i32.ne (i32.trunc_sat_f64_s (f64.const -2147483648.9)) (i32.const -2147483648)) (then (return (i32.const 37))))
+    (if (i32.ne (i32.trunc_sat_f64_s (f64.const -2147483649)) (i32.const -2147483648)) (then (return (i32.const 38))))
+
+    ;; i32.trunc_sat_f64_u
+    (if (i32.ne (i32.trunc_sat_f64_u (f64.const nan)) (i32.const 0)) (then (return (i32.const 39))))
+    (if (i32.ne (i32.trunc_sat_f64_u (f64.const -nan)) (i32.const 0)) (then (return (i32.const 40))))
+    (if (i32.ne (i32.trunc_sat_f64_u (f64.const inf)) (i32.const -1)) (then (return (i32.const 41))))
+    (if (i32.ne (i32.trunc_sat_f64_u (f64.const -inf)) (i32.const 0)) (then (return (i32.const 42))))
+    (if (i32.ne (i32.trunc_sat_f64_u (f64.const -0.9)) (i32.const 0)) (then (return (i32.const 43))))
+    (if (i32.ne (i32.trunc_sat_f64_u (f64.const 1.9)) (i32.const 1)) (then (return (i32.const 44))))
+    (if (i32.ne (i32.trunc_sat_f64_u (f64.const -1.9)) (i32.const 0)) (then (return (i32.const 45))))
+    (if (i32.ne (i32.trunc_sat_f64_u (f64.const 1e30)) (i32.const -1)) (then (return (i32.const 46))))
+    (if (i32.ne (i32.trunc_sat_f64_u (f64.const -1e30)) (i32.const 0)) (then (return (i32.const 47))))
+    (if (i32.ne (i32.trunc_sat_f64_u (f64.const 4294967295.9)) (i32.const -1)) (then (return (i32.const 48))))
+    (if (i32.ne (i32.trunc_sat_f64_u (f64.const 4294967296)) (i32.const -1)) (then (return (i32.const 49))))
+    (if (i32.ne (i32.trunc_sat_f64_u (f64.const -0.99999)) (i32.const 0)) (then (return (i32.const 50))))
+    (if (i32.ne (i32.trunc_sat_f64_u (f64.const -1)) (i32.const 0)) (then (return (i32.const 51))))
+
+    ;; i64.trunc_sat_f32_s
+    (if (i64.ne (i64.trunc_sat_f32_s (f32.const nan)) (i64.const 0)) (then (return (i32.const 52))))
+    (if (i64.ne (i64.trunc_sat_f32_s (f32.const -nan)) (i64.const 0)) (then (return (i32.const 53))))
+    (if (i64.ne (i64.trunc_sat_f32_s (f32.const inf)) (i64.const 9223372036854775807)) (then (return (i32.const 54))))
+    (if (i64.ne (i64.trunc_sat_f32_s (f32.const -inf)) (i64.const -9223372036854775808)) (then (return (i32.const 55))))
+    (if (i64.ne (i64.trunc_sat_f32_s (f32.const -0.9)) (i64.const 0)) (then (return (i32.const 56))))
+    (if (i64.ne (i64.trunc_sat_f32_s (f32.const 1.9)) (i64.const 1)) (then (return (i32.const 57))))
+    (if (i64.ne (i64.trunc_sat_f32_s (f32.const -1.9)) (i64.const -1)) (then (return (i32.const 58))))
+    (if (i64.ne (i64.trunc_sat_f32_s (f32.const 1e30)) (i64.const 9223372036854775807)) (then (return (i32.const 59))))
+    (if (i64.ne (i64.trunc_sat_f32_s (f32.const -1e30)) (i64.const -9223372036854775808)) (then (return (i32.const 60))))
+    (if (i64.ne (i64.trunc_sat_f32_s (f32.const 9223371487098961920)) (i64.const 9223371487098961920)) (then (return (i32.const 61))))
+    (if (i64.ne (i64.trunc_sat_f32_s (f32.const 9223372036854775808)) (i64.const 9223372036854775807)) (then (return (i32.const 62))))
+    (if (i64.ne (i64.trunc_sat_f32_s (f32.const -9223372036854775808)) (i64.const -9223372036854775808)) (then (return (i32.const 63))))
+    (if (i64.ne (i64.trunc_sat_f32_s (f32.const -9223373136366403584)) (i64.const -9223372036854775808)) (then (return (i32.const 64))))
+
+    ;; i64.trunc_sat_f32_u
+    (if (i64.ne (i64.trunc_sat_f32_u (f32.const nan)) (i64.const 0)) (then (return (i32.const 65))))
+    (if (i64.ne (i64.trunc_sat_f32_u (f32.const -nan)) (i64.const 0)) (then (return (i32.const 66))))
+    (if (i64.ne (i64.trunc_sat_f32_u (f32.const inf)) (i64.const -1)) (then (return (i32.const 67))))
+    (if (i64.ne (i64.trunc_sat_f32_u (f32.const -inf)) (i64.const 0)) (then (return (i32.const 68))))
+    (if (i64.ne (i64.trunc_sat_f32_u (f32.const -0.9)) (i64.const 0)) (then (return (i32.const 69))))
+    (if (i64.ne (i64.trunc_sat_f32_u (f32.const 1.9)) (i64.const 1)) (then (return (i32.const 70))))
+    (if (i64.ne (i64.trunc_sat_f32_u (f32.const -1.9)) (i64.const 0)) (then (return (i32.const 71))))
+    (if (i64.ne (i64.trunc_sat_f32_u (f32.const 1e30)) (i64.const -1)) (then (return (i32.const 72))))
+    (if (i64.ne (i64.trunc_sat_f32_u (f32.const -1e30)) (i64.const 0)) (then (return (i32.const 73))))
+    (if (i64.ne (i64.trunc_sat_f32_u (f32.const 18446742974197923840)) (i64.const -1099511627776)) (then (return (i32.const 74))))
+    (if (i64.ne (i64.trunc_sat_f32_u (f32.const 18446744073709551616)) (i64.const -1)) (then (return (i32.const 75))))
+    (if (i64.ne (i64.trunc_sat_f32_u (f32.const -1)) (i64.const 0)) (then (return (i32.const 76))))
+
+    ;; i64.trunc_sat_f64_s
+    (if (i64.ne (i64.trunc_sat_f64_s (f64.const nan)) (i64.const 0)) (then (return (i32.const 77))))
+    (if (i64.ne (i64.trunc_sat_f64_s (f64.const -nan)) (i64.const 0)) (then (return (i32.const 78))))
+    (if (i64.ne (i64.trunc_sat_f64_s (f64.const inf)) (i64.const 9223372036854775807)) (then (return (i32.const 79))))
+    (if (i64.ne (i64.trunc_sat_f64_s (f64.const -inf)) (i64.const -9223372036854775808)) (then (return (i32.const 80))))
+    (if (i64.ne (i64.trunc_sat_f64_s (f64.const -0.9)) (i64.const 0)) (then (return (i32.const 81))))
+    (if (i64.ne (i64.trunc_sat_f64_s (f64.const 1.9)) (i64.const 1)) (then (return (i32.const 82))))
+    (if (i64.ne (i64.trunc_sat_f64_s (f64.const -1.9)) (i64.const -1)) (then (return (i32.const 83))))
+    (if (i64.ne (i64.trunc_sat_f64_s (f64.const 1e30)) (i64.const 9223372036854775807)) (then (return (i32.const 84))))
+    (if (i64.ne (i64.trunc_sat_f64_s (f64.const -1e30)) (i64.const -9223372036854775808)) (then (return (i32.const 85))))
+    (if (i64.ne (i64.trunc_sat_f64_s (f64.const 9223372036854774784)) (i64.const 9223372036854774784)) (then (return (i32.const 86))))
+    (if (i64.ne (i64.trunc_sat_f64_s (f64.const 9223372036854775808)) (i64.const 9223372036854775807)) (then (return (i32.const 87))))
+    (if (i64.ne (i64.trunc_sat_f64_s (f64.const -9223372036854775808)) (i64.const -9223372036854775808)) (then (return (i32.const 88))))
+    (if (i64.ne (i64.trunc_sat_f64_s (f64.const -9223372036854777856)) (i64.const -9223372036854775808)) (then (return (i32.const 89))))
+
+    ;; i64.trunc_sat_f64_u
+    (if (i64.ne (i64.trunc_sat_f64_u (f64.const nan)) (i64.const 0)) (then (return (i32.const 90))))
+    (if (i64.ne (i64.trunc_sat_f64_u (f64.const -nan)) (i64.const 0)) (then (return (i32.const 91))))
+    (if (i64.ne (i64.trunc_sat_f64_u (f64.const inf)) (i64.const -1)) (then (return (i32.const 92))))
+    (if (i64.ne (i64.trunc_sat_f64_u (f64.const -inf)) (i64.const 0)) (then (return (i32.const 93))))
+    (if (i64.ne (i64.trunc_sat_f64_u (f64.const -0.9)) (i64.const 0)) (then (return (i32.const 94))))
+    (if (i64.ne (i64.trunc_sat_f64_u (f64.const 1.9)) (i64.const 1)) (then (return (i32.const 95))))
+    (if (i64.ne (i64.trunc_sat_f64_u (f64.const -1.9)) (i64.const 0)) (then (return (i32.const 96))))
+    (if (i64.ne (i64.trunc_sat_f64_u (f64.const 1e30)) (i64.const -1)) (then (return (i32.const 97))))
+    (if (i64.ne (i64.trunc_sat_f64_u (f64.const -1e30)) (i64.const 0)) (then (return (i32.const 98))))
+    (if (i64.ne (i64.trunc_sat_f64_u (f64.const 18446744073709549568)) (i64.const -2048)) (then (return (i32.const 99))))
+    (if (i64.ne (i64.trunc_sat_f64_u (f64.const 18446744073709551616)) (i64.const -1)) (then (return (i32.const 100))))
+    (if (i64.ne (i64.trunc_sat_f64_u (f64.const -1)) (i64.const 0)) (then (return (i32.const 101))))
+
+    (i32.const 0)
+  )
+
+)